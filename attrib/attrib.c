@@ -19,7 +19,9 @@
 */
 
 #include <dos.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <_string.h>
 
 #include "types.h"
@@ -65,18 +67,60 @@ LOCAL char info [] = "[-----] -> [-----] ";
 LOCAL unsigned found;
 LOCAL byte retcode = EXIT_OK;
 
+/* Changes are applied a directory at a time: its path is looked up	*/
+/* once per batch, not once per file.					*/
+
+#define BATCH 64
+
+LOCAL struct _dosattr_t batch [BATCH];
+LOCAL char batch_name [BATCH][13];
+LOCAL ATTR batch_old [BATCH];
+LOCAL unsigned batched;
+
+/* /@ lists are read in large blocks (a file is mapped) and their lines	*/
+/* gathered into a pool. Runs of plain names are then looked up a	*/
+/* directory at a time: each directory is searched once for all the	*/
+/* names in it, and results are given in list order.			*/
+
+#define POOL	0x4000
+#define ITEMS	256
+#define CHUNK	0x8000u
+
+typedef struct {
+	char *target;			/* trimmed, uppercased line	*/
+	unsigned dirlen;		/* up to the name		*/
+	byte found;
+	ATTR attrib;
+	char name [13];			/* as the directory has it	*/
+} ITEM;
+
+LOCAL char pool [POOL];
+LOCAL unsigned pooled;
+LOCAL ITEM items [ITEMS], *order [ITEMS];
+LOCAL unsigned nitems;
+
 /*----------------------------------------------------------------------*/
 
 LOCAL char *PROC adds	(char dst[], const char src[]);
 LOCAL ATTR PROC attr2str(char str[], ATTR attr);
 
+LOCAL void PROC flush	(char *pathend);
+LOCAL void PROC do_file	(char *pathend, const struct find_t *fi);
 LOCAL void PROC do_mask	(char *pathend);
+LOCAL int _Cdecl do_dir	(const struct doswalk_t *dir, void *arg);
 LOCAL void PROC do_path	(char *pathend);
 
 LOCAL char *PROC trimsq	(char *p, char *pend);
 LOCAL char *PROC nsplit	(char *pathend);
 
 LOCAL void PROC process	(const char target[]);
+
+LOCAL unsigned PROC plain(const char target[]);
+LOCAL int _Cdecl by_place(const void *a, const void *b);
+LOCAL void PROC lookup	(ITEM **first, ITEM **last);
+LOCAL void PROC run	(void);
+LOCAL void PROC line	(const char *p, const char *pend);
+LOCAL size_t PROC scan	(const char *buf, size_t len, int final);
 LOCAL void PROC list	(const char name[]);
 
 LOCAL void PROC _s_	(const char s[]);
@@ -104,6 +148,48 @@ LOCAL ATTR PROC attr2str (char attr_str[], ATTR attr) {
 
 /*----------------------------------------------------------------------*/
 
+LOCAL void PROC flush (char *pathend) {
+	unsigned i;
+
+	*pathend = '\0';
+	_dos_setfileattrs (*path ? path : ".", batch, batched);
+
+	for (i = 0; i < batched; i++) {
+		adds (pathend, batch [i].name);
+		if (batch [i].error) {
+			sayerror (E_ACCESS, "access denied", path);
+			continue;
+		}
+		attr2str (OLD_ATTR, batch_old [i]);
+		attr2str (NEW_ATTR, batch [i].attrib
+				    | (batch_old [i] & _A_SUBDIR));
+		say (info, path);
+	}
+	batched = 0;
+}
+
+LOCAL void PROC do_file (char *pathend, const struct find_t *fi) {
+	const char *p;
+	p = fi->name-1; do p++; while (*p == '.');
+	if (*p == '\0') return;			/* name == dots */
+
+	adds (pathend, fi->name); found++;
+    {	ATTR attr = attr2str (OLD_ATTR, fi->attrib);
+
+	if (*NEW_PART != '\0') {
+	    attr = (attr & attr_keep) | attr_set;
+	    strcpy (batch_name [batched], fi->name);
+	    batch [batched].name = batch_name [batched];
+	    batch [batched].attrib = attr & (ATTR)~_A_SUBDIR;
+	    batch_old [batched] = fi->attrib;
+	    if (++batched == BATCH) flush (pathend);
+	    return;
+	}
+    }
+
+	say (info, path);
+}
+
 LOCAL void PROC do_mask (char *pathend) {
 	static struct find_t fi;
 
@@ -111,44 +197,31 @@ LOCAL void PROC do_mask (char *pathend) {
 	if (_dos_findfirst (path, findattr, &fi))
 		return;
 
-	do {	const char *p;
-		p = fi.name-1; do p++; while (*p == '.');
-		if (*p == '\0') continue;		/* name == dots */
-
-		adds (pathend, fi.name); found++;
-	    {	ATTR attr = attr2str (OLD_ATTR, fi.attrib);
-
-		if (*NEW_PART != '\0') {
-		    attr = (attr & attr_keep) | attr_set;
-		    /* if (_dos_setfileattr (path, */
-		    /* 			  attr2str (NEW_ATTR, attr) */
-		    /* 			  & (ATTR)~_A_SUBDIR)) { */
-		    /*   sayerror (E_ACCESS, "access denied", path); */
-		    /*   continue; */
-		    /* } */
-		}
-	    }
+	do	do_file (pathend, &fi);
+	while (_dos_findnext (&fi) == 0);
 
-		say (info, path);
-	} while (_dos_findnext (&fi) == 0);
+	if (batched) flush (pathend);
 }
 
-LOCAL void PROC do_path (char *pathend) {
-	struct find_t fi;
+/* With /S the tree is walked by several threads at once; directories	*/
+/* still come back in the order of a sequential walk.			*/
 
-	do_mask (pathend); if (recurse == 0) return;
+LOCAL int _Cdecl do_dir (const struct doswalk_t *dir, void *arg) {
+	char *pathend = adds (path, dir->path);
+	size_t i;
 
-	adds (pathend, "*.*");
-	if (_dos_findfirst (path, DIR_ATTR, &fi))
-		return;
+	for (i = 0; i < dir->count; i++)
+		do_file (pathend, &dir->entries [i]);
 
-	do {	const char *p;
-		if ((fi.attrib & _A_SUBDIR) == 0) continue;
-		p = fi.name-1; do p++; while (*p == '.');
-		if (*p == '\0') continue;		/* name == dots */
+	if (batched) flush (pathend);
+	return 0;
+}
 
-		do_path (adds (adds (pathend, fi.name), "\\"));
-	} while (_dos_findnext (&fi) == 0);
+LOCAL void PROC do_path (char *pathend) {
+	if (recurse == 0) { do_mask (pathend); return; }
+
+	adds (pathend, mask);
+	_dos_walktree (path, findattr, 0, do_dir, NULL);
 }
 
 /*----------------------------------------------------------------------*/
@@ -208,26 +281,192 @@ LOCAL void PROC process (const char target[]) {
 	if (found == 0) sayerror (E_TARGET, "no targets", target);
 }
 
+/*----------------------------------------------------------------------*/
+
+/* Returns length of directory part, if target may be looked up along	*/
+/* with others of its directory (single 8.3 name, no wildcards);	*/
+/* otherwise returns ~0.						*/
+
+LOCAL unsigned PROC plain (const char target[]) {
+	const char *p = target, *name = target, *dot = NULL;
+
+	if (recurse) return ~0u;
+
+	for (; *p; p++)
+		if (*p == '\\' || *p == '/' || *p == ':') name = p+1;
+
+	for (p = name; *p; p++) {
+		if (*p == '*' || *p == '?') return ~0u;
+		if (*p == '.') {
+			if (dot) return ~0u;
+			dot = p;
+		}
+	}
+
+	if (dot == NULL) dot = p;
+	if (dot == name || dot - name > 8 || p - dot > 4 || p[-1] == '.')
+		return ~0u;
+	return name - target;
+}
+
+LOCAL int _Cdecl by_place (const void *a, const void *b) {
+	const ITEM *x = *(const ITEM *const *)a, *y = *(const ITEM *const *)b;
+	int r;
+
+	if (x->dirlen != y->dirlen) return x->dirlen < y->dirlen ? -1 : 1;
+	r = memcmp (x->target, y->target, x->dirlen);
+	if (r == 0) r = strcmp (x->target+x->dirlen, y->target+y->dirlen);
+	if (r == 0) r = x < y ? -1 : x > y;	/* equal names: list order */
+	return r;
+}
+
+/* Searches the directory of a group of items, sorted by name, once.	*/
+/* An item listed again sees the attributes set for its first place.	*/
+
+LOCAL void PROC lookup (ITEM **first, ITEM **last) {
+	static struct find_t fi;
+	unsigned dirlen = (*first)->dirlen;
+
+	memcpy (path, (*first)->target, dirlen);
+	adds (&path [dirlen], "*.*");
+	if (_dos_findfirst (path, ALL_ATTR, &fi))
+		return;				/* left to process()	*/
+
+	do {	ITEM **lo = first, **hi = last;
+		ATTR attr = fi.attrib;
+		char key [13];
+
+		strupr (strcpy (key, fi.name));
+
+		while (lo < hi) {		/* first name >= found	*/
+			ITEM **mid = lo + (hi - lo) / 2;
+			if (strcmp ((*mid)->target+dirlen, key) < 0)
+				lo = mid+1;
+			else	hi = mid;
+		}
+
+		for (; lo < last; lo++) {
+			if (strcmp ((*lo)->target+dirlen, key)) break;
+			(*lo)->found = 1, (*lo)->attrib = attr;
+			strcpy ((*lo)->name, fi.name);
+			if (*NEW_PART != '\0') attr = (attr & attr_keep) | attr_set;
+		}
+	} while (_dos_findnext (&fi) == 0);
+}
+
+/* Looks up pending items and reports them.				*/
+
+LOCAL void PROC run (void) {
+	static struct find_t fi;
+	ITEM *it, *prev = NULL;
+	unsigned i, j;
+
+	for (i = 0; i < nitems; i++) order [i] = &items [i];
+	qsort (order, nitems, sizeof *order, by_place);
+
+	for (i = 0; i < nitems; i = j) {
+		for (j = i+1; j < nitems; j++)
+			if (order [j]->dirlen != order [i]->dirlen
+			 || memcmp (order [j]->target, order [i]->target,
+					order [i]->dirlen)) break;
+		lookup (&order [i], &order [j]);
+	}
+
+	for (it = items; it < &items [nitems]; prev = it, it++) {
+		if (batched && (it->found == 0 || it->dirlen != prev->dirlen
+		 || memcmp (it->target, prev->target, it->dirlen)))
+			flush (&path [prev->dirlen]);
+
+		if (it->found == 0) { process (it->target); continue; }
+
+		memcpy (path, it->target, it->dirlen);
+		strcpy (fi.name, it->name), fi.attrib = it->attrib;
+		do_file (&path [it->dirlen], &fi);
+	}
+	if (batched) flush (&path [prev->dirlen]);
+
+	nitems = 0, pooled = 0;
+}
+
+LOCAL void PROC line (const char *p, const char *pend) {
+	unsigned len = pend - p, dirlen;
+	char *q;
+
+	if (len && pend [-1] == '\r') len--;
+	if (pooled + len >= sizeof (pool)) run ();
+
+	q = &pool [pooled];
+	memcpy (q, p, len);
+	q = trimsq (q, q + len);
+	if (*q == '\0') return;
+	strupr (q);
+
+	if ((dirlen = plain (q)) == ~0u) {	/* wildcards and such	*/
+		if (nitems) run ();
+		process (q);
+		return;
+	}
+
+	items [nitems].target = q;
+	items [nitems].dirlen = dirlen;
+	items [nitems].found = 0;
+	pooled = q - pool + strlen (q) + 1;
+	if (++nitems == ITEMS) run ();
+}
+
+/* Splits lines, longer ones into pieces of PATHLEN-1 as before;	*/
+/* returns number of bytes used, the rest is an incomplete line.	*/
+
+LOCAL size_t PROC scan (const char *buf, size_t len, int final) {
+	const char *p = buf, *end = buf + len;
+
+	while (p < end) {
+		size_t n = end - p; const char *nl;
+		if (n > PATHLEN-1) n = PATHLEN-1;
+
+		if ((nl = memchr (p, '\n', n)) != NULL) {
+			line (p, nl); p = nl+1;
+			continue;
+		}
+		if (n < PATHLEN-1 && !final) break;
+		line (p, p+n); p += n;
+	}
+	return p - buf;
+}
+
 LOCAL void PROC list (const char name[]) {
-	FILE *fp = stdin;
-	if (name[0] && (fp = fopen (name, "rt")) == NULL) {
+	int fh = 0;				/* stdin		*/
+	if (name[0] && _dos_open (name, O_RDONLY, &fh)) {
 		sayerror (E_LIST, "error open file", name);
 		return;
 	}
 
-    {	static char line [PATHLEN]; register int eof;
-	do {	register char *p = line; int ch;
-
-		do {	ch = fgetc (fp);
-			if (ch == EOF || ch == '\n') break;
-			*p++ = ch;
-		} while (p < &line [sizeof (line)-1]);
+    {	struct _mapwin_t win; off_t start, size; byte mapped = 0;
+	if (_dos_seek (fh, 0, SEEK_CUR, &start) == 0
+	 && _dos_seek (fh, 0, SEEK_END, &size) == 0) {
+		mapped = _dos_mapfile (fh, start, 0, _MAP_SEQUENTIAL, &win) == 0;
+		if (!mapped) _dos_seek (fh, start, SEEK_SET, &start);
+	}
 
-		eof = ch, p = trimsq (line, p);
-		if (*p) process (strupr (p));
-/*!*/	} while (eof -= EOF);
+	if (mapped) {
+		off_t offset;
+		do	offset = win.offset + scan (win.address, win.length,
+					win.offset + win.length >= size);
+		while (_dos_mapseek (&win, offset) == 0);
+		_dos_unmapfile (&win);
+	} else {				/* pipe, device, image	*/
+		static char buf [CHUNK]; unsigned have = 0, got;
+		do {	size_t used;
+			if (_dos_read (fh, &buf [have], sizeof (buf) - have, &got))
+				got = 0;
+			have += got;
+			used = scan (buf, have, got == 0);
+			memmove (buf, &buf [used], have -= used);
+		} while (got);
+	}
     }
-	if (fp != stdin) fclose (fp);
+	if (nitems) run ();
+	if (fh != 0) _dos_close (fh);
 }
 
 /*----------------------------------------------------------------------*/
@@ -0,0 +1,499 @@
+/*
+  _dos.h -- DOS interface routines (private)
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _INC__DOS
+#define _INC__DOS
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sys/time.h>
+#include <dos.h>
+
+/* write-behind cache (cache.c) */
+
+/* Absorb a write at the handle’s current position into the cache.
+   Returns false if the caller must write through instead */
+extern
+bool
+_dosix__wbcache_write
+(int handle,
+ const void *buffer,
+ unsigned count);
+
+/* Write back everything cached for handle and leave the host file
+   position where the DOS program expects it */
+extern
+unsigned
+_dosix__wbcache_flush
+(int handle);
+
+/* Write back and drop everything cached for handle */
+extern
+unsigned
+_dosix__wbcache_close
+(int handle);
+
+/* io_uring (uring.c) */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/* A ring mapped into the process; users fill SQEs and reap CQEs
+   through the mapped indices themselves */
+struct uring
+{
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+  unsigned in_flight;
+};
+
+extern
+int
+_dosix__uring_setup
+(struct uring *ring,
+ unsigned entries);
+
+extern
+int
+_dosix__uring_enter
+(struct uring *ring,
+ unsigned to_submit,
+ unsigned min_complete);
+
+/* Whether the kernel supports each of the count IORING_OP_ codes in
+   ops */
+extern
+bool
+_dosix__uring_probe
+(struct uring *ring,
+ const uint8_t *ops,
+ size_t count);
+
+extern
+void
+_dosix__uring_close
+(struct uring *ring);
+
+/* dates and times (dostime.c) */
+
+/* Broken-down local time of t.  Each thread caches the offsets of the
+   zone for the intervals they hold over, so the zone is seldom
+   consulted.  Returns -1 with errno set on failure */
+extern
+int
+_dosix__time_local
+(time_t t,
+ struct tm *tm);
+
+/* Unix time of the local time tm, whose fields may be out of range as
+   for mktime; tm_isdst is not looked at */
+extern
+int
+_dosix__time_unix
+(const struct tm *tm,
+ time_t *t);
+
+/* Current time of the DOS clock, and setting it; the host clock is
+   left alone */
+extern
+void
+_dosix__clock_get
+(struct timeval *tv);
+
+extern
+void
+_dosix__clock_set
+(const struct timeval *tv);
+
+/* Times the DOS clock has been set, for those who keep time off it */
+extern
+unsigned
+_dosix__clock_changes
+(void);
+
+/* timer interrupts (timer.c) */
+
+/* Whether INT 08h or 1Ch is hooked, and thus whether timer interrupts
+   are to be raised */
+extern
+void
+_dosix__timer_hook
+(bool hooked);
+
+/* call tracing (trace.c) */
+
+/* Services are told apart by vector, AH and, for those that leave the
+   choice of a sub-function to it, AL or BL */
+#define TRACE_REG_NONE 0
+#define TRACE_REG_AL 1
+#define TRACE_REG_BL 2
+#define TRACE_KEY(intnum, ah, reg, sub)					\
+  ((uint32_t) 1 << 26 | (uint32_t) (reg) << 24				\
+   | (uint32_t) (intnum) << 16 | (uint32_t) (ah) << 8 | (uint8_t) (sub))
+#define TRACE_KEY_REG(key) (((key) >> 24) & 3)
+#define TRACE_KEY_INTNUM(key) (((key) >> 16) & 0xff)
+#define TRACE_KEY_AH(key) (((key) >> 8) & 0xff)
+#define TRACE_KEY_SUB(key) ((key) & 0xff)
+
+/* What is done with the calls */
+#define TRACE_STATS 1
+#define TRACE_RECORD 2
+
+/* Start of a recording, followed by a version byte */
+#define RECORD_MAGIC "DOSIXREC"
+#define RECORD_VERSION 1
+
+/* -1 until the environment is looked up, then what is done with the
+   calls, if anything */
+extern int _dosix__trace_enabled;
+
+/* Look the environment up once, and tell what is done with calls */
+extern
+int
+_dosix__trace_start
+(void);
+
+/* Monotonic time in nanoseconds */
+extern
+uint64_t
+_dosix__trace_clock
+(void);
+
+/* Account for a call that took ns, from the registers it took to those
+   it left; exterror is the extended error of a failed call, or 0 */
+extern
+void
+_dosix__trace_end
+(uint32_t key,
+ uint64_t ns,
+ const cpu_t *in,
+ const cpu_t *out,
+ unsigned exterror);
+
+/* Append a record, as encoded by the caller, to the recording */
+extern
+void
+_dosix__trace_record
+(const void *record,
+ size_t size);
+
+/* Whether fd is the file calls are, or are going to be, recorded to */
+extern
+bool
+_dosix__trace_records_to
+(int fd);
+
+/* path translation (drive.c) */
+
+/* A DOS path resolved to a directory descriptor and a name in it,
+   suitable for the *at family of system calls */
+struct dospath
+{
+  int dirfd;			/* directory the name is relative to */
+  const char *name;		/* final component, "." for the root */
+  int drive;			/* 0 = A: */
+  struct fatvol *fat;		/* image volume, dirfd unused if set */
+  const char *dir;		/* directory, relative to the root */
+
+  /* Private */
+  struct path_entry *_entry;	/* pinned cache entry */
+  int _fd;			/* uncached dirfd owned by this path */
+  char _buf[PATH_MAX];
+  char _name[NAME_MAX + 1];	/* host name behind a short one */
+};
+
+/* Translate path through the drive mount table.  Returns -1 with
+   errno set on failure; a successful resolution must be released */
+extern
+int
+_dosix__path_resolve
+(const char *path,
+ struct dospath *dp);
+
+extern
+void
+_dosix__path_release
+(struct dospath *dp);
+
+/* Current drive (0 = A:) and number of drive letters */
+extern
+int
+_dosix__drive_get
+(void);
+
+extern
+int
+_dosix__drive_set
+(int drive);
+
+extern
+int
+_dosix__drive_count
+(void);
+
+/* Geometry and free space of drive, -1 for the current drive, in
+   clusters; host drives report statvfs fragments as clusters */
+struct drive_space
+{
+  unsigned bytes_per_sector;
+  unsigned sectors_per_cluster;
+  uint64_t total_clusters;
+  uint64_t avail_clusters;
+};
+
+extern
+int
+_dosix__drive_space
+(int drive,
+ struct drive_space *space);
+
+/* Called on every write, so that free space is not served stale */
+extern
+void
+_dosix__drive_space_invalidate
+(void);
+
+/* Make path the current directory of the drive it names */
+extern
+int
+_dosix__drive_chdir
+(const char *path);
+
+/* Copy the current directory of drive, -1 for the current drive, as
+   ‘X:\DIR’ into buffer */
+extern
+int
+_dosix__drive_getcwd
+(int drive,
+ char *buffer,
+ size_t size);
+
+/* 8.3 aliases (alias.c) */
+
+/* Fill fcb with the blank padded basis of name, the way an FCB holds
+   it.  Returns true if name is not itself a valid short name */
+extern
+bool
+_dosix__alias_basis
+(const char *name,
+ char fcb[11]);
+
+extern
+void
+_dosix__alias_format
+(const char fcb[11],
+ char alias[13]);
+
+/* Short name of name in the directory dirfd, through the alias map
+   of the directory */
+extern
+int
+_dosix__alias_get
+(int dirfd,
+ const char *name,
+ char alias[13]);
+
+/* The alias map of directory dirfd, for a caller looking up many of
+   its entries, as while reading it.  Must be closed */
+struct alias_map;
+
+extern
+struct alias_map *
+_dosix__alias_open
+(int dirfd);
+
+/* Short name of name in m; entries newer than m are not in it */
+extern
+int
+_dosix__alias_lookup
+(struct alias_map *m,
+ const char *name,
+ char alias[13]);
+
+extern
+void
+_dosix__alias_close
+(struct alias_map *m);
+
+/* Host name of the entry of directory dirfd whose short name, in any
+   case, is dosname */
+extern
+int
+_dosix__alias_resolve
+(int dirfd,
+ const char *dosname,
+ char *name,
+ size_t size);
+
+/* DOS attributes of host files (dosattr.c) */
+
+/* Attributes of name in dirfd, whose status is st.  Hidden, system
+   and archive come from Samba’s extended attribute, read-only from
+   the permissions */
+extern
+int
+_dosix__attr_get
+(int dirfd,
+ const char *name,
+ const struct stat *st,
+ unsigned *attrib);
+
+extern
+int
+_dosix__attr_set
+(int dirfd,
+ const char *name,
+ const struct stat *st,
+ unsigned attrib);
+
+/* Batches of names in dirfd, with errors left in each entry as errno
+   values; large ones go through io_uring where available */
+extern
+void
+_dosix__attr_getv
+(int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count);
+
+extern
+void
+_dosix__attr_setv
+(int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count);
+
+/* FAT image drives (fat.c) */
+
+struct fatvol;
+
+/* A directory entry of an image */
+struct fatent
+{
+  char name[NAME_MAX + 1];	/* long name, or alias if none */
+  char alias[13];		/* 8.3 name */
+  unsigned attrib;
+  unsigned wr_date, wr_time;	/* DOS format, as stored */
+  uint32_t cluster;
+  uint32_t size;
+};
+
+/* Open a FAT12/16/32 volume, or the first FAT partition of a disk,
+   from an image file */
+extern
+struct fatvol *
+_dosix__fat_mount
+(const char *image);
+
+/* Paths are relative to the volume root and ‘/’ separated; errors
+   are returned as -1 with errno set */
+extern
+int
+_dosix__fat_stat
+(struct fatvol *vol,
+ const char *dir,
+ const char *name,
+ struct fatent *ent);
+
+extern
+void *
+_dosix__fat_opendir
+(struct fatvol *vol,
+ const char *dir);
+
+extern
+bool
+_dosix__fat_readdir
+(void *stream,
+ struct fatent *ent);
+
+extern
+void
+_dosix__fat_closedir
+(void *stream);
+
+/* Files of an image are read through handles that are host
+   descriptors kept reserved, so they never collide with host files */
+extern
+int
+_dosix__fat_open
+(struct fatvol *vol,
+ const char *dir,
+ const char *name,
+ int *handle);
+
+extern
+bool
+_dosix__fat_handle
+(int handle);
+
+extern
+ssize_t
+_dosix__fat_read
+(int handle,
+ void *buffer,
+ size_t count);
+
+extern
+ssize_t
+_dosix__fat_pread
+(int handle,
+ void *buffer,
+ size_t count,
+ off_t offset);
+
+extern
+off_t
+_dosix__fat_seek
+(int handle,
+ off_t offset,
+ int origin);
+
+extern
+int
+_dosix__fat_fstat
+(int handle,
+ struct fatent *ent);
+
+extern
+int
+_dosix__fat_close
+(int handle);
+
+/* File system type, 12, 16 or 32 */
+extern
+int
+_dosix__fat_type
+(struct fatvol *vol);
+
+extern
+void
+_dosix__fat_space
+(struct fatvol *vol,
+ struct drive_space *space);
+
+#endif
@@ -0,0 +1,423 @@
+/*
+  aio.c -- Asynchronous DOS handle I/O (DOSix extension)
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
+#include <dos.h>
+#include "_dos.h"
+
+
+/* constants */
+
+#define AIO_URING_ENTRIES 256	/* io_uring submission queue size */
+#define AIO_THREADS 8		/* thread pool size for the fallback */
+
+enum aio_backend
+  {
+   AIO_BACKEND_NONE,
+   AIO_BACKEND_URING,
+   AIO_BACKEND_THREADS
+  };
+
+enum aio_opcode
+  {
+   AIO_READ,
+   AIO_WRITE
+  };
+
+
+/* global private variables */
+
+static pthread_once_t aio_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t aio_done = PTHREAD_COND_INITIALIZER;
+static enum aio_backend aio_backend;
+static struct uring uring;
+static struct _dosaio_t *aio_queue_head, *aio_queue_tail;
+/* While a thread waits in the kernel for completions, no other takes
+   any, so that the one it waits for cannot be taken from under it */
+static bool aio_reaping;
+
+
+/* io_uring backend */
+
+/* Complete every request whose CQE is available; caller holds
+   aio_lock */
+static
+void
+uring_reap
+(struct uring *ring)
+{
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++)
+    {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      struct _dosaio_t *aio = (struct _dosaio_t *) (uintptr_t) cqe->user_data;
+      if (cqe->res < 0)
+	{
+	  errno = -cqe->res;
+	  aio->error = _dosix__dosexterr (NULL);
+	  aio->result = 0;
+	}
+      else
+	{
+	  aio->error = 0;
+	  aio->result = cqe->res;
+	}
+      if (aio->_opcode == AIO_WRITE) _dosix__drive_space_invalidate ();
+      __atomic_store_n (&aio->_done, 1, __ATOMIC_RELEASE);
+      ring->in_flight--;
+    }
+  __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Wait for completions with aio_lock dropped: one thread waits in
+   the kernel, the others for it; caller holds aio_lock */
+static
+int
+uring_wait
+(struct uring *ring)
+{
+  if (aio_reaping)
+    {
+      pthread_cond_wait (&aio_done, &aio_lock);
+      return 0;
+    }
+  aio_reaping = true;
+  pthread_mutex_unlock (&aio_lock);
+  int ret = _dosix__uring_enter (ring, 0, 1);
+  pthread_mutex_lock (&aio_lock);
+  aio_reaping = false;
+  uring_reap (ring);
+  pthread_cond_broadcast (&aio_done);
+  return ret;
+}
+
+/* Queue one request and hand it to the kernel; caller holds
+   aio_lock */
+static
+int
+uring_submit
+(struct uring *ring,
+ struct _dosaio_t *aio)
+{
+  /* never overflow the completion queue */
+  while (ring->in_flight >= AIO_URING_ENTRIES)
+    {
+      if (! aio_reaping) uring_reap (ring);
+      if (ring->in_flight < AIO_URING_ENTRIES) break;
+      if (uring_wait (ring) < 0) return -1;
+    }
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = aio->_opcode == AIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+  sqe->fd = aio->handle;
+  sqe->off = aio->offset;
+  sqe->addr = (uintptr_t) aio->buffer;
+  sqe->len = aio->count;
+  sqe->user_data = (uintptr_t) aio;
+  ring->sq_array[index] = index;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  if (_dosix__uring_enter (ring, 1, 0) < 0)
+    {
+      /* take the entry back so the ring stays consistent */
+      __atomic_store_n (ring->sq_tail, tail, __ATOMIC_RELEASE);
+      return -1;
+    }
+  ring->in_flight++;
+  return 0;
+}
+
+
+/* thread pool backend */
+
+static
+void *
+aio_worker
+(void *arg __attribute__ ((unused)))
+{
+  for (;;)
+    {
+      pthread_mutex_lock (&aio_lock);
+      while (! aio_queue_head)
+	pthread_cond_wait (&aio_work, &aio_lock);
+      struct _dosaio_t *aio = aio_queue_head;
+      aio_queue_head = aio->_next;
+      if (! aio_queue_head) aio_queue_tail = NULL;
+      pthread_mutex_unlock (&aio_lock);
+
+      ssize_t ret = aio->_opcode == AIO_READ
+	? pread (aio->handle, aio->buffer, aio->count, aio->offset)
+	: pwrite (aio->handle, aio->buffer, aio->count, aio->offset);
+
+      pthread_mutex_lock (&aio_lock);
+      if (ret < 0)
+	{
+	  aio->error = _dosix__dosexterr (NULL);
+	  aio->result = 0;
+	}
+      else
+	{
+	  aio->error = 0;
+	  aio->result = ret;
+	}
+      if (aio->_opcode == AIO_WRITE) _dosix__drive_space_invalidate ();
+      __atomic_store_n (&aio->_done, 1, __ATOMIC_RELEASE);
+      pthread_cond_broadcast (&aio_done);
+      pthread_mutex_unlock (&aio_lock);
+    }
+  return NULL;
+}
+
+static
+bool
+threads_setup
+(void)
+{
+  pthread_attr_t attr;
+  if (pthread_attr_init (&attr))
+    return false;
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  size_t started = 0;
+  for (size_t i = 0; i < AIO_THREADS; i++)
+    {
+      pthread_t thread;
+      if (! pthread_create (&thread, &attr, aio_worker, NULL))
+	started++;
+    }
+  pthread_attr_destroy (&attr);
+  return started > 0;
+}
+
+
+/* backend selection */
+
+/* io_uring is only used if it knows IORING_OP_READ and
+   IORING_OP_WRITE (Linux 5.6) */
+static
+void
+aio_init
+(void)
+{
+  static const uint8_t ops[] = {IORING_OP_READ, IORING_OP_WRITE};
+  if (! _dosix__uring_setup (&uring, AIO_URING_ENTRIES))
+    {
+      if (_dosix__uring_probe (&uring, ops, sizeof (ops)))
+	{
+	  aio_backend = AIO_BACKEND_URING;
+	  return;
+	}
+      _dosix__uring_close (&uring);
+    }
+  if (threads_setup ())
+    aio_backend = AIO_BACKEND_THREADS;
+  else
+    aio_backend = AIO_BACKEND_NONE;
+}
+
+
+/* _dos_aioread, _dos_aiowrite */
+
+/* Refuse requests the handle’s access mode or another process’ record
+   locks wouldn’t allow through the synchronous services */
+static
+unsigned
+aio_check
+(struct _dosaio_t *aio)
+{
+  int flags = fcntl (aio->handle, F_GETFL);
+  if (flags == -1)
+    return _dosix__dosexterr (NULL);
+  int accmode = flags & O_ACCMODE;
+  if ((aio->_opcode == AIO_READ && accmode == O_WRONLY)
+      || (aio->_opcode == AIO_WRITE && accmode == O_RDONLY))
+    {
+      errno = EACCES;
+      return _dosix__dosexterr (NULL);
+    }
+  if (! aio->count) return 0;
+  struct flock flock =
+    {
+     .l_type = aio->_opcode == AIO_READ ? F_RDLCK : F_WRLCK,
+     .l_whence = SEEK_SET,
+     .l_start = aio->offset,
+     .l_len = aio->count
+    };
+  if (fcntl (aio->handle, F_GETLK, &flock) == -1)
+    return _dosix__dosexterr (NULL);
+  if (flock.l_type != F_UNLCK)
+    {
+      errno = EDEADLK;		/* reported as lock violation */
+      return _dosix__dosexterr (NULL);
+    }
+  return 0;
+}
+
+/* Disk image files have no host descriptor to hand the kernel: reads
+   are done in place and complete at once, writes are refused as the
+   images are read-only */
+static
+unsigned
+aio_fat
+(struct _dosaio_t *aio)
+{
+  if (aio->_opcode == AIO_WRITE)
+    {
+      errno = EACCES;
+      return _dosix__dosexterr (NULL);
+    }
+  ssize_t ret = _dosix__fat_pread (aio->handle, aio->buffer, aio->count,
+				   aio->offset);
+  if (ret < 0)
+    {
+      aio->error = _dosix__dosexterr (NULL);
+      aio->result = 0;
+    }
+  else aio->result = ret;
+  __atomic_store_n (&aio->_done, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static
+unsigned
+aio_submit
+(struct _dosaio_t *aio,
+ enum aio_opcode opcode)
+{
+  assert (aio);
+  pthread_once (&aio_once, aio_init);
+  aio->_opcode = opcode;
+  aio->_next = NULL;
+  aio->result = 0;
+  aio->error = 0;
+  aio->_done = 0;
+  if (_dosix__fat_handle (aio->handle))
+    return aio_fat (aio);
+  /* transfers at explicit offsets must not race the write-behind
+     cache */
+  unsigned err = _dosix__wbcache_flush (aio->handle);
+  if (err) return err;
+  err = aio_check (aio);
+  if (err) return err;
+  switch (aio_backend)
+    {
+    case AIO_BACKEND_URING:
+      pthread_mutex_lock (&aio_lock);
+      int ret = uring_submit (&uring, aio);
+      pthread_mutex_unlock (&aio_lock);
+      if (ret < 0)
+	return _dosix__dosexterr (NULL);
+      return 0;
+    case AIO_BACKEND_THREADS:
+      pthread_mutex_lock (&aio_lock);
+      if (aio_queue_tail) aio_queue_tail->_next = aio;
+      else aio_queue_head = aio;
+      aio_queue_tail = aio;
+      pthread_cond_signal (&aio_work);
+      pthread_mutex_unlock (&aio_lock);
+      return 0;
+    default:
+      errno = ENOSYS;
+      return _dosix__dosexterr (NULL);
+    }
+}
+
+unsigned
+_dosix__dos_aioread
+(struct _dosaio_t *aio)
+{
+  return aio_submit (aio, AIO_READ);
+}
+
+unsigned
+_dosix__dos_aiowrite
+(struct _dosaio_t *aio)
+{
+  return aio_submit (aio, AIO_WRITE);
+}
+
+
+/* _dos_aiopoll, _dos_aiowait */
+
+int
+_dosix__dos_aiopoll
+(struct _dosaio_t *aio)
+{
+  assert (aio);
+  if (__atomic_load_n (&aio->_done, __ATOMIC_ACQUIRE))
+    return 1;
+  if (aio_backend == AIO_BACKEND_URING)
+    {
+      /* completions are in shared memory: no system call needed */
+      pthread_mutex_lock (&aio_lock);
+      if (! aio_reaping) uring_reap (&uring);
+      pthread_mutex_unlock (&aio_lock);
+    }
+  return __atomic_load_n (&aio->_done, __ATOMIC_ACQUIRE);
+}
+
+unsigned
+_dosix__dos_aiowait
+(struct _dosaio_t *aio)
+{
+  assert (aio);
+  switch (aio_backend)
+    {
+    case AIO_BACKEND_URING:
+      pthread_mutex_lock (&aio_lock);
+      for (;;)
+	{
+	  if (! aio_reaping) uring_reap (&uring);
+	  if (aio->_done) break;
+	  if (uring_wait (&uring) < 0)
+	    {
+	      pthread_mutex_unlock (&aio_lock);
+	      return _dosix__dosexterr (NULL);
+	    }
+	}
+      pthread_mutex_unlock (&aio_lock);
+      break;
+    case AIO_BACKEND_THREADS:
+      pthread_mutex_lock (&aio_lock);
+      while (! aio->_done)
+	pthread_cond_wait (&aio_done, &aio_lock);
+      pthread_mutex_unlock (&aio_lock);
+      break;
+    default:
+      break;
+    }
+  return aio->error;
+}
@@ -0,0 +1,668 @@
+/*
+  alias.c -- 8.3 aliases of long file names
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include "_dos.h"
+
+
+/* constants */
+
+#define ALIAS_CACHE_SIZE 64	/* directories whose maps are kept */
+#define ALIAS_XATTR "user.dosix.alias"
+#define ALIAS_XATTR_MAX 65536
+#define ALIAS_TICK 10000000	/* coarsest timestamp granularity, in ns */
+
+
+/* type definitions */
+
+struct alias_ent
+{
+  char *name;			/* host name */
+  char alias[13];		/* upper case 8.3 name */
+  bool lossy;			/* alias is not just name upper cased */
+};
+
+/* Highest tail found taken during a scan for a stem, an alias with
+   its tail digits masked.  Every lower tail of as many digits is taken
+   as well, so searches for a free one skip past it */
+struct alias_next
+{
+  char stem[11];
+  unsigned n;			/* 0 if the slot is free */
+};
+
+/* The alias map of a directory as of a scan.  It is not changed
+   once built, so that its holders look names up without locking */
+struct alias_map
+{
+  struct timespec mtime;	/* of the directory when scanned */
+  struct timespec scanned;	/* when it was scanned */
+  struct alias_ent *ents;	/* sorted by name */
+  size_t count;
+  size_t *by_name;		/* hash tables of entry index + 1 */
+  size_t *by_alias;
+  size_t buckets;		/* a power of two */
+  unsigned refs;		/* the cache's and its holders' */
+};
+
+/* Cache slot of a directory, keyed by its inode so that every path
+   leading to it shares the map */
+struct alias_dir
+{
+  dev_t dev;
+  ino_t ino;			/* 0 if the slot is free */
+  struct alias_map *map;	/* NULL until first scanned */
+  bool scanning;		/* by one thread, without alias_lock */
+  unsigned long used;		/* LRU clock */
+};
+
+
+/* global private variables */
+
+/* Guards the slots only; directories are scanned without it */
+static pthread_mutex_t alias_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alias_scanned = PTHREAD_COND_INITIALIZER;
+static struct alias_dir alias_cache[ALIAS_CACHE_SIZE];
+static unsigned long alias_clock;
+
+
+/* basis names */
+
+/* Characters a short name may not contain besides control ones */
+static const char alias_invalid[] = "\"*+,/:;<=>?[\\]|";
+
+static
+char
+alias_char
+(unsigned char c,
+ bool *lossy)
+{
+  if (c < 0x20 || c > 0x7e || strchr (alias_invalid, c))
+    {
+      *lossy = true;
+      return '_';
+    }
+  return toupper (c);
+}
+
+bool
+_dosix__alias_basis
+(const char *name,
+ char fcb[11])
+{
+  assert (name), assert (fcb);
+  memset (fcb, ' ', 11);
+  if (! strcmp (name, ".") || ! strcmp (name, ".."))
+    {
+      memcpy (fcb, name, strlen (name));
+      return false;
+    }
+  bool lossy = false;
+  const char *dot = strrchr (name, '.');
+  if (dot == name) dot = NULL;	/* ‘.profile’ has no extension */
+  size_t n = 0;
+  for (const char *p = name; *p && p != dot; p++)
+    if (*p == ' ' || *p == '.')
+      lossy = true;		/* spaces and inner periods are dropped */
+    else if (n == 8)
+      {
+	lossy = true;
+	break;
+      }
+    else fcb[n++] = alias_char (*p, &lossy);
+  if (! n)
+    {
+      lossy = true;
+      fcb[0] = '_';
+    }
+  if (dot)
+    {
+      n = 0;
+      for (const char *p = dot + 1; *p; p++)
+	if (*p == ' ')
+	  lossy = true;
+	else if (n == 3)
+	  {
+	    lossy = true;
+	    break;
+	  }
+	else fcb[8 + n++] = alias_char (*p, &lossy);
+    }
+  return lossy;
+}
+
+void
+_dosix__alias_format
+(const char fcb[11],
+ char alias[13])
+{
+  assert (fcb), assert (alias);
+  size_t n = 0;
+  for (size_t i = 0; i < 8 && fcb[i] != ' '; i++)
+    alias[n++] = fcb[i];
+  if (fcb[8] != ' ')
+    {
+      alias[n++] = '.';
+      for (size_t i = 8; i < 11 && fcb[i] != ' '; i++)
+	alias[n++] = fcb[i];
+    }
+  alias[n] = '\0';
+}
+
+
+/* numeric tails */
+
+/* basis with ‘~n’ in the last positions of the name part */
+static
+void
+alias_tail
+(const char basis[11],
+ unsigned n,
+ char fcb[11])
+{
+  char tail[12];
+  size_t len = snprintf (tail, sizeof (tail), "~%u", n);
+  size_t keep = 0;
+  while (keep < 8 - len && basis[keep] != ' ') keep++;
+  memcpy (fcb, basis, 11);
+  memset (fcb + keep, ' ', 8 - keep);
+  memcpy (fcb + keep, tail, len);
+}
+
+
+/* alias maps */
+
+/* Aliases are assigned once per directory scan: real 8.3 names keep
+   their own, names remembered from earlier scans (in memory or in the
+   ALIAS_XATTR attribute of the directory) keep theirs, and the rest
+   take the lowest free tail in byte order of name.  Without the
+   attribute the outcome still depends on the directory contents
+   alone, so it is stable across runs while these do not change. */
+
+static
+size_t
+alias_hash
+(const char *s)
+{
+  size_t h = 2166136261u;
+  while (*s) h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+static
+size_t *
+alias_slot
+(size_t *table,
+ size_t buckets,
+ const struct alias_ent *ents,
+ const char *key,
+ bool by_alias)
+{
+  size_t i = alias_hash (key) & (buckets - 1);
+  for (;; i = (i + 1) & (buckets - 1))
+    {
+      if (! table[i]) return &table[i];
+      const struct alias_ent *e = &ents[table[i] - 1];
+      if (! strcmp (by_alias ? e->alias : e->name, key))
+	return &table[i];
+    }
+}
+
+/* Slot of the stem of fcb, the alias with tail n */
+static
+struct alias_next *
+alias_next_slot
+(struct alias_next *table,
+ size_t buckets,
+ const char fcb[11],
+ unsigned n)
+{
+  char stem[11];
+  memcpy (stem, fcb, 11);
+  char *tilde = memchr (stem, '~', 8);
+  for (; n; n /= 10) *++tilde = '#';
+  size_t h = 2166136261u;
+  for (int i = 0; i < 11; i++)
+    h = (h ^ (unsigned char) stem[i]) * 16777619u;
+  for (size_t i = h & (buckets - 1);; i = (i + 1) & (buckets - 1))
+    if (! table[i].n || ! memcmp (table[i].stem, stem, 11))
+      {
+	memcpy (table[i].stem, stem, 11);
+	return &table[i];
+      }
+}
+
+static
+int
+alias_cmp
+(const void *a,
+ const void *b)
+{
+  return strcmp (((const struct alias_ent *) a)->name,
+		 ((const struct alias_ent *) b)->name);
+}
+
+static
+void
+alias_unref
+(struct alias_map *m)
+{
+  if (! m || __atomic_sub_fetch (&m->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+  for (size_t i = 0; i < m->count; i++)
+    free (m->ents[i].name);
+  free (m->ents);
+  free (m->by_name);
+  free (m->by_alias);
+  free (m);
+}
+
+/* Alias name had in the previous map of the directory, or in its
+   persisted attribute */
+static
+const char *
+alias_previous
+(const struct alias_map *old,
+ const char *xattr,
+ size_t xlen,
+ const char *name)
+{
+  if (old)
+    {
+      size_t i = *alias_slot (old->by_name, old->buckets, old->ents,
+			      name, false);
+      return i && old->ents[i - 1].lossy ? old->ents[i - 1].alias : NULL;
+    }
+  /* pairs of alias and name, each NUL terminated */
+  for (const char *p = xattr, *end = xattr + xlen; p < end;)
+    {
+      const char *a = p;
+      p += strnlen (p, end - p) + 1;
+      if (p >= end) break;
+      const char *n = p;
+      size_t len = strnlen (p, end - p);
+      if (p + len == end) break;	/* not terminated */
+      p += len + 1;
+      if (! strcmp (n, name)) return a;
+    }
+  return NULL;
+}
+
+static
+void
+alias_persist
+(int fd,
+ const struct alias_map *d)
+{
+  char *buf = malloc (ALIAS_XATTR_MAX);
+  if (! buf) return;
+  size_t len = 0;
+  for (size_t i = 0; i < d->count; i++)
+    {
+      const struct alias_ent *e = &d->ents[i];
+      if (! e->lossy) continue;
+      size_t alen = strlen (e->alias) + 1, nlen = strlen (e->name) + 1;
+      if (len + alen + nlen > ALIAS_XATTR_MAX)
+	break;			/* what does not fit is derived again */
+      memcpy (buf + len, e->alias, alen), len += alen;
+      memcpy (buf + len, e->name, nlen), len += nlen;
+    }
+  /* best effort: file systems without user attributes only lose
+     stability across changes of the directory */
+  if (len) fsetxattr (fd, ALIAS_XATTR, buf, len, 0);
+  else fremovexattr (fd, ALIAS_XATTR);
+  free (buf);
+}
+
+/* Build the map of the directory dirfd, whose status is st, from its
+   contents and old, its previous map if any */
+static
+struct alias_map *
+alias_scan
+(int dirfd,
+ const struct stat *st,
+ const struct alias_map *old)
+{
+  int fd = openat (dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR *dir = fd < 0 ? NULL : fdopendir (fd);
+  if (! dir)
+    {
+      if (fd >= 0) close (fd);
+      return NULL;
+    }
+  struct alias_map new = {.mtime = st->st_mtim, .refs = 1};
+  clock_gettime (CLOCK_REALTIME, &new.scanned);
+  size_t size = 0;
+  struct dirent *de;
+  while ((de = readdir (dir)))
+    {
+      if (! strcmp (de->d_name, ".") || ! strcmp (de->d_name, ".."))
+	continue;
+      if (new.count == size)
+	{
+	  size = size ? 2 * size : 64;
+	  void *p = realloc (new.ents, size * sizeof (*new.ents));
+	  if (! p) goto nomem;
+	  new.ents = p;
+	}
+      struct alias_ent *e = &new.ents[new.count];
+      if (! (e->name = strdup (de->d_name))) goto nomem;
+      new.count++;
+    }
+  qsort (new.ents, new.count, sizeof (*new.ents), alias_cmp);
+  for (new.buckets = 64; new.buckets < 2 * new.count;)
+    new.buckets *= 2;
+  new.by_name = calloc (new.buckets, sizeof (size_t));
+  new.by_alias = calloc (new.buckets, sizeof (size_t));
+  if (! new.by_name || ! new.by_alias) goto nomem;
+
+  char *xattr = NULL;
+  ssize_t xlen = 0;
+  if (! old && (xattr = malloc (ALIAS_XATTR_MAX)))
+    {
+      xlen = fgetxattr (fd, ALIAS_XATTR, xattr, ALIAS_XATTR_MAX);
+      if (xlen < 0) xlen = 0;
+    }
+  /* a name goes through a stem for each length of its tail */
+  size_t next_buckets = 8 * new.buckets;
+  struct alias_next *next = calloc (next_buckets, sizeof (*next));
+  if (! next)
+    {
+      free (xattr);
+      goto nomem;
+    }
+
+  /* real short names first, then remembered aliases, then new ones */
+  bool changed = false;
+  for (int pass = 0; pass < 3; pass++)
+    for (size_t i = 0; i < new.count; i++)
+      {
+	struct alias_ent *e = &new.ents[i];
+	char basis[11];
+	if (! pass)
+	  {
+	    *e->alias = '\0';
+	    *alias_slot (new.by_name, new.buckets, new.ents, e->name,
+			 false) = i + 1;
+	    e->lossy = _dosix__alias_basis (e->name, basis);
+	    if (e->lossy) continue;
+	    _dosix__alias_format (basis, e->alias);
+	  }
+	else if (! e->lossy || *e->alias)
+	  continue;
+	else if (pass == 1)
+	  {
+	    const char *a = alias_previous (old, xattr, xlen, e->name);
+	    if (! a || strlen (a) >= sizeof (e->alias)
+		|| *alias_slot (new.by_alias, new.buckets, new.ents, a,
+				true))
+	      continue;
+	    strcpy (e->alias, a);
+	  }
+	else
+	  {
+	    _dosix__alias_basis (e->name, basis);
+	    char fcb[11];
+	    for (unsigned n = 1;; n++)
+	      {
+		alias_tail (basis, n, fcb);
+		struct alias_next *last
+		  = alias_next_slot (next, next_buckets, fcb, n);
+		if (last->n >= n)
+		  {
+		    n = last->n;
+		    continue;
+		  }
+		last->n = n;
+		_dosix__alias_format (fcb, e->alias);
+		if (! *alias_slot (new.by_alias, new.buckets, new.ents,
+				   e->alias, true))
+		  break;
+	      }
+	    changed = true;
+	  }
+	size_t *slot = alias_slot (new.by_alias, new.buckets, new.ents,
+				   e->alias, true);
+	/* of real names differing in case only the first is reached */
+	if (! *slot) *slot = i + 1;
+      }
+  free (xattr);
+  free (next);
+  struct alias_map *m = malloc (sizeof (*m));
+  if (! m) goto nomem;
+  if (changed || (old && new.count < old->count))
+    alias_persist (fd, &new);
+  closedir (dir);
+  *m = new;
+  return m;
+
+ nomem:
+  closedir (dir);
+  for (size_t i = 0; i < new.count; i++)
+    free (new.ents[i].name);
+  free (new.ents);
+  free (new.by_name);
+  free (new.by_alias);
+  errno = ENOMEM;
+  return NULL;
+}
+
+/* A reference to the up to date map of directory dirfd.  With rescan
+   the map is rebuilt if it may have missed a change that left the
+   directory time as it was.  A directory is scanned by one thread at
+   a time while the others go on with theirs */
+static
+struct alias_map *
+alias_map_get
+(int dirfd,
+ bool rescan)
+{
+  struct stat st;
+  if (fstat (dirfd, &st)) return NULL;
+  pthread_mutex_lock (&alias_lock);
+  struct alias_dir *d, *victim;
+  for (;;)
+    {
+      d = victim = NULL;
+      for (size_t i = 0; i < ALIAS_CACHE_SIZE; i++)
+	{
+	  struct alias_dir *e = &alias_cache[i];
+	  if (e->ino == st.st_ino && e->dev == st.st_dev)
+	    {
+	      d = e;
+	      break;
+	    }
+	  if (! e->scanning && (! victim || e->used < victim->used))
+	    victim = e;
+	}
+      struct alias_map *m = d ? d->map : NULL;
+      if (m && m->mtime.tv_sec == st.st_mtim.tv_sec
+	  && m->mtime.tv_nsec == st.st_mtim.tv_nsec)
+	{
+	  int64_t age = (m->scanned.tv_sec - st.st_mtim.tv_sec)
+	    * 1000000000LL + m->scanned.tv_nsec - st.st_mtim.tv_nsec;
+	  if (! rescan || age > ALIAS_TICK)
+	    {
+	      __atomic_add_fetch (&m->refs, 1, __ATOMIC_RELAXED);
+	      d->used = ++alias_clock;
+	      pthread_mutex_unlock (&alias_lock);
+	      return m;
+	    }
+	}
+      if (! d || ! d->scanning) break;
+      pthread_cond_wait (&alias_scanned, &alias_lock);
+    }
+  if (! d && victim)
+    {
+      d = victim;
+      alias_unref (d->map);
+      d->map = NULL;
+      d->dev = st.st_dev;
+      d->ino = st.st_ino;
+    }
+  /* with every slot being scanned the map is not cached */
+  struct alias_map *old = NULL;
+  if (d)
+    {
+      d->scanning = true;
+      d->used = ++alias_clock;
+      old = d->map;
+    }
+  pthread_mutex_unlock (&alias_lock);
+  struct alias_map *m = alias_scan (dirfd, &st, old);
+  if (! d) return m;
+  pthread_mutex_lock (&alias_lock);
+  d->scanning = false;
+  if (m)
+    {
+      __atomic_add_fetch (&m->refs, 1, __ATOMIC_RELAXED);
+      d->map = m;
+      alias_unref (old);
+    }
+  else if (! old) d->ino = 0;
+  pthread_cond_broadcast (&alias_scanned);
+  pthread_mutex_unlock (&alias_lock);
+  return m;
+}
+
+/* Alias of name in m, if m has it */
+static
+bool
+alias_lookup
+(const struct alias_map *m,
+ const char *name,
+ char alias[13])
+{
+  size_t i = *alias_slot (m->by_name, m->buckets, m->ents, name, false);
+  if (i) strcpy (alias, m->ents[i - 1].alias);
+  return i;
+}
+
+struct alias_map *
+_dosix__alias_open
+(int dirfd)
+{
+  return alias_map_get (dirfd, false);
+}
+
+int
+_dosix__alias_lookup
+(struct alias_map *m,
+ const char *name,
+ char alias[13])
+{
+  assert (m), assert (name), assert (alias);
+  char basis[11];
+  if (! _dosix__alias_basis (name, basis))
+    {
+      _dosix__alias_format (basis, alias);
+      return 0;
+    }
+  if (alias_lookup (m, name, alias)) return 0;
+  errno = ENOENT;
+  return -1;
+}
+
+void
+_dosix__alias_close
+(struct alias_map *m)
+{
+  alias_unref (m);
+}
+
+int
+_dosix__alias_get
+(int dirfd,
+ const char *name,
+ char alias[13])
+{
+  assert (name), assert (alias);
+  char basis[11];
+  if (! _dosix__alias_basis (name, basis))
+    {
+      _dosix__alias_format (basis, alias);
+      return 0;
+    }
+  for (int rescan = 0; rescan < 2; rescan++)
+    {
+      struct alias_map *m = alias_map_get (dirfd, rescan);
+      if (! m) break;
+      bool found = alias_lookup (m, name, alias);
+      alias_unref (m);
+      if (found) return 0;
+      errno = ENOENT;
+    }
+  return -1;
+}
+
+int
+_dosix__alias_resolve
+(int dirfd,
+ const char *dosname,
+ char *name,
+ size_t size)
+{
+  assert (dosname), assert (name);
+  char basis[11], key[13];
+  if (_dosix__alias_basis (dosname, basis))
+    {
+      errno = ENOENT;		/* not a short name */
+      return -1;
+    }
+  _dosix__alias_format (basis, key);
+  for (int rescan = 0; rescan < 2; rescan++)
+    {
+      struct alias_map *m = alias_map_get (dirfd, rescan);
+      if (! m) break;
+      size_t i = *alias_slot (m->by_alias, m->buckets, m->ents, key,
+			      true);
+      if (i)
+	{
+	  const char *n = m->ents[i - 1].name;
+	  int ret = strlen (n) < size ? 0 : -1;
+	  if (ret) errno = ENAMETOOLONG;
+	  else strcpy (name, n);
+	  alias_unref (m);
+	  return ret;
+	}
+      alias_unref (m);
+      errno = ENOENT;
+    }
+  return -1;
+}
+
@@ -0,0 +1,233 @@
+/*
+  bios.c -- BIOS services
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <bios.h>
+#include "_dos.h"
+
+
+/* constants */
+
+#define TICKS_PER_DAY ((uint64_t) _TICKS_PER_DAY)
+#define DAY 86400
+
+
+/* global variables */
+
+/* The tick count is never kept up by anything.  It is the ticks since
+   midnight by the DOS clock at some anchor, plus those the monotonic
+   clock has counted since, so reading it costs no more than a vDSO
+   call.  The anchor moves whenever the DOS clock is set and at each
+   midnight.  Readers take it under the sequence count tick_seq, odd
+   while it moves, and only those moving it lock tick_lock. */
+static pthread_mutex_t tick_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned tick_seq;
+static bool tick_anchored;
+static unsigned tick_changes;	/* of the DOS clock, at the anchor */
+static struct timespec tick_mono; /* monotonic time of the anchor */
+static uint64_t tick_base;	/* ticks since midnight at the anchor */
+static bool tick_midnight;	/* a midnight went by unread */
+
+
+/* tick count */
+
+/* Ticks in the time between from and to */
+static
+uint64_t
+tick_elapsed
+(const struct timespec *from,
+ const struct timespec *to)
+{
+  int64_t sec = to->tv_sec - from->tv_sec;
+  long nsec = to->tv_nsec - from->tv_nsec;
+  if (nsec < 0)
+    {
+      sec--;
+      nsec += 1000000000;
+    }
+  if (sec < 0) return 0;
+  return (sec * TICKS_PER_DAY + nsec * TICKS_PER_DAY / 1000000000) / DAY;
+}
+
+/* Ticks since midnight by the DOS clock */
+static
+uint64_t
+tick_clock
+(void)
+{
+  struct timeval tv;
+  _dosix__clock_get (&tv);
+  struct tm tm;
+  uint64_t sec = _dosix__time_local (tv.tv_sec, &tm)
+    ? (tv.tv_sec % DAY + DAY) % DAY
+    : tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+  return (sec * TICKS_PER_DAY + tv.tv_usec * TICKS_PER_DAY / 1000000)
+    / DAY;
+}
+
+/* Move the anchor, with tick_lock held */
+static
+void
+tick_anchor
+(unsigned changes,
+ const struct timespec *mono,
+ uint64_t base)
+{
+  __atomic_store_n (&tick_seq, tick_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  __atomic_store_n (&tick_anchored, true, __ATOMIC_RELAXED);
+  __atomic_store_n (&tick_changes, changes, __ATOMIC_RELAXED);
+  __atomic_store_n (&tick_mono.tv_sec, mono->tv_sec, __ATOMIC_RELAXED);
+  __atomic_store_n (&tick_mono.tv_nsec, mono->tv_nsec, __ATOMIC_RELAXED);
+  __atomic_store_n (&tick_base, base, __ATOMIC_RELAXED);
+  __atomic_store_n (&tick_seq, tick_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Ticks from the anchor to now.  Returns false if the anchor is not
+   the one for changes of the DOS clock, or is moving */
+static
+bool
+tick_count
+(const struct timespec *now,
+ unsigned changes,
+ uint64_t *ticks)
+{
+  unsigned seq = __atomic_load_n (&tick_seq, __ATOMIC_ACQUIRE);
+  if (seq & 1) return false;
+  bool anchored = __atomic_load_n (&tick_anchored, __ATOMIC_RELAXED);
+  unsigned c = __atomic_load_n (&tick_changes, __ATOMIC_RELAXED);
+  struct timespec mono =
+    {
+     .tv_sec = __atomic_load_n (&tick_mono.tv_sec, __ATOMIC_RELAXED),
+     .tv_nsec = __atomic_load_n (&tick_mono.tv_nsec, __ATOMIC_RELAXED)
+    };
+  uint64_t base = __atomic_load_n (&tick_base, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  if (__atomic_load_n (&tick_seq, __ATOMIC_RELAXED) != seq
+      || ! anchored || c != changes)
+    return false;
+  *ticks = base + tick_elapsed (&mono, now);
+  return true;
+}
+
+/* Ticks since midnight */
+static
+uint64_t
+tick_read
+(void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  unsigned changes = _dosix__clock_changes ();
+  uint64_t ticks;
+  if (tick_count (&now, changes, &ticks) && ticks < TICKS_PER_DAY)
+    return ticks;
+  /* the anchor moves, unless another thread just moved it */
+  pthread_mutex_lock (&tick_lock);
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  changes = _dosix__clock_changes ();
+  if (! tick_count (&now, changes, &ticks))
+    {
+      ticks = tick_clock ();
+      tick_anchor (changes, &now, ticks);
+    }
+  if (ticks >= TICKS_PER_DAY)
+    {
+      /* the DOS clock is trusted over the count for the new day,
+	 unless it has yet to see midnight itself */
+      uint64_t clock = tick_clock ();
+      __atomic_store_n (&tick_midnight, true, __ATOMIC_RELAXED);
+      ticks = clock < TICKS_PER_DAY / 2 ? clock : ticks % TICKS_PER_DAY;
+      tick_anchor (changes, &now, ticks);
+    }
+  pthread_mutex_unlock (&tick_lock);
+  return ticks;
+}
+
+
+/* _bios_timeofday */
+
+unsigned
+_dosix__bios_timeofday
+(unsigned service,
+ long *timeval)
+{
+  assert (timeval);
+  switch (service)
+    {
+    case _TIME_GETCLOCK:
+      {
+	*timeval = tick_read ();
+	return __atomic_exchange_n (&tick_midnight, false, __ATOMIC_RELAXED);
+      }
+    case _TIME_SETCLOCK:
+      {
+	if (*timeval < 0 || *timeval >= _TICKS_PER_DAY)
+	  {
+	    errno = EINVAL;
+	    return 1;
+	  }
+	/* the DOS clock keeps the date and takes the time of day */
+	uint64_t usec = *timeval * UINT64_C (86400000000) / TICKS_PER_DAY;
+	struct timeval tv;
+	_dosix__clock_get (&tv);
+	struct tm tm;
+	if (_dosix__time_local (tv.tv_sec, &tm)) return 1;
+	tm.tm_hour = tm.tm_min = 0;
+	tm.tm_sec = usec / 1000000;
+	if (_dosix__time_unix (&tm, &tv.tv_sec)) return 1;
+	tv.tv_usec = usec % 1000000;
+	pthread_mutex_lock (&tick_lock);
+	_dosix__clock_set (&tv);
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	tick_anchor (_dosix__clock_changes (), &now, *timeval);
+	__atomic_store_n (&tick_midnight, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&tick_lock);
+	return 0;
+      }
+    default:
+      errno = EINVAL;
+      return 1;
+    }
+}
+
+
+/* _bios_tickcount */
+
+/* The count at 0040:006C, which a flat address space has no room for.
+   The midnight flag is left for _bios_timeofday to report. */
+unsigned long
+_dosix__bios_tickcount
+(void)
+{
+  return tick_read ();
+}
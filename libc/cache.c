@@ -0,0 +1,454 @@
+/*
+  cache.c -- Write-behind cache for DOS handles (DOSix extension)
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <search.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <dos.h>
+#include "_dos.h"
+
+
+/* constants */
+
+#define WB_EXTENT_SIZE (64 * 1024)  /* largest single dirty buffer */
+#define WB_HANDLE_LIMIT (1024 * 1024) /* dirty bytes forcing a flush */
+#define WB_DEFAULT_INTERVAL 1000      /* periodic flush, in ms */
+
+
+/* type definitions */
+
+struct wb_extent
+{
+  off_t offset;			/* file offset of first byte */
+  size_t length;		/* dirty bytes in data */
+  char data[WB_EXTENT_SIZE];
+};
+
+struct wb_handle
+{
+  int handle;
+  off_t pos;			/* file position seen by the program */
+  struct wb_extent **extents;	/* sorted by offset */
+  size_t count;
+  size_t dirty;			/* bytes waiting to be written */
+  unsigned error;		/* deferred write-back error */
+};
+
+
+/* global private variables */
+
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t wb_once = PTHREAD_ONCE_INIT;
+static void *wb_tree;
+static bool wb_used;		/* set once anything was ever cached */
+static unsigned wb_policy = _WB_WRITETHROUGH;
+static unsigned wb_interval = WB_DEFAULT_INTERVAL;
+static bool wb_thread_running;
+static struct _wbstat_t wb_stat;
+
+
+/* auxiliary functions */
+
+static
+int
+wb_cmp
+(const void *_a,
+ const void *_b)
+{
+  const struct wb_handle *a = (const struct wb_handle *) _a;
+  const struct wb_handle *b = (const struct wb_handle *) _b;
+  return a->handle - b->handle;
+}
+
+static
+struct wb_handle *
+wb_find
+(int handle)
+{
+  struct wb_handle key = { .handle = handle };
+  struct wb_handle **wb = tfind (&key, &wb_tree, wb_cmp);
+  return wb ? *wb : NULL;
+}
+
+static
+uint64_t
+wb_clock
+(void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Write back every dirty extent, one pwritev per contiguous run;
+   caller holds wb_lock */
+static
+unsigned
+wb_writeback
+(struct wb_handle *wb)
+{
+  if (! wb->count) return wb->error;
+  _dosix__drive_space_invalidate ();
+  uint64_t start = wb_clock ();
+  struct iovec iov[IOV_MAX];
+  size_t i = 0;
+  while (i < wb->count)
+    {
+      off_t offset = wb->extents[i]->offset;
+      size_t n = 0, bytes = 0;
+      do
+	{
+	  iov[n].iov_base = wb->extents[i + n]->data;
+	  iov[n].iov_len = wb->extents[i + n]->length;
+	  bytes += iov[n].iov_len;
+	  n++;
+	}
+      while (i + n < wb->count && n < IOV_MAX
+	     && wb->extents[i + n]->offset == offset + (off_t) bytes);
+      /* pwritev may be short: finish the run piecewise */
+      struct iovec *v = iov;
+      while (bytes)
+	{
+	  ssize_t ret = pwritev (wb->handle, v, n, offset);
+	  wb_stat.flush_calls++;
+	  if (ret < 0)
+	    {
+	      if (errno == EINTR) continue;
+	      if (! wb->error) wb->error = _dosix__dosexterr (NULL);
+	      bytes = 0;
+	      break;
+	    }
+	  bytes -= ret, offset += ret;
+	  while (n && (size_t) ret >= v->iov_len)
+	    ret -= v->iov_len, v++, n--;
+	  if (n)
+	    v->iov_base = (char *) v->iov_base + ret, v->iov_len -= ret;
+	}
+      i += v - iov + n;
+    }
+  for (i = 0; i < wb->count; i++)
+    free (wb->extents[i]);
+  free (wb->extents);
+  wb->extents = NULL;
+  wb->count = 0;
+  wb->dirty = 0;
+  uint64_t elapsed = wb_clock () - start;
+  wb_stat.flushes++;
+  wb_stat.flush_ns_total += elapsed;
+  if (elapsed > wb_stat.flush_ns_max)
+    wb_stat.flush_ns_max = elapsed;
+  /* the program expects the host position past its last write */
+  if (lseek (wb->handle, wb->pos, SEEK_SET) == (off_t) -1 && ! wb->error)
+    wb->error = _dosix__dosexterr (NULL);
+  return wb->error;
+}
+
+static
+void
+wb_writeback_twalk
+(const void *nodep,
+ VISIT value,
+ int level __attribute__ ((unused)))
+{
+  if (value != leaf && value != postorder)
+    return;
+  wb_writeback (*(struct wb_handle * const *) nodep);
+}
+
+static
+void
+wb_writeback_all
+(void)
+{
+  pthread_mutex_lock (&wb_lock);
+  twalk (wb_tree, wb_writeback_twalk);
+  pthread_mutex_unlock (&wb_lock);
+}
+
+static
+void *
+wb_thread
+(void *arg __attribute__ ((unused)))
+{
+  for (;;)
+    {
+      unsigned interval = __atomic_load_n (&wb_interval, __ATOMIC_RELAXED);
+      struct timespec ts =
+	{
+	 .tv_sec = interval / 1000,
+	 .tv_nsec = (interval % 1000) * 1000000L
+	};
+      nanosleep (&ts, NULL);
+      if (__atomic_load_n (&wb_policy, __ATOMIC_RELAXED) == _WB_PERIODIC)
+	wb_writeback_all ();
+    }
+  return NULL;
+}
+
+static
+unsigned
+wb_configure
+(unsigned policy,
+ unsigned interval)
+{
+  switch (policy)
+    {
+    case _WB_WRITETHROUGH:
+      __atomic_store_n (&wb_policy, policy, __ATOMIC_RELAXED);
+      wb_writeback_all ();
+      return 0;
+    case _WB_ONCLOSE:
+      __atomic_store_n (&wb_policy, policy, __ATOMIC_RELAXED);
+      return 0;
+    case _WB_PERIODIC:
+      __atomic_store_n (&wb_interval,
+			interval ? interval : WB_DEFAULT_INTERVAL,
+			__ATOMIC_RELAXED);
+      pthread_mutex_lock (&wb_lock);
+      if (! wb_thread_running)
+	{
+	  pthread_t thread;
+	  pthread_attr_t attr;
+	  pthread_attr_init (&attr);
+	  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+	  wb_thread_running = ! pthread_create (&thread, &attr, wb_thread, NULL);
+	  pthread_attr_destroy (&attr);
+	}
+      bool running = wb_thread_running;
+      pthread_mutex_unlock (&wb_lock);
+      if (! running)
+	return _dosix__dosexterr (NULL);
+      __atomic_store_n (&wb_policy, policy, __ATOMIC_RELAXED);
+      return 0;
+    default:
+      errno = EINVAL;
+      return _dosix__dosexterr (NULL);
+    }
+}
+
+/* The policy may be preset from the environment:
+   DOSIX_WBCACHE=close|periodic[:milliseconds] */
+static
+void
+wb_init
+(void)
+{
+  /* nothing cached may be lost on a normal exit */
+  atexit (wb_writeback_all);
+  const char *env = getenv ("DOSIX_WBCACHE");
+  if (! env) return;
+  if (! strcmp (env, "close"))
+    wb_configure (_WB_ONCLOSE, 0);
+  else if (! strncmp (env, "periodic", strlen ("periodic")))
+    {
+      const char *ms = strchr (env, ':');
+      wb_configure (_WB_PERIODIC, ms ? strtoul (ms + 1, NULL, 10) : 0);
+    }
+}
+
+
+/* cache hooks for the DOS handle services */
+
+bool
+_dosix__wbcache_write
+(int handle,
+ const void *buffer,
+ unsigned count)
+{
+  pthread_once (&wb_once, wb_init);
+  if (__atomic_load_n (&wb_policy, __ATOMIC_RELAXED) == _WB_WRITETHROUGH
+      || count >= WB_HANDLE_LIMIT / 2)
+    {
+      /* the caller writes through at the host position, which is only
+	 where the program expects once what is cached is written back;
+	 an error is kept for the next flush or close to report */
+      if (! __atomic_load_n (&wb_used, __ATOMIC_ACQUIRE)) return false;
+      pthread_mutex_lock (&wb_lock);
+      struct wb_handle *wb = wb_find (handle);
+      if (wb) wb_writeback (wb);
+      pthread_mutex_unlock (&wb_lock);
+      return false;
+    }
+  pthread_mutex_lock (&wb_lock);
+  struct wb_handle *wb = wb_find (handle);
+  if (! wb)
+    {
+      /* appending handles are left alone: the kernel picks the
+	 offset */
+      int flags = fcntl (handle, F_GETFL);
+      off_t pos = lseek (handle, 0, SEEK_CUR);
+      if (flags == -1 || flags & O_APPEND || pos == (off_t) -1)
+	goto write_through;
+      wb = calloc (1, sizeof (*wb));
+      if (! wb) goto write_through;
+      wb->handle = handle;
+      wb->pos = pos;
+      if (! tsearch (wb, &wb_tree, wb_cmp))
+	{
+	  free (wb);
+	  goto write_through;
+	}
+      __atomic_store_n (&wb_used, true, __ATOMIC_RELEASE);
+    }
+  else if (! wb->count)
+    {
+      /* the host position may have moved since the last write-back */
+      off_t pos = lseek (handle, 0, SEEK_CUR);
+      if (pos == (off_t) -1) goto write_through;
+      wb->pos = pos;
+    }
+  const char *src = buffer;
+  while (count)
+    {
+      struct wb_extent *last = wb->count ? wb->extents[wb->count - 1] : NULL;
+      if (last && last->offset + (off_t) last->length == wb->pos
+	  && last->length < WB_EXTENT_SIZE)
+	{
+	  size_t n = WB_EXTENT_SIZE - last->length;
+	  if (n > count) n = count;
+	  memcpy (last->data + last->length, src, n);
+	  /* bytes joining data of an earlier write save a system call */
+	  if (last->length) wb_stat.bytes_coalesced += n;
+	  last->length += n;
+	  src += n, count -= n, wb->pos += n, wb->dirty += n;
+	  continue;
+	}
+      if (last && last->offset + (off_t) last->length != wb->pos)
+	{
+	  /* a write somewhere else: keep the extent list sorted and
+	     disjoint by writing back first */
+	  wb_writeback (wb);
+	  continue;
+	}
+      struct wb_extent *ext = malloc (sizeof (*ext));
+      struct wb_extent **extents =
+	realloc (wb->extents, (wb->count + 1) * sizeof (*extents));
+      if (! ext || ! extents)
+	{
+	  free (ext);
+	  if (extents) wb->extents = extents;
+	  /* what was already absorbed is consistent: flush it and
+	     write the remainder through, deferring any error */
+	  wb_writeback (wb);
+	  while (count)
+	    {
+	      ssize_t ret = write (handle, src, count);
+	      if (ret < 0 && errno == EINTR) continue;
+	      if (ret <= 0)
+		{
+		  if (! wb->error) wb->error = _dosix__dosexterr (NULL);
+		  break;
+		}
+	      src += ret, count -= ret, wb->pos += ret;
+	    }
+	  pthread_mutex_unlock (&wb_lock);
+	  return true;
+	}
+      ext->offset = wb->pos;
+      ext->length = 0;
+      extents[wb->count++] = ext;
+      wb->extents = extents;
+    }
+  wb_stat.writes++;
+  wb_stat.bytes_cached += (const char *) src - (const char *) buffer;
+  if (wb->dirty >= WB_HANDLE_LIMIT)
+    wb_writeback (wb);
+  pthread_mutex_unlock (&wb_lock);
+  return true;
+
+ write_through:
+  pthread_mutex_unlock (&wb_lock);
+  return false;
+}
+
+unsigned
+_dosix__wbcache_flush
+(int handle)
+{
+  if (! __atomic_load_n (&wb_used, __ATOMIC_ACQUIRE)) return 0;
+  pthread_mutex_lock (&wb_lock);
+  struct wb_handle *wb = wb_find (handle);
+  unsigned err = 0;
+  if (wb)
+    {
+      err = wb_writeback (wb);
+      wb->error = 0;		/* reported once */
+    }
+  pthread_mutex_unlock (&wb_lock);
+  return err;
+}
+
+unsigned
+_dosix__wbcache_close
+(int handle)
+{
+  if (! __atomic_load_n (&wb_used, __ATOMIC_ACQUIRE)) return 0;
+  pthread_mutex_lock (&wb_lock);
+  struct wb_handle *wb = wb_find (handle);
+  unsigned err = 0;
+  if (wb)
+    {
+      err = wb_writeback (wb);
+      tdelete (wb, &wb_tree, wb_cmp);
+      free (wb);
+    }
+  pthread_mutex_unlock (&wb_lock);
+  return err;
+}
+
+
+/* _dos_wbcache */
+
+unsigned
+_dosix__dos_wbcache
+(unsigned policy,
+ unsigned interval)
+{
+  pthread_once (&wb_once, wb_init);
+  return wb_configure (policy, interval);
+}
+
+
+/* _dos_wbstat */
+
+void
+_dosix__dos_wbstat
+(struct _wbstat_t *stat)
+{
+  assert (stat);
+  pthread_mutex_lock (&wb_lock);
+  *stat = wb_stat;
+  pthread_mutex_unlock (&wb_lock);
+}
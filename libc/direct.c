@@ -0,0 +1,118 @@
+/*
+  direct.c -- Directory handling/creation
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <direct.h>
+#include "_dos.h"
+
+
+/* _chdir */
+
+int
+_dosix__chdir
+(const char *dirname)
+{
+  if (! dirname)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if (_dosix__drive_chdir (dirname))
+    {
+      /* the only error Microsoft documents */
+      errno = ENOENT;
+      return -1;
+    }
+  return 0;
+}
+
+
+/* _getcwd, _getdcwd */
+
+char *
+_dosix__getdcwd
+(int drive,
+ char *buffer,
+ int maxlen)
+{
+  /* like Microsoft’s, a null buffer is allocated with at least
+     maxlen bytes */
+  char path[PATH_MAX + 3];
+  if (drive < 0 || _dosix__drive_getcwd (drive - 1, path, sizeof (path)))
+    {
+      errno = EACCES;		/* invalid drive */
+      return NULL;
+    }
+  size_t len = strlen (path);
+  if (! buffer)
+    {
+      size_t size = len + 1 > (size_t) maxlen ? len + 1 : (size_t) maxlen;
+      buffer = malloc (size);
+      if (! buffer)
+	{
+	  errno = ENOMEM;
+	  return NULL;
+	}
+    }
+  else if (len >= (size_t) maxlen)
+    {
+      errno = ERANGE;
+      return NULL;
+    }
+  return memcpy (buffer, path, len + 1);
+}
+
+char *
+_dosix__getcwd
+(char *buffer,
+ int maxlen)
+{
+  return _dosix__getdcwd (0, buffer, maxlen);
+}
+
+
+/* _getdrive, _chdrive */
+
+int
+_dosix__getdrive
+(void)
+{
+  return _dosix__drive_get () + 1;
+}
+
+int
+_dosix__chdrive
+(int drive)
+{
+  if (_dosix__drive_set (drive - 1))
+    {
+      errno = EACCES;
+      return -1;
+    }
+  return 0;
+}
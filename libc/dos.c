@@ -34,31 +34,47 @@
 #include <search.h>
 #include <fcntl.h>
 #include <time.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <dos.h>
+#include <bios.h>
 #include <share.h>
 #include <conio.h>
 #include <dosix/stdlib.h>
 #include <dosix/fcntl.h>
+#include "_dos.h"
 
 
 /* DOS interrupt services enumeration */
 
 /* Interrupts */
 
+#define INT08_TIMER 0x08
+#define INT1A_TIME_OF_DAY 0x1a
+#define INT1C_TIMER_TICK 0x1c
 #define INT21_MAIN_DOS_API 0x21
 #define INT2F_MULTIPLEX 0x2f
 
 /* Sub-functions */
 
+#define INT1A_AH_GETCLOCK 0x00
+#define INT1A_AH_SETCLOCK 0x01
+#define INT1A_AH_GETRTCTIME 0x02
+#define INT1A_AH_SETRTCTIME 0x03
+#define INT1A_AH_GETRTCDATE 0x04
+#define INT1A_AH_SETRTCDATE 0x05
 #define INT21_AH_GETCHE 0x01
 #define INT21_AH_PUTCH 0x02
 #define INT21_AH_GETCH 0x08
 #define INT21_AH_WRITE_STDOUT 0x09
+#define INT21_AH_SETDRIVE 0x0e
+#define INT21_AH_GETDRIVE 0x19
 #define INT21_AH_SET_DTA_ADDR 0x1a
 #define INT21_AH_SETVECT 0x25
 #define INT21_AH_GETDATE 0x2a
@@ -67,9 +83,15 @@
 #define INT21_AH_SETTIME 0x2d
 #define INT21_AH_GET_DTA_ADDR 0x2f
 #define INT21_AH_GETVECT 0x35
+#define INT21_AH_GETDISKFREE 0x36
+#define INT21_AH_CHDIR 0x3b
 #define INT21_AH_CREAT 0x3c
 #define INT21_AH_OPEN 0x3d
 #define INT21_AH_CLOSE 0x3e
+#define INT21_AH_READ 0x3f
+#define INT21_AH_WRITE 0x40
+#define INT21_AH_SEEK 0x42
+#define INT21_AH_GETCWD 0x47
 #define INT21_AH_ALLOCMEM 0x48
 #define INT21_AH_FREEMEM 0x49
 #define INT21_AH_SETBLOCK 0x4a
@@ -77,6 +99,7 @@
 #define INT21_AH_FINDNEXT 0x4f
 #define INT21_AH_EXTERR 0x59
 #define INT21_AH_CREATNEW 0x5b
+#define INT21_AH_COMMIT 0x68
 #define INT21_BH_EXTERR 0x00
 #define INT21_BL_EXTERR 0x00
 #define INT21_AH_FILE_METADATA 0x43
@@ -85,8 +108,58 @@
 #define INT21_AH_FILE_TIME 0x57
 #define INT21_AL_FILE_TIME_GETFTIME 0x00
 #define INT21_AL_FILE_TIME_SETFTIME 0x01
+#define INT21_AH_LFN 0x71
+#define INT21_AL_LFN_CHDIR 0x3b
+#define INT21_AL_LFN_FILE_METADATA 0x43
+#define INT21_BL_LFN_GETFILEATTR 0x00
+#define INT21_BL_LFN_SETFILEATTR 0x01
+#define INT21_BL_LFN_GETPHYSSIZE 0x02
+#define INT21_BL_LFN_SETWRTIME 0x03
+#define INT21_BL_LFN_GETWRTIME 0x04
+#define INT21_BL_LFN_SETACDATE 0x05
+#define INT21_BL_LFN_GETACDATE 0x06
+#define INT21_BL_LFN_SETCRTIME 0x07
+#define INT21_BL_LFN_GETCRTIME 0x08
+#define INT21_AL_LFN_GETCWD 0x47
+#define INT21_AL_LFN_FINDFIRST 0x4e
+#define INT21_AL_LFN_FINDNEXT 0x4f
+#define INT21_AL_LFN_TRUENAME 0x60
+#define INT21_CL_LFN_TRUENAME_CANONICAL 0x00
+#define INT21_CL_LFN_TRUENAME_SHORT 0x01
+#define INT21_CL_LFN_TRUENAME_LONG 0x02
+#define INT21_AL_LFN_EXTOPEN 0x6c
+#define INT21_AL_LFN_VOLINFO 0xa0
+#define INT21_AL_LFN_FINDCLOSE 0xa1
+#define INT21_AL_LFN_BASIS 0xa8
 #define INT2F_AH_DOS_INTERNAL 0x12
 #define INT2F_AL_DOS_INTERNAL_EXTERR_SET 0x22
+#define INT2F_AH_DOSIX 0xd5
+#define INT2F_AL_DOSIX_INSTALL_CHECK 0x00
+#define INT2F_AL_DOSIX_MAPFILE 0x01
+#define INT2F_AL_DOSIX_MAPSEEK 0x02
+#define INT2F_AL_DOSIX_UNMAPFILE 0x03
+#define INT2F_AL_DOSIX_AIOREAD 0x04
+#define INT2F_AL_DOSIX_AIOWRITE 0x05
+#define INT2F_AL_DOSIX_AIOPOLL 0x06
+#define INT2F_AL_DOSIX_AIOWAIT 0x07
+
+/* DOSix extensions version reported by the installation check */
+#define DOSIX_EXT_VERSION 0x0100
+
+/* Long file name searches open at once */
+#define LFN_FIND_MAX 32
+
+/* Tree walks: worker threads at most, directories kept open while
+   queued, entries handed to the caller at a time, and directories read
+   ahead of the caller at most */
+#define WALK_THREADS_MAX 64
+#define WALK_FDS 256
+#define WALK_DELIVER 256
+#define WALK_AHEAD 1024
+
+/* Interrupts going through a hooked vector are counted on a cache line
+   of its own, so that busy vectors don't slow each other down */
+#define VECT_LINE 64
 
 
 /* type definitions */
@@ -106,9 +179,211 @@ union dta_t {
   struct _find_t find_t;	/* Used by findfirst and findnext */
 };
 
+/* State DOS keeps for the program it runs.  Every thread is a task of
+   its own here, so that none sees the DTA or the error of another. */
+struct dos_task
+{
+  struct _DOSERROR errorinfo;	/* last extended error */
+  struct media_id media_id;	/* disk wanted, for an invalid change */
+  union dta_t dta;		/* default DTA */
+  union dta_t *current_dta;	/* NULL while dta is the one */
+  struct lfn_find *lfn_finds[LFN_FIND_MAX]; /* long name searches */
+  bool traced;			/* in a call being traced */
+  unsigned errors;		/* errors set so far */
+};
+
+struct lfn_find
+{
+  struct _find_t find;
+  unsigned required;		/* attributes entries must have */
+};
+
+/* Record filled by the long file name find services */
+struct lfn_finddata
+{
+  uint32_t attrib;
+  uint64_t cr_time;		/* FILETIME, or DOS time and date */
+  uint64_t ac_time;
+  uint64_t wr_time;
+  uint32_t size_high;
+  uint32_t size_low;
+  char reserved[8];
+  char name[260];
+  char alias[14];		/* empty if name is a valid 8.3 name */
+} __attribute__ ((packed));
+
+/* What a register points to in a recorded call */
+enum record_buf
+  {
+   REC_NONE,
+   REC_PATH,			/* ASCIZ string */
+   REC_IN_CX,			/* CX bytes read by the service */
+   REC_OUT_CX,			/* CX bytes written by the service */
+   REC_OUT_PATH,		/* _MAX_PATH bytes written */
+   REC_OUT_FIND,		/* long name find record written */
+   REC_DTA			/* disk transfer area */
+  };
+
+/* Values services hand out, which a replay gets others in place of */
+enum record_map
+  {
+   REC_MAP_NONE,
+   REC_MAP_HANDLE,
+   REC_MAP_SEG,
+   REC_MAP_FIND,
+   REC_MAP_DTA,
+   REC_MAPS
+  };
+
+/* The value is no longer handed out once the call succeeds */
+#define REC_RELEASE 0x80
+
+/* How a service is recorded.  Those not in the tables are recorded for
+   their registers alone, and skipped on replay */
+struct record_args
+{
+  bool replay;
+  uint8_t dx, si, di;		/* enum record_buf */
+  uint8_t in;			/* map of BX, or of ES for segments */
+  uint8_t out;			/* map of AX */
+};
+
+/* Recorded call being put together */
+struct record_out
+{
+  uint8_t *data;
+  size_t len, size;
+  bool failed;
+};
+
+/* Entry found by a tree walk, kept compact until it is delivered */
+struct walk_ent
+{
+  char name[13];		/* DOS name */
+  unsigned attrib;
+  off_t size;
+  time_t mtime;			/* host entries */
+  unsigned wr_date, wr_time;	/* image entries */
+};
+
+/* Directory of a tree walk: queued, read by a worker or by the caller
+   if it gets there first, then delivered by the caller in the order a
+   sequential walk would have */
+struct walk_node
+{
+  int fd;			/* open host directory, or -1 */
+  char *host;			/* host path from the root, or image path */
+  char *path;			/* DOS prefix of its entries */
+  unsigned depth;
+  unsigned refs;		/* its parent's or the caller's, a deque's */
+  bool claimed;			/* taken to be read */
+  bool done;			/* read, guarded by walk->lock */
+  struct walk_ent *ents;
+  size_t count, size;
+  struct walk_node **children;	/* in directory order */
+  size_t nchildren, csize;
+};
+
+/* Directories queued by one worker: it takes back the newest, others
+   steal the oldest */
+struct walk_deque
+{
+  struct walk *walk;
+  unsigned index;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct walk_node **nodes;
+  size_t head, tail, size;
+};
+
+struct walk
+{
+  int rootfd;			/* host drives */
+  struct fatvol *fat;		/* image drives */
+  char pattern[NAME_MAX + 1];
+  unsigned attrib;
+  unsigned threads;
+  struct walk_deque *deques;
+  pthread_mutex_t lock;
+  pthread_cond_t work;		/* for idle workers */
+  pthread_cond_t ready;		/* for the caller */
+  pthread_cond_t room;		/* for workers too far ahead */
+  size_t queued;		/* nodes in deques */
+  size_t pending;		/* nodes not read yet */
+  size_t held;			/* nodes read and not delivered */
+  unsigned idle;		/* workers waiting for work */
+  unsigned fds;			/* descriptors of queued nodes */
+  bool stop;
+  bool nomem;			/* something was left out for want of memory */
+};
+
+/* Directory open in a recursive search */
+struct findtree_level
+{
+  DIR *dir;			/* host directory */
+  struct alias_map *aliases;	/* its alias map, once needed */
+  void *fatdir;			/* image directory */
+  size_t pathlen;		/* DOS prefix before its name was added */
+  size_t hostlen;		/* image path before its name was added */
+  bool post;			/* its own entry is due when it is left */
+  struct _find_t self;
+};
+
+struct findtree
+{
+  struct fatvol *fat;		/* image drives */
+  char pattern[NAME_MAX + 1];
+  unsigned attrib, flags, maxdepth;
+  int (*skip) (const struct _findtree_t *, void *);
+  void *arg;
+  struct findtree_level *levels;
+  size_t depth, size;		/* levels open */
+  char *path, *host;		/* DOS prefix, image path */
+  size_t pathsize, hostsize;
+  bool descend;			/* the entry last found is entered next */
+  bool post;			/* and given when it is left */
+  char name[NAME_MAX + 1];	/* its host name */
+  struct _find_t self;
+};
+
+/* Handlers hooked to a vector, the last hooked first.  A chain is
+   never changed once published: hooking builds a new one */
+struct vect_hook
+{
+  int (*handler) (cpu_t *, void *);
+  void *arg;
+};
+
+struct vect_chain
+{
+  struct vect_chain *retired;	/* next chain waiting to be freed */
+  size_t count;
+  struct vect_hook hooks[];
+};
+
+struct vect_readers
+{
+  unsigned count;		/* interrupts going through */
+} __attribute__ ((aligned (VECT_LINE)));
+
 
 /* forward declarations */
 
+static
+void
+int08_timer
+(cpu_t *);
+
+static
+void
+int1a_time_of_day
+(cpu_t *);
+
+static
+void
+int1c_timer_tick
+(cpu_t *);
+
 static
 void
 int21_main_dos_api
@@ -119,26 +394,39 @@ void
 int2f_multiplex
 (cpu_t *);
 
+static
+void
+trace_syscall
+(uint8_t intnum,
+ cpu_t *cpu,
+ syscall_t syscall);
+
 
 /* global public variables */
 
 /* Holds extended error code for libc usage.  Set by
-   exterr_set */
-int __near _doserrno;
+   exterr_set, for the calling thread */
+__thread int __near _dosix__doserrno;
 
 
 /* global private variables */
 
 static void *allocmem_tree;
-static struct _DOSERROR errorinfo;
-static struct media_id media_id;
-static union dta_t dta;
-static union dta_t *current_dta = &dta;
-static syscall_t int_vect[UINT8_MAX] =
+static pthread_mutex_t allocmem_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct dos_task task;
+static __thread struct record_out record_out;
+static syscall_t int_vect[UINT8_MAX + 1] =
   {
+   [INT08_TIMER] = int08_timer,
+   [INT1A_TIME_OF_DAY] = int1a_time_of_day,
+   [INT1C_TIMER_TICK] = int1c_timer_tick,
    [INT21_MAIN_DOS_API] = int21_main_dos_api,
    [INT2F_MULTIPLEX] = int2f_multiplex
   };
+static struct vect_chain *vect_chains[UINT8_MAX + 1];
+static struct vect_chain *vect_retired[UINT8_MAX + 1];
+static struct vect_readers vect_readers[UINT8_MAX + 1];
+static pthread_mutex_t vect_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 /* error codes */
@@ -534,620 +822,629 @@ _dosix__dosexterr
     case 0:			/* report errorinfo as is */
       break;
     case EPERM:
-      errorinfo.exterror = EXTERR_ACCESS_DENIED;
-      errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_ACCESS_DENIED;
+      task.errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENOENT:
-      errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case ESRCH:
-      errorinfo.exterror = EXTERR_PROC_ADDR_NOT_FOUND;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_PROC_ADDR_NOT_FOUND;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EINTR:
-      errorinfo.exterror = EXTERR_INVAL_SYS_CALL;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_RETRY;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_INVAL_SYS_CALL;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_RETRY;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EIO:
-      errorinfo.exterror = EXTERR_READ_FAULT;
-      errorinfo.errclass = ERRCLASS_HW_FAIL;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_READ_FAULT;
+      task.errorinfo.errclass = ERRCLASS_HW_FAIL;
+      task.errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENXIO:
-      errorinfo.exterror = EXTERR_LVL4_DRV_NOT_FOUND_DOS_IOCTL;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_LVL4_DRV_NOT_FOUND_DOS_IOCTL;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case E2BIG:
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENOEXEC:
-      errorinfo.exterror = EXTERR_BAD_EXE_FORMAT;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_BAD_EXE_FORMAT;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EBADF:
-      errorinfo.exterror = EXTERR_INVAL_HANDLE;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_INVAL_HANDLE;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ECHILD:
-      errorinfo.exterror = EXTERR_CWAIT_FOUND_NO_CHILDREN;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_CWAIT_FOUND_NO_CHILDREN;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EDEADLK:
-      errorinfo.exterror = EXTERR_LOCK_VIOLATION;
-      errorinfo.errclass = ERRCLASS_LOCKED;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_LOCK_VIOLATION;
+      task.errorinfo.errclass = ERRCLASS_LOCKED;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENOMEM:
-      errorinfo.exterror = EXTERR_INSUF_MEM;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_MEM_RELATED;
+      task.errorinfo.exterror = EXTERR_INSUF_MEM;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_MEM_RELATED;
       break;
     case EACCES:
-      errorinfo.exterror = EXTERR_ACCESS_DENIED;
-      errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_ACCESS_DENIED;
+      task.errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EFAULT:
-      errorinfo.exterror = EXTERR_MBA_INVAL;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_MEM_RELATED;
+      task.errorinfo.exterror = EXTERR_MBA_INVAL;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_MEM_RELATED;
       break;
     case ENOTBLK:
-      errorinfo.exterror = EXTERR_INVAL_DRV_0x0f;
-      errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_INVAL_DRV_0x0f;
+      task.errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EBUSY:
-      errorinfo.exterror = EXTERR_DRV_BUSY;
-      errorinfo.errclass = ERRCLASS_LOCKED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_DRV_BUSY;
+      task.errorinfo.errclass = ERRCLASS_LOCKED;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EEXIST:
-      errorinfo.exterror = EXTERR_FILE_EXISTS;
-      errorinfo.errclass = ERRCLASS_ALREADY_EXISTS;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_FILE_EXISTS;
+      task.errorinfo.errclass = ERRCLASS_ALREADY_EXISTS;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EXDEV:
-      errorinfo.exterror = EXTERR_NOT_SAME_DEVICE;
-      errorinfo.errclass = ERRCLASS_CANNOT;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_NOT_SAME_DEVICE;
+      task.errorinfo.errclass = ERRCLASS_CANNOT;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case ENODEV:
-      errorinfo.exterror = EXTERR_UNKNOWN_MEDIA_TYPE;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_UNKNOWN_MEDIA_TYPE;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENOTDIR:
-      errorinfo.exterror = EXTERR_PATH_NOT_FOUND;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_PATH_NOT_FOUND;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EISDIR:
-      errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EINVAL:
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EMFILE:
-      errorinfo.exterror = EXTERR_TOO_MANY_OPEN_FILES;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_TOO_MANY_OPEN_FILES;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENFILE:
-      errorinfo.exterror = EXTERR_TOO_MANY_OPEN_FILES;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_TOO_MANY_OPEN_FILES;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENOTTY:
-      errorinfo.exterror = EXTERR_UNKNOWN_CATEGORY_IOCTL;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_CHAR_DEV;
+      task.errorinfo.exterror = EXTERR_UNKNOWN_CATEGORY_IOCTL;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_CHAR_DEV;
       break;
     case ETXTBSY:
-      errorinfo.exterror = EXTERR_CANT_COMPLETE_FILE_OP;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_CANT_COMPLETE_FILE_OP;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EFBIG:
-      errorinfo.exterror = EXTERR_INSUF_DSK_SPACE;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_INSUF_DSK_SPACE;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case ENOSPC:
-      errorinfo.exterror = EXTERR_DSK_FULL;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_DSK_FULL;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case ESPIPE:
-      errorinfo.exterror = EXTERR_ATTEMPT_SEEK_DEV_PIPE;
-      errorinfo.errclass = ERRCLASS_CANNOT;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_ATTEMPT_SEEK_DEV_PIPE;
+      task.errorinfo.errclass = ERRCLASS_CANNOT;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EROFS:
-      errorinfo.exterror = EXTERR_DSK_WRITE_PROTECTED;
-      errorinfo.errclass = ERRCLASS_CANNOT;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_DSK_WRITE_PROTECTED;
+      task.errorinfo.errclass = ERRCLASS_CANNOT;
+      task.errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EMLINK:
     case ETOOMANYREFS:
     case ELOOP:
-      errorinfo.exterror = EXTERR_TOO_MANY_REDIRS;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_TOO_MANY_REDIRS;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EPIPE:
-      errorinfo.exterror = EXTERR_BROKEN_PIPE;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_BROKEN_PIPE;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EDOM:
-      errorinfo.exterror = EXTERR_DATA_INVAL;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_DATA_INVAL;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ERANGE:
-      errorinfo.exterror = EXTERR_FIXUP_OVERFLOW;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_FIXUP_OVERFLOW;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #if EWOULDBLOCK != EAGAIN
     case EWOULDBLOCK:
-      errorinfo.exterror = EXTERR_FCB_UNAVAILABLE;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_FCB_UNAVAILABLE;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EAGAIN:
-      errorinfo.exterror = EXTERR_FCB_UNAVAILABLE;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_FCB_UNAVAILABLE;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #else
     case EAGAIN:
-      errorinfo.exterror = EXTERR_FCB_UNAVAILABLE;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_FCB_UNAVAILABLE;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
     case EINPROGRESS:
-      errorinfo.exterror = EXTERR_NET_BUSY;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_BUSY;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case EALREADY:
-      errorinfo.exterror = EXTERR_NET_BUSY;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_BUSY;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENOTSOCK:
-      errorinfo.exterror = EXTERR_NET_DEV_TYPE_INCORRECT;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_DEV_TYPE_INCORRECT;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case EMSGSIZE:
-      errorinfo.exterror = EXTERR_NET_WRITE_FAULT;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_WRITE_FAULT;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case EPROTOTYPE:
     case ENOPROTOOPT:
-      errorinfo.exterror = EXTERR_NET_REQ_NOT_SUPPORTED;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_REQ_NOT_SUPPORTED;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
 #if ENOTSUP != EOPNOTSUPP
     case ENOTSUP:
-      errorinfo.exterror = EXTERR_INVAL_PARM;
-      errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_INVAL_PARM;
+      task.errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EOPNOTSUPP:
-      errorinfo.exterror = EXTERR_FN_NOT_SUPPORTED_NET;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_FN_NOT_SUPPORTED_NET;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
 #else
     case ENOTSUP:
-      errorinfo.exterror = EXTERR_INVAL_PARM;
-      errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_INVAL_PARM;
+      task.errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
     case EPROTONOSUPPORT:
     case ESOCKTNOSUPPORT:
     case EPFNOSUPPORT:
     case EAFNOSUPPORT:
-      errorinfo.exterror = EXTERR_FN_NOT_SUPPORTED_NET;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_FN_NOT_SUPPORTED_NET;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case EADDRINUSE:
-      errorinfo.exterror = EXTERR_DUP_NAME_ON_NET;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_DUP_NAME_ON_NET;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case EADDRNOTAVAIL:
-      errorinfo.exterror = EXTERR_NET_NAME_NOT_FOUND_0x35;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_NAME_NOT_FOUND_0x35;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENETDOWN:
     case ENETUNREACH:
-      errorinfo.exterror = EXTERR_NET_DEV_NO_LONGER_EXISTS;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_DEV_NO_LONGER_EXISTS;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENETRESET:
-      errorinfo.exterror = EXTERR_REMOTE_COMPUTER_NOT_LISTENING;
-      errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_REMOTE_COMPUTER_NOT_LISTENING;
+      task.errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ECONNABORTED:
-      errorinfo.exterror = EXTERR_NET_NAME_DEL;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_NAME_DEL;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ECONNRESET:
-      errorinfo.exterror = EXTERR_UNEXPECT_ADAPT_CLOSE;
-      errorinfo.errclass = ERRCLASS_UNKNOWN;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_UNEXPECT_ADAPT_CLOSE;
+      task.errorinfo.errclass = ERRCLASS_UNKNOWN;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENOBUFS:
-      errorinfo.exterror = EXTERR_INSUF_MEM;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_MEM_RELATED;
+      task.errorinfo.exterror = EXTERR_INSUF_MEM;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_MEM_RELATED;
       break;
     case EISCONN:
-      errorinfo.exterror = EXTERR_DUP_REDIR;
-      errorinfo.errclass = ERRCLASS_ALREADY_EXISTS;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_DUP_REDIR;
+      task.errorinfo.errclass = ERRCLASS_ALREADY_EXISTS;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENOTCONN:
     case EDESTADDRREQ:
     case EHOSTDOWN:
     case EHOSTUNREACH:
-      errorinfo.exterror = EXTERR_REMOTE_COMPUTER_NOT_LISTENING;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_REMOTE_COMPUTER_NOT_LISTENING;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ESHUTDOWN:
-      errorinfo.exterror = EXTERR_NET_DEV_NO_LONGER_EXISTS;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRCLASS_CANNOT;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_DEV_NO_LONGER_EXISTS;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRCLASS_CANNOT;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ETIMEDOUT:
-      errorinfo.exterror = EXTERR_UNEXPECT_ADAPT_CLOSE;
-      errorinfo.errclass = ERRCLASS_TIME;
-      errorinfo.action = ERRACT_RETRY;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_UNEXPECT_ADAPT_CLOSE;
+      task.errorinfo.errclass = ERRCLASS_TIME;
+      task.errorinfo.action = ERRACT_RETRY;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ECONNREFUSED:
-      errorinfo.exterror = EXTERR_NET_REQ_NOT_ACCEPT;
-      errorinfo.errclass = ERRCLASS_UNKNOWN;
-      errorinfo.action = ERRACT_DELAYED_RETRY;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_REQ_NOT_ACCEPT;
+      task.errorinfo.errclass = ERRCLASS_UNKNOWN;
+      task.errorinfo.action = ERRACT_DELAYED_RETRY;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENAMETOOLONG:
-      errorinfo.exterror = EXTERR_NET_NAME_LIMIT_EXCEEDED;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_NET_NAME_LIMIT_EXCEEDED;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ENOTEMPTY:
-      errorinfo.exterror = EXTERR_JOIN_DIR_NOT_EMPTY;
-      errorinfo.errclass = ERRCLASS_CANNOT;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_JOIN_DIR_NOT_EMPTY;
+      task.errorinfo.errclass = ERRCLASS_CANNOT;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
 #ifdef EPROCLIM
     case EPROCLIM:
-      errorinfo.exterror = EXTERR_NO_MORE_PROC_SLOTS;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_NO_MORE_PROC_SLOTS;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
     case EUSERS:
-      errorinfo.exterror = EXTERR_TOO_MANY_OPEN_FILES;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_TOO_MANY_OPEN_FILES;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EDQUOT:
-      errorinfo.exterror = EXTERR_DSK_LIMIT_EXCEEDED_NET_NODE;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_DSK_LIMIT_EXCEEDED_NET_NODE;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case ESTALE:
-      errorinfo.exterror = EXTERR_INVAL_HANDLE;
-      errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_INVAL_HANDLE;
+      task.errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
     case EREMOTE:
-      errorinfo.exterror = EXTERR_DRV_LOCK_OTHER_PROC;
-      errorinfo.errclass = ERRCLASS_LOCKED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_DRV_LOCK_OTHER_PROC;
+      task.errorinfo.errclass = ERRCLASS_LOCKED;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
 #ifdef EBADRPC
     case EBADRPC:
-      errorinfo.exterror = EXTERR_BAD_REQ_STRUCT_LEN;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_BAD_REQ_STRUCT_LEN;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
 #ifdef ERPCMISMATCH
     case ERPCMISMATCH:
-      errorinfo.exterror = EXTERR_NET_INVAL_NET_VER;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_NET_INVAL_NET_VER;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
 #ifdef EPROGUNAVAIL
     case EPROGUNAVAIL:
-      errorinfo.exterror = EXTERR_NET_INVAL_NET_VER;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_NET_INVAL_NET_VER;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
 #ifdef EPROGMISMATCH
     case EPROGMISMATCH:
-      errorinfo.exterror = EXTERR_NET_INVAL_NET_VER;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_NET_INVAL_NET_VER;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
 #ifdef EPROCUNAVAIL
     case EPROCUNAVAIL:
-      errorinfo.exterror = EXTERR_FN_NUM_INVAL;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_FN_NUM_INVAL;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
     case ENOLCK:
-      errorinfo.exterror = EXTERR_LOCK_COUNT_EXCEEDED;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_LOCK_COUNT_EXCEEDED;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #ifdef EFTYPE
     case EFTYPE:
-      errorinfo.exterror = EXTERR_FMT_INVAL;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      task.errorinfo.exterror = EXTERR_FMT_INVAL;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
       break;
 #endif
 #ifdef EAUTH
     case EAUTH:
-      errorinfo.exterror = EXTERR_LOGIN_ATTEMPT_INVAL;
-      errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_LOGIN_ATTEMPT_INVAL;
+      task.errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
 #ifdef ENEEDAUTH
     case ENEEDAUTH:
-      errorinfo.exterror = EXTERR_LOGIN_ATTEMPT_INVAL;
-      errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_LOGIN_ATTEMPT_INVAL;
+      task.errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
     case ENOSYS:
-      errorinfo.exterror = EXTERR_INVAL_FN_NUM;
-      errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_INVAL_FN_NUM;
+      task.errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EILSEQ:
-      errorinfo.exterror = EXTERR_INVAL_CHAR;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_CHAR_DEV;
+      task.errorinfo.exterror = EXTERR_INVAL_CHAR;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_CHAR_DEV;
       break;
 #ifdef EBACKGROUND
     case EBACKGROUND:
-      errorinfo.exterror = EXTERR_OPER_INVAL_INT_HANDLER;
-      errorinfo.errclass = ERRCLASS_SYS_FAIL;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_CHAR_DEV;
+      task.errorinfo.exterror = EXTERR_OPER_INVAL_INT_HANDLER;
+      task.errorinfo.errclass = ERRCLASS_SYS_FAIL;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_CHAR_DEV;
       break;
 #endif
 #ifdef EDIED
     case EDIED:
-      errorinfo.exterror = EXTERR_SEMAPHORE_OWNER_DIED;
-      errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_SEMAPHORE_OWNER_DIED;
+      task.errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
 #endif
 #ifdef ED
     case ED:
-      errorinfo.exterror = EXTERR_NO_ERROR;
-      errorinfo.errclass = ERRCLASS_NONE;
-      errorinfo.action = ERRACT_NONE;
-      errorinfo.locus = ERRLOCUS_NONE;
+      task.errorinfo.exterror = EXTERR_NO_ERROR;
+      task.errorinfo.errclass = ERRCLASS_NONE;
+      task.errorinfo.action = ERRACT_NONE;
+      task.errorinfo.locus = ERRLOCUS_NONE;
       break;
 #endif
 #ifdef EGREGIOUS
     case EGREGIOUS:
-      errorinfo.exterror = EXTERR_NO_ERROR;
-      errorinfo.errclass = ERRCLASS_NONE;
-      errorinfo.action = ERRACT_NONE;
-      errorinfo.locus = ERRLOCUS_NONE;
+      task.errorinfo.exterror = EXTERR_NO_ERROR;
+      task.errorinfo.errclass = ERRCLASS_NONE;
+      task.errorinfo.action = ERRACT_NONE;
+      task.errorinfo.locus = ERRLOCUS_NONE;
       break;
 #endif
 #ifdef EIEIO
     case EIEIO:
-      errorinfo.exterror = EXTERR_NO_ERROR;
-      errorinfo.errclass = ERRCLASS_NONE;
-      errorinfo.action = ERRACT_NONE;
-      errorinfo.locus = ERRLOCUS_NONE;
+      task.errorinfo.exterror = EXTERR_NO_ERROR;
+      task.errorinfo.errclass = ERRCLASS_NONE;
+      task.errorinfo.action = ERRACT_NONE;
+      task.errorinfo.locus = ERRLOCUS_NONE;
       break;
 #endif
 #ifdef EGRATUITOUS
     case EGRATUITOUS:
-      errorinfo.exterror = EXTERR_NO_ERROR;
-      errorinfo.errclass = ERRCLASS_NONE;
-      errorinfo.action = ERRACT_NONE;
-      errorinfo.locus = ERRLOCUS_NONE;
+      task.errorinfo.exterror = EXTERR_NO_ERROR;
+      task.errorinfo.errclass = ERRCLASS_NONE;
+      task.errorinfo.action = ERRACT_NONE;
+      task.errorinfo.locus = ERRLOCUS_NONE;
       break;
 #endif
     case EBADMSG:
     case ENOMSG:
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EIDRM:
-      errorinfo.exterror = EXTERR_NET_NAME_DEL;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_NET_NAME_DEL;
+      task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EMULTIHOP:
-      errorinfo.exterror = EXTERR_NET_DEV_TYPE_INCORRECT;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_DEV_TYPE_INCORRECT;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENODATA:
-      errorinfo.exterror = EXTERR_NO_DATA_AVAIL_NONBLOCK_READ;
-      errorinfo.errclass = ERRCLASS_TMP_SITUATION;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NO_DATA_AVAIL_NONBLOCK_READ;
+      task.errorinfo.errclass = ERRCLASS_TMP_SITUATION;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENOLINK:
-      errorinfo.exterror = EXTERR_NET_DEV_NO_LONGER_EXISTS;
-      errorinfo.errclass = ERRCLASS_HW_FAIL;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_DEV_NO_LONGER_EXISTS;
+      task.errorinfo.errclass = ERRCLASS_HW_FAIL;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENOSR:
-      errorinfo.exterror = EXTERR_INSUF_MEM;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_INSUF_MEM;
+      task.errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+      task.errorinfo.action = ERRACT_IMMEDIATE_ABORT;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ENOSTR:
-      errorinfo.exterror = EXTERR_NET_DEV_TYPE_INCORRECT;
-      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_NET_DEV_TYPE_INCORRECT;
+      task.errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case EOVERFLOW:
-      errorinfo.exterror = EXTERR_SHARING_BUFFER_OVERFLOW;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_SHARING_BUFFER_OVERFLOW;
+      task.errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case EPROTO:
-      errorinfo.exterror = EXTERR_UNEXPECTED_NET_ERROR;
-      errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_NET_RELATED;
+      task.errorinfo.exterror = EXTERR_UNEXPECTED_NET_ERROR;
+      task.errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_NET_RELATED;
       break;
     case ETIME:
-      errorinfo.exterror = EXTERR_TEMPORARILY_PAUSED;
-      errorinfo.errclass = ERRCLASS_TIME;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_TEMPORARILY_PAUSED;
+      task.errorinfo.errclass = ERRCLASS_TIME;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     case ECANCELED:
-      errorinfo.exterror = EXTERR_MORE_DATA_AVAIL;
-      errorinfo.errclass = ERRCLASS_UNKNOWN;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_MORE_DATA_AVAIL;
+      task.errorinfo.errclass = ERRCLASS_UNKNOWN;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
+#ifdef EUCLEAN
+    case EUCLEAN:		/* corrupt disk image */
+      task.errorinfo.exterror = EXTERR_DATA_INVAL;
+      task.errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
+      task.errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      break;
+#endif
     default:			/* should never get here */
       assert (false);
-      errorinfo.exterror = EXTERR_ACCESS_CODE_INVAL;
-      errorinfo.errclass = ERRCLASS_UNKNOWN;
-      errorinfo.action = ERRACT_IGNORE;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      task.errorinfo.exterror = EXTERR_ACCESS_CODE_INVAL;
+      task.errorinfo.errclass = ERRCLASS_UNKNOWN;
+      task.errorinfo.action = ERRACT_IGNORE;
+      task.errorinfo.locus = ERRLOCUS_UNKNOWN;
       break;
     }
-  if (_errorinfo) *_errorinfo = errorinfo;
-  return errorinfo.exterror;
+  if (errno) task.errors++;
+  if (_errorinfo) *_errorinfo = task.errorinfo;
+  return task.errorinfo.exterror;
 }
 
 static
@@ -1167,8 +1464,8 @@ cpu_exterr
   cpu->h.ch = errorinfo.locus;
   if (errorinfo.exterror == EXTERR_DSK_CHANGE_INVAL)
     {
-      cpu->r.es = _FP_SEG (&media_id);
-      cpu->r.di = _FP_OFF (&media_id);
+      cpu->r.es = _FP_SEG (&task.media_id);
+      cpu->r.di = _FP_OFF (&task.media_id);
     }
 }
 
@@ -1178,19 +1475,20 @@ exterr_set
 (struct _DOSERROR *new_errorinfo, int _errno)
 {
   if (new_errorinfo->exterror != EXTERR_DONT_CHANGE)
-    errorinfo.exterror = new_errorinfo->exterror;
+    task.errorinfo.exterror = new_errorinfo->exterror;
   if (new_errorinfo->errclass != ERRCLASS_DONT_CHANGE)
-    errorinfo.errclass = new_errorinfo->errclass;
+    task.errorinfo.errclass = new_errorinfo->errclass;
   if (new_errorinfo->action != ERRACT_DONT_CHANGE)
-    errorinfo.action = new_errorinfo->action;
+    task.errorinfo.action = new_errorinfo->action;
   if (new_errorinfo->locus != ERRLOCUS_DONT_CHANGE)
-    errorinfo.locus = new_errorinfo->locus;
+    task.errorinfo.locus = new_errorinfo->locus;
+  task.errors++;
   /* update _doserrno on behalf of libc */
-  _doserrno = errorinfo.exterror;
+  _dosix__doserrno = task.errorinfo.exterror;
   /* note: use zero _errno to prevent _dosexterr from interpreting a
      previous libc error, so it reports the current exterr */
   errno = _errno;
-  return errorinfo.exterror;
+  return task.errorinfo.exterror;
 }
 
 static
@@ -1212,7 +1510,7 @@ union dta_t *
 get_dta_addr
 (void)
 {
-  return current_dta;
+  return task.current_dta ? task.current_dta : &task.dta;
 }
 
 static
@@ -1232,7 +1530,7 @@ void
 set_dta_addr
 (union dta_t *target_dta)
 {
-  current_dta = target_dta;
+  task.current_dta = target_dta;
 }
 
 static
@@ -1312,9 +1610,11 @@ _dosix__dos_allocmem
     }
   else
     {
+      pthread_mutex_lock (&allocmem_lock);
       struct allocmem **_allocmem_ptr = tsearch (allocmem_ptr,
 						 &allocmem_tree,
 						 &allocmem_cmp);
+      pthread_mutex_unlock (&allocmem_lock);
       if (! _allocmem_ptr)
 	{
 	  free (allocmem_ptr);
@@ -1360,11 +1660,13 @@ _dosix__dos_setblock
      .address = (void *) seg,
      .length = 16 * size
     };
+  pthread_mutex_lock (&allocmem_lock);
   struct allocmem **allocmem_ptr = tfind (&allocmem,
 					  &allocmem_tree,
 					  &allocmem_cmp);
   if (! allocmem_ptr)
     {
+      pthread_mutex_unlock (&allocmem_lock);
       errno = EFAULT;
       return _dosix__dosexterr (&errorinfo);
     }
@@ -1374,9 +1676,13 @@ _dosix__dos_setblock
 			     allocmem.length,
 			     0);
   if (allocmem.address == (void *) -1)
-    return allocmem_error (maxsize);
+    {
+      pthread_mutex_unlock (&allocmem_lock);
+      return allocmem_error (maxsize);
+    }
   assert (allocmem.address == (void *) seg);
   **allocmem_ptr = allocmem;
+  pthread_mutex_unlock (&allocmem_lock);
   return 0;
 }
 
@@ -1409,11 +1715,13 @@ _dosix__dos_freemem
      .address = (void *) seg,
      .length = 0
     };
+  pthread_mutex_lock (&allocmem_lock);
   struct allocmem **allocmem_ptr = tfind (&allocmem,
 					  &allocmem_tree,
 					  &allocmem_cmp);
   if (! allocmem_ptr)
     {
+      pthread_mutex_unlock (&allocmem_lock);
       errno = EFAULT;
       return _dosix__dosexterr (&errorinfo);
     }
@@ -1421,17 +1729,20 @@ _dosix__dos_freemem
   if (munmap (allocmem.address,
 	      (*allocmem_ptr)->length))
     {
+      pthread_mutex_unlock (&allocmem_lock);
       errorinfo.exterror = EXTERR_MCB_DESTROYED;
       errorinfo.errclass = ERRCLASS_INTERN_SYS_ERROR;
       errorinfo.action = ERRACT_IMMEDIATE_ABORT;
       errorinfo.locus = ERRLOCUS_MEM_RELATED;
       return exterr_set (&errorinfo, EINVAL);
     }
+  struct allocmem *freed = *allocmem_ptr;
   void *pnode = tdelete (&allocmem,
 			 &allocmem_tree,
 			 &allocmem_cmp);
+  pthread_mutex_unlock (&allocmem_lock);
   assert (pnode);
-  free (*allocmem_ptr);
+  free (freed);
   return 0;
 }
 
@@ -1463,11 +1774,23 @@ dos_creat
     & ((attrib & _A_RDONLY)
        ? ~S_IWUSR
        : ~0);
-  int fd = open (filename,
-		 flags,
-		 mode);
+  struct dospath dp;
+  if (_dosix__path_resolve (filename, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  int fd = -1;
+  if (dp.fat)
+    errno = EROFS;		/* disk images are read-only */
+  else fd = openat (dp.dirfd,
+		    dp.name,
+		    flags,
+		    mode);
+  struct stat fs;
+  if (fd >= 0 && attrib & (_A_HIDDEN | _A_SYSTEM) && ! fstat (fd, &fs))
+    _dosix__attr_set (dp.dirfd, dp.name, &fs, attrib | _A_ARCH);
+  _dosix__path_release (&dp);
   if (fd < 0)
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  if (flags & O_TRUNC) _dosix__drive_space_invalidate ();
   *handle = fd;
   return 0;
 }
@@ -1529,18 +1852,39 @@ cpu_creatnew
 
 /* _dos_open */
 
+/* Open path in mode, truncating it once the sharing mode is granted
+   if truncate is set */
+static
 unsigned
-_dosix__dos_open
+dos_open
 (const char *path,
  unsigned mode,
- int *handle)
+ int *handle,
+ bool truncate)
 {
   assert (path), assert (handle);
   struct _DOSERROR errorinfo = {0};
   int flags = (mode & _O_RDONLY ? O_RDONLY : 0)
     | (mode & _O_WRONLY ? O_WRONLY  : 0)
     | (mode & _O_RDWR ? O_RDWR : 0);
-  int fd = open (path, flags);
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  int fd = -1;
+  if (dp.fat)
+    {
+      /* disk images are read-only and shared by nobody else */
+      if ((flags & O_ACCMODE) != O_RDONLY || truncate)
+	errno = EROFS;
+      else if (! _dosix__fat_open (dp.fat, dp.dir, dp.name, &fd))
+	{
+	  _dosix__path_release (&dp);
+	  *handle = fd;
+	  return 0;
+	}
+    }
+  else fd = openat (dp.dirfd, dp.name, flags);
+  _dosix__path_release (&dp);
   if (fd < 0)
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
   if (! (mode & _SH_DENYNO))
@@ -1567,10 +1911,30 @@ _dosix__dos_open
       if (fcntl (fd, F_SETFD, flags) == -1)
 	return _dosix__dosexterr (&errorinfo);	/* TODO? better error handling */
     }
+  if (truncate)
+    {
+      /* a handle just opened has nothing in the write-behind cache */
+      if (ftruncate (fd, 0))
+	{
+	  unsigned err = _dosix__dosexterr (&errorinfo);
+	  close (fd);
+	  return err;
+	}
+      _dosix__drive_space_invalidate ();
+    }
   *handle = fd;
   return 0;
 }
 
+unsigned
+_dosix__dos_open
+(const char *path,
+ unsigned mode,
+ int *handle)
+{
+  return dos_open (path, mode, handle, false);
+}
+
 static
 void
 cpu_open
@@ -1599,9 +1963,14 @@ _dosix__dos_close
 (int handle)
 {
   struct _DOSERROR errorinfo = {0};
+  if (_dosix__fat_handle (handle))
+    return _dosix__fat_close (handle)
+      ? _dosix__dosexterr (&errorinfo) : 0;
+  /* a failed write-back is still reported, but the handle goes */
+  unsigned err = _dosix__wbcache_close (handle);
   if (close (handle))
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
-  return 0;
+  return err;
 }
 
 static
@@ -1616,1072 +1985,4540 @@ cpu_close
 }
 
 
-/* _dos_getfileattr */
+/* _dos_read */
 
 unsigned
-_dosix__dos_getfileattr
-(const char *path,
- unsigned *attrib)
+_dosix__dos_read
+(int handle,
+ void *buffer,
+ unsigned count,
+ unsigned *numread)
 {
+  assert (buffer);
+  assert (numread);
   struct _DOSERROR errorinfo = {0};
-  struct stat fs;
-  if (stat (path, &fs))
-    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
-  unsigned _attrib = 0;
-  if (S_ISDIR (fs.st_mode))
-    _attrib = _A_SUBDIR;
+  ssize_t ret;
+  if (_dosix__fat_handle (handle))
+    ret = _dosix__fat_read (handle, buffer, count);
   else
     {
-      _attrib = _A_NORMAL | _A_ARCH;
-      if (access (path, W_OK))
-	switch (errno)
-	  {
-	  case EROFS:
-	  case EACCES:
-	    _attrib |= _A_RDONLY;
-	    break;
-	  case ENOENT:
-	  default:
-	    return _dosix__dosexterr (&errorinfo);
-	  }
-    }
-  *attrib = _attrib;
-  return 0;
+      /* reads must see what the write-behind cache holds */
+      unsigned err = _dosix__wbcache_flush (handle);
+      if (err) return err;
+      do ret = read (handle, buffer, count);
+      while (ret < 0 && errno == EINTR);
+    }
+  if (ret < 0)
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  *numread = ret;
+  return 0;
 }
 
 static
 void
-cpu_getfileattr
+cpu_read
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_FILE_METADATA);
-  assert (cpu->l.al == INT21_AL_FILE_METADATA_GETFILEATTR);
-  unsigned attrib;
-  cpu->r.ax = _dosix__dos_getfileattr (_MK_FP (cpu->r.ds, cpu->r.dx),
-				       &attrib);
-  cpu->r.cx = attrib;
-  cpu->r.flags = cpu->r.ax ? 1 : 0;
+  assert (cpu->h.ah == INT21_AH_READ);
+  unsigned numread;
+  unsigned err = _dosix__dos_read (cpu->r.bx,
+				   _MK_FP (cpu->r.ds, cpu->r.dx),
+				   cpu->r.cx,
+				   &numread);
+  cpu->r.ax = err ? err : numread;
+  cpu->r.flags = err ? 1 : 0;
 }
 
 
-/* _dos_setfileattr */
+/* _dos_write */
 
 unsigned
-_dosix__dos_setfileattr
-(const char *path,
- unsigned attrib)
+_dosix__dos_write
+(int handle,
+ const void *buffer,
+ unsigned count,
+ unsigned *numwrt)
 {
-  struct _DOSERROR errorinfo;
-  struct stat fs;
-  if (stat (path, &fs))
-    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
-
-  mode_t mode = fs.st_mode;
-
-  if (attrib & _A_RDONLY)
-    mode &= ~(S_IWUSR | S_IWGRP | S_IWOTH);
-  else mode |= (S_IWUSR | S_IWGRP | S_IWOTH);
-
-  if (chmod (path, mode))
+  assert (buffer);
+  assert (numwrt);
+  struct _DOSERROR errorinfo = {0};
+  if (_dosix__fat_handle (handle))
+    {
+      errno = EACCES;		/* opened read-only */
+      return _dosix__dosexterr (&errorinfo);
+    }
+  if (! count)
+    {
+      /* a zero-length write truncates or extends the file at the
+	 current position */
+      unsigned err = _dosix__wbcache_flush (handle);
+      if (err) return err;
+      _dosix__drive_space_invalidate ();
+      off_t pos = lseek (handle, 0, SEEK_CUR);
+      if (pos == (off_t) -1 || ftruncate (handle, pos))
+	return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+      *numwrt = 0;
+      return 0;
+    }
+  if (_dosix__wbcache_write (handle, buffer, count))
+    {
+      *numwrt = count;
+      return 0;
+    }
+  _dosix__drive_space_invalidate ();
+  ssize_t ret;
+  do ret = write (handle, buffer, count);
+  while (ret < 0 && errno == EINTR);
+  if (ret < 0)
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
-
+  *numwrt = ret;
   return 0;
 }
 
 static
 void
-cpu_setfileattr
+cpu_write
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_FILE_METADATA);
-  assert (cpu->l.al == INT21_AL_FILE_METADATA_SETFILEATTR);
-  cpu->r.ax = _dosix__dos_setfileattr (_MK_FP (cpu->r.ds, cpu->r.dx),
-				       cpu->r.cx);
-  cpu->r.flags = cpu->r.ax ? 1 : 0;
+  assert (cpu->h.ah == INT21_AH_WRITE);
+  unsigned numwrt;
+  unsigned err = _dosix__dos_write (cpu->r.bx,
+				    _MK_FP (cpu->r.ds, cpu->r.dx),
+				    cpu->r.cx,
+				    &numwrt);
+  cpu->r.ax = err ? err : numwrt;
+  cpu->r.flags = err ? 1 : 0;
 }
 
 
-/* time conversion */
+/* _dos_seek */
 
-static
 unsigned
-unixtime_struct
-(const struct _dosdate_t *date,
- const struct _dostime_t *time,
- struct timeval *tv)
+_dosix__dos_seek
+(int handle,
+ off_t offset,
+ int origin,
+ off_t *newpos)
 {
-  assert (date), assert (time), assert (tv);
+  assert (newpos);
   struct _DOSERROR errorinfo = {0};
-  struct tm tm =
-    {
-     .tm_sec = time->second,
-     .tm_min = time->minute,
-     .tm_hour = time->hour,
-     .tm_mday = date->day,
-     .tm_mon = date->month - 1,
-     .tm_year = date->year - 1900,
-     .tm_wday = date->dayofweek,
-    };
-  time_t utime = mktime (&tm);
-  if (utime == (time_t) -1)
+  off_t pos;
+  if (_dosix__fat_handle (handle))
+    pos = _dosix__fat_seek (handle, offset, origin);
+  else
     {
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
-      return exterr_set (&errorinfo, EINVAL);
+      /* the host position is only meaningful with nothing cached */
+      unsigned err = _dosix__wbcache_flush (handle);
+      if (err) return err;
+      pos = lseek (handle, offset, origin);
     }
-  tv->tv_sec = utime;
-  tv->tv_usec = time->hsecond * 10000;
+  if (pos == (off_t) -1)
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  *newpos = pos;
   return 0;
 }
 
 static
-unsigned
-dostime_struct
-(const struct timeval *tv,
- struct _dosdate_t *date,
- struct _dostime_t *time)
+void
+cpu_seek
+(cpu_t *cpu)
 {
-  assert (tv);
-  struct _DOSERROR errorinfo = {0};
-  struct tm *tm = localtime (&tv->tv_sec);
-  if (! tm)
-    {
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
-      return exterr_set (&errorinfo, 0);
-    }
-  if (date)
-    *date = (struct _dosdate_t)
-      {
-       .day = tm->tm_mday,
-       .month = tm->tm_mon + 1,
-       .year = 1900 + tm->tm_year,
-       .dayofweek = tm->tm_wday
-      };
-  if (time)
-    *time = (struct _dostime_t)
-      {
-       .hour = tm->tm_hour,
-       .minute = tm->tm_min,
-       .second = tm->tm_sec,
-       .hsecond = tv->tv_usec / 10000
-      };
-  return 0;
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_SEEK);
+  off_t newpos;
+  /* offset in CX:DX, signed for the relative origins */
+  off_t offset = (int32_t) (((cpu->r.cx & 0xffff) << 16)
+			    | (cpu->r.dx & 0xffff));
+  unsigned err = _dosix__dos_seek (cpu->r.bx,
+				   offset,
+				   cpu->l.al,
+				   &newpos);
+  cpu->r.ax = err ? err : newpos & 0xffff;
+  if (! err) cpu->r.dx = (newpos >> 16) & 0xffff;
+  cpu->r.flags = err ? 1 : 0;
 }
 
-/* Convert DOS date-time encoded integers to Unix time */
-static
+
+/* _dos_commit */
+
 unsigned
-unixtime_int
-(unsigned date,
- unsigned time,
- time_t *utime)
+_dosix__dos_commit
+(int handle)
 {
-  struct tm tm =
-    {
-     .tm_sec = (time & ((1 << 5) - 1)) * 2,
-     .tm_min = time >> 5 & ((1 << 6) - 1),
-     .tm_hour = time >> 11,
-     .tm_mday = date & ((1 << 5) - 1),
-     .tm_mon = (date >> 5 & ((1 << 4) - 1)) - 1,
-     .tm_year = (date >> 9) + (1980 - 1900),
-     .tm_isdst = -1
-    };
-  time_t _utime = mktime (&tm);
   struct _DOSERROR errorinfo = {0};
-  if (_utime == (time_t) (-1))
-    {
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
-      return exterr_set (&errorinfo, 0);
-    }
-  if (utime)
-    *utime = _utime;
+  if (_dosix__fat_handle (handle))
+    return 0;			/* nothing to commit on a read-only image */
+  unsigned err = _dosix__wbcache_flush (handle);
+  if (err) return err;
+  if (fsync (handle))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
   return 0;
 }
 
-/* Convert Unix time to DOS date-time encoded integers */
 static
-unsigned
-dostime_int
-(const time_t *utime,
- unsigned *date,
- unsigned *time)
+void
+cpu_commit
+(cpu_t *cpu)
 {
-  assert (utime);
-  struct _DOSERROR errorinfo = {0};
-  struct tm *tm = localtime (utime);
-  if (! tm)
-    {
-      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
-      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_UNKNOWN;
-      return exterr_set (&errorinfo, 0);
-    }
-  if (date)
-    *date = tm->tm_year - (1980 - 1900) << 9
-      | tm->tm_mon + 1 << 5
-      | tm->tm_mday;
-  if (time)
-    *time = tm->tm_hour << 11
-      | tm->tm_min << 5
-      | tm->tm_sec / 2;
-  return 0;
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_COMMIT);
+  cpu->r.ax = _dosix__dos_commit (cpu->r.bx);
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
 
-/* _dos_getftime */
+/* _dos_mapfile, _dos_mapseek, _dos_unmapfile */
 
+static
 unsigned
-_dosix__dos_getftime
-(int handle,
- unsigned *date,
- unsigned *time)
+mapwin_eof
+(void)
 {
   struct _DOSERROR errorinfo = {0};
-  struct stat fs;
-  if (fstat (handle, &fs))
-    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
-  unsigned err = dostime_int (&fs.st_mtime,
-				date,
-				time);
-  return err ? err: 0;
+  errorinfo.exterror = EXTERR_CANT_COMPLETE_FILE_OP;
+  errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
+  errorinfo.action = ERRACT_IGNORE;
+  errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+  return exterr_set (&errorinfo, 0);
 }
 
 static
 void
-cpu_getftime
-(cpu_t *cpu)
+mapwin_advise
+(struct _mapwin_t *win)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_FILE_TIME);
-  assert (cpu->l.al == INT21_AL_FILE_TIME_GETFTIME);
-  unsigned date, time;
-  cpu->r.ax = _dosix__dos_getftime (cpu->r.bx,
-				    &date,
-				    &time);
-  cpu->r.cx = time;
-  cpu->r.dx = date;
-  cpu->r.flags = cpu->r.ax ? 1 : 0;
+  /* advice is only a hint: ignore errors */
+  if (win->_advice & _MAP_SEQUENTIAL)
+    madvise (win->_base, win->_maplen, MADV_SEQUENTIAL);
+  else if (win->_advice & _MAP_RANDOM)
+    madvise (win->_base, win->_maplen, MADV_RANDOM);
+  if (win->_advice & _MAP_WILLNEED)
+    madvise (win->_base, win->_maplen, MADV_WILLNEED);
 }
 
-
-/* _dos_setftime */
+/* Make the window start at file offset ‘offset’, reusing the current
+   mapping whenever it already covers the requested range */
+static
+unsigned
+mapwin_slide
+(struct _mapwin_t *win,
+ off_t offset)
+{
+  assert (win);
+  struct _DOSERROR errorinfo = {0};
+  /* what is cached for the handle must be in the file the window
+     shows and the size it has */
+  unsigned err = _dosix__wbcache_flush (win->_handle);
+  if (err) return err;
+  if (offset >= win->_filesize)
+    {
+      /* the file may have grown since it was mapped */
+      struct stat fs;
+      if (fstat (win->_handle, &fs))
+	return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+      win->_filesize = fs.st_size;
+    }
+  if (offset < 0 || offset >= win->_filesize)
+    return mapwin_eof ();
+  size_t length = win->_winlen;
+  if (length > (size_t) (win->_filesize - offset))
+    length = win->_filesize - offset;
+  if (! win->_base
+      || offset < win->_mapoff
+      || offset + length > win->_mapoff + win->_maplen)
+    {
+      long page_size = sysconf (_SC_PAGESIZE);
+      off_t mapoff = offset - offset % page_size;
+      size_t maplen = (offset - mapoff) + length;
+      void *base = mmap (NULL,
+			 maplen,
+			 win->_prot,
+			 MAP_SHARED,
+			 win->_handle,
+			 mapoff);
+      if (base == MAP_FAILED)
+	return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+      if (win->_base)
+	munmap (win->_base, win->_maplen);
+      win->_base = base;
+      win->_maplen = maplen;
+      win->_mapoff = mapoff;
+      mapwin_advise (win);
+    }
+  win->offset = offset;
+  win->length = length;
+  win->address = (char *) win->_base + (offset - win->_mapoff);
+  return 0;
+}
 
 unsigned
-_dosix__dos_setftime
+_dosix__dos_mapfile
 (int handle,
- unsigned date,
- unsigned time)
+ off_t offset,
+ size_t length,
+ unsigned advice,
+ struct _mapwin_t *win)
 {
-  time_t _time;
+  assert (win);
   struct _DOSERROR errorinfo = {0};
-  unsigned err = unixtime_int (date, time, &_time);
+  if (_dosix__fat_handle (handle))
+    {
+      errno = ENODEV;		/* image clusters needn't be contiguous */
+      return _dosix__dosexterr (&errorinfo);
+    }
+  unsigned err = _dosix__wbcache_flush (handle);
   if (err) return err;
+  int flags = fcntl (handle, F_GETFL);
+  if (flags == -1)
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  int prot;
+  switch (flags & O_ACCMODE)
+    {
+    case O_RDONLY:
+      prot = PROT_READ;
+      break;
+    case O_RDWR:
+      prot = PROT_READ | PROT_WRITE;
+      break;
+    default:			/* a write-only handle can’t be mapped */
+      errno = EACCES;
+      return _dosix__dosexterr (&errorinfo);
+    }
   struct stat fs;
   if (fstat (handle, &fs))
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
-  struct timeval tvp[2] =
+  *win = (struct _mapwin_t)
     {
-     {
-      .tv_sec = fs.st_atime,
-      .tv_usec = 0
-     },
-     {
-      .tv_sec = _time,
-      .tv_usec = 0
-     }
+     ._handle = handle,
+     ._advice = advice,
+     ._prot = prot,
+     ._winlen = length ? length : _MAP_BUDGET,
+     ._filesize = fs.st_size
     };
-  if (futimes (handle, tvp))
+  return mapwin_slide (win, offset);
+}
+
+unsigned
+_dosix__dos_mapseek
+(struct _mapwin_t *win,
+ off_t offset)
+{
+  assert (win);
+  return mapwin_slide (win, offset);
+}
+
+unsigned
+_dosix__dos_unmapfile
+(struct _mapwin_t *win)
+{
+  assert (win);
+  struct _DOSERROR errorinfo = {0};
+  if (win->_base && munmap (win->_base, win->_maplen))
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  win->_base = win->address = NULL;
+  win->_maplen = win->length = 0;
   return 0;
 }
 
 static
 void
-cpu_setftime
+cpu_mapfile
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_FILE_TIME);
-  assert (cpu->l.al == INT21_AL_FILE_TIME_SETFTIME);
-  cpu->r.ax = _dosix__dos_setftime (cpu->r.bx,
-				    cpu->r.dx,
-				    cpu->r.cx);
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_MAPFILE);
+  cpu->r.ax = _dosix__dos_mapfile (cpu->r.bx,
+				   cpu->r.si,
+				   cpu->r.cx,
+				   cpu->r.dx,
+				   _MK_FP (cpu->r.es, cpu->r.di));
   cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
-
-/* _dos_find functions */
-
 static
-unsigned
-findnext
-(void)
+void
+cpu_mapseek
+(cpu_t *cpu)
 {
-  union dta_t *cdta = current_dta;
-  for (;
-       cdta->find_t._gl_pathi < cdta->find_t._glob.gl_pathc;
-       cdta->find_t._gl_pathi++)
-    {
-      char *filename = cdta->find_t._glob.gl_pathv[cdta->find_t._gl_pathi];
-      unsigned attrib;
-      if (_dosix__dos_getfileattr (filename, &attrib))
-	continue; /* ignore files for which attributes can’t be queried */
-      struct stat fs;
-      if (stat (filename, &fs))
-	continue;		/* ignore files that can’t be stat’ed */
-      /* check if file matches the given attributes */
-      if (cdta->find_t._attrib & attrib
-	  || (! S_ISDIR (fs.st_mode)
-	      && (cdta->find_t._attrib & (_A_HIDDEN | _A_RDONLY
-					  | _A_SUBDIR | _A_SYSTEM)
-		  || ! cdta->find_t._attrib)))
-	{
-	  cdta->find_t.attrib = attrib;
-	  unsigned err = dostime_int (&fs.st_mtime,
-				      &cdta->find_t.wr_date,
-				      &cdta->find_t.wr_time);
-	  if (err) return err;
-	  cdta->find_t.size = fs.st_size;
-	  memccpy (cdta->find_t.name, filename, 0,
-		   sizeof (cdta->find_t.name));	/* memcpy is safer than strcpy */
-
-	  cdta->find_t._gl_pathi++;
-	  return 0;
-	}
-    };
-
-  assert (cdta->find_t._gl_pathi
-	  == cdta->find_t._glob.gl_pathc);
-
-  /* Notice that if the caller does’t consume all results the
-     glob_t object will leak */
-  globfree (&cdta->find_t._glob);
-  errorinfo.exterror = EXTERR_NO_MORE_FILES;
-  errorinfo.errclass = ERRCLASS_NOT_FOUND;
-  errorinfo.action = ERRACT_IGNORE;
-  errorinfo.locus = ERRLOCUS_BLOCK_DEV;
-  return exterr_set (&errorinfo, 0);
+  assert (cpu);
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_MAPSEEK);
+  cpu->r.ax = _dosix__dos_mapseek (_MK_FP (cpu->r.es, cpu->r.di),
+				   cpu->r.si);
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
 static
 void
-cpu_findnext
+cpu_unmapfile
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_FINDNEXT);
-  cpu->r.ax = findnext ();
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_UNMAPFILE);
+  cpu->r.ax = _dosix__dos_unmapfile (_MK_FP (cpu->r.es, cpu->r.di));
   cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
-unsigned
-_dosix__dos_findnext
-(struct _find_t *fileinfo)
-{
-  union dta_t *prev_dta = get_dta_addr ();
-  set_dta_addr ((union dta_t *) fileinfo);
-  unsigned ret = findnext ();
-  set_dta_addr (prev_dta);
-  if (ret) errno = ENOENT;
-  return ret;
-}
-
-static int
-errfunc
-(const char *filename,
- int error_code)
-{
-  struct _DOSERROR errorinfo = {0};
-  switch (error_code)
-    {
-    case EACCES:
-      errorinfo.exterror = EXTERR_ACCESS_DENIED;
-      errorinfo.errclass = ERRCLASS_ACCESS_DENIED;
-      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
-      return exterr_set (&errorinfo, 0);
-      break;
-    case ENOENT:
-      errorinfo.exterror = EXTERR_PATH_NOT_FOUND;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
-      return exterr_set (&errorinfo, 0);
-      break;
-    case EIO:
-      errorinfo.exterror = EXTERR_READ_FAULT;
-      errorinfo.errclass = ERRCLASS_MEDIA_ERROR;
-      errorinfo.action = ERRACT_RETRY_AFTER_USR_INTERV;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
-      return exterr_set (&errorinfo, 0);
-      break;
-    default:		/* Get generic error handling based on libc */
-      errno = error_code;
-      return 1;
-      break;
-    }
-}
-
-static
-unsigned
-findfirst
-(char *filename,
- unsigned attrib,
- unsigned append_flag)
-{
-  struct _DOSERROR errorinfo = {0};
-  union dta_t *cdta = current_dta;
-  glob_t *pglob = &cdta->find_t._glob;
-  /* TODO: DOS expects ‘*.*’ to be interpreted as Unix’s ’*’ */
-  /* TODO: DOS expects file-system to be case-insensitive */
-  switch (glob (filename, GLOB_NOESCAPE | GLOB_NOSORT, &errfunc, pglob))
-    {
-    case 0:			/* success */
-      break;
-    case GLOB_ABORTED:
-      globfree (pglob);
-      return _dosix__dosexterr (&errorinfo);
-    case GLOB_NOMATCH:
-      globfree (pglob);
-      errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
-      errorinfo.errclass = ERRCLASS_NOT_FOUND;
-      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
-      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
-      return exterr_set (&errorinfo, 0);
-    case GLOB_NOSPACE:
-      globfree (pglob);
-      errorinfo.exterror = EXTERR_INSUF_MEM;
-      errorinfo.errclass = ERRCLASS_OUT_OF_RESOURCE;
-      errorinfo.action = ERRACT_IMMEDIATE_ABORT;
-      errorinfo.locus = ERRLOCUS_MEM_RELATED;
-      return exterr_set (&errorinfo, 0);
-    default:			/* should never get here */
-      assert (false);
-    };
-  assert (cdta->find_t._glob.gl_pathc > 0);
-  cdta->find_t._gl_pathi = 0;
-  cdta->find_t._filename = filename;
-  cdta->find_t._attrib = attrib;
-  return findnext ();
-}
+
+/* _dos_aioread, _dos_aiowrite, _dos_aiopoll, _dos_aiowait */
 
 static
 void
-cpu_findfirst
+cpu_aioread
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_FINDFIRST);
-  cpu->r.ax = findfirst (_MK_FP (cpu->r.ds, cpu->r.dx),
-			       cpu->r.cx,
-			       cpu->l.al);
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_AIOREAD);
+  cpu->r.ax = _dosix__dos_aioread (_MK_FP (cpu->r.es, cpu->r.di));
   cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
-unsigned
-_dosix__dos_findfirst
-(const char *filename,
- unsigned attrib,
- struct _find_t *fileinfo)
-{
-  union dta_t *prev_dta = get_dta_addr ();
-  set_dta_addr ((union dta_t *) fileinfo);
-  unsigned ret = findfirst ((char *) filename, attrib, 0);
-  set_dta_addr (prev_dta);
-  if (ret) errno = ENOENT;
-  return ret;
-}
-
+static
 void
-_dosix__dos_findclose
-(struct _find_t *fileinfo)
+cpu_aiowrite
+(cpu_t *cpu)
 {
-  return;
+  assert (cpu);
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_AIOWRITE);
+  cpu->r.ax = _dosix__dos_aiowrite (_MK_FP (cpu->r.es, cpu->r.di));
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
-
-/* _dos_getdate */
-
+static
 void
-_dosix__dos_getdate
-(struct _dosdate_t *date)
+cpu_aiopoll
+(cpu_t *cpu)
 {
-  assert (date);
-  struct timeval tv;
-  if (gettimeofday (&tv, NULL))
-    return;			/* fail silently */
-  dostime_struct (&tv, date, NULL);
+  assert (cpu);
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_AIOPOLL);
+  /* AX = 1 if the transfer completed, 0 if still in flight */
+  cpu->r.ax = _dosix__dos_aiopoll (_MK_FP (cpu->r.es, cpu->r.di));
+  cpu->r.flags = 0;
 }
 
 static
 void
-cpu_getdate
+cpu_aiowait
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_GETDATE);
-  struct _dosdate_t date;
-  _dosix__dos_getdate (&date);
-  cpu->r.cx = date.year;
-  cpu->h.dh = date.month;
-  cpu->l.dl = date.day;
-  cpu->l.al = date.dayofweek; /* DOS 1.10+ */
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_AIOWAIT);
+  cpu->r.ax = _dosix__dos_aiowait (_MK_FP (cpu->r.es, cpu->r.di));
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
 
-/* _dos_setdate */
+/* _dos_getfileattr */
 
+static
 unsigned
-_dosix__dos_setdate
-(struct _dosdate_t *date)
+fileattr
+(int dirfd,
+ const char *name,
+ struct stat *fs,
+ unsigned *attrib)
 {
-  assert (date);
   struct _DOSERROR errorinfo = {0};
-  struct _dostime_t time;
-  _dosix__dos_gettime (&time);
-  struct timeval tv;
-  unsigned err = unixtime_struct (date, &time, &tv);
-  if (err) return err;
-  if (settimeofday (&tv, NULL))
+  if (fstatat (dirfd, name, fs, 0)
+      || _dosix__attr_get (dirfd, name, fs, attrib))
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
   return 0;
 }
 
-static
-void
-cpu_setdate
-(cpu_t *cpu)
+unsigned
+_dosix__dos_getfileattr
+(const char *path,
+ unsigned *attrib)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_SETDATE);
-  struct _dosdate_t date =
+  assert (attrib);
+  struct _DOSERROR errorinfo = {0};
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  unsigned err = 0;
+  if (dp.fat)
     {
-     .year = cpu->r.cx,
-     .month = cpu->h.dh,
-     .day = cpu->l.dl
-    };
-  /* AL = result
-     00h successful
-     FFh invalid time, system time unchanged */
-  cpu->l.al = _dosix__dos_setdate (&date) ? 0xff : 0x00;
-}
-
-
-/* _dos_gettime */
-
-void
-_dosix__dos_gettime
-(struct _dostime_t *time)
-{
-  assert (time);
-  struct timeval tv;
-  if (gettimeofday (&tv, NULL))
-    return;			/* fail silently */
-  dostime_struct (&tv, NULL, time);
+      struct fatent ent;
+      if (_dosix__fat_stat (dp.fat, dp.dir, dp.name, &ent))
+	err = _dosix__dosexterr (&errorinfo);
+      else *attrib = ent.attrib;
+    }
+  else
+    {
+      struct stat fs;
+      err = fileattr (dp.dirfd, dp.name, &fs, attrib);
+    }
+  _dosix__path_release (&dp);
+  return err;
 }
 
 static
 void
-cpu_gettime
+cpu_getfileattr
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_GETTIME);
-  struct _dostime_t time;
-  _dosix__dos_gettime (&time);
-  cpu->h.ch = time.hour;
-  cpu->l.cl = time.minute;
-  cpu->h.dh = time.second;
-  cpu->l.dl = time.hsecond;
+  assert (cpu->h.ah == INT21_AH_FILE_METADATA);
+  assert (cpu->l.al == INT21_AL_FILE_METADATA_GETFILEATTR);
+  unsigned attrib;
+  cpu->r.ax = _dosix__dos_getfileattr (_MK_FP (cpu->r.ds, cpu->r.dx),
+				       &attrib);
+  cpu->r.cx = attrib;
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
 
-/* _dos_settime */
+/* _dos_setfileattr */
 
 unsigned
-_dosix__dos_settime
-(struct _dostime_t *time)
+_dosix__dos_setfileattr
+(const char *path,
+ unsigned attrib)
 {
-  assert (time);
-  struct _DOSERROR errorinfo = {0};
-  struct _dosdate_t date;
-  _dosix__dos_getdate (&date);
-  struct timeval tv;
-  unsigned err = unixtime_struct (&date, time, &tv);
-  if (err) return err;
-  if (settimeofday (&tv, NULL))
+  struct _DOSERROR errorinfo;
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  if (dp.fat)
+    {
+      _dosix__path_release (&dp);
+      errno = EROFS;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  struct stat fs;
+  int ret = fstatat (dp.dirfd, dp.name, &fs, 0)
+    || _dosix__attr_set (dp.dirfd, dp.name, &fs, attrib);
+  _dosix__path_release (&dp);
+  if (ret)
     return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+
   return 0;
 }
 
 static
 void
-cpu_settime
+cpu_setfileattr
 (cpu_t *cpu)
 {
   assert (cpu);
-  assert (cpu->h.ah == INT21_AH_SETTIME);
-  struct _dostime_t time =
-    {
-     .hour = cpu->h.ch,
-     .minute = cpu->l.cl,
-     .second = cpu->h.dh,
-     .hsecond = cpu->l.dl
-    };
-  /* AL = result
-     00h successful
-     FFh invalid time, system time unchanged */
-  cpu->l.al = _dosix__dos_settime (&time) ? 0xff : 0x00;
+  assert (cpu->h.ah == INT21_AH_FILE_METADATA);
+  assert (cpu->l.al == INT21_AL_FILE_METADATA_SETFILEATTR);
+  cpu->r.ax = _dosix__dos_setfileattr (_MK_FP (cpu->r.ds, cpu->r.dx),
+				       cpu->r.cx);
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
 }
 
 
-/* _dos_getvect */
-
-syscall_t
-_dos_getvect
-(unsigned intnum)
-{
-  assert (intnum < UINT8_MAX);
-  return int_vect[intnum];
-}
+/* _dos_getfileattrs, _dos_setfileattrs */
 
+/* The directory is resolved once for the whole batch, so that each
+   entry costs a lookup of its own name alone */
 static
-void
-cpu_getvect
-(cpu_t *cpu)
+unsigned
+fileattrs
+(const char *dir,
+ struct _dosattr_t *attrs,
+ size_t count,
+ bool set)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_GETVECT);
-  syscall_t syscall = _dos_getvect (cpu->l.al);
-  cpu->r.es = _FP_SEG (syscall);
-  cpu->r.bx = _FP_OFF (syscall);
-}
+  assert (dir), assert (attrs || ! count);
+  struct _DOSERROR errorinfo = {0};
+  struct dospath dp;
+  unsigned err = 0;
+  if (_dosix__path_resolve (dir, &dp))
+    goto fail;
+  if (dp.fat)
+    {
+      if (set)
+	{
+	  _dosix__path_release (&dp);
+	  errno = EROFS;
+	  goto fail;
+	}
+      char fatdir[PATH_MAX];
+      if (! strcmp (dp.name, "."))
+	snprintf (fatdir, sizeof (fatdir), "%s", dp.dir);
+      else snprintf (fatdir, sizeof (fatdir), "%s%s%s",
+		     dp.dir, *dp.dir ? "/" : "", dp.name);
+      for (size_t i = 0; i < count; i++)
+	{
+	  struct fatent ent;
+	  attrs[i].error = _dosix__fat_stat (dp.fat, fatdir, attrs[i].name,
+					     &ent) ? errno : 0;
+	  if (! attrs[i].error) attrs[i].attrib = ent.attrib;
+	}
+    }
+  else
+    {
+      int dirfd = openat (dp.dirfd, dp.name,
+			  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dirfd < 0)
+	{
+	  _dosix__path_release (&dp);
+	  goto fail;
+	}
+      if (set) _dosix__attr_setv (dirfd, attrs, count);
+      else _dosix__attr_getv (dirfd, attrs, count);
+      close (dirfd);
+    }
+  _dosix__path_release (&dp);
 
-
-/* _dos_setvect */
+  /* entries come back with errno values */
+  for (size_t i = 0; i < count; i++)
+    if (attrs[i].error)
+      {
+	errno = attrs[i].error;
+	attrs[i].error = _dosix__dosexterr (&errorinfo);
+	if (! err) err = attrs[i].error;
+      }
+  return err;
+
+ fail:
+  err = _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  for (size_t i = 0; i < count; i++)
+    attrs[i].error = err;
+  return err;
+}
 
-void
-_dosix__dos_setvect
-(unsigned intnum,
- syscall_t syscall)
+unsigned
+_dosix__dos_getfileattrs
+(const char *dir,
+ struct _dosattr_t *attrs,
+ size_t count)
 {
-  assert (syscall);
-  assert (intnum < UINT8_MAX);
-  int_vect[intnum] = syscall;
+  return fileattrs (dir, attrs, count, false);
 }
 
-static
-void
-cpu_setvect
-(cpu_t *cpu)
+unsigned
+_dosix__dos_setfileattrs
+(const char *dir,
+ struct _dosattr_t *attrs,
+ size_t count)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_SETVECT);
-  _dosix__dos_setvect (cpu->l.al,
-		       _MK_FP (cpu->r.ds, cpu->r.dx));
+  return fileattrs (dir, attrs, count, true);
 }
 
 
-/* write_stdout */
+/* time conversion */
 
 static
 unsigned
-write_stdout
-(const char *string)
+unixtime_struct
+(const struct _dosdate_t *date,
+ const struct _dostime_t *time,
+ struct timeval *tv)
+{
+  assert (date), assert (time), assert (tv);
+  struct _DOSERROR errorinfo = {0};
+  struct tm tm =
+    {
+     .tm_sec = time->second,
+     .tm_min = time->minute,
+     .tm_hour = time->hour,
+     .tm_mday = date->day,
+     .tm_mon = date->month - 1,
+     .tm_year = date->year - 1900,
+     .tm_wday = date->dayofweek,
+    };
+  time_t utime;
+  if (_dosix__time_unix (&tm, &utime))
+    {
+      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      return exterr_set (&errorinfo, EINVAL);
+    }
+  tv->tv_sec = utime;
+  tv->tv_usec = time->hsecond * 10000;
+  return 0;
+}
+
+static
+unsigned
+dostime_struct
+(const struct timeval *tv,
+ struct _dosdate_t *date,
+ struct _dostime_t *time)
+{
+  assert (tv);
+  struct _DOSERROR errorinfo = {0};
+  struct tm tm;
+  if (_dosix__time_local (tv->tv_sec, &tm))
+    {
+      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      return exterr_set (&errorinfo, 0);
+    }
+  if (date)
+    *date = (struct _dosdate_t)
+      {
+       .day = tm.tm_mday,
+       .month = tm.tm_mon + 1,
+       .year = 1900 + tm.tm_year,
+       .dayofweek = tm.tm_wday
+      };
+  if (time)
+    *time = (struct _dostime_t)
+      {
+       .hour = tm.tm_hour,
+       .minute = tm.tm_min,
+       .second = tm.tm_sec,
+       .hsecond = tv->tv_usec / 10000
+      };
+  return 0;
+}
+
+/* Convert DOS date-time encoded integers to Unix time */
+static
+unsigned
+unixtime_int
+(unsigned date,
+ unsigned time,
+ time_t *utime)
+{
+  struct tm tm =
+    {
+     .tm_sec = (time & ((1 << 5) - 1)) * 2,
+     .tm_min = time >> 5 & ((1 << 6) - 1),
+     .tm_hour = time >> 11,
+     .tm_mday = date & ((1 << 5) - 1),
+     .tm_mon = (date >> 5 & ((1 << 4) - 1)) - 1,
+     .tm_year = (date >> 9) + (1980 - 1900)
+    };
+  time_t _utime;
+  struct _DOSERROR errorinfo = {0};
+  if (_dosix__time_unix (&tm, &_utime))
+    {
+      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      return exterr_set (&errorinfo, 0);
+    }
+  if (utime)
+    *utime = _utime;
+  return 0;
+}
+
+/* Convert Unix time to DOS date-time encoded integers */
+static
+unsigned
+dostime_int
+(const time_t *utime,
+ unsigned *date,
+ unsigned *time)
+{
+  assert (utime);
+  struct _DOSERROR errorinfo = {0};
+  struct tm tm;
+  if (_dosix__time_local (*utime, &tm))
+    {
+      errorinfo.exterror = EXTERR_BAD_ARGUMENTS;
+      errorinfo.errclass = ERRCLASS_APP_PROG_ERROR;
+      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      return exterr_set (&errorinfo, 0);
+    }
+  if (date)
+    *date = tm.tm_year - (1980 - 1900) << 9
+      | tm.tm_mon + 1 << 5
+      | tm.tm_mday;
+  if (time)
+    *time = tm.tm_hour << 11
+      | tm.tm_min << 5
+      | tm.tm_sec / 2;
+  return 0;
+}
+
+
+/* _dos_getftime */
+
+unsigned
+_dosix__dos_getftime
+(int handle,
+ unsigned *date,
+ unsigned *time)
+{
+  struct _DOSERROR errorinfo = {0};
+  struct fatent ent;
+  if (_dosix__fat_handle (handle))
+    {
+      /* images store DOS times already */
+      if (_dosix__fat_fstat (handle, &ent))
+	return _dosix__dosexterr (&errorinfo);
+      *date = ent.wr_date;
+      *time = ent.wr_time;
+      return 0;
+    }
+  unsigned err = _dosix__wbcache_flush (handle);
+  if (err) return err;
+  struct stat fs;
+  if (fstat (handle, &fs))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  err = dostime_int (&fs.st_mtime,
+		     date,
+		     time);
+  return err ? err: 0;
+}
+
+static
+void
+cpu_getftime
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_FILE_TIME);
+  assert (cpu->l.al == INT21_AL_FILE_TIME_GETFTIME);
+  unsigned date, time;
+  cpu->r.ax = _dosix__dos_getftime (cpu->r.bx,
+				    &date,
+				    &time);
+  cpu->r.cx = time;
+  cpu->r.dx = date;
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+
+/* _dos_setftime */
+
+unsigned
+_dosix__dos_setftime
+(int handle,
+ unsigned date,
+ unsigned time)
+{
+  time_t _time;
+  struct _DOSERROR errorinfo = {0};
+  unsigned err = unixtime_int (date, time, &_time);
+  if (err) return err;
+  if (_dosix__fat_handle (handle))
+    {
+      errno = EROFS;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  /* a later write-back would clobber the new time */
+  err = _dosix__wbcache_flush (handle);
+  if (err) return err;
+  struct stat fs;
+  if (fstat (handle, &fs))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  struct timeval tvp[2] =
+    {
+     {
+      .tv_sec = fs.st_atime,
+      .tv_usec = 0
+     },
+     {
+      .tv_sec = _time,
+      .tv_usec = 0
+     }
+    };
+  if (futimes (handle, tvp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  return 0;
+}
+
+static
+void
+cpu_setftime
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_FILE_TIME);
+  assert (cpu->l.al == INT21_AL_FILE_TIME_SETFTIME);
+  cpu->r.ax = _dosix__dos_setftime (cpu->r.bx,
+				    cpu->r.dx,
+				    cpu->r.cx);
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+
+/* _dos_find functions */
+
+/* DOS wildcard match: ‘?’ matches any one character and ‘*’ any run
+   of them, case is ignored, and ‘?’ or ‘.’ at the end of the name
+   match nothing, so that ‘*.*’ and ‘NAME.???’ find ‘NAME’ too. */
+static
+bool
+dos_match
+(const char *pattern,
+ const char *name)
+{
+  for (; *pattern; pattern++, name++)
+    switch (*pattern)
+      {
+      case '*':
+	for (; *name; name++)
+	  if (dos_match (pattern + 1, name))
+	    return true;
+	return dos_match (pattern + 1, name);
+      case '?':
+	if (! *name) return dos_match (pattern + 1, name);
+	break;
+      case '.':
+	if (! *name) return dos_match (pattern + 1, name);
+	if (*name != '.') return false;
+	break;
+      default:
+	if (toupper ((unsigned char) *pattern)
+	    != toupper ((unsigned char) *name))
+	  return false;
+	break;
+      }
+  return ! *name;
+}
+
+static
+unsigned
+find_no_more_files
+(void)
+{
+  task.errorinfo.exterror = EXTERR_NO_MORE_FILES;
+  task.errorinfo.errclass = ERRCLASS_NOT_FOUND;
+  task.errorinfo.action = ERRACT_IGNORE;
+  task.errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+  return exterr_set (&task.errorinfo, 0);
+}
+
+/* An entry produced by the streaming search */
+struct findent
+{
+  const char *name;
+  unsigned attrib;
+  bool image;			/* fat is valid, else st */
+  struct fatent fat;
+  struct stat st;
+  char alias[13];		/* host short name, empty until needed */
+};
+
+/* Read the next entry of find matching its pattern and attributes.
+   The directory stream is closed once exhausted */
+static
+unsigned
+find_read
+(struct _find_t *find,
+ struct findent *fe)
+{
+  if (find->_fatdir)
+    {
+      fe->image = true;
+      while (_dosix__fat_readdir (find->_fatdir, &fe->fat))
+	{
+	  if (! dos_match (find->_pattern, fe->fat.name)
+	      && ! dos_match (find->_pattern, fe->fat.alias))
+	    continue;
+	  /* hidden, system and directory entries only when asked for */
+	  if ((fe->fat.attrib & (_A_HIDDEN | _A_SYSTEM | _A_SUBDIR))
+	      & ~find->_attrib)
+	    continue;
+	  fe->name = fe->fat.name;
+	  fe->attrib = fe->fat.attrib;
+	  return 0;
+	}
+      _dosix__fat_closedir (find->_fatdir);
+      find->_fatdir = NULL;
+      return find_no_more_files ();
+    }
+  DIR *dir = find->_dir;
+  struct dirent *de;
+  fe->image = false;
+  while (dir && (de = readdir (dir)))
+    {
+      /* a long name also matches through its alias */
+      *fe->alias = '\0';
+      if (! dos_match (find->_pattern, de->d_name)
+	  && (_dosix__alias_get (dirfd (dir), de->d_name, fe->alias)
+	      || ! strcmp (fe->alias, de->d_name)
+	      || ! dos_match (find->_pattern, fe->alias)))
+	continue;
+      unsigned attrib;
+      if (fileattr (dirfd (dir), de->d_name, &fe->st, &attrib))
+	continue; /* ignore files for which attributes can’t be queried */
+      /* hidden, system and directory entries only when asked for */
+      if (! ((attrib & (_A_HIDDEN | _A_SYSTEM | _A_SUBDIR))
+	     & ~find->_attrib))
+	{
+	  fe->name = de->d_name;
+	  fe->attrib = attrib;
+	  return 0;
+	}
+    };
+
+  /* Notice that if the caller does’t consume all results nor calls
+     _dos_findclose the directory stream will leak */
+  if (dir) closedir (dir);
+  find->_dir = NULL;
+  return find_no_more_files ();
+}
+
+static
+unsigned
+findnext
+(void)
+{
+  struct _find_t *find = &get_dta_addr ()->find_t;
+  struct findent fe;
+  unsigned err = find_read (find, &fe);
+  if (err) return err;
+  /* callers of the 8.3 services get 8.3 names */
+  const char *name = fe.name;
+  char basis[11];
+  if (fe.image)
+    {
+      find->wr_date = fe.fat.wr_date;
+      find->wr_time = fe.fat.wr_time;
+      find->size = fe.fat.size;
+      name = fe.fat.alias;
+    }
+  else
+    {
+      err = dostime_int (&fe.st.st_mtime, &find->wr_date, &find->wr_time);
+      if (err) return err;
+      find->size = fe.st.st_size;
+      if (_dosix__alias_basis (fe.name, basis)
+	  && (*fe.alias
+	      || ! _dosix__alias_get (dirfd (find->_dir), fe.name,
+				      fe.alias)))
+	name = fe.alias;
+    }
+  find->attrib = fe.attrib;
+  memccpy (find->name, name, 0,
+	   sizeof (find->name));	/* memcpy is safer than strcpy */
+  return 0;
+}
+
+static
+void
+cpu_findnext
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_FINDNEXT);
+  cpu->r.ax = findnext ();
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+unsigned
+_dosix__dos_findnext
+(struct _find_t *fileinfo)
+{
+  union dta_t *prev_dta = get_dta_addr ();
+  set_dta_addr ((union dta_t *) fileinfo);
+  unsigned ret = findnext ();
+  set_dta_addr (prev_dta);
+  if (ret) errno = ENOENT;
+  return ret;
+}
+
+/* findfirst reports an empty search as file not found */
+static
+unsigned
+findfirst_result
+(unsigned err)
+{
+  if (err != EXTERR_NO_MORE_FILES)
+    return err;
+  struct _DOSERROR errorinfo = {0};
+  errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
+  errorinfo.errclass = ERRCLASS_NOT_FOUND;
+  errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+  errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+  return exterr_set (&errorinfo, 0);
+}
+
+/* Start a search of the directory filename names, for entries
+   matching its final component */
+static
+unsigned
+find_open
+(struct _find_t *find,
+ const char *filename,
+ unsigned attrib)
+{
+  struct _DOSERROR errorinfo = {0};
+  find->_dir = NULL;
+  find->_fatdir = NULL;
+  struct dospath dp;
+  if (_dosix__path_resolve (filename, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  if (strlen (dp.name) >= sizeof (find->_pattern))
+    {
+      _dosix__path_release (&dp);
+      errorinfo.exterror = EXTERR_FILE_NOT_FOUND;
+      errorinfo.errclass = ERRCLASS_NOT_FOUND;
+      errorinfo.action = ERRACT_PROMPT_USR_REENTER_INPUT;
+      errorinfo.locus = ERRLOCUS_BLOCK_DEV;
+      return exterr_set (&errorinfo, 0);
+    }
+  strcpy (find->_pattern, dp.name);
+  find->_attrib = attrib;
+  if (dp.fat)
+    {
+      find->_fatdir = _dosix__fat_opendir (dp.fat, dp.dir);
+      _dosix__path_release (&dp);
+      if (! find->_fatdir)
+	return _dosix__dosexterr (&errorinfo);
+      return 0;
+    }
+  /* the directory is read as a stream: nothing is collected up
+     front */
+  int fd = openat (dp.dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  _dosix__path_release (&dp);
+  DIR *dir = fd < 0 ? NULL : fdopendir (fd);
+  if (! dir)
+    {
+      if (fd >= 0) close (fd);
+      return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+    }
+  find->_dir = dir;
+  return 0;
+}
+
+static
+unsigned
+findfirst
+(char *filename,
+ unsigned attrib,
+ unsigned append_flag)
+{
+  unsigned err = find_open (&get_dta_addr ()->find_t, filename, attrib);
+  if (err) return err;
+  return findfirst_result (findnext ());
+}
+
+static
+void
+cpu_findfirst
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_FINDFIRST);
+  cpu->r.ax = findfirst (_MK_FP (cpu->r.ds, cpu->r.dx),
+			       cpu->r.cx,
+			       cpu->l.al);
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+unsigned
+_dosix__dos_findfirst
+(const char *filename,
+ unsigned attrib,
+ struct _find_t *fileinfo)
+{
+  union dta_t *prev_dta = get_dta_addr ();
+  set_dta_addr ((union dta_t *) fileinfo);
+  unsigned ret = findfirst ((char *) filename, attrib, 0);
+  set_dta_addr (prev_dta);
+  if (ret) errno = ENOENT;
+  return ret;
+}
+
+void
+_dosix__dos_findclose
+(struct _find_t *fileinfo)
+{
+  assert (fileinfo);
+  if (fileinfo->_dir)
+    closedir (fileinfo->_dir);
+  if (fileinfo->_fatdir)
+    _dosix__fat_closedir (fileinfo->_fatdir);
+  fileinfo->_dir = NULL;
+  fileinfo->_fatdir = NULL;
+}
+
+
+/* _dos_walktree */
+
+/* Several workers read directories at once, each taking its own
+   queue depth first and stealing from the others when it runs dry.
+   Every directory is read once, for the entries matching the search
+   and for its subdirectories alike, which are opened relative to it.
+   The caller gets the directories back in the order a single threaded
+   walk would have produced them, reading the next one itself if no
+   worker took it yet, and workers wait once WALK_AHEAD directories are
+   read and not delivered, so that memory stays bounded however large
+   the tree.  Linked directories are not entered, so that a walk always
+   ends. */
+
+static
+struct walk_node *
+walk_node
+(struct walk_node *parent,
+ const char *host,
+ const char *dosname)
+{
+  struct walk_node *node = calloc (1, sizeof (*node));
+  if (! node) return NULL;
+  node->fd = -1;
+  node->refs = 1;
+  if (parent)
+    {
+      node->depth = parent->depth + 1;
+      if (asprintf (&node->host, "%s%s%s", parent->host,
+		    *parent->host ? "/" : "", host) < 0)
+	node->host = NULL;
+      if (asprintf (&node->path, "%s%s\\", parent->path, dosname) < 0)
+	node->path = NULL;
+    }
+  else
+    {
+      node->host = strdup (host);
+      node->path = strdup (dosname);
+    }
+  if (! node->host || ! node->path)
+    {
+      free (node->host);
+      free (node->path);
+      free (node);
+      return NULL;
+    }
+  return node;
+}
+
+/* Drop a reference to node; the last one frees it, dropping those it
+   holds to its subdirectories */
+static
+void
+walk_unref
+(struct walk_node *node)
+{
+  if (__atomic_sub_fetch (&node->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+  for (size_t i = 0; i < node->nchildren; i++)
+    walk_unref (node->children[i]);
+  if (node->fd >= 0) close (node->fd);
+  free (node->children);
+  free (node->ents);
+  free (node->host);
+  free (node->path);
+  free (node);
+}
+
+static
+struct walk_ent *
+walk_add_ent
+(struct walk_node *node)
+{
+  if (node->count == node->size)
+    {
+      size_t size = node->size ? 2 * node->size : 16;
+      void *p = realloc (node->ents, size * sizeof (*node->ents));
+      if (! p) return NULL;
+      node->ents = p;
+      node->size = size;
+    }
+  return memset (&node->ents[node->count++], 0, sizeof (*node->ents));
+}
+
+static
+bool
+walk_add_child
+(struct walk_node *node,
+ struct walk_node *child)
+{
+  if (node->nchildren == node->csize)
+    {
+      size_t size = node->csize ? 2 * node->csize : 8;
+      void *p = realloc (node->children, size * sizeof (*node->children));
+      if (! p) return false;
+      node->children = p;
+      node->csize = size;
+    }
+  node->children[node->nchildren++] = child;
+  return true;
+}
+
+/* hidden, system and directory entries only when asked for */
+static
+bool
+walk_wanted
+(struct walk *walk,
+ unsigned attrib)
+{
+  return ! ((attrib & (_A_HIDDEN | _A_SYSTEM | _A_SUBDIR)) & ~walk->attrib);
+}
+
+static
+void
+walk_read_image
+(struct walk *walk,
+ struct walk_node *node)
+{
+  void *dir = _dosix__fat_opendir (walk->fat, node->host);
+  if (! dir) return;
+  struct fatent ent;
+  while (_dosix__fat_readdir (dir, &ent))
+    {
+      if (! strcmp (ent.name, ".") || ! strcmp (ent.name, ".."))
+	continue;
+      if ((dos_match (walk->pattern, ent.name)
+	   || dos_match (walk->pattern, ent.alias))
+	  && walk_wanted (walk, ent.attrib))
+	{
+	  struct walk_ent *e = walk_add_ent (node);
+	  if (! e)
+	    {
+	      __atomic_store_n (&walk->nomem, true, __ATOMIC_RELAXED);
+	      break;
+	    }
+	  strcpy (e->name, ent.alias);
+	  e->attrib = ent.attrib;
+	  e->size = ent.size;
+	  e->wr_date = ent.wr_date;
+	  e->wr_time = ent.wr_time;
+	}
+      if (ent.attrib & _A_SUBDIR)
+	{
+	  struct walk_node *child = walk_node (node, ent.name, ent.alias);
+	  if (! child || ! walk_add_child (node, child))
+	    {
+	      if (child) walk_unref (child);
+	      __atomic_store_n (&walk->nomem, true, __ATOMIC_RELAXED);
+	    }
+	}
+    }
+  _dosix__fat_closedir (dir);
+}
+
+/* Name 8.3 callers know name of dir by: its alias, looked up in
+   *aliases, the map of dir taken on the first long name met */
+static
+const char *
+dir_alias
+(DIR *dir,
+ struct alias_map **aliases,
+ const char *name,
+ char alias[13])
+{
+  char basis[11];
+  if (! _dosix__alias_basis (name, basis)) return name;
+  if (! *aliases) *aliases = _dosix__alias_open (dirfd (dir));
+  /* an entry newer than the map brings it up to date */
+  if ((*aliases && ! _dosix__alias_lookup (*aliases, name, alias))
+      || ! _dosix__alias_get (dirfd (dir), name, alias))
+    return alias;
+  return name;
+}
+
+static
+void
+walk_read_host
+(struct walk *walk,
+ struct walk_node *node)
+{
+  int fd = node->fd;
+  if (fd >= 0)
+    __atomic_sub_fetch (&walk->fds, 1, __ATOMIC_RELAXED);
+  else fd = openat (walk->rootfd, node->host,
+		    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  node->fd = -1;
+  DIR *dir = fd < 0 ? NULL : fdopendir (fd);
+  if (! dir)
+    {
+      if (fd >= 0) close (fd);
+      return;
+    }
+  struct alias_map *aliases = NULL;
+  struct dirent *de;
+  while ((de = readdir (dir)))
+    {
+      const char *name = de->d_name;
+      if (! strcmp (name, ".") || ! strcmp (name, ".."))
+	continue;
+      char alias[13];
+      const char *dosname = dir_alias (dir, &aliases, name, alias);
+      struct stat st;
+      unsigned attrib;
+      if ((dos_match (walk->pattern, name)
+	   || (dosname != name && dos_match (walk->pattern, dosname)))
+	  && ! fstatat (dirfd (dir), name, &st, 0)
+	  && ! _dosix__attr_get (dirfd (dir), name, &st, &attrib)
+	  && walk_wanted (walk, attrib))
+	{
+	  struct walk_ent *e = walk_add_ent (node);
+	  if (! e)
+	    {
+	      __atomic_store_n (&walk->nomem, true, __ATOMIC_RELAXED);
+	      break;
+	    }
+	  memccpy (e->name, dosname, 0, sizeof (e->name));
+	  e->name[sizeof (e->name) - 1] = '\0';
+	  e->attrib = attrib;
+	  e->size = st.st_size;
+	  e->mtime = st.st_mtime;
+	}
+      bool subdir = de->d_type == DT_DIR;
+      if (de->d_type == DT_UNKNOWN)
+	subdir = ! fstatat (dirfd (dir), name, &st, AT_SYMLINK_NOFOLLOW)
+	  && S_ISDIR (st.st_mode);
+      if (! subdir) continue;
+      struct walk_node *child = walk_node (node, name, dosname);
+      if (! child || ! walk_add_child (node, child))
+	{
+	  if (child) walk_unref (child);
+	  __atomic_store_n (&walk->nomem, true, __ATOMIC_RELAXED);
+	  continue;
+	}
+      /* while few are held, subdirectories are opened from here and
+	 not looked up again from the root */
+      if (__atomic_add_fetch (&walk->fds, 1, __ATOMIC_RELAXED) <= WALK_FDS)
+	child->fd = openat (dirfd (dir), name, O_RDONLY | O_DIRECTORY
+			    | O_NOFOLLOW | O_CLOEXEC);
+      if (child->fd < 0)
+	__atomic_sub_fetch (&walk->fds, 1, __ATOMIC_RELAXED);
+    }
+  if (aliases) _dosix__alias_close (aliases);
+  closedir (dir);
+}
+
+static
+void
+walk_done
+(struct walk *walk,
+ struct walk_node *node)
+{
+  pthread_mutex_lock (&walk->lock);
+  node->done = true;
+  __atomic_add_fetch (&walk->held, 1, __ATOMIC_RELAXED);
+  if (! __atomic_sub_fetch (&walk->pending, 1, __ATOMIC_SEQ_CST))
+    pthread_cond_broadcast (&walk->work);
+  pthread_cond_broadcast (&walk->ready);
+  pthread_mutex_unlock (&walk->lock);
+}
+
+static
+void
+walk_push
+(struct walk *walk,
+ unsigned index,
+ struct walk_node *node)
+{
+  struct walk_deque *q = &walk->deques[index];
+  pthread_mutex_lock (&q->lock);
+  if (q->tail == q->size)
+    {
+      size_t size = q->size ? 2 * q->size : 64;
+      void *p = realloc (q->nodes, size * sizeof (*q->nodes));
+      if (! p)
+	{
+	  /* left for the caller to read when it gets there */
+	  pthread_mutex_unlock (&q->lock);
+	  return;
+	}
+      q->nodes = p;
+      q->size = size;
+    }
+  __atomic_add_fetch (&node->refs, 1, __ATOMIC_RELAXED);
+  q->nodes[q->tail++] = node;
+  pthread_mutex_unlock (&q->lock);
+  __atomic_add_fetch (&walk->queued, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&walk->idle, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock (&walk->lock);
+      pthread_cond_signal (&walk->work);
+      pthread_mutex_unlock (&walk->lock);
+    }
+}
+
+static
+struct walk_node *
+walk_take
+(struct walk *walk,
+ unsigned index)
+{
+  struct walk_node *node = NULL;
+  for (unsigned i = 0; ! node && i < walk->threads; i++)
+    {
+      struct walk_deque *q = &walk->deques[(index + i) % walk->threads];
+      pthread_mutex_lock (&q->lock);
+      if (q->head < q->tail)
+	node = i ? q->nodes[q->head++] : q->nodes[--q->tail];
+      if (q->head == q->tail) q->head = q->tail = 0;
+      pthread_mutex_unlock (&q->lock);
+    }
+  if (node) __atomic_sub_fetch (&walk->queued, 1, __ATOMIC_SEQ_CST);
+  return node;
+}
+
+/* Read node, claimed by the caller, and queue its subdirectories on
+   deque index if there are workers to take them */
+static
+void
+walk_read
+(struct walk *walk,
+ unsigned index,
+ bool queue,
+ struct walk_node *node)
+{
+  if (__atomic_load_n (&walk->stop, __ATOMIC_RELAXED))
+    {
+      if (node->fd >= 0) close (node->fd);
+      node->fd = -1;
+    }
+  else
+    {
+      if (walk->fat) walk_read_image (walk, node);
+      else walk_read_host (walk, node);
+      /* the first subdirectory is taken back first */
+      for (size_t i = node->nchildren; i--;)
+	{
+	  __atomic_add_fetch (&walk->pending, 1, __ATOMIC_SEQ_CST);
+	  if (queue) walk_push (walk, index, node->children[i]);
+	}
+    }
+  walk_done (walk, node);
+}
+
+static
+void
+walk_stop
+(struct walk *walk)
+{
+  pthread_mutex_lock (&walk->lock);
+  __atomic_store_n (&walk->stop, true, __ATOMIC_RELAXED);
+  pthread_cond_broadcast (&walk->work);
+  pthread_cond_broadcast (&walk->room);
+  pthread_mutex_unlock (&walk->lock);
+}
+
+static
+void *
+walk_worker
+(void *arg)
+{
+  struct walk_deque *q = arg;
+  struct walk *walk = q->walk;
+  for (;;)
+    {
+      if (__atomic_load_n (&walk->held, __ATOMIC_RELAXED) >= WALK_AHEAD)
+	{
+	  pthread_mutex_lock (&walk->lock);
+	  while (__atomic_load_n (&walk->held, __ATOMIC_RELAXED) >= WALK_AHEAD
+		 && ! walk->stop)
+	    pthread_cond_wait (&walk->room, &walk->lock);
+	  pthread_mutex_unlock (&walk->lock);
+	}
+      struct walk_node *node = walk_take (walk, q->index);
+      if (! node)
+	{
+	  pthread_mutex_lock (&walk->lock);
+	  __atomic_add_fetch (&walk->idle, 1, __ATOMIC_SEQ_CST);
+	  while (! __atomic_load_n (&walk->queued, __ATOMIC_SEQ_CST)
+		 && __atomic_load_n (&walk->pending, __ATOMIC_SEQ_CST)
+		 && ! walk->stop)
+	    pthread_cond_wait (&walk->work, &walk->lock);
+	  __atomic_sub_fetch (&walk->idle, 1, __ATOMIC_SEQ_CST);
+	  bool quit = ! __atomic_load_n (&walk->pending, __ATOMIC_SEQ_CST)
+	    || walk->stop;
+	  pthread_mutex_unlock (&walk->lock);
+	  if (quit) return NULL;
+	  continue;
+	}
+      /* the caller may have read it already */
+      if (! __atomic_exchange_n (&node->claimed, true, __ATOMIC_SEQ_CST))
+	walk_read (walk, q->index, true, node);
+      walk_unref (node);
+    }
+}
+
+/* Hand the entries of node to fn, a few at a time.  Returns nonzero
+   if fn asked to stop */
+static
+int
+walk_deliver
+(struct walk *walk,
+ struct walk_node *node,
+ struct _find_t *finds,
+ int (*fn) (const struct _doswalk_t *, void *),
+ void *arg)
+{
+  size_t i = 0;
+  do
+    {
+      size_t count = 0;
+      for (; i < node->count && count < WALK_DELIVER; i++, count++)
+	{
+	  struct walk_ent *e = &node->ents[i];
+	  struct _find_t *f = &finds[count];
+	  f->_dir = f->_fatdir = NULL;
+	  f->_attrib = walk->attrib;
+	  strcpy (f->_pattern, walk->pattern);
+	  f->attrib = e->attrib;
+	  f->wr_date = e->wr_date;
+	  f->wr_time = e->wr_time;
+	  if (! walk->fat
+	      && dostime_int (&e->mtime, &f->wr_date, &f->wr_time))
+	    f->wr_date = f->wr_time = 0;
+	  f->size = e->size;
+	  strcpy (f->name, e->name);
+	}
+      struct _doswalk_t dw = {node->path, node->depth, finds, count};
+      int ret = fn (&dw, arg);
+      if (ret) return ret;
+    }
+  while (i < node->count);
+  return 0;
+}
+
+unsigned
+_dosix__dos_walktree
+(const char *filename,
+ unsigned attrib,
+ unsigned threads,
+ int (*fn) (const struct _doswalk_t *, void *),
+ void *arg)
+{
+  assert (filename), assert (fn);
+  struct _DOSERROR errorinfo = {0};
+  struct walk walk = {.rootfd = -1, .attrib = attrib,
+		      .lock = PTHREAD_MUTEX_INITIALIZER,
+		      .work = PTHREAD_COND_INITIALIZER,
+		      .ready = PTHREAD_COND_INITIALIZER,
+		      .room = PTHREAD_COND_INITIALIZER};
+
+  /* entries are named after the directory part of filename */
+  const char *base = filename;
+  for (const char *p = filename; *p; p++)
+    if (*p == '\\' || *p == '/' || *p == ':') base = p + 1;
+  char *prefix = strndup (filename, base - filename);
+  if (! prefix) return _dosix__dosexterr (&errorinfo);
+
+  struct dospath dp;
+  if (_dosix__path_resolve (filename, &dp))
+    {
+      free (prefix);
+      return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+    }
+  memccpy (walk.pattern, dp.name, 0, sizeof (walk.pattern));
+  walk.pattern[sizeof (walk.pattern) - 1] = '\0';
+  struct walk_node *root = walk_node (NULL, dp.fat ? dp.dir : ".", prefix);
+  free (prefix);
+  if (! root)
+    {
+      _dosix__path_release (&dp);
+      errno = ENOMEM;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  if (dp.fat)
+    walk.fat = dp.fat;
+  else
+    {
+      walk.rootfd = openat (dp.dirfd, ".", O_RDONLY | O_DIRECTORY
+			    | O_CLOEXEC);
+      if (walk.rootfd >= 0)
+	root->fd = openat (walk.rootfd, ".", O_RDONLY | O_DIRECTORY
+			   | O_CLOEXEC);
+      if (root->fd < 0)
+	{
+	  unsigned err = _dosix__dosexterr (&errorinfo);
+	  if (walk.rootfd >= 0) close (walk.rootfd);
+	  _dosix__path_release (&dp);
+	  walk_unref (root);
+	  return err;
+	}
+      walk.fds = 1;
+    }
+  _dosix__path_release (&dp);
+
+  if (! threads)
+    {
+      long n = sysconf (_SC_NPROCESSORS_ONLN);
+      threads = n > 0 ? n : 1;
+    }
+  if (threads > WALK_THREADS_MAX) threads = WALK_THREADS_MAX;
+  walk.deques = calloc (threads, sizeof (*walk.deques));
+  struct walk_node **stack = malloc (sizeof (*stack));
+  struct _find_t *finds = malloc (WALK_DELIVER * sizeof (*finds));
+  size_t depth = 0, size = 1;
+  if (walk.deques && stack && finds)
+    {
+      walk.threads = threads;
+      for (unsigned i = 0; i < threads; i++)
+	{
+	  walk.deques[i].walk = &walk;
+	  walk.deques[i].index = i;
+	  pthread_mutex_init (&walk.deques[i].lock, NULL);
+	}
+      walk.pending = 1;
+      walk_push (&walk, 0, root);
+      stack[depth++] = root;
+      unsigned started = 0;
+      for (; started < threads; started++)
+	if (pthread_create (&walk.deques[started].thread, NULL,
+			    walk_worker, &walk.deques[started]))
+	  break;
+
+      while (depth && ! walk.stop)
+	{
+	  struct walk_node *node = stack[--depth];
+	  /* with no worker at all the caller reads the whole tree */
+	  if (! __atomic_exchange_n (&node->claimed, true, __ATOMIC_SEQ_CST))
+	    walk_read (&walk, 0, started, node);
+	  pthread_mutex_lock (&walk.lock);
+	  while (! node->done)
+	    pthread_cond_wait (&walk.ready, &walk.lock);
+	  pthread_mutex_unlock (&walk.lock);
+	  if (walk_deliver (&walk, node, finds, fn, arg))
+	    walk_stop (&walk);
+	  if (depth + node->nchildren > size)
+	    {
+	      size_t nsize = 2 * (depth + node->nchildren);
+	      void *p = realloc (stack, nsize * sizeof (*stack));
+	      if (! p)
+		{
+		  stack[depth++] = node;
+		  walk.nomem = true;
+		  walk_stop (&walk);
+		  break;
+		}
+	      stack = p;
+	      size = nsize;
+	    }
+	  for (size_t i = node->nchildren; i--;)
+	    stack[depth++] = node->children[i];
+	  node->nchildren = 0;
+	  walk_unref (node);
+	  pthread_mutex_lock (&walk.lock);
+	  if (__atomic_sub_fetch (&walk.held, 1, __ATOMIC_RELAXED)
+	      == WALK_AHEAD - 1)
+	    pthread_cond_broadcast (&walk.room);
+	  pthread_mutex_unlock (&walk.lock);
+	}
+      for (unsigned i = 0; i < started; i++)
+	pthread_join (walk.deques[i].thread, NULL);
+      for (unsigned i = 0; i < threads; i++)
+	{
+	  /* what no worker took */
+	  struct walk_deque *q = &walk.deques[i];
+	  for (size_t j = q->head; j < q->tail; j++)
+	    walk_unref (q->nodes[j]);
+	  pthread_mutex_destroy (&q->lock);
+	  free (q->nodes);
+	}
+    }
+  else
+    {
+      depth = 0;
+      walk_unref (root);
+      walk.nomem = true;
+    }
+  /* what a stopped walk did not deliver */
+  while (depth) walk_unref (stack[--depth]);
+  free (stack);
+  free (finds);
+  free (walk.deques);
+  if (walk.rootfd >= 0) close (walk.rootfd);
+  pthread_cond_destroy (&walk.work);
+  pthread_cond_destroy (&walk.ready);
+  pthread_cond_destroy (&walk.room);
+  if (walk.nomem)
+    {
+      /* a partial tree is no success */
+      errno = ENOMEM;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  return 0;
+}
+
+
+/* _dos_findtree, _dos_findtreenext, _dos_findtreeclose */
+
+/* A recursive search keeps the directories on its way down open, and
+   opens each subdirectory relative to its parent, so that no path is
+   looked up twice.  Linked directories are not entered. */
+
+/* Put s1 and s2 at offset len of the growing string *buf */
+static
+bool
+findtree_append
+(char **buf,
+ size_t *size,
+ size_t len,
+ const char *s1,
+ const char *s2)
+{
+  size_t need = len + strlen (s1) + strlen (s2) + 1;
+  if (need > *size)
+    {
+      size_t nsize = *size ? *size : 64;
+      while (nsize < need) nsize *= 2;
+      char *p = realloc (*buf, nsize);
+      if (! p) return false;
+      *buf = p;
+      *size = nsize;
+    }
+  strcpy (stpcpy (*buf + len, s1), s2);
+  return true;
+}
+
+/* Open the subdirectory name of the innermost level, known to DOS as
+   dosname, or the starting directory through rootfd if none is open */
+static
+bool
+findtree_enter
+(struct findtree *t,
+ int rootfd,
+ const char *name,
+ const char *dosname)
+{
+  if (t->depth == t->size)
+    {
+      size_t size = t->size ? 2 * t->size : 8;
+      void *p = realloc (t->levels, size * sizeof (*t->levels));
+      if (! p) return false;
+      t->levels = p;
+      t->size = size;
+    }
+  struct findtree_level *l = &t->levels[t->depth];
+  struct findtree_level *up = t->depth ? l - 1 : NULL;
+  *l = (struct findtree_level)
+    {
+     .pathlen = up ? strlen (t->path) : 0,
+     .hostlen = up && t->fat ? strlen (t->host) : 0
+    };
+  if (up && ! findtree_append (&t->path, &t->pathsize, l->pathlen,
+			       dosname, "\\"))
+    return false;
+  if (t->fat)
+    {
+      if (up && ! findtree_append (&t->host, &t->hostsize, l->hostlen,
+				   *t->host ? "/" : "", name))
+	goto fail;
+      l->fatdir = _dosix__fat_opendir (t->fat, t->host);
+      if (! l->fatdir) goto fail;
+    }
+  else
+    {
+      int fd = up
+	? openat (dirfd (up->dir), name, O_RDONLY | O_DIRECTORY
+		  | O_NOFOLLOW | O_CLOEXEC)
+	: openat (rootfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      l->dir = fd < 0 ? NULL : fdopendir (fd);
+      if (! l->dir)
+	{
+	  if (fd >= 0) close (fd);
+	  goto fail;
+	}
+    }
+  t->depth++;
+  return true;
+
+ fail:
+  if (up) t->path[l->pathlen] = '\0';
+  if (up && t->fat) t->host[l->hostlen] = '\0';
+  return false;
+}
+
+static
+void
+findtree_leave
+(struct findtree *t)
+{
+  struct findtree_level *l = &t->levels[--t->depth];
+  if (l->aliases) _dosix__alias_close (l->aliases);
+  if (l->dir) closedir (l->dir);
+  if (l->fatdir) _dosix__fat_closedir (l->fatdir);
+  if (t->depth)
+    {
+      t->path[l->pathlen] = '\0';
+      if (t->fat) t->host[l->hostlen] = '\0';
+    }
+}
+
+static
+void
+findtree_free
+(struct findtree *t)
+{
+  while (t->depth) findtree_leave (t);
+  free (t->levels);
+  free (t->path);
+  free (t->host);
+  free (t);
+}
+
+/* Read the next entry of the innermost level into f, with its host
+   name in t->name.  Returns false once the level is exhausted */
+static
+bool
+findtree_read
+(struct findtree *t,
+ struct _find_t *f,
+ bool *matched,
+ bool *subdir)
+{
+  struct findtree_level *l = &t->levels[t->depth - 1];
+  *f = (struct _find_t) {._attrib = t->attrib};
+  strcpy (f->_pattern, t->pattern);
+  if (t->fat)
+    {
+      struct fatent ent;
+      while (_dosix__fat_readdir (l->fatdir, &ent))
+	{
+	  if (! strcmp (ent.name, ".") || ! strcmp (ent.name, ".."))
+	    continue;
+	  *matched = dos_match (t->pattern, ent.name)
+	    || dos_match (t->pattern, ent.alias);
+	  *subdir = ent.attrib & _A_SUBDIR;
+	  strcpy (t->name, ent.name);
+	  strcpy (f->name, ent.alias);
+	  f->attrib = ent.attrib;
+	  f->wr_date = ent.wr_date;
+	  f->wr_time = ent.wr_time;
+	  f->size = ent.size;
+	  return true;
+	}
+      return false;
+    }
+  struct dirent *de;
+  while ((de = readdir (l->dir)))
+    {
+      const char *name = de->d_name;
+      if (! strcmp (name, ".") || ! strcmp (name, ".."))
+	continue;
+      char alias[13];
+      const char *dosname = dir_alias (l->dir, &l->aliases, name, alias);
+      struct stat st;
+      *matched = dos_match (t->pattern, name)
+	|| (dosname != name && dos_match (t->pattern, dosname));
+      *subdir = de->d_type == DT_DIR;
+      if (de->d_type == DT_UNKNOWN)
+	*subdir = ! fstatat (dirfd (l->dir), name, &st, AT_SYMLINK_NOFOLLOW)
+	  && S_ISDIR (st.st_mode);
+      if (! *matched && ! *subdir)
+	continue;
+      /* ignore files for which attributes can’t be queried */
+      if (fstatat (dirfd (l->dir), name, &st, 0)
+	  || _dosix__attr_get (dirfd (l->dir), name, &st, &f->attrib))
+	continue;
+      if (dostime_int (&st.st_mtime, &f->wr_date, &f->wr_time))
+	f->wr_date = f->wr_time = 0;
+      f->size = st.st_size;
+      memccpy (f->name, dosname, 0, sizeof (f->name));
+      f->name[sizeof (f->name) - 1] = '\0';
+      memccpy (t->name, name, 0, sizeof (t->name));
+      t->name[sizeof (t->name) - 1] = '\0';
+      return true;
+    }
+  return false;
+}
+
+static
+unsigned
+findtree_next
+(struct _findtree_t *ft)
+{
+  struct findtree *t = ft->_state;
+  if (! t) return find_no_more_files ();
+  for (;;)
+    {
+      if (t->descend)
+	{
+	  t->descend = false;
+	  if (findtree_enter (t, -1, t->name, t->self.name))
+	    {
+	      t->levels[t->depth - 1].post = t->post;
+	      t->levels[t->depth - 1].self = t->self;
+	    }
+	  else if (t->post)
+	    {
+	      /* a directory that can’t be read still is an entry */
+	      ft->entry = t->self;
+	      ft->depth = t->depth - 1;
+	      ft->parent = t->path;
+	      return 0;
+	    }
+	}
+      if (! t->depth)
+	{
+	  findtree_free (t);
+	  ft->_state = NULL;
+	  return find_no_more_files ();
+	}
+      struct _find_t f;
+      bool matched, subdir;
+      if (! findtree_read (t, &f, &matched, &subdir))
+	{
+	  struct findtree_level *l = &t->levels[t->depth - 1];
+	  bool post = l->post;
+	  findtree_leave (t);
+	  if (! post) continue;
+	  ft->entry = l->self;
+	  ft->depth = t->depth - 1;
+	  ft->parent = t->path;
+	  return 0;
+	}
+      /* hidden, system and directory entries only when asked for */
+      matched = matched
+	&& ! ((f.attrib & (_A_HIDDEN | _A_SYSTEM | _A_SUBDIR)) & ~t->attrib);
+      ft->entry = f;
+      ft->depth = t->depth - 1;
+      ft->parent = t->path;
+      if (subdir && t->depth <= t->maxdepth
+	  && ! (t->skip && t->skip (ft, t->arg)))
+	{
+	  t->descend = true;
+	  t->post = matched && (t->flags & _FIND_POSTORDER);
+	  t->self = f;
+	  if (matched && ! t->post) return 0;
+	  continue;
+	}
+      if (matched) return 0;
+    }
+}
+
+unsigned
+_dosix__dos_findtree
+(const char *filename,
+ unsigned attrib,
+ unsigned flags,
+ unsigned maxdepth,
+ int (*skip) (const struct _findtree_t *, void *),
+ void *arg,
+ struct _findtree_t *ft)
+{
+  assert (filename), assert (ft);
+  struct _DOSERROR errorinfo = {0};
+  ft->_state = NULL;
+  struct findtree *t = calloc (1, sizeof (*t));
+  if (! t)
+    {
+      errno = ENOMEM;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  t->attrib = attrib;
+  t->flags = flags;
+  t->maxdepth = maxdepth;
+  t->skip = skip;
+  t->arg = arg;
+
+  /* entries are named after the directory part of filename */
+  const char *base = filename;
+  for (const char *p = filename; *p; p++)
+    if (*p == '\\' || *p == '/' || *p == ':') base = p + 1;
+  char *prefix = strndup (filename, base - filename);
+  bool ok = prefix && findtree_append (&t->path, &t->pathsize, 0,
+				       prefix, "");
+  free (prefix);
+  if (! ok)
+    {
+      findtree_free (t);
+      errno = ENOMEM;
+      return _dosix__dosexterr (&errorinfo);
+    }
+
+  struct dospath dp;
+  if (_dosix__path_resolve (filename, &dp))
+    {
+      findtree_free (t);
+      return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+    }
+  memccpy (t->pattern, dp.name, 0, sizeof (t->pattern));
+  t->pattern[sizeof (t->pattern) - 1] = '\0';
+  t->fat = dp.fat;
+  if (dp.fat)
+    ok = findtree_append (&t->host, &t->hostsize, 0, dp.dir, "");
+  if (! ok) errno = ENOMEM;
+  else ok = findtree_enter (t, dp.dirfd, ".", "");
+  _dosix__path_release (&dp);
+  if (! ok)
+    {
+      unsigned err = _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+      findtree_free (t);
+      return err;
+    }
+
+  ft->_state = t;
+  unsigned ret = findfirst_result (findtree_next (ft));
+  if (ret) errno = ENOENT;
+  return ret;
+}
+
+unsigned
+_dosix__dos_findtreenext
+(struct _findtree_t *ft)
+{
+  assert (ft);
+  unsigned ret = findtree_next (ft);
+  if (ret) errno = ENOENT;
+  return ret;
+}
+
+void
+_dosix__dos_findtreeclose
+(struct _findtree_t *ft)
+{
+  assert (ft);
+  if (ft->_state) findtree_free (ft->_state);
+  ft->_state = NULL;
+}
+
+
+/* _dos_getdrive, _dos_setdrive */
+
+void
+_dosix__dos_getdrive
+(unsigned *drive)
+{
+  assert (drive);
+  *drive = _dosix__drive_get () + 1;
+}
+
+static
+void
+cpu_getdrive
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETDRIVE);
+  cpu->l.al = _dosix__drive_get ();
+}
+
+void
+_dosix__dos_setdrive
+(unsigned drive,
+ unsigned *numdrives)
+{
+  assert (numdrives);
+  /* an invalid drive is silently ignored, as DOS does */
+  _dosix__drive_set (drive - 1);
+  *numdrives = _dosix__drive_count ();
+}
+
+static
+void
+cpu_setdrive
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_SETDRIVE);
+  unsigned numdrives;
+  _dosix__dos_setdrive (cpu->l.dl + 1, &numdrives);
+  cpu->l.al = numdrives;
+}
+
+
+/* _dos_getdiskfree */
+
+/* Total bytes in count clusters of space, saturated */
+static
+uint64_t
+diskfree_bytes
+(uint64_t count,
+ const struct drive_space *space)
+{
+  uint64_t bytes;
+  if (__builtin_mul_overflow (count,
+			      (uint64_t) space->bytes_per_sector
+			      * space->sectors_per_cluster,
+			      &bytes))
+    return UINT64_MAX;
+  return bytes;
+}
+
+/* Describe space with a geometry that fits the limits of the caller:
+   the cluster is grown, by doubling sectors per cluster, until the
+   cluster count fits; what still does not fit is capped, never
+   wrapped */
+static
+void
+diskfree_fit
+(const struct drive_space *space,
+ unsigned max_bps,
+ unsigned max_spc,
+ uint64_t max_clusters,
+ struct _diskfree_t *diskspace)
+{
+  uint64_t total = diskfree_bytes (space->total_clusters, space);
+  uint64_t avail = diskfree_bytes (space->avail_clusters, space);
+  uint64_t bps = space->bytes_per_sector <= max_bps
+    ? space->bytes_per_sector
+    : 512;
+  uint64_t spc = (uint64_t) space->bytes_per_sector
+    * space->sectors_per_cluster / bps;
+  if (! spc) spc = 1;
+  if (spc > max_spc) spc = max_spc;
+  while (total / (bps * spc) > max_clusters && spc * 2 <= max_spc)
+    spc *= 2;
+  total /= bps * spc;
+  avail /= bps * spc;
+  if (total > max_clusters) total = max_clusters;
+  if (avail > total) avail = total;
+  diskspace->total_clusters = total;
+  diskspace->avail_clusters = avail;
+  diskspace->sectors_per_cluster = spc;
+  diskspace->bytes_per_sector = bps;
+}
+
+unsigned
+_dosix__dos_getdiskfree
+(unsigned drive,
+ struct _diskfree_t *diskspace)
+{
+  assert (diskspace);
+  struct _DOSERROR errorinfo = {0};
+  struct drive_space space;
+  if (_dosix__drive_space ((int) drive - 1, &space))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  diskfree_fit (&space, UINT_MAX, 128, UINT_MAX, diskspace);
+  return 0;
+}
+
+static
+void
+cpu_getdiskfree
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETDISKFREE);
+  struct drive_space space;
+  struct _diskfree_t diskspace;
+  if (_dosix__drive_space ((int) cpu->l.dl - 1, &space))
+    {
+      cpu->r.ax = 0xffff;	/* invalid drive */
+      return;
+    }
+  /* 16-bit registers: the figures the DOS 5+ kernel itself reports
+     for large drives */
+  diskfree_fit (&space, 0x8000, 64, 0xffff, &diskspace);
+  cpu->r.ax = diskspace.sectors_per_cluster;
+  cpu->r.bx = diskspace.avail_clusters;
+  cpu->r.cx = diskspace.bytes_per_sector;
+  cpu->r.dx = diskspace.total_clusters;
+}
+
+
+/* current directory */
+
+static
+void
+cpu_chdir
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_CHDIR);
+  struct _DOSERROR errorinfo = {0};
+  if (_dosix__drive_chdir (_MK_FP (cpu->r.ds, cpu->r.dx)))
+    cpu->r.ax = _dosix__dosexterr (&errorinfo);
+  else cpu->r.ax = 0;
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+static
+void
+cpu_getcwd
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETCWD);
+  struct _DOSERROR errorinfo = {0};
+  /* DOS returns the path without drive and leading backslash, in a
+     64-byte buffer */
+  char path[64 + 3];
+  if (_dosix__drive_getcwd ((int) cpu->l.dl - 1, path, sizeof (path)))
+    {
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+      cpu->r.flags = 1;
+      return;
+    }
+  strcpy (_MK_FP (cpu->r.ds, cpu->r.si), path + 3);
+  cpu->r.ax = 0x0100;		/* undocumented, but relied upon */
+  cpu->r.flags = 0;
+}
+
+
+/* long file names */
+
+/* Host directories carry long names natively: every service below
+   works on them directly, and 8.3 aliases are only derived when a
+   program asks for one (7160h CL=1) */
+
+/* 100 ns intervals since 1601-01-01 */
+static
+uint64_t
+lfn_filetime
+(const struct timespec *ts)
+{
+  return ((uint64_t) ts->tv_sec + 11644473600) * 10000000
+    + ts->tv_nsec / 100;
+}
+
+/* Store a time of a found entry in the format the caller chose: 0 for
+   FILETIME, 1 for DOS time and date */
+static
+unsigned
+lfn_time
+(const struct findent *fe,
+ const struct timespec *ts,
+ unsigned format,
+ uint64_t *ft)
+{
+  unsigned date, time;
+  if (fe->image)
+    {
+      /* images keep the write time only */
+      date = fe->fat.wr_date;
+      time = fe->fat.wr_time;
+      if (format)
+	{
+	  *ft = time | date << 16;
+	  return 0;
+	}
+      time_t t;
+      unsigned err = unixtime_int (date, time, &t);
+      if (err) return err;
+      *ft = lfn_filetime (&(struct timespec) {.tv_sec = t});
+      return 0;
+    }
+  if (! format)
+    {
+      *ft = lfn_filetime (ts);
+      return 0;
+    }
+  unsigned err = dostime_int (&ts->tv_sec, &date, &time);
+  if (err) return err;
+  *ft = time | date << 16;
+  return 0;
+}
+
+static
+unsigned
+lfn_findnext
+(struct lfn_find *lf,
+ unsigned format,
+ struct lfn_finddata *fd)
+{
+  struct findent fe;
+  unsigned err;
+  do
+    if ((err = find_read (&lf->find, &fe)))
+      return err;
+  while ((fe.attrib & lf->required) != lf->required);
+  memset (fd, 0, sizeof (*fd));
+  fd->attrib = fe.attrib;
+  /* there is no birth time in struct stat: the status change time
+     stands for the creation time */
+  uint64_t cr, ac, wr;
+  if ((err = lfn_time (&fe, &fe.st.st_ctim, format, &cr))
+      || (err = lfn_time (&fe, &fe.st.st_atim, format, &ac))
+      || (err = lfn_time (&fe, &fe.st.st_mtim, format, &wr)))
+    return err;
+  fd->cr_time = cr, fd->ac_time = ac, fd->wr_time = wr;
+  uint64_t size = fe.image ? fe.fat.size : (uint64_t) fe.st.st_size;
+  fd->size_high = size >> 32;
+  fd->size_low = size;
+  size_t n = strnlen (fe.name, sizeof (fd->name) - 1);
+  memcpy (fd->name, fe.name, n);
+  fd->name[n] = '\0';
+  /* images store their aliases; host ones are not worth deriving for
+     every entry */
+  if (fe.image && strcmp (fe.fat.alias, fe.name))
+    strcpy (fd->alias, fe.fat.alias);
+  return 0;
+}
+
+static
+struct lfn_find *
+lfn_find_get
+(unsigned handle)
+{
+  if (handle < 1 || handle > LFN_FIND_MAX)
+    return NULL;
+  return task.lfn_finds[handle - 1];
+}
+
+static
+void
+cpu_lfn_findfirst
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_FINDFIRST);
+  struct _DOSERROR errorinfo = {0};
+  size_t i;
+  for (i = 0; i < LFN_FIND_MAX && task.lfn_finds[i]; i++);
+  struct lfn_find *lf = NULL;
+  if (i == LFN_FIND_MAX)
+    errno = EMFILE;
+  else lf = malloc (sizeof (*lf));
+  if (! lf)
+    {
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+      cpu->r.flags = 1;
+      return;
+    }
+  lf->required = cpu->h.ch;
+  unsigned err = find_open (&lf->find, _MK_FP (cpu->r.ds, cpu->r.dx),
+			    cpu->l.cl);
+  if (! err)
+    err = findfirst_result (lfn_findnext (lf, cpu->r.si,
+					 _MK_FP (cpu->r.es, cpu->r.di)));
+  if (err)
+    {
+      _dosix__dos_findclose (&lf->find);
+      free (lf);
+      cpu->r.ax = err;
+      cpu->r.flags = 1;
+      return;
+    }
+  task.lfn_finds[i] = lf;
+  cpu->r.ax = i + 1;
+  cpu->r.cx = 0;		/* no Unicode conversion took place */
+  cpu->r.flags = 0;
+}
+
+static
+void
+cpu_lfn_findnext
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_FINDNEXT);
+  struct _DOSERROR errorinfo = {0};
+  struct lfn_find *lf = lfn_find_get (cpu->r.bx);
+  if (! lf)
+    {
+      errno = EBADF;
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+    }
+  else cpu->r.ax = lfn_findnext (lf, cpu->r.si,
+				 _MK_FP (cpu->r.es, cpu->r.di));
+  cpu->r.cx = 0;
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+static
+void
+cpu_lfn_findclose
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_FINDCLOSE);
+  struct _DOSERROR errorinfo = {0};
+  struct lfn_find *lf = lfn_find_get (cpu->r.bx);
+  if (! lf)
+    {
+      errno = EBADF;
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+      cpu->r.flags = 1;
+      return;
+    }
+  _dosix__dos_findclose (&lf->find);
+  free (lf);
+  task.lfn_finds[cpu->r.bx - 1] = NULL;
+  cpu->r.ax = 0;
+  cpu->r.flags = 0;
+}
+
+/* Extended open or create: the action flags in DX choose between
+   opening, truncating and creating */
+static
+unsigned
+lfn_extopen
+(const char *path,
+ unsigned mode,
+ unsigned attrib,
+ unsigned action,
+ int *handle,
+ unsigned *taken)
+{
+  struct _DOSERROR errorinfo = {0};
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  struct stat fs;
+  struct fatent ent;
+  bool exists = dp.fat
+    ? ! _dosix__fat_stat (dp.fat, dp.dir, dp.name, &ent)
+    : ! fstatat (dp.dirfd, dp.name, &fs, 0);
+  _dosix__path_release (&dp);
+  unsigned err;
+  if (exists && action & 0x02)
+    {
+      if ((err = dos_open (path, mode, handle, true)))
+	return err;
+      *taken = 3;		/* replaced */
+      return 0;
+    }
+  if (exists && action & 0x01)
+    {
+      *taken = 1;		/* opened */
+      return _dosix__dos_open (path, mode, handle);
+    }
+  if (! exists && action & 0x10)
+    {
+      *taken = 2;		/* created */
+      return dos_creat (path, attrib, handle, O_RDWR | O_CREAT | O_EXCL);
+    }
+  errno = exists ? EEXIST : ENOENT;
+  return _dosix__dosexterr (&errorinfo);
+}
+
+static
+void
+cpu_lfn_extopen
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_EXTOPEN);
+  int handle;
+  unsigned taken;
+  /* the commit and critical error bits of BX have no meaning here */
+  unsigned err = lfn_extopen (_MK_FP (cpu->r.ds, cpu->r.si),
+			      cpu->l.bl,
+			      cpu->r.cx,
+			      cpu->r.dx,
+			      &handle,
+			      &taken);
+  cpu->r.ax = err ? err : (unsigned) handle;
+  if (! err) cpu->r.cx = taken;
+  cpu->r.flags = err ? 1 : 0;
+}
+
+/* Status of path for the time and size subfunctions of 7143h */
+static
+unsigned
+lfn_stat
+(const char *path,
+ struct findent *fe)
+{
+  struct _DOSERROR errorinfo = {0};
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  int ret;
+  fe->image = dp.fat;
+  if (dp.fat)
+    {
+      ret = _dosix__fat_stat (dp.fat, dp.dir, dp.name, &fe->fat);
+      if (! ret)
+	{
+	  struct drive_space space;
+	  _dosix__fat_space (dp.fat, &space);
+	  uint64_t cluster = space.sectors_per_cluster
+	    * space.bytes_per_sector;
+	  /* images keep the write time only */
+	  time_t t = 0;
+	  unixtime_int (fe->fat.wr_date, fe->fat.wr_time, &t);
+	  fe->st = (struct stat)
+	    {
+	     .st_size = fe->fat.size,
+	     .st_blocks = (fe->fat.size + cluster - 1) / cluster
+	     * cluster / 512,
+	     .st_atim.tv_sec = t,
+	     .st_mtim.tv_sec = t,
+	     .st_ctim.tv_sec = t
+	    };
+	}
+    }
+  else ret = fstatat (dp.dirfd, dp.name, &fe->st, 0);
+  _dosix__path_release (&dp);
+  if (ret)
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  return 0;
+}
+
+/* Set the access and write times of path; UTIME_OMIT leaves one */
+static
+unsigned
+lfn_utime
+(const char *path,
+ unsigned acdate,
+ unsigned wrdate,
+ unsigned wrtime)
+{
+  struct _DOSERROR errorinfo = {0};
+  struct timespec ts[2] =
+    {{.tv_nsec = UTIME_OMIT}, {.tv_nsec = UTIME_OMIT}};
+  time_t t;
+  unsigned err;
+  if (acdate != UINT_MAX)
+    {
+      if ((err = unixtime_int (acdate, 0, &t)))
+	return err;
+      ts[0] = (struct timespec) {.tv_sec = t};
+    }
+  if (wrdate != UINT_MAX)
+    {
+      if ((err = unixtime_int (wrdate, wrtime, &t)))
+	return err;
+      ts[1] = (struct timespec) {.tv_sec = t};
+    }
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  int ret = -1;
+  if (dp.fat)
+    errno = EROFS;		/* disk images are read-only */
+  else ret = utimensat (dp.dirfd, dp.name, ts, 0);
+  _dosix__path_release (&dp);
+  if (ret)
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  return 0;
+}
+
+static
+void
+cpu_lfn_fileattr
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_FILE_METADATA);
+  struct _DOSERROR errorinfo = {0};
+  const char *path = _MK_FP (cpu->r.ds, cpu->r.dx);
+  struct findent fe;
+  unsigned attrib, date, time;
+  unsigned err = 0;
+  switch (cpu->l.bl)
+    {
+    case INT21_BL_LFN_GETFILEATTR: /* 0x00 */
+      if (! (err = _dosix__dos_getfileattr (path, &attrib)))
+	cpu->r.cx = attrib;
+      break;
+    case INT21_BL_LFN_SETFILEATTR: /* 0x01 */
+      err = _dosix__dos_setfileattr (path, cpu->r.cx);
+      break;
+    case INT21_BL_LFN_GETPHYSSIZE: /* 0x02 */
+      if (! (err = lfn_stat (path, &fe)))
+	{
+	  uint64_t size = (uint64_t) fe.st.st_blocks * 512;
+	  cpu->r.ax = size & 0xffff;
+	  cpu->r.dx = size >> 16 & 0xffff;
+	  cpu->r.flags = 0;
+	  return;
+	}
+      break;
+    case INT21_BL_LFN_SETWRTIME: /* 0x03 */
+      err = lfn_utime (path, UINT_MAX, cpu->r.di, cpu->r.cx);
+      break;
+    case INT21_BL_LFN_GETWRTIME: /* 0x04 */
+      if (! (err = lfn_stat (path, &fe))
+	  && ! (err = dostime_int (&fe.st.st_mtime, &date, &time)))
+	cpu->r.di = date, cpu->r.cx = time;
+      break;
+    case INT21_BL_LFN_SETACDATE: /* 0x05 */
+      err = lfn_utime (path, cpu->r.di, UINT_MAX, 0);
+      break;
+    case INT21_BL_LFN_GETACDATE: /* 0x06 */
+      if (! (err = lfn_stat (path, &fe))
+	  && ! (err = dostime_int (&fe.st.st_atime, &date, NULL)))
+	cpu->r.di = date;
+      break;
+    case INT21_BL_LFN_SETCRTIME: /* 0x07 */
+      /* the host has no settable creation time: only check path */
+      err = lfn_stat (path, &fe);
+      break;
+    case INT21_BL_LFN_GETCRTIME: /* 0x08 */
+      if (! (err = lfn_stat (path, &fe))
+	  && ! (err = dostime_int (&fe.st.st_ctime, &date, &time)))
+	{
+	  cpu->r.di = date, cpu->r.cx = time;
+	  cpu->r.si = fe.st.st_ctime % 2 * 100
+	    + fe.st.st_ctim.tv_nsec / 10000000;
+	}
+      break;
+    default:
+      errno = ENOSYS;
+      err = _dosix__dosexterr (&errorinfo);
+      break;
+    }
+  cpu->r.ax = err;
+  cpu->r.flags = err ? 1 : 0;
+}
+
+static
+void
+cpu_lfn_chdir
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_CHDIR);
+  struct _DOSERROR errorinfo = {0};
+  if (_dosix__drive_chdir (_MK_FP (cpu->r.ds, cpu->r.dx)))
+    cpu->r.ax = _dosix__dosexterr (&errorinfo);
+  else cpu->r.ax = 0;
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+static
+void
+cpu_lfn_getcwd
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_GETCWD);
+  struct _DOSERROR errorinfo = {0};
+  char path[PATH_MAX + 3];
+  if (_dosix__drive_getcwd ((int) cpu->l.dl - 1, path, sizeof (path)))
+    cpu->r.ax = _dosix__dosexterr (&errorinfo);
+  else if (strlen (path + 3) >= 260)
+    {
+      errno = ENAMETOOLONG;
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+    }
+  else
+    {
+      strcpy (_MK_FP (cpu->r.ds, cpu->r.si), path + 3);
+      cpu->r.ax = 0;
+    }
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+/* Fully qualify path into buffer, a 261-byte one.  Each component is
+   looked up in turn for the short and long forms */
+static
+unsigned
+lfn_truename
+(const char *path,
+ unsigned form,
+ char *buffer)
+{
+  struct _DOSERROR errorinfo = {0};
+  struct dospath dp;
+  if (_dosix__path_resolve (path, &dp))
+    return _dosix__dosexterr (&errorinfo); /* TODO? better error handling */
+  char rel[PATH_MAX];
+  int n = ! strcmp (dp.name, ".")
+    ? snprintf (rel, sizeof (rel), "%s", dp.dir)
+    : snprintf (rel, sizeof (rel), "%s%s%s", dp.dir,
+		*dp.dir ? "/" : "", dp.name);
+  char drive = 'A' + dp.drive;
+  _dosix__path_release (&dp);
+  if (n < 0 || (size_t) n >= sizeof (rel))
+    {
+      errno = ENAMETOOLONG;
+      return _dosix__dosexterr (&errorinfo);
+    }
+
+  char out[PATH_MAX + 3] = {drive, ':', '\\'};
+  size_t len = 3;
+  /* each query addresses its component by the name as given */
+  char query[PATH_MAX + 3] = {drive, ':', '\\'};
+  size_t qlen = 3;
+  char *save;
+  for (char *c = strtok_r (rel, "/", &save); c;
+       c = strtok_r (NULL, "/", &save))
+    {
+      if (qlen > 3) query[qlen++] = '\\';
+      strcpy (query + qlen, c);
+      qlen += strlen (c);
+      char alias[13];
+      const char *name = c;
+      struct fatent ent;
+      struct stat fs;
+      if (_dosix__path_resolve (query, &dp))
+	return _dosix__dosexterr (&errorinfo);
+      int ret = 0;
+      if (form == INT21_CL_LFN_TRUENAME_CANONICAL);
+      else if (dp.fat)
+	{
+	  ret = _dosix__fat_stat (dp.fat, dp.dir, dp.name, &ent);
+	  name = form == INT21_CL_LFN_TRUENAME_SHORT
+	    ? ent.alias : ent.name;
+	}
+      else if (form == INT21_CL_LFN_TRUENAME_SHORT)
+	{
+	  ret = fstatat (dp.dirfd, dp.name, &fs, 0)
+	    || _dosix__alias_get (dp.dirfd, dp.name, alias);
+	  name = alias;
+	}
+      else ret = fstatat (dp.dirfd, dp.name, &fs, 0);
+      _dosix__path_release (&dp);
+      if (ret)
+	return _dosix__dosexterr (&errorinfo);
+      size_t nlen = strlen (name);
+      if (len + nlen + 1 >= sizeof (out))
+	{
+	  errno = ENAMETOOLONG;
+	  return _dosix__dosexterr (&errorinfo);
+	}
+      if (len > 3) out[len++] = '\\';
+      memcpy (out + len, name, nlen + 1);
+      len += nlen;
+    }
+  out[len] = '\0';
+  if (len >= 261)
+    {
+      errno = ENAMETOOLONG;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  strcpy (buffer, out);
+  return 0;
+}
+
+static
+void
+cpu_lfn_truename
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_TRUENAME);
+  struct _DOSERROR errorinfo = {0};
+  /* CH bit 7, SUBST expansion, is moot: drives map straight to the
+     host */
+  switch (cpu->l.cl)
+    {
+    case INT21_CL_LFN_TRUENAME_CANONICAL: /* 0x00 */
+    case INT21_CL_LFN_TRUENAME_SHORT: /* 0x01 */
+    case INT21_CL_LFN_TRUENAME_LONG: /* 0x02 */
+      cpu->r.ax = lfn_truename (_MK_FP (cpu->r.ds, cpu->r.si),
+				cpu->l.cl,
+				_MK_FP (cpu->r.es, cpu->r.di));
+      break;
+    default:
+      errno = ENOSYS;
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+      break;
+    }
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+static
+void
+cpu_lfn_volinfo
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_VOLINFO);
+  struct _DOSERROR errorinfo = {0};
+  struct dospath dp;
+  if (_dosix__path_resolve (_MK_FP (cpu->r.ds, cpu->r.dx), &dp))
+    {
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+      cpu->r.flags = 1;
+      return;
+    }
+  const char *fsname = ! dp.fat ? "DOSIX"
+    : _dosix__fat_type (dp.fat) == 32 ? "FAT32" : "FAT";
+  /* searches are case-insensitive, and case is preserved */
+  cpu->r.bx = 0x4000 | 0x0002;
+  _dosix__path_release (&dp);
+  char *buffer = _MK_FP (cpu->r.es, cpu->r.di);
+  if (buffer && cpu->r.cx > 0)
+    snprintf (buffer, cpu->r.cx, "%s", fsname);
+  cpu->r.cx = 255;		/* maximum file name length */
+  cpu->r.dx = 260;		/* maximum path length */
+  cpu->r.ax = 0;
+  cpu->r.flags = 0;
+}
+
+static
+void
+cpu_lfn_basis
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_LFN);
+  assert (cpu->l.al == INT21_AL_LFN_BASIS);
+  struct _DOSERROR errorinfo = {0};
+  char fcb[11];
+  _dosix__alias_basis (_MK_FP (cpu->r.ds, cpu->r.si), fcb);
+  switch (cpu->h.dh)
+    {
+    case 0:			/* FCB format */
+      memcpy (_MK_FP (cpu->r.es, cpu->r.di), fcb, sizeof (fcb));
+      cpu->r.ax = 0;
+      break;
+    case 1:			/* ASCIZ 8.3 format */
+      _dosix__alias_format (fcb, _MK_FP (cpu->r.es, cpu->r.di));
+      cpu->r.ax = 0;
+      break;
+    default:
+      errno = ENOSYS;
+      cpu->r.ax = _dosix__dosexterr (&errorinfo);
+      break;
+    }
+  cpu->r.flags = cpu->r.ax ? 1 : 0;
+}
+
+
+/* _dos_getdate */
+
+void
+_dosix__dos_getdate
+(struct _dosdate_t *date)
+{
+  assert (date);
+  struct timeval tv;
+  _dosix__clock_get (&tv);
+  dostime_struct (&tv, date, NULL);
+}
+
+static
+void
+cpu_getdate
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETDATE);
+  struct _dosdate_t date;
+  _dosix__dos_getdate (&date);
+  cpu->r.cx = date.year;
+  cpu->h.dh = date.month;
+  cpu->l.dl = date.day;
+  cpu->l.al = date.dayofweek; /* DOS 1.10+ */
+}
+
+
+/* _dos_setdate */
+
+unsigned
+_dosix__dos_setdate
+(struct _dosdate_t *date)
+{
+  assert (date);
+  struct _dostime_t time;
+  _dosix__dos_gettime (&time);
+  struct timeval tv;
+  unsigned err = unixtime_struct (date, &time, &tv);
+  if (err) return err;
+  _dosix__clock_set (&tv);
+  return 0;
+}
+
+static
+void
+cpu_setdate
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_SETDATE);
+  struct _dosdate_t date =
+    {
+     .year = cpu->r.cx,
+     .month = cpu->h.dh,
+     .day = cpu->l.dl
+    };
+  /* AL = result
+     00h successful
+     FFh invalid time, system time unchanged */
+  cpu->l.al = _dosix__dos_setdate (&date) ? 0xff : 0x00;
+}
+
+
+/* _dos_gettime */
+
+void
+_dosix__dos_gettime
+(struct _dostime_t *time)
+{
+  assert (time);
+  struct timeval tv;
+  _dosix__clock_get (&tv);
+  dostime_struct (&tv, NULL, time);
+}
+
+static
+void
+cpu_gettime
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETTIME);
+  struct _dostime_t time;
+  _dosix__dos_gettime (&time);
+  cpu->h.ch = time.hour;
+  cpu->l.cl = time.minute;
+  cpu->h.dh = time.second;
+  cpu->l.dl = time.hsecond;
+}
+
+
+/* _dos_settime */
+
+unsigned
+_dosix__dos_settime
+(struct _dostime_t *time)
+{
+  assert (time);
+  struct _dosdate_t date;
+  _dosix__dos_getdate (&date);
+  struct timeval tv;
+  unsigned err = unixtime_struct (&date, time, &tv);
+  if (err) return err;
+  _dosix__clock_set (&tv);
+  return 0;
+}
+
+static
+void
+cpu_settime
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_SETTIME);
+  struct _dostime_t time =
+    {
+     .hour = cpu->h.ch,
+     .minute = cpu->l.cl,
+     .second = cpu->h.dh,
+     .hsecond = cpu->l.dl
+    };
+  /* AL = result
+     00h successful
+     FFh invalid time, system time unchanged */
+  cpu->l.al = _dosix__dos_settime (&time) ? 0xff : 0x00;
+}
+
+
+/* _bios_timeofday */
+
+static
+void
+cpu_getclock
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT1A_AH_GETCLOCK);
+  long ticks;
+  cpu->l.al = _dosix__bios_timeofday (_TIME_GETCLOCK, &ticks);
+  cpu->r.cx = ticks >> 16;
+  cpu->r.dx = ticks & 0xffff;
+}
+
+static
+void
+cpu_setclock
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT1A_AH_SETCLOCK);
+  long ticks = (long) (cpu->r.cx & 0xffff) << 16 | (cpu->r.dx & 0xffff);
+  _dosix__bios_timeofday (_TIME_SETCLOCK, &ticks);
+}
+
+
+/* real-time clock */
+
+/* The real-time clock is the DOS clock, which thus changes at once
+   when it is set, rather than at the next boot */
+
+static
+uint8_t
+bcd_from_int
+(unsigned n)
+{
+  return (n / 10 % 10) << 4 | n % 10;
+}
+
+/* Returns -1 if bcd is not a valid BCD number */
+static
+int
+bcd_to_int
+(uint8_t bcd)
+{
+  if ((bcd >> 4) > 9 || (bcd & 0xf) > 9) return -1;
+  return (bcd >> 4) * 10 + (bcd & 0xf);
+}
+
+static
+void
+cpu_getrtctime
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT1A_AH_GETRTCTIME);
+  struct timeval tv;
+  _dosix__clock_get (&tv);
+  struct tm tm;
+  if (_dosix__time_local (tv.tv_sec, &tm))
+    {
+      cpu->r.flags = 1;		/* clock not running */
+      return;
+    }
+  cpu->h.ch = bcd_from_int (tm.tm_hour);
+  cpu->l.cl = bcd_from_int (tm.tm_min);
+  cpu->h.dh = bcd_from_int (tm.tm_sec);
+  cpu->l.dl = tm.tm_isdst > 0;	/* daylight saving time */
+  cpu->r.flags = 0;
+}
+
+static
+void
+cpu_setrtctime
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT1A_AH_SETRTCTIME);
+  int hour = bcd_to_int (cpu->h.ch);
+  int minute = bcd_to_int (cpu->l.cl);
+  int second = bcd_to_int (cpu->h.dh);
+  if (hour < 0 || minute < 0 || second < 0)
+    {
+      cpu->r.flags = 1;
+      return;
+    }
+  /* DL, the daylight saving time option, is the zone’s business */
+  struct _dostime_t time =
+    {
+     .hour = hour,
+     .minute = minute,
+     .second = second
+    };
+  cpu->r.flags = _dosix__dos_settime (&time) ? 1 : 0;
+}
+
+static
+void
+cpu_getrtcdate
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT1A_AH_GETRTCDATE);
+  struct _dosdate_t date;
+  _dosix__dos_getdate (&date);
+  cpu->h.ch = bcd_from_int (date.year / 100);
+  cpu->l.cl = bcd_from_int (date.year % 100);
+  cpu->h.dh = bcd_from_int (date.month);
+  cpu->l.dl = bcd_from_int (date.day);
+  cpu->r.flags = 0;
+}
+
+static
+void
+cpu_setrtcdate
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT1A_AH_SETRTCDATE);
+  int century = bcd_to_int (cpu->h.ch);
+  int year = bcd_to_int (cpu->l.cl);
+  int month = bcd_to_int (cpu->h.dh);
+  int day = bcd_to_int (cpu->l.dl);
+  if (century < 0 || year < 0 || month < 0 || day < 0)
+    {
+      cpu->r.flags = 1;
+      return;
+    }
+  struct _dosdate_t date =
+    {
+     .year = century * 100 + year,
+     .month = month,
+     .day = day
+    };
+  cpu->r.flags = _dosix__dos_setdate (&date) ? 1 : 0;
+}
+
+
+/* _dos_getvect */
+
+syscall_t
+_dosix__dos_getvect
+(unsigned intnum)
+{
+  assert (intnum <= UINT8_MAX);
+  return __atomic_load_n (&int_vect[intnum], __ATOMIC_ACQUIRE);
+}
+
+static
+void
+cpu_getvect
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETVECT);
+  syscall_t syscall = _dosix__dos_getvect (cpu->l.al);
+  cpu->r.es = _FP_SEG (syscall);
+  cpu->r.bx = _FP_OFF (syscall);
+}
+
+
+/* timer_check */
+
+/* Timer interrupts are only raised for those who listen */
+static
+void
+timer_check
+(unsigned intnum)
+{
+  if (intnum != INT08_TIMER && intnum != INT1C_TIMER_TICK) return;
+  _dosix__timer_hook
+    (__atomic_load_n (&int_vect[INT08_TIMER], __ATOMIC_ACQUIRE)
+     != int08_timer
+     || __atomic_load_n (&int_vect[INT1C_TIMER_TICK], __ATOMIC_ACQUIRE)
+     != int1c_timer_tick
+     || __atomic_load_n (&vect_chains[INT08_TIMER], __ATOMIC_ACQUIRE)
+     || __atomic_load_n (&vect_chains[INT1C_TIMER_TICK], __ATOMIC_ACQUIRE));
+}
+
+
+/* _dos_setvect */
+
+void
+_dosix__dos_setvect
+(unsigned intnum,
+ syscall_t syscall)
+{
+  assert (syscall);
+  assert (intnum <= UINT8_MAX);
+  __atomic_store_n (&int_vect[intnum], syscall, __ATOMIC_RELEASE);
+  timer_check (intnum);
+}
+
+static
+void
+cpu_setvect
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_SETVECT);
+  _dosix__dos_setvect (cpu->l.al,
+		       _MK_FP (cpu->r.ds, cpu->r.dx));
+}
+
+
+/* _dos_hookvect, _dos_unhookvect */
+
+/* Hooking and unhooking take vect_lock and swap in a new chain, so
+   interrupts never wait.  A chain replaced may still be walked by an
+   interrupt that loaded it before, so it is only freed once no
+   interrupt is seen going through its vector: by the next hook or
+   unhook, or by the last interrupt to leave. */
+
+/* Free the chains retired from intnum if nothing walks them; caller
+   holds vect_lock */
+static
+void
+vect_reap
+(unsigned intnum)
+{
+  if (__atomic_load_n (&vect_readers[intnum].count, __ATOMIC_SEQ_CST))
+    return;
+  while (vect_retired[intnum])
+    {
+      struct vect_chain *next = vect_retired[intnum]->retired;
+      free (vect_retired[intnum]);
+      __atomic_store_n (&vect_retired[intnum], next, __ATOMIC_RELAXED);
+    }
+}
+
+/* Publish chain for intnum and retire the one it replaces; caller
+   holds vect_lock */
+static
+void
+vect_publish
+(unsigned intnum,
+ struct vect_chain *chain)
+{
+  struct vect_chain *old = __atomic_exchange_n (&vect_chains[intnum], chain,
+						__ATOMIC_SEQ_CST);
+  if (old)
+    {
+      old->retired = vect_retired[intnum];
+      __atomic_store_n (&vect_retired[intnum], old, __ATOMIC_SEQ_CST);
+    }
+  vect_reap (intnum);
+}
+
+unsigned
+_dosix__dos_hookvect
+(unsigned intnum,
+ int (*handler) (cpu_t *, void *),
+ void *arg)
+{
+  assert (handler);
+  assert (intnum <= UINT8_MAX);
+  struct _DOSERROR errorinfo = {0};
+  pthread_mutex_lock (&vect_lock);
+  struct vect_chain *old = vect_chains[intnum];
+  size_t count = old ? old->count : 0;
+  struct vect_chain *chain =
+    malloc (sizeof (*chain) + (count + 1) * sizeof (*chain->hooks));
+  if (! chain)
+    {
+      pthread_mutex_unlock (&vect_lock);
+      errno = ENOMEM;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  chain->count = count + 1;
+  chain->hooks[0] = (struct vect_hook) {.handler = handler, .arg = arg};
+  if (count)
+    memcpy (&chain->hooks[1], old->hooks, count * sizeof (*old->hooks));
+  vect_publish (intnum, chain);
+  pthread_mutex_unlock (&vect_lock);
+  timer_check (intnum);
+  return 0;
+}
+
+unsigned
+_dosix__dos_unhookvect
+(unsigned intnum,
+ int (*handler) (cpu_t *, void *),
+ void *arg)
+{
+  assert (handler);
+  assert (intnum <= UINT8_MAX);
+  struct _DOSERROR errorinfo = {0};
+  pthread_mutex_lock (&vect_lock);
+  struct vect_chain *old = vect_chains[intnum];
+  size_t i;
+  for (i = 0; old && i < old->count; i++)
+    if (old->hooks[i].handler == handler && old->hooks[i].arg == arg)
+      break;
+  if (! old || i == old->count)
+    {
+      pthread_mutex_unlock (&vect_lock);
+      errno = EINVAL;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  struct vect_chain *chain = NULL;
+  if (old->count > 1)
+    {
+      chain = malloc (sizeof (*chain)
+		      + (old->count - 1) * sizeof (*chain->hooks));
+      if (! chain)
+	{
+	  pthread_mutex_unlock (&vect_lock);
+	  errno = ENOMEM;
+	  return _dosix__dosexterr (&errorinfo);
+	}
+      chain->count = old->count - 1;
+      memcpy (chain->hooks, old->hooks, i * sizeof (*old->hooks));
+      memcpy (&chain->hooks[i], &old->hooks[i + 1],
+	      (old->count - i - 1) * sizeof (*old->hooks));
+    }
+  vect_publish (intnum, chain);
+  pthread_mutex_unlock (&vect_lock);
+  timer_check (intnum);
+  return 0;
+}
+
+
+/* write_stdout */
+
+static
+unsigned
+write_stdout
+(const char *string)
+{
+  for (size_t i = 0; string[i] != '$'; i++)
+    {
+      int ret = putchar (string[i]);
+      if (ret == EOF) break;
+    }
+  return '$';
+}
+
+static
+void
+cpu_write_stdout
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_WRITE_STDOUT);
+  cpu->r.ax = write_stdout (_MK_FP (cpu->r.ds,
+				    cpu->r.dx));
+}
+
+
+/* libc-based kernel services */
+
+static
+void
+cpu_getch
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETCH);
+  cpu->l.al = _dosix__getch ();
+}
+
+static
+void
+cpu_getche
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_GETCHE);
+  cpu->l.al = _dosix__getche ();
+}
+
+static
+void
+cpu_putch
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT21_AH_PUTCH);
+  cpu->l.al = _dosix__putch (cpu->l.dl);
+}
+
+
+/* call_syscall */
+
+static
+void
+call_syscall
+(uint8_t intnum,
+ cpu_t *cpu,
+ syscall_t syscall)
+{
+  if (! syscall)
+    errx (86,
+	  "Not implemented: "
+	  "INT %02Xh "
+	  "AX=%04Xh "
+	  "BX=%04Xh "
+	  "CX=%04Xh "
+	  "DX=%04Xh ",
+	  intnum,
+	  cpu->r.ax,
+	  cpu->r.bx,
+	  cpu->r.cx,
+	  cpu->r.dx);
+  else if (__builtin_expect (_dosix__trace_enabled, 0) && ! task.traced)
+    trace_syscall (intnum,
+		   cpu,
+		   syscall);
+  else
+    syscall (cpu);
+}
+
+
+/* interrupt */
+
+static
+void
+interrupt
+(uint8_t intnum,
+ cpu_t *cpu)
+{
+  assert (cpu);
+  /* hooked handlers first, each passing the interrupt on by returning
+     zero */
+  if (__atomic_load_n (&vect_chains[intnum], __ATOMIC_RELAXED))
+    {
+      __atomic_add_fetch (&vect_readers[intnum].count, 1, __ATOMIC_SEQ_CST);
+      const struct vect_chain *chain =
+	__atomic_load_n (&vect_chains[intnum], __ATOMIC_SEQ_CST);
+      bool handled = false;
+      for (size_t i = 0; chain && ! handled && i < chain->count; i++)
+	handled = chain->hooks[i].handler (cpu, chain->hooks[i].arg);
+      /* the last one out frees what was retired meanwhile, unless
+	 a hook or unhook is under way and will */
+      if (! __atomic_sub_fetch (&vect_readers[intnum].count, 1, __ATOMIC_SEQ_CST)
+	  && __atomic_load_n (&vect_retired[intnum], __ATOMIC_SEQ_CST)
+	  && ! pthread_mutex_trylock (&vect_lock))
+	{
+	  vect_reap (intnum);
+	  pthread_mutex_unlock (&vect_lock);
+	}
+      if (handled) return;
+    }
+  call_syscall (intnum,
+		cpu,
+		__atomic_load_n (&int_vect[intnum], __ATOMIC_ACQUIRE));
+}
+
+
+/* intr */
+
+void
+_dosix_intr
+(int intnum,
+ union REGPACK *regs)
+{
+  cpu_t cpu = {0};
+  interrupt (intnum, regs ? (cpu_t *) regs : &cpu);
+}
+
+
+/* _int86x */
+
+/* The service works on outregs itself, once inregs is copied over
+   unless they are one and the same */
+int
+_dosix__int86x
+(int intnum,
+ union _REGS *inregs,
+ union _REGS *outregs,
+ struct _SREGS *segregs)
+{
+  cpu_t regs;
+  cpu_t *cpu = outregs ? outregs : &regs;
+  if (! inregs) *cpu = (cpu_t) {0};
+  else if (inregs != cpu) *cpu = *inregs;
+  if (segregs)
+    {
+      cpu->r.ds = segregs->ds;
+      cpu->r.es = segregs->es;
+      cpu->r.ss = segregs->ss;
+    };
+  interrupt (intnum, cpu);
+  if (outregs && cpu->r.flags)
+    _dosix__doserrno = cpu->r.ax;
+  /* with no code segment to switch, CS comes back as it went */
+  if (segregs)
+    *segregs = (_SREGS)
+      {
+       .es = cpu->r.es,
+       .cs = segregs->cs,
+       .ss = cpu->r.ss,
+       .ds = cpu->r.ds
+      };
+  return cpu->r.ax;
+}
+
+
+/* _int86 */
+
+int
+_dosix__int86
+(int intnum,
+ union _REGS *inregs,
+ union _REGS *outregs)
+{
+  return _dosix__int86x (intnum,
+			 inregs,
+			 outregs,
+			 NULL);
+}
+
+
+/* _intdosx */
+
+int
+_dosix__intdosx
+(union _REGS *inregs,
+ union _REGS *outregs,
+ struct _SREGS *segregs)
+{
+  return _dosix__int86x (INT21_MAIN_DOS_API,
+			 inregs,
+			 outregs,
+			 segregs);
+}
+
+
+/* _intdos */
+
+int
+_dosix__intdos
+(union _REGS *inregs,
+ union _REGS *outregs)
+{
+  return _dosix__intdosx (inregs,
+			  outregs,
+			  NULL);
+}
+
+
+/* _bdos */
+
+int
+_dosix__bdos
+(int dosfunc,
+ unsigned int dosdx,
+ unsigned int dosal)
+{
+  union _REGS inregs;
+  union _REGS outregs;
+  inregs.h.ah = dosfunc;
+  inregs.x.dx = dosdx;
+  inregs.h.al = dosal;
+  return _dosix__intdos (&inregs,
+			 &outregs);
+}
+
+
+/* DOSix extensions installation check */
+
+static
+void
+cpu_dosix_install_check
+(cpu_t *cpu)
+{
+  assert (cpu);
+  assert (cpu->h.ah == INT2F_AH_DOSIX);
+  assert (cpu->l.al == INT2F_AL_DOSIX_INSTALL_CHECK);
+  cpu->l.al = 0xff;		/* installed */
+  cpu->r.bx = DOSIX_EXT_VERSION;
+}
+
+
+/* service tables */
+
+/* Each vector with sub-functions lists its services as
+   FN (AH, function), and those where AH leaves the choice to another
+   register as SUB (AH, register, list), list naming the sub-functions
+   as SUBFN (value, function).  The register is AL or BL, or BX when
+   the whole of it is taken */
+
+#define INT1A_SERVICES(FN, SUB)			\
+  FN (INT1A_AH_GETCLOCK, cpu_getclock)		\
+  FN (INT1A_AH_SETCLOCK, cpu_setclock)		\
+  FN (INT1A_AH_GETRTCTIME, cpu_getrtctime)	\
+  FN (INT1A_AH_SETRTCTIME, cpu_setrtctime)	\
+  FN (INT1A_AH_GETRTCDATE, cpu_getrtcdate)	\
+  FN (INT1A_AH_SETRTCDATE, cpu_setrtcdate)
+
+#define INT21_SERVICES(FN, SUB)				\
+  FN (INT21_AH_GETCHE, cpu_getche)			\
+  FN (INT21_AH_PUTCH, cpu_putch)			\
+  FN (INT21_AH_GETCH, cpu_getch)			\
+  FN (INT21_AH_WRITE_STDOUT, cpu_write_stdout)		\
+  FN (INT21_AH_SETDRIVE, cpu_setdrive)			\
+  FN (INT21_AH_GETDRIVE, cpu_getdrive)			\
+  FN (INT21_AH_SET_DTA_ADDR, cpu_set_dta_addr)		\
+  FN (INT21_AH_SETVECT, cpu_setvect)			\
+  FN (INT21_AH_GETDATE, cpu_getdate)			\
+  FN (INT21_AH_SETDATE, cpu_setdate)			\
+  FN (INT21_AH_GETTIME, cpu_gettime)			\
+  FN (INT21_AH_SETTIME, cpu_settime)			\
+  FN (INT21_AH_GET_DTA_ADDR, cpu_get_dta_addr)		\
+  FN (INT21_AH_GETVECT, cpu_getvect)			\
+  FN (INT21_AH_GETDISKFREE, cpu_getdiskfree)		\
+  FN (INT21_AH_CHDIR, cpu_chdir)			\
+  FN (INT21_AH_CREAT, cpu_creat)			\
+  FN (INT21_AH_OPEN, cpu_open)				\
+  FN (INT21_AH_CLOSE, cpu_close)			\
+  FN (INT21_AH_READ, cpu_read)				\
+  FN (INT21_AH_WRITE, cpu_write)			\
+  FN (INT21_AH_SEEK, cpu_seek)				\
+  SUB (INT21_AH_FILE_METADATA, AL, INT21_FILE_METADATA)	\
+  FN (INT21_AH_GETCWD, cpu_getcwd)			\
+  FN (INT21_AH_ALLOCMEM, cpu_allocmem)			\
+  FN (INT21_AH_FREEMEM, cpu_freemem)			\
+  FN (INT21_AH_SETBLOCK, cpu_setblock)			\
+  FN (INT21_AH_FINDFIRST, cpu_findfirst)		\
+  FN (INT21_AH_FINDNEXT, cpu_findnext)			\
+  SUB (INT21_AH_FILE_TIME, AL, INT21_FILE_TIME)		\
+  SUB (INT21_AH_EXTERR, BX, INT21_EXTERR)		\
+  FN (INT21_AH_CREATNEW, cpu_creatnew)			\
+  FN (INT21_AH_COMMIT, cpu_commit)			\
+  SUB (INT21_AH_LFN, AL, INT21_LFN)
+
+#define INT21_FILE_METADATA(SUBFN)				\
+  SUBFN (INT21_AL_FILE_METADATA_GETFILEATTR, cpu_getfileattr)	\
+  SUBFN (INT21_AL_FILE_METADATA_SETFILEATTR, cpu_setfileattr)
+
+#define INT21_FILE_TIME(SUBFN)				\
+  SUBFN (INT21_AL_FILE_TIME_GETFTIME, cpu_getftime)	\
+  SUBFN (INT21_AL_FILE_TIME_SETFTIME, cpu_setftime)
+
+#define INT21_EXTERR(SUBFN)					\
+  SUBFN (INT21_BH_EXTERR << 8 | INT21_BL_EXTERR, cpu_exterr)
+
+#define INT21_LFN(SUBFN)				\
+  SUBFN (INT21_AL_LFN_CHDIR, cpu_lfn_chdir)		\
+  SUBFN (INT21_AL_LFN_FILE_METADATA, cpu_lfn_fileattr)	\
+  SUBFN (INT21_AL_LFN_GETCWD, cpu_lfn_getcwd)		\
+  SUBFN (INT21_AL_LFN_FINDFIRST, cpu_lfn_findfirst)	\
+  SUBFN (INT21_AL_LFN_FINDNEXT, cpu_lfn_findnext)	\
+  SUBFN (INT21_AL_LFN_TRUENAME, cpu_lfn_truename)	\
+  SUBFN (INT21_AL_LFN_EXTOPEN, cpu_lfn_extopen)		\
+  SUBFN (INT21_AL_LFN_VOLINFO, cpu_lfn_volinfo)		\
+  SUBFN (INT21_AL_LFN_FINDCLOSE, cpu_lfn_findclose)	\
+  SUBFN (INT21_AL_LFN_BASIS, cpu_lfn_basis)
+
+#define INT2F_SERVICES(FN, SUB)				\
+  SUB (INT2F_AH_DOS_INTERNAL, AL, INT2F_DOS_INTERNAL)	\
+  SUB (INT2F_AH_DOSIX, AL, INT2F_DOSIX)
+
+#define INT2F_DOS_INTERNAL(SUBFN)				\
+  SUBFN (INT2F_AL_DOS_INTERNAL_EXTERR_SET, cpu_exterr_set)
+
+#define INT2F_DOSIX(SUBFN)					\
+  SUBFN (INT2F_AL_DOSIX_INSTALL_CHECK, cpu_dosix_install_check)	\
+  SUBFN (INT2F_AL_DOSIX_MAPFILE, cpu_mapfile)			\
+  SUBFN (INT2F_AL_DOSIX_MAPSEEK, cpu_mapseek)			\
+  SUBFN (INT2F_AL_DOSIX_UNMAPFILE, cpu_unmapfile)		\
+  SUBFN (INT2F_AL_DOSIX_AIOREAD, cpu_aioread)			\
+  SUBFN (INT2F_AL_DOSIX_AIOWRITE, cpu_aiowrite)			\
+  SUBFN (INT2F_AL_DOSIX_AIOPOLL, cpu_aiopoll)			\
+  SUBFN (INT2F_AL_DOSIX_AIOWAIT, cpu_aiowait)
+
+/* Register holding the sub-function */
+enum service_reg
+  {
+   SERVICE_AL,
+   SERVICE_BL,
+   SERVICE_BX
+  };
+
+/* What AH selects: either a function or a table of sub-functions */
+struct service
+{
+  syscall_t syscall;
+  const syscall_t *sub;
+  enum service_reg reg;
+};
+
+#define SERVICE_NONE(...)
+#define SERVICE_FN(ah, fn) [ah] = {.syscall = fn},
+#define SERVICE_SUB(ah, r, list)			\
+  [ah] = {.sub = list##_SUBFNS, .reg = SERVICE_##r},
+#define SERVICE_SUBFN(value, fn) [value] = fn,
+#define SERVICE_SUBFNS(ah, r, list)				\
+  static const syscall_t list##_SUBFNS[UINT8_MAX + 1] =	\
+    {list (SERVICE_SUBFN)};
+
+INT1A_SERVICES (SERVICE_NONE, SERVICE_SUBFNS)
+INT21_SERVICES (SERVICE_NONE, SERVICE_SUBFNS)
+INT2F_SERVICES (SERVICE_NONE, SERVICE_SUBFNS)
+
+static const struct service int1a_services[UINT8_MAX + 1] =
+  {INT1A_SERVICES (SERVICE_FN, SERVICE_SUB)};
+
+static const struct service int21_services[UINT8_MAX + 1] =
+  {INT21_SERVICES (SERVICE_FN, SERVICE_SUB)};
+
+static const struct service int2f_services[UINT8_MAX + 1] =
+  {INT2F_SERVICES (SERVICE_FN, SERVICE_SUB)};
+
+
+/* dispatch */
+
+/* The function of the service AH selected, found for those with
+   sub-functions by a second register: one load more at most */
+static inline
+syscall_t
+service_syscall
+(const struct service *s,
+ const cpu_t *cpu)
+{
+  if (! s->sub) return s->syscall;
+  uintptr_t value = s->reg == SERVICE_AL ? cpu->l.al
+    : s->reg == SERVICE_BL ? cpu->l.bl
+    : cpu->r.bx;
+  return value <= UINT8_MAX ? s->sub[value] : NULL;
+}
+
+/* Two loads at most, however many services a vector has */
+static
+void
+dispatch
+(uint8_t intnum,
+ const struct service *services,
+ cpu_t *cpu)
+{
+  call_syscall (intnum,
+		cpu,
+		service_syscall (&services[cpu->h.ah], cpu));
+}
+
+/* The table behind a built-in vector handler, or NULL for a handler
+   the program installed */
+static
+const struct service *
+vect_services
+(syscall_t handler)
+{
+  return handler == int21_main_dos_api ? int21_services
+    : handler == int2f_multiplex ? int2f_services
+    : handler == int1a_time_of_day ? int1a_services
+    : NULL;
+}
+
+
+/* _int86n */
+
+/* Each entry goes in and comes out through the same register set, as
+   with _int86 given one for both, and starts with carry clear so that
+   its carry tells how that call went.  As long as the vector is left
+   to its built-in handler, entries skip the vector and go straight to
+   the service, which is looked up once for a run of entries with the
+   same AH.  A hooked vector takes each entry through its chain. */
+size_t
+_dosix__int86n
+(int intnum,
+ union _REGS *regs,
+ size_t count)
+{
+  assert (regs || ! count);
+  uint8_t vector = intnum;
+  syscall_t handler = NULL;
+  const struct service *services = NULL;
+  const struct service *s = NULL;
+  int ah = -1;			/* AH s was looked up for */
+  size_t failed = 0;
+  for (size_t i = 0; i < count; i++)
+    {
+      cpu_t *cpu = &regs[i];
+      cpu->r.flags = 0;
+      /* entries may set the vector or hook it for those after them */
+      syscall_t current = __atomic_load_n (&int_vect[vector],
+					   __ATOMIC_ACQUIRE);
+      if (current != handler)
+	{
+	  handler = current;
+	  services = vect_services (handler);
+	  ah = -1;
+	}
+      if (! services
+	  || __atomic_load_n (&vect_chains[vector], __ATOMIC_RELAXED))
+	interrupt (vector, cpu);
+      else
+	{
+	  if (cpu->h.ah != ah)
+	    {
+	      ah = cpu->h.ah;
+	      s = &services[ah];
+	    }
+	  call_syscall (vector,
+			cpu,
+			service_syscall (s, cpu));
+	}
+      if (cpu->r.flags)
+	{
+	  failed++;
+	  _dosix__doserrno = cpu->r.ax;
+	}
+    }
+  return failed;
+}
+
+
+/* call recording */
+
+/* Recorded calls are made of bytes and unsigned LEB128 numbers:
+   vector, whether the call can be replayed, trace key, time taken in
+   ns, the DTA of the calling thread, AX BX CX DX SI DI ES BP and
+   flags going in, AX and flags coming out, the maps of the value going
+   in and of AX coming out, and the kinds of what DX, SI and DI point
+   to, each kind but REC_NONE followed by a length and, for input, as
+   many bytes.  Calls setting the clock are recorded but not replayed,
+   and the current drive and directories a replay changes are put back
+   after it */
+
+#define REC(...) {.replay = true, __VA_ARGS__}
+
+static const struct record_args int21_record[UINT8_MAX + 1] =
+  {
+   [INT21_AH_SETDRIVE] = REC (),
+   [INT21_AH_GETDRIVE] = REC (),
+   [INT21_AH_SET_DTA_ADDR] = REC (.dx = REC_DTA),
+   [INT21_AH_GETDATE] = REC (),
+   [INT21_AH_GETTIME] = REC (),
+   [INT21_AH_GET_DTA_ADDR] = REC (),
+   [INT21_AH_GETVECT] = REC (),
+   [INT21_AH_GETDISKFREE] = REC (),
+   [INT21_AH_CHDIR] = REC (.dx = REC_PATH),
+   [INT21_AH_CREAT] = REC (.dx = REC_PATH, .out = REC_MAP_HANDLE),
+   [INT21_AH_OPEN] = REC (.dx = REC_PATH, .out = REC_MAP_HANDLE),
+   [INT21_AH_CLOSE] = REC (.in = REC_MAP_HANDLE | REC_RELEASE),
+   [INT21_AH_READ] = REC (.dx = REC_OUT_CX, .in = REC_MAP_HANDLE),
+   [INT21_AH_WRITE] = REC (.dx = REC_IN_CX, .in = REC_MAP_HANDLE),
+   [INT21_AH_SEEK] = REC (.in = REC_MAP_HANDLE),
+   [INT21_AH_FILE_METADATA] = REC (.dx = REC_PATH),
+   [INT21_AH_GETCWD] = REC (.si = REC_OUT_PATH),
+   [INT21_AH_ALLOCMEM] = REC (.out = REC_MAP_SEG),
+   [INT21_AH_FREEMEM] = REC (.in = REC_MAP_SEG | REC_RELEASE),
+   [INT21_AH_SETBLOCK] = REC (.in = REC_MAP_SEG),
+   [INT21_AH_FINDFIRST] = REC (.dx = REC_PATH),
+   [INT21_AH_FINDNEXT] = REC (),
+   [INT21_AH_FILE_TIME] = REC (.in = REC_MAP_HANDLE),
+   [INT21_AH_EXTERR] = REC (),
+   [INT21_AH_CREATNEW] = REC (.dx = REC_PATH, .out = REC_MAP_HANDLE),
+   [INT21_AH_COMMIT] = REC (.in = REC_MAP_HANDLE)
+  };
+
+static const struct record_args int21_lfn_record[UINT8_MAX + 1] =
+  {
+   [INT21_AL_LFN_CHDIR] = REC (.dx = REC_PATH),
+   [INT21_AL_LFN_FILE_METADATA] = REC (.dx = REC_PATH),
+   [INT21_AL_LFN_GETCWD] = REC (.si = REC_OUT_PATH),
+   [INT21_AL_LFN_FINDFIRST] = REC (.dx = REC_PATH, .di = REC_OUT_FIND,
+				   .out = REC_MAP_FIND),
+   [INT21_AL_LFN_FINDNEXT] = REC (.di = REC_OUT_FIND, .in = REC_MAP_FIND),
+   [INT21_AL_LFN_TRUENAME] = REC (.si = REC_PATH, .di = REC_OUT_PATH),
+   [INT21_AL_LFN_EXTOPEN] = REC (.si = REC_PATH, .out = REC_MAP_HANDLE),
+   [INT21_AL_LFN_VOLINFO] = REC (.dx = REC_PATH, .di = REC_OUT_CX),
+   [INT21_AL_LFN_FINDCLOSE] = REC (.in = REC_MAP_FIND | REC_RELEASE),
+   [INT21_AL_LFN_BASIS] = REC (.si = REC_PATH, .di = REC_OUT_PATH)
+  };
+
+static
+const struct record_args *
+record_args_of
+(uint8_t intnum,
+ const cpu_t *cpu)
+{
+  static const struct record_args none, regs = REC ();
+  switch (intnum)
+    {
+    case INT1A_TIME_OF_DAY:
+      return cpu->h.ah == INT1A_AH_SETCLOCK
+	|| cpu->h.ah == INT1A_AH_SETRTCTIME
+	|| cpu->h.ah == INT1A_AH_SETRTCDATE
+	? &none : &regs;
+    case INT21_MAIN_DOS_API:
+      return cpu->h.ah == INT21_AH_LFN
+	? &int21_lfn_record[cpu->l.al]
+	: &int21_record[cpu->h.ah];
+    case INT2F_MULTIPLEX:
+      return cpu->h.ah == INT2F_AH_DOSIX
+	&& cpu->l.al == INT2F_AL_DOSIX_INSTALL_CHECK
+	? &regs : &none;
+    default:
+      return &none;
+    }
+}
+
+/* Bytes a register of kind points to, in a call with registers cpu */
+static
+size_t
+record_buf_len
+(enum record_buf kind,
+ const cpu_t *cpu,
+ uintptr_t address)
+{
+  switch (kind)
+    {
+    case REC_PATH:
+      return strlen ((const char *) address) + 1;
+    case REC_IN_CX:
+    case REC_OUT_CX:
+      return (unsigned) cpu->r.cx;
+    case REC_OUT_PATH:
+      return _MAX_PATH;
+    case REC_OUT_FIND:
+      return sizeof (struct lfn_finddata);
+    case REC_DTA:
+      return sizeof (union dta_t);
+    default:
+      return 0;
+    }
+}
+
+static
+void
+record_bytes
+(struct record_out *r,
+ const void *bytes,
+ size_t count)
+{
+  if (r->len + count > r->size)
+    {
+      size_t size = r->size ? r->size : 256;
+      while (size < r->len + count) size *= 2;
+      uint8_t *data = realloc (r->data, size);
+      if (! data)
+	{
+	  r->failed = true;
+	  return;
+	}
+      r->data = data;
+      r->size = size;
+    }
+  memcpy (r->data + r->len, bytes, count);
+  r->len += count;
+}
+
+static
+void
+record_uint
+(struct record_out *r,
+ uint64_t value)
+{
+  uint8_t bytes[10];
+  size_t n = 0;
+  do
+    {
+      bytes[n] = value & 0x7f;
+      value >>= 7;
+      if (value) bytes[n] |= 0x80;
+      n++;
+    }
+  while (value);
+  record_bytes (r, bytes, n);
+}
+
+/* Put the call together in the thread's buffer and append it to the
+   recording in one piece */
+static
+void
+record_call
+(uint8_t intnum,
+ uint32_t key,
+ uint64_t ns,
+ const cpu_t *in,
+ const cpu_t *out)
+{
+  const struct record_args *a = record_args_of (intnum, in);
+  struct record_out *r = &record_out;
+  r->len = 0;
+  r->failed = false;
+  uint8_t head[] = {intnum, a->replay};
+  record_bytes (r, head, sizeof (head));
+  record_uint (r, key);
+  record_uint (r, ns);
+  record_uint (r, (uintptr_t) get_dta_addr ());
+  const uintptr_t regs[] =
+    {
+     in->r.ax, in->r.bx, in->r.cx, in->r.dx, in->r.si, in->r.di,
+     in->r.es, in->r.bp, in->r.flags, out->r.ax, out->r.flags
+    };
+  for (size_t i = 0; i < sizeof (regs) / sizeof (*regs); i++)
+    record_uint (r, regs[i]);
+  uint8_t maps[] = {a->in, a->out};
+  record_bytes (r, maps, sizeof (maps));
+  const uint8_t kinds[] = {a->dx, a->si, a->di};
+  const uintptr_t addresses[] = {in->r.dx, in->r.si, in->r.di};
+  for (size_t i = 0; i < sizeof (kinds); i++)
+    {
+      uint8_t kind = addresses[i] ? kinds[i] : REC_NONE;
+      record_bytes (r, &kind, 1);
+      if (kind == REC_NONE) continue;
+      size_t len = record_buf_len (kind, in, addresses[i]);
+      record_uint (r, len);
+      if (kind == REC_PATH || kind == REC_IN_CX)
+	record_bytes (r, (const void *) addresses[i], len);
+    }
+  if (! r->failed) _dosix__trace_record (r->data, r->len);
+}
+
+
+/* call tracing */
+
+/* Only the calls a thread makes from outside are traced: those that
+   services make in turn are part of their time, and a vector handler
+   passing a call on to its service counts once.  Calls a hooked
+   handler takes over never get here. */
+static
+void
+trace_syscall
+(uint8_t intnum,
+ cpu_t *cpu,
+ syscall_t syscall)
+{
+  int what = _dosix__trace_start ();
+  if (! what)
+    {
+      syscall (cpu);
+      return;
+    }
+  /* the service table is the vector's, whether syscall is its
+     handler or, from _int86n, the service itself */
+  const struct service *services =
+    vect_services (__atomic_load_n (&int_vect[intnum], __ATOMIC_ACQUIRE));
+  const struct service *s = services ? &services[cpu->h.ah] : NULL;
+  unsigned reg = ! s || ! s->sub ? TRACE_REG_NONE
+    : s->reg == SERVICE_AL ? TRACE_REG_AL
+    : TRACE_REG_BL;
+  uint32_t key = TRACE_KEY (intnum, cpu->h.ah, reg,
+			    reg == TRACE_REG_AL ? cpu->l.al
+			    : reg == TRACE_REG_BL ? cpu->l.bl
+			    : 0);
+  cpu_t in = *cpu;
+  unsigned errors = task.errors;
+  task.traced = true;
+  uint64_t start = _dosix__trace_clock ();
+  syscall (cpu);
+  uint64_t ns = _dosix__trace_clock () - start;
+  task.traced = false;
+  /* services that cannot fail leave the carry as they found it, so
+     failing takes an error set as well */
+  bool failed = cpu->r.flags && task.errors != errors;
+  if (what & TRACE_STATS)
+    _dosix__trace_end (key,
+		       ns,
+		       &in,
+		       cpu,
+		       failed ? task.errorinfo.exterror : 0);
+  if (what & TRACE_RECORD)
+    record_call (intnum,
+		 key,
+		 ns,
+		 &in,
+		 cpu);
+}
+
+
+/* _dos_replay */
+
+/* Statistics of the calls of a trace key */
+struct replay_stat
+{
+  uint32_t key;
+  struct _replaystat_t stat;
+};
+
+/* Values the recording had from services, each with the one the
+   replay got instead */
+struct replay_map
+{
+  uintptr_t from, to;
+};
+
+struct replay
+{
+  const uint8_t *p, *end;	/* what is left of the recording */
+  bool bad;
+  struct replay_map *maps[REC_MAPS];
+  size_t map_count[REC_MAPS], map_size[REC_MAPS];
+  void *scratch[3];		/* output buffers of DX, SI and DI */
+  size_t scratch_size[3];
+  struct replay_stat *stats;
+  size_t stat_count, stat_size;
+  int drive;			/* current drive before the replay */
+  char (*cwd)[PATH_MAX + 3];	/* current directory of each drive */
+};
+
+static
+uint64_t
+replay_uint
+(struct replay *rp)
+{
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+      if (rp->p == rp->end) break;
+      uint8_t byte = *rp->p++;
+      value |= (uint64_t) (byte & 0x7f) << shift;
+      if (! (byte & 0x80)) return value;
+    }
+  rp->bad = true;
+  return 0;
+}
+
+static
+const uint8_t *
+replay_bytes
+(struct replay *rp,
+ size_t count)
 {
-  for (size_t i = 0; string[i] != '$'; i++)
+  if ((size_t) (rp->end - rp->p) < count)
     {
-      int ret = putchar (string[i]);
-      if (ret == EOF) break;
+      rp->bad = true;
+      return NULL;
     }
-  return '$';
+  const uint8_t *bytes = rp->p;
+  rp->p += count;
+  return bytes;
 }
 
 static
-void
-cpu_write_stdout
-(cpu_t *cpu)
+struct replay_map *
+replay_map_find
+(struct replay *rp,
+ unsigned map,
+ uintptr_t from)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_WRITE_STDOUT);
-  cpu->r.ax = write_stdout (_MK_FP (cpu->r.ds,
-				    cpu->r.dx));
+  for (size_t i = 0; i < rp->map_count[map]; i++)
+    if (rp->maps[map][i].from == from) return &rp->maps[map][i];
+  return NULL;
 }
 
-
-/* libc-based kernel services */
-
 static
-void
-cpu_getch
-(cpu_t *cpu)
+bool
+replay_map_add
+(struct replay *rp,
+ unsigned map,
+ uintptr_t from,
+ uintptr_t to)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_GETCH);
-  cpu->l.al = _dosix__getch ();
+  struct replay_map *m = replay_map_find (rp, map, from);
+  if (! m)
+    {
+      if (rp->map_count[map] == rp->map_size[map])
+	{
+	  size_t size = rp->map_size[map] ? 2 * rp->map_size[map] : 16;
+	  m = realloc (rp->maps[map], size * sizeof (*m));
+	  if (! m) return false;
+	  rp->maps[map] = m;
+	  rp->map_size[map] = size;
+	}
+      m = &rp->maps[map][rp->map_count[map]++];
+    }
+  *m = (struct replay_map) {.from = from, .to = to};
+  return true;
 }
 
 static
 void
-cpu_getche
-(cpu_t *cpu)
+replay_map_remove
+(struct replay *rp,
+ unsigned map,
+ uintptr_t from)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_GETCHE);
-  cpu->l.al = _dosix__getche ();
+  struct replay_map *m = replay_map_find (rp, map, from);
+  if (m) *m = rp->maps[map][--rp->map_count[map]];
 }
 
 static
-void
-cpu_putch
-(cpu_t *cpu)
+struct _replaystat_t *
+replay_stat
+(struct replay *rp,
+ uint32_t key)
 {
-  assert (cpu);
-  assert (cpu->h.ah == INT21_AH_PUTCH);
-  cpu->l.al = _dosix__putch (cpu->l.dl);
+  for (size_t i = 0; i < rp->stat_count; i++)
+    if (rp->stats[i].key == key) return &rp->stats[i].stat;
+  if (rp->stat_count == rp->stat_size)
+    {
+      size_t size = rp->stat_size ? 2 * rp->stat_size : 32;
+      struct replay_stat *stats = realloc (rp->stats,
+					   size * sizeof (*stats));
+      if (! stats) return NULL;
+      rp->stats = stats;
+      rp->stat_size = size;
+    }
+  struct replay_stat *rs = &rp->stats[rp->stat_count++];
+  rs->key = key;
+  struct _replaystat_t *s = &rs->stat;
+  *s = (struct _replaystat_t)
+    {
+     .intnum = TRACE_KEY_INTNUM (key),
+     .ah = TRACE_KEY_AH (key),
+     .subreg = TRACE_KEY_REG (key) == TRACE_REG_AL ? 'A'
+     : TRACE_KEY_REG (key) == TRACE_REG_BL ? 'B' : 0,
+     .sub = TRACE_KEY_SUB (key)
+    };
+  return s;
 }
 
-
-/* call_syscall */
-
+/* DTA standing for the one at address when recorded, kept until the
+   replay is over */
 static
-void
-call_syscall
-(uint8_t intnum,
- cpu_t *cpu,
- syscall_t syscall)
+union dta_t *
+replay_dta
+(struct replay *rp,
+ uintptr_t address)
 {
-  if (! syscall)
-    errx (86,
-	  "Not implemented: "
-	  "INT %02Xh "
-	  "AX=%04Xh "
-	  "BX=%04Xh "
-	  "CX=%04Xh "
-	  "DX=%04Xh ",
-	  intnum,
-	  cpu->r.ax,
-	  cpu->r.bx,
-	  cpu->r.cx,
-	  cpu->r.dx);
-  else
-    syscall (cpu);
+  struct replay_map *m = replay_map_find (rp, REC_MAP_DTA, address);
+  if (m) return (union dta_t *) m->to;
+  union dta_t *dta = calloc (1, sizeof (*dta));
+  if (dta && ! replay_map_add (rp, REC_MAP_DTA, address, (uintptr_t) dta))
+    {
+      free (dta);
+      return NULL;
+    }
+  return dta;
 }
 
-
-/* interrupt */
-
+/* Point a register at what the replay has in place of what it pointed
+   to when recorded.  The kind recorded must be the one the service
+   takes, so that no address is ever passed on as it was recorded */
 static
-void
-interrupt
-(uint8_t intnum,
- cpu_t *cpu)
+bool
+replay_buf
+(struct replay *rp,
+ unsigned i,
+ uint8_t expected,
+ uintptr_t *reg)
 {
-  assert (cpu);
-  call_syscall (intnum,
-		cpu,
-		_dos_getvect(intnum));
-
+  const uint8_t *kind = replay_bytes (rp, 1);
+  if (! kind) return false;
+  if (*kind != (*reg ? expected : REC_NONE)) return ! (rp->bad = true);
+  if (*kind == REC_NONE) return true;
+  size_t len = replay_uint (rp);
+  if (rp->bad) return false;
+  if (*kind == REC_PATH || *kind == REC_IN_CX)
+    {
+      /* input is read straight out of the recording */
+      const uint8_t *bytes = replay_bytes (rp, len);
+      if (! bytes || (*kind == REC_PATH && (! len || bytes[len - 1])))
+	return ! (rp->bad = true);
+      *reg = (uintptr_t) bytes;
+      return true;
+    }
+  if (*kind == REC_DTA)
+    {
+      union dta_t *dta = replay_dta (rp, *reg);
+      *reg = (uintptr_t) dta;
+      return dta;
+    }
+  if (len > rp->scratch_size[i])
+    {
+      void *scratch = realloc (rp->scratch[i], len);
+      if (! scratch) return false;
+      rp->scratch[i] = scratch;
+      rp->scratch_size[i] = len;
+    }
+  memset (rp->scratch[i], 0, len);
+  *reg = (uintptr_t) rp->scratch[i];
+  return true;
 }
 
-
-/* intr */
+/* Busiest services first */
+static
+int
+replay_cmp
+(const void *a,
+ const void *b)
+{
+  const struct replay_stat *sa = a, *sb = b;
+  return sa->stat.ns < sb->stat.ns ? 1 : sa->stat.ns > sb->stat.ns ? -1 : 0;
+}
 
+/* Whatever the recorded program left open is closed, its memory given
+   back and the directories it went to left, so that a replay leaves
+   the process as it found it */
+static
 void
-_dosix_intr
-(int intnum,
- union REGPACK *regs)
+replay_release
+(struct replay *rp,
+ union dta_t *prev_dta)
 {
-  cpu_t cpu = {0};
-  if (regs)
-    cpu = (cpu_t)
-      {
-       .r =
-       {
-	.ax = regs->x.ax,
-	.bx = regs->x.bx,
-	.cx = regs->x.cx,
-	.dx = regs->x.dx,
-	.bp = regs->x.bp,
-	.si = regs->x.si,
-	.di = regs->x.di,
-	.ds = regs->x.ds,
-	.es = regs->x.es,
-	.flags = regs->x.flags
-       }
-      };
-  interrupt (intnum, &cpu);
+  for (size_t i = 0; i < rp->map_count[REC_MAP_HANDLE]; i++)
+    _dosix__dos_close (rp->maps[REC_MAP_HANDLE][i].to);
+  for (size_t i = 0; i < rp->map_count[REC_MAP_SEG]; i++)
+    _dosix__dos_freemem (rp->maps[REC_MAP_SEG][i].to);
+  for (size_t i = 0; i < rp->map_count[REC_MAP_FIND]; i++)
+    {
+      cpu_t cpu = {0};
+      cpu.h.ah = INT21_AH_LFN;
+      cpu.l.al = INT21_AL_LFN_FINDCLOSE;
+      cpu.r.bx = rp->maps[REC_MAP_FIND][i].to;
+      _dosix__int86 (INT21_MAIN_DOS_API, &cpu, &cpu);
+    }
+  set_dta_addr (prev_dta);
+  for (int i = 0; rp->cwd && i < _dosix__drive_count (); i++)
+    if (*rp->cwd[i]) _dosix__drive_chdir (rp->cwd[i]);
+  _dosix__drive_set (rp->drive);
+  free (rp->cwd);
+  for (size_t i = 0; i < rp->map_count[REC_MAP_DTA]; i++)
+    free ((void *) rp->maps[REC_MAP_DTA][i].to);
+  for (size_t i = 0; i < REC_MAPS; i++)
+    free (rp->maps[i]);
+  for (size_t i = 0; i < 3; i++)
+    free (rp->scratch[i]);
+  free (rp->stats);
 }
 
-
-/* _int86x */
-
-int
-_dosix__int86x
-(int intnum,
- union _REGS *inregs,
- union _REGS *outregs,
- struct _SREGS *segregs)
+/* Calls are replayed one after the other through _int86, whatever
+   threads made them */
+static
+bool
+replay_call
+(struct replay *rp)
 {
-  cpu_t cpu = {0};
-  if (inregs)
-    cpu = (cpu_t)
-      {
-       .r.ax = inregs->x.ax,
-       .r.bx = inregs->x.bx,
-       .r.cx = inregs->x.cx,
-       .r.dx = inregs->x.dx,
-       .r.si = inregs->x.si,
-       .r.di = inregs->x.di,
-       .r.flags = inregs->x.cflag
-      };
-  if (segregs)
+  const uint8_t *head = replay_bytes (rp, 2);
+  uint32_t key = replay_uint (rp);
+  uint64_t recorded_ns = replay_uint (rp);
+  uintptr_t recorded_dta = replay_uint (rp);
+  uint64_t regs[11];
+  for (size_t i = 0; i < sizeof (regs) / sizeof (*regs); i++)
+    regs[i] = replay_uint (rp);
+  const uint8_t *maps = replay_bytes (rp, 2);
+  if (rp->bad) return false;
+  uint8_t intnum = head[0];
+  if (intnum != INT1A_TIME_OF_DAY && intnum != INT21_MAIN_DOS_API
+      && intnum != INT2F_MULTIPLEX)
+    return ! (rp->bad = true);
+  cpu_t cpu =
     {
-      cpu.r.cs = segregs->cs;
-      cpu.r.ds = segregs->ds;
-      cpu.r.es = segregs->es;
-      cpu.r.ss = segregs->ss;
+     .r =
+     {
+      .ax = regs[0], .bx = regs[1], .cx = regs[2], .dx = regs[3],
+      .si = regs[4], .di = regs[5], .es = regs[6], .bp = regs[7],
+      .flags = regs[8]
+     }
     };
-  interrupt (intnum, &cpu);
-  if (outregs)
+  /* what the call is made of comes from this build's table: a
+     recording that disagrees with it is corrupt or from another
+     build */
+  const struct record_args *a = record_args_of (intnum, &cpu);
+  bool replayable = a->replay;
+  if (head[1] != a->replay || maps[0] != a->in || maps[1] != a->out
+      || TRACE_KEY_INTNUM (key) != intnum)
+    return ! (rp->bad = true);
+  uintptr_t *bufs[] = {&cpu.r.dx, &cpu.r.si, &cpu.r.di};
+  const uint8_t kinds[] = {a->dx, a->si, a->di};
+  for (unsigned i = 0; i < 3; i++)
+    if (! replay_buf (rp, i, kinds[i], bufs[i])) return false;
+  struct _replaystat_t *s = replay_stat (rp, key);
+  if (! s) return false;
+  unsigned in_map = maps[0] & ~REC_RELEASE;
+  /* a handle, segment or find handle the replay got nothing for
+     would be issued as recorded, and could be anything here; only the
+     predefined handles 0 to 4 are the same in every process */
+  uintptr_t *in = in_map == REC_MAP_SEG ? &cpu.r.es : &cpu.r.bx;
+  uintptr_t recorded_in = *in;
+  struct replay_map *m = in_map ? replay_map_find (rp, in_map, *in) : NULL;
+  if (! replayable
+      || (in_map && ! m
+	  && (in_map != REC_MAP_HANDLE || *in > 4)))
     {
-      *outregs = (_REGS)
-	{
-	 .x =
-	 {
-	  .ax = cpu.r.ax,
-	  .bx = cpu.r.bx,
-	  .cx = cpu.r.cx,
-	  .dx = cpu.r.dx,
-	  .si = cpu.r.si,
-	  .di = cpu.r.di,
-	  .cflag = cpu.r.flags
-	 }
-	};
-      if (cpu.r.flags)
-	_doserrno = cpu.r.ax;
+      s->skipped++;
+      return true;
     }
-  if (segregs)
-    *segregs = (_SREGS)
-      {
-       .es = cpu.r.es,
-       .cs = cpu.r.cs,
-       .ss = cpu.r.ss,
-       .ds = cpu.r.ds
-      };
-  return cpu.r.ax;
+  if (m) *in = m->to;
+  /* the DTA of the thread that made the call, threads being replayed
+     as one */
+  union dta_t *dta = replay_dta (rp, recorded_dta);
+  if (! dta) return false;
+  set_dta_addr (dta);
+  unsigned errors = task.errors;
+  uint64_t start = _dosix__trace_clock ();
+  _dosix__int86 (intnum, &cpu, &cpu);
+  uint64_t ns = _dosix__trace_clock () - start;
+  /* as in tracing, a carry left as it was is no failure */
+  bool failed = cpu.r.flags && task.errors != errors;
+  bool carry = cpu.r.flags, recorded_carry = regs[10];
+  s->calls++;
+  s->ns += ns;
+  if (ns > s->max_ns) s->max_ns = ns;
+  s->recorded_ns += recorded_ns;
+  if (failed) s->failed++;
+  if (carry != recorded_carry) s->mismatched++;
+  if (! carry && ! recorded_carry)
+    {
+      if (maps[0] & REC_RELEASE)
+	replay_map_remove (rp, in_map, recorded_in);
+      if (maps[1] && ! replay_map_add (rp, maps[1], regs[9], cpu.r.ax))
+	return false;
+    }
+  return true;
 }
 
-
-/* _int86 */
-
-int
-_dosix__int86
-(int intnum,
- union _REGS *inregs,
- union _REGS *outregs)
+unsigned
+_dosix__dos_replay
+(const char *file,
+ int (*report) (const struct _replaystat_t *, void *),
+ void *arg)
 {
-  return _dosix__int86x (intnum,
-			 inregs,
-			 outregs,
-			 NULL);
+  assert (file);
+  struct _DOSERROR errorinfo = {0};
+  int fd = open (file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return _dosix__dosexterr (&errorinfo);
+  struct stat st;
+  if (fstat (fd, &st))
+    {
+      unsigned err = _dosix__dosexterr (&errorinfo);
+      close (fd);
+      return err;
+    }
+  /* the recording would be truncated or grow under the replay */
+  if (_dosix__trace_records_to (fd))
+    {
+      close (fd);
+      errno = ETXTBSY;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  void *data = MAP_FAILED;
+  if (st.st_size > 0)
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED && st.st_size > 0)
+    return _dosix__dosexterr (&errorinfo);
+  struct replay rp =
+    {
+     .p = data == MAP_FAILED ? NULL : data,
+     .end = data == MAP_FAILED ? NULL : (uint8_t *) data + st.st_size,
+     .drive = _dosix__drive_get (),
+     .cwd = calloc (_dosix__drive_count (), sizeof (*rp.cwd))
+    };
+  for (int i = 0; rp.cwd && i < _dosix__drive_count (); i++)
+    if (_dosix__drive_getcwd (i, rp.cwd[i], sizeof (*rp.cwd)))
+      *rp.cwd[i] = '\0';
+  const uint8_t *head = replay_bytes (&rp, strlen (RECORD_MAGIC) + 1);
+  rp.bad = ! head || memcmp (head, RECORD_MAGIC, strlen (RECORD_MAGIC))
+    || head[strlen (RECORD_MAGIC)] != RECORD_VERSION;
+  union dta_t *prev_dta = get_dta_addr ();
+  /* the replay's own calls are neither traced nor recorded */
+  bool traced = task.traced;
+  task.traced = true;
+  bool ok = rp.cwd;
+  while (ok && ! rp.bad && rp.p < rp.end)
+    ok = replay_call (&rp);
+  if (ok && ! rp.bad)
+    {
+      qsort (rp.stats, rp.stat_count, sizeof (*rp.stats), replay_cmp);
+      for (size_t i = 0; report && i < rp.stat_count; i++)
+	if (report (&rp.stats[i].stat, arg)) break;
+    }
+  replay_release (&rp, prev_dta);
+  task.traced = traced;
+  if (data != MAP_FAILED) munmap (data, st.st_size);
+  if (rp.bad)
+    {
+      errorinfo.exterror = EXTERR_DATA_INVAL;
+      errorinfo.errclass = ERRCLASS_BAD_FORMAT;
+      errorinfo.action = ERRACT_ABORT_AFTER_CLEANUP;
+      errorinfo.locus = ERRLOCUS_UNKNOWN;
+      return exterr_set (&errorinfo, EINVAL);
+    }
+  if (! ok)
+    {
+      errno = ENOMEM;
+      return _dosix__dosexterr (&errorinfo);
+    }
+  return 0;
 }
 
 
-/* _intdosx */
+/* int21_main_dos_api */
 
-int
-_dosix__intdosx
-(union _REGS *inregs,
- union _REGS *outregs,
- struct _SREGS *segregs)
+static
+void
+int21_main_dos_api
+(cpu_t *cpu)
 {
-  return _dosix__int86x (INT21_MAIN_DOS_API,
-			 inregs,
-			 outregs,
-			 segregs);
+  assert (cpu);
+  dispatch (INT21_MAIN_DOS_API,
+	    int21_services,
+	    cpu);
 }
 
 
-/* _intdos */
+/* int2f_multiplex */
 
-int
-_dosix__intdos
-(union _REGS *inregs,
- union _REGS *outregs)
+static
+void
+int2f_multiplex
+(cpu_t *cpu)
 {
-  return _dosix__intdosx (inregs,
-			  outregs,
-			  NULL);
+  assert (cpu);
+  dispatch (INT2F_MULTIPLEX,
+	    int2f_services,
+	    cpu);
 }
 
 
-/* _bdos */
+/* int1a_time_of_day */
 
-int
-_dosix__bdos
-(int dosfunc,
- unsigned int dosdx,
- unsigned int dosal)
+static
+void
+int1a_time_of_day
+(cpu_t *cpu)
 {
-  union _REGS inregs;
-  union _REGS outregs;
-  inregs.h.ah = dosfunc;
-  inregs.x.dx = dosdx;
-  inregs.h.al = dosal;
-  return _dosix__intdos (&inregs,
-			 &outregs);
+  assert (cpu);
+  dispatch (INT1A_TIME_OF_DAY,
+	    int1a_services,
+	    cpu);
 }
 
 
-/* int21_main_dos_api */
+/* int08_timer */
 
+/* What is left of the BIOS handler: the tick count keeps itself */
 static
 void
-int21_main_dos_api
+int08_timer
 (cpu_t *cpu)
 {
   assert (cpu);
-  syscall_t syscall = NULL;
-  switch (cpu->h.ah) /* AH */
-    {
-    case INT21_AH_FILE_METADATA: /* 0x43 */
-      switch (cpu->l.al) /* AL */
-	{
-	case INT21_AL_FILE_METADATA_GETFILEATTR: /* 0x00 */
-	  syscall = cpu_getfileattr;
-	  break;
-	case INT21_AL_FILE_METADATA_SETFILEATTR: /* 0x01 */
-	  syscall = cpu_setfileattr;
-	  break;
-	}
-      break;
-    case INT21_AH_FILE_TIME: /* 0x57 */
-      switch (cpu->l.al) /* AL */
-	{
-	case INT21_AL_FILE_TIME_GETFTIME: /* 0x00 */
-	  syscall = cpu_getftime;
-	  break;
-	case INT21_AL_FILE_TIME_SETFTIME: /* 0x01 */
-	  syscall = cpu_setftime;
-	  break;
-	}
-      break;
-    case INT21_AH_GETCHE: /* 0x01 */
-      syscall = cpu_getche;
-      break;
-    case INT21_AH_PUTCH: /* 0x02 */
-      syscall = cpu_putch;
-      break;
-    case INT21_AH_GETCH: /* 0x08 */
-      syscall = cpu_getch;
-      break;
-    case INT21_AH_WRITE_STDOUT: /* 0x09 */
-      syscall = cpu_write_stdout;
-      break;
-    case INT21_AH_SET_DTA_ADDR: /* 0x1a */
-      syscall = cpu_set_dta_addr;
-      break;
-    case INT21_AH_SETVECT: /* 0x25 */
-      syscall = cpu_setvect;
-      break;
-    case INT21_AH_GETDATE: /* 0x2a */
-      syscall = cpu_getdate;
-      break;
-    case INT21_AH_SETDATE: /* 0x2b */
-      syscall = cpu_setdate;
-      break;
-    case INT21_AH_GETTIME: /* 0x2c */
-      syscall = cpu_gettime;
-      break;
-    case INT21_AH_SETTIME: /* 0x2d */
-      syscall = cpu_settime;
-      break;
-    case INT21_AH_GET_DTA_ADDR: /* 0x2f */
-      syscall = cpu_get_dta_addr;
-      break;
-    case INT21_AH_GETVECT: /* 0x35 */
-      syscall = cpu_getvect;
-      break;
-    case INT21_AH_CREAT: /* 0x3c */
-      syscall = cpu_creat;
-      break;
-    case INT21_AH_OPEN:	/* 0x3d */
-      syscall = cpu_open;
-      break;
-    case INT21_AH_CLOSE: /* 0x3e */
-      syscall = cpu_close;
-      break;
-    case INT21_AH_ALLOCMEM: /* 0x48 */
-      syscall = cpu_allocmem;
-      break;
-    case INT21_AH_FREEMEM: /* 0x49 */
-      syscall = cpu_freemem;
-      break;
-    case INT21_AH_SETBLOCK: /* 0x4a */
-      syscall = cpu_setblock;
-      break;
-    case INT21_AH_FINDFIRST: /* 0x4e */
-      syscall = cpu_findfirst;
-      break;
-    case INT21_AH_FINDNEXT: /* 0x4f */
-      syscall = cpu_findnext;
-      break;
-    case INT21_AH_EXTERR: /* 0x59 */
-      switch (cpu->h.bh) /* BH */
-	{
-	case INT21_BH_EXTERR: /* 0x00 */
-	  switch (cpu->l.bl) /* BL */
-	    {
-	    case INT21_BL_EXTERR: /* 0x00 */
-	      syscall = cpu_exterr;
-	      break;
-	    }
-	  break;
-	}
-      break;
-    case INT21_AH_CREATNEW: /* 0x5b */
-      syscall = cpu_creatnew;
-      break;
-    }
-  call_syscall (INT21_MAIN_DOS_API,
-		cpu,
-		syscall);
+  interrupt (INT1C_TIMER_TICK, cpu);
 }
 
 
-/* int2f_multiplex */
+/* int1c_timer_tick */
 
 static
 void
-int2f_multiplex
+int1c_timer_tick
 (cpu_t *cpu)
 {
   assert (cpu);
-  syscall_t syscall = NULL;
-  switch (cpu->h.ah) /* AH */
-    {
-    case INT2F_AH_DOS_INTERNAL: /* 0x12 */
-      switch (cpu->l.al) /* AL */
-	{
-	case INT2F_AL_DOS_INTERNAL_EXTERR_SET: /* 0x22 */
-	  syscall = cpu_exterr_set;
-	  break;
-	}
-      break;
-    };
-  call_syscall (INT2F_MULTIPLEX,
-		cpu,
-		syscall);
 }
@@ -0,0 +1,701 @@
+/*
+  dosattr.c -- DOS file attributes of host files
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <linux/io_uring.h>
+#include "_dos.h"
+
+
+/* constants */
+
+/* Samba keeps DOS attributes here, as a ‘0x’ hex string possibly
+   followed by a binary blob it alone reads */
+#define ATTR_XATTR "user.DOSATTRIB"
+#define ATTR_CACHE_SIZE 4096	/* inodes whose attributes are kept */
+#define ATTR_LOCKS 64
+#define ATTR_STORED (_A_RDONLY | _A_HIDDEN | _A_SYSTEM | _A_ARCH)
+#define ATTR_NONE UINT_MAX	/* no attribute stored */
+#define ATTR_URING_ENTRIES 256	/* batch ring size */
+#define ATTR_URING_MIN 64	/* smaller batches are done in place */
+#define ATTR_STATX (STATX_TYPE | STATX_MODE | STATX_INO | STATX_CTIME)
+
+
+/* type definitions */
+
+/* Stored attributes of an inode, valid while its change time is the
+   same: setting an extended attribute changes it too */
+struct attr_entry
+{
+  dev_t dev;
+  ino_t ino;
+  struct timespec ctime;
+  unsigned attrib;		/* ATTR_NONE if none */
+};
+
+/* A ring for batches, and the room its requests point into */
+struct attr_ring
+{
+  struct uring ring;
+  struct statx stx[ATTR_URING_ENTRIES];
+  struct stat st[ATTR_URING_ENTRIES];
+  int res[ATTR_URING_ENTRIES];
+  bool queued[ATTR_URING_ENTRIES];
+  char path[ATTR_URING_ENTRIES][NAME_MAX + 32];
+  char value[ATTR_URING_ENTRIES][64];
+};
+
+
+/* global private variables */
+
+static struct attr_entry attr_cache[ATTR_CACHE_SIZE];
+static pthread_mutex_t attr_locks[ATTR_LOCKS] =
+  {[0 ... ATTR_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER};
+static pthread_once_t attr_once = PTHREAD_ONCE_INIT;
+static bool attr_uring;
+static pthread_key_t attr_ring_key;	/* ring of each thread */
+
+
+/* attribute cache */
+
+static
+size_t
+attr_slot
+(const struct stat *st)
+{
+  return (st->st_ino * 0x9e3779b97f4a7c15u ^ st->st_dev)
+    % ATTR_CACHE_SIZE;
+}
+
+static
+bool
+attr_lookup
+(const struct stat *st,
+ unsigned *attrib)
+{
+  size_t i = attr_slot (st);
+  struct attr_entry *e = &attr_cache[i];
+  pthread_mutex_t *lock = &attr_locks[i % ATTR_LOCKS];
+  pthread_mutex_lock (lock);
+  bool hit = e->ino == st->st_ino && e->dev == st->st_dev
+    && e->ctime.tv_sec == st->st_ctim.tv_sec
+    && e->ctime.tv_nsec == st->st_ctim.tv_nsec;
+  if (hit) *attrib = e->attrib;
+  pthread_mutex_unlock (lock);
+  return hit;
+}
+
+static
+void
+attr_store
+(const struct stat *st,
+ unsigned attrib)
+{
+  size_t i = attr_slot (st);
+  pthread_mutex_t *lock = &attr_locks[i % ATTR_LOCKS];
+  pthread_mutex_lock (lock);
+  attr_cache[i] = (struct attr_entry)
+    {
+     .dev = st->st_dev,
+     .ino = st->st_ino,
+     .ctime = st->st_ctim,
+     .attrib = attrib
+    };
+  pthread_mutex_unlock (lock);
+}
+
+
+/* extended attribute */
+
+/* There are no *at variants of the xattr calls: the descriptor is
+   reached through procfs instead */
+static
+bool
+attr_path
+(int dirfd,
+ const char *name,
+ char *path,
+ size_t size)
+{
+  int n = snprintf (path, size, "/proc/self/fd/%d/%s", dirfd, name);
+  if (n < 0 || (size_t) n >= size)
+    {
+      errno = ENAMETOOLONG;
+      return false;
+    }
+  return true;
+}
+
+/* Stored attributes in the first len bytes of value */
+static
+unsigned
+attr_parse
+(char *value,
+ ssize_t len)
+{
+  if (len <= 0) return ATTR_NONE;
+  value[len] = '\0';
+  unsigned attrib;
+  if (sscanf (value, "0x%x", &attrib) != 1)
+    return ATTR_NONE;
+  return attrib & ATTR_STORED;
+}
+
+static
+unsigned
+attr_read
+(int dirfd,
+ const char *name)
+{
+  char path[PATH_MAX + 32], value[64];
+  if (! attr_path (dirfd, name, path, sizeof (path)))
+    return ATTR_NONE;
+  ssize_t len = getxattr (path, ATTR_XATTR, value, sizeof (value) - 1);
+  if (len < 0 && errno == ERANGE)
+    {
+      /* a long binary blob: only its hex string prefix matters */
+      char *buf = malloc (XATTR_SIZE_MAX);
+      if (! buf) return ATTR_NONE;
+      len = getxattr (path, ATTR_XATTR, buf, XATTR_SIZE_MAX);
+      if (len > 0)
+	{
+	  memcpy (value, buf, sizeof (value) - 1);
+	  if (len >= (ssize_t) sizeof (value))
+	    len = sizeof (value) - 1;
+	}
+      free (buf);
+    }
+  return attr_parse (value, len);
+}
+
+/* The value Samba would store for attrib of st; the terminating NUL
+   is part of it, as Samba writes it */
+static
+int
+attr_value
+(const struct stat *st,
+ unsigned attrib,
+ char *value,
+ size_t size)
+{
+  attrib &= ATTR_STORED;
+  if (S_ISDIR (st->st_mode)) attrib |= _A_SUBDIR;
+  return snprintf (value, size, "0x%x", attrib) + 1;
+}
+
+
+/* DOS attributes */
+
+/* Only the owner’s write permission is considered */
+static
+bool
+attr_rdonly
+(const struct stat *st)
+{
+  return ! S_ISDIR (st->st_mode) && ! (st->st_mode & S_IWUSR);
+}
+
+/* Attributes shown for st when stored ones are stored */
+static
+unsigned
+attr_compose
+(unsigned stored,
+ const struct stat *st)
+{
+  unsigned attrib;
+  if (stored == ATTR_NONE)
+    attrib = S_ISDIR (st->st_mode) ? 0 : _A_ARCH;
+  else attrib = stored & ~_A_RDONLY;
+  if (S_ISDIR (st->st_mode)) attrib |= _A_SUBDIR;
+  if (attr_rdonly (st)) attrib |= _A_RDONLY;
+  return attrib;
+}
+
+int
+_dosix__attr_get
+(int dirfd,
+ const char *name,
+ const struct stat *st,
+ unsigned *attrib)
+{
+  assert (name), assert (st), assert (attrib);
+  unsigned stored;
+  if (! attr_lookup (st, &stored))
+    {
+      stored = attr_read (dirfd, name);
+      attr_store (st, stored);
+    }
+  *attrib = attr_compose (stored, st);
+  return 0;
+}
+
+/* Whether the cache knows st already stores what attrib would */
+static
+bool
+attr_same
+(const struct stat *st,
+ unsigned attrib)
+{
+  unsigned stored;
+  return attr_lookup (st, &stored)
+    && ! ((attr_compose (stored, st) ^ attrib)
+	  & (_A_HIDDEN | _A_SYSTEM | _A_ARCH));
+}
+
+/* New permissions of st for attrib; read-only stays in them, where
+   the host enforces it */
+static
+bool
+attr_mode
+(const struct stat *st,
+ unsigned attrib,
+ mode_t *mode)
+{
+  if (S_ISDIR (st->st_mode)
+      || attr_rdonly (st) == ! ! (attrib & _A_RDONLY))
+    return false;
+  *mode = st->st_mode & 07777;
+  if (attrib & _A_RDONLY)
+    *mode &= ~(S_IWUSR | S_IWGRP | S_IWOTH);
+  else *mode |= S_IWUSR;
+  return true;
+}
+
+/* Apply attrib to st, through fd if it is open and else through name
+   in dirfd.  Without write permission the extended attribute cannot
+   be set, so it goes in while the file is still writable */
+static
+int
+attr_change
+(int fd,
+ int dirfd,
+ const char *name,
+ const struct stat *st,
+ unsigned attrib)
+{
+  mode_t mode;
+  bool chmod = attr_mode (st, attrib, &mode);
+  if (chmod && ! (attrib & _A_RDONLY)
+      && (fd >= 0 ? fchmod (fd, mode) : fchmodat (dirfd, name, mode, 0)))
+    return -1;
+  if (! attr_same (st, attrib))
+    {
+      char value[16];
+      int len = attr_value (st, attrib, value, sizeof (value));
+      int ret;
+      if (fd >= 0)
+	ret = fsetxattr (fd, ATTR_XATTR, value, len, 0);
+      else
+	{
+	  char path[PATH_MAX + 32];
+	  if (! attr_path (dirfd, name, path, sizeof (path)))
+	    return -1;
+	  ret = setxattr (path, ATTR_XATTR, value, len, 0);
+	}
+      /* where attributes cannot be stored only read-only sticks */
+      if (ret && errno != ENOTSUP)
+	return -1;
+    }
+  if (chmod && (attrib & _A_RDONLY)
+      && (fd >= 0 ? fchmod (fd, mode) : fchmodat (dirfd, name, mode, 0)))
+    return -1;
+  return 0;
+}
+
+int
+_dosix__attr_set
+(int dirfd,
+ const char *name,
+ const struct stat *st,
+ unsigned attrib)
+{
+  assert (name), assert (st);
+  return attr_change (-1, dirfd, name, st, attrib);
+}
+
+
+/* batches */
+
+/* Each entry costs a single lookup of its name in the directory,
+   and none of its DOS path; names may be 8.3 aliases */
+static
+int
+attr_get_one
+(int dirfd,
+ struct _dosattr_t *e)
+{
+  const char *name = e->name;
+  char host[NAME_MAX + 1];
+  struct stat st;
+  if (fstatat (dirfd, name, &st, 0))
+    {
+      if (errno != ENOENT
+	  || _dosix__alias_resolve (dirfd, name, host, sizeof (host))
+	  || fstatat (dirfd, name = host, &st, 0))
+	return errno;
+    }
+  return _dosix__attr_get (dirfd, name, &st, &e->attrib) ? errno : 0;
+}
+
+static
+int
+attr_set_one
+(int dirfd,
+ struct _dosattr_t *e)
+{
+  const char *name = e->name;
+  char host[NAME_MAX + 1];
+  int flags = O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC;
+  int fd = openat (dirfd, name, flags);
+  if (fd < 0 && errno == ENOENT
+      && ! _dosix__alias_resolve (dirfd, name, host, sizeof (host)))
+    fd = openat (dirfd, name = host, flags);
+  struct stat st;
+  if (fd < 0)
+    {
+      /* unreadable files are changed through their name */
+      if (errno != EACCES
+	  || fstatat (dirfd, name, &st, 0)
+	  || attr_change (-1, dirfd, name, &st, e->attrib))
+	return errno;
+      return 0;
+    }
+  int err = fstat (fd, &st) || attr_change (fd, dirfd, name, &st, e->attrib)
+    ? errno : 0;
+  close (fd);
+  return err;
+}
+
+static
+void
+attr_ring_close
+(void *arg)
+{
+  struct attr_ring *ar = arg;
+  _dosix__uring_close (&ar->ring);
+  free (ar);
+}
+
+/* The ring of the calling thread, set up by its first batch and kept
+   until the thread exits */
+static
+struct attr_ring *
+attr_ring_get
+(void)
+{
+  struct attr_ring *ar = pthread_getspecific (attr_ring_key);
+  if (ar) return ar;
+  ar = malloc (sizeof (*ar));
+  if (! ar) return NULL;
+  if (_dosix__uring_setup (&ar->ring, ATTR_URING_ENTRIES))
+    {
+      free (ar);
+      return NULL;
+    }
+  if (pthread_setspecific (attr_ring_key, ar))
+    {
+      attr_ring_close (ar);
+      return NULL;
+    }
+  return ar;
+}
+
+/* A ring left with requests in flight can't be reused */
+static
+void
+attr_ring_drop
+(struct attr_ring *ar)
+{
+  pthread_setspecific (attr_ring_key, NULL);
+  attr_ring_close (ar);
+}
+
+/* Queue request i; nothing is consumed before the ring is entered */
+static
+struct io_uring_sqe *
+attr_ring_queue
+(struct attr_ring *ar,
+ unsigned i)
+{
+  struct uring *ring = &ar->ring;
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->user_data = i;
+  ring->sq_array[index] = index;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->in_flight++;
+  ar->queued[i] = true;
+  return sqe;
+}
+
+/* Run everything queued, leaving each result in res */
+static
+int
+attr_ring_run
+(struct attr_ring *ar)
+{
+  struct uring *ring = &ar->ring;
+  unsigned count = ring->in_flight;
+  if (count && _dosix__uring_enter (ring, count, count) < 0)
+    return -1;
+  while (ring->in_flight)
+    {
+      unsigned head = *ring->cq_head;
+      unsigned tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++, ring->in_flight--)
+	{
+	  struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+	  ar->res[cqe->user_data] = cqe->res;
+	}
+      __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+      if (ring->in_flight
+	  && _dosix__uring_enter (ring, 0, ring->in_flight) < 0)
+	return -1;
+    }
+  return 0;
+}
+
+/* First round of a batch: the status of every name */
+static
+int
+attr_ring_statx
+(struct attr_ring *ar,
+ int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count)
+{
+  memset (ar->queued, 0, count * sizeof (*ar->queued));
+  for (size_t i = 0; i < count; i++)
+    {
+      struct io_uring_sqe *sqe = attr_ring_queue (ar, i);
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dirfd;
+      sqe->addr = (uintptr_t) attrs[i].name;
+      sqe->len = ATTR_STATX;
+      sqe->off = (uintptr_t) &ar->stx[i];
+    }
+  if (attr_ring_run (ar)) return -1;
+  for (size_t i = 0; i < count; i++)
+    {
+      ar->queued[i] = false;
+      if (ar->res[i] < 0) continue;
+      struct statx *stx = &ar->stx[i];
+      struct stat *st = &ar->st[i];
+      memset (st, 0, sizeof (*st));
+      st->st_dev = makedev (stx->stx_dev_major, stx->stx_dev_minor);
+      st->st_ino = stx->stx_ino;
+      st->st_mode = stx->stx_mode;
+      st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+      st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+    }
+  return 0;
+}
+
+/* Names that fail a round, aliases among them, and requests the
+   kernel does not know are retried in place */
+static
+int
+attr_getv_ring
+(struct attr_ring *ar,
+ int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count)
+{
+  if (attr_ring_statx (ar, dirfd, attrs, count))
+    return -1;
+  for (size_t i = 0; i < count; i++)
+    {
+      struct _dosattr_t *e = &attrs[i];
+      unsigned stored;
+      if (ar->res[i] < 0)
+	e->error = attr_get_one (dirfd, e);
+      else if (attr_lookup (&ar->st[i], &stored))
+	{
+	  e->attrib = attr_compose (stored, &ar->st[i]);
+	  e->error = 0;
+	}
+      else if (! attr_path (dirfd, e->name, ar->path[i],
+			    sizeof (ar->path[i])))
+	e->error = errno;
+      else
+	{
+	  struct io_uring_sqe *sqe = attr_ring_queue (ar, i);
+	  sqe->opcode = IORING_OP_GETXATTR;
+	  sqe->addr = (uintptr_t) ATTR_XATTR;
+	  sqe->addr2 = (uintptr_t) ar->value[i];
+	  sqe->addr3 = (uintptr_t) ar->path[i];
+	  sqe->len = sizeof (ar->value[i]) - 1;
+	}
+    }
+  if (attr_ring_run (ar)) return -1;
+  for (size_t i = 0; i < count; i++)
+    {
+      if (! ar->queued[i]) continue;
+      struct _dosattr_t *e = &attrs[i];
+      int res = ar->res[i];
+      unsigned stored = res == -ERANGE || res == -EINVAL
+	? attr_read (dirfd, e->name)
+	: attr_parse (ar->value[i], res);
+      attr_store (&ar->st[i], stored);
+      e->attrib = attr_compose (stored, &ar->st[i]);
+      e->error = 0;
+    }
+  return 0;
+}
+
+static
+int
+attr_setv_ring
+(struct attr_ring *ar,
+ int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count)
+{
+  if (attr_ring_statx (ar, dirfd, attrs, count))
+    return -1;
+  for (size_t i = 0; i < count; i++)
+    {
+      struct _dosattr_t *e = &attrs[i];
+      struct stat *st = &ar->st[i];
+      mode_t mode;
+      e->error = 0;
+      if (ar->res[i] < 0)
+	e->error = attr_set_one (dirfd, e);
+      else if (attr_mode (st, e->attrib, &mode)
+	       && ! (e->attrib & _A_RDONLY)
+	       && fchmodat (dirfd, e->name, mode, 0))
+	e->error = errno;
+      else if (attr_same (st, e->attrib))
+	{
+	  if (attr_mode (st, e->attrib, &mode)
+	      && fchmodat (dirfd, e->name, mode, 0))
+	    e->error = errno;
+	}
+      else if (! attr_path (dirfd, e->name, ar->path[i],
+			    sizeof (ar->path[i])))
+	e->error = errno;
+      else
+	{
+	  int len = attr_value (st, e->attrib, ar->value[i],
+				sizeof (ar->value[i]));
+	  struct io_uring_sqe *sqe = attr_ring_queue (ar, i);
+	  sqe->opcode = IORING_OP_SETXATTR;
+	  sqe->addr = (uintptr_t) ATTR_XATTR;
+	  sqe->addr2 = (uintptr_t) ar->value[i];
+	  sqe->addr3 = (uintptr_t) ar->path[i];
+	  sqe->len = len;
+	}
+    }
+  if (attr_ring_run (ar)) return -1;
+  for (size_t i = 0; i < count; i++)
+    {
+      if (! ar->queued[i]) continue;
+      struct _dosattr_t *e = &attrs[i];
+      int res = ar->res[i];
+      mode_t mode;
+      if (res == -EINVAL)
+	e->error = attr_set_one (dirfd, e);
+      else if (res < 0 && res != -ENOTSUP)
+	e->error = -res;
+      else if ((e->attrib & _A_RDONLY)
+	       && attr_mode (&ar->st[i], e->attrib, &mode)
+	       && fchmodat (dirfd, e->name, mode, 0))
+	e->error = errno;
+    }
+  return 0;
+}
+
+/* Batches go through io_uring only if the environment asks for it:
+   DOSIX_ATTRURING=1.  Status and attribute requests are run by kernel
+   workers, which pays off where lookups block, on network or cold
+   disks, but loses to the calls made in place on a warm cache */
+static
+void
+attr_init
+(void)
+{
+  const char *env = getenv ("DOSIX_ATTRURING");
+  attr_uring = env && strcmp (env, "0")
+    && ! pthread_key_create (&attr_ring_key, attr_ring_close);
+}
+
+static
+void
+attr_batch
+(int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count,
+ int (*one) (int, struct _dosattr_t *),
+ int (*ring) (struct attr_ring *, int, struct _dosattr_t *, size_t))
+{
+  assert (attrs || ! count);
+  pthread_once (&attr_once, attr_init);
+  size_t i = 0;
+  struct attr_ring *ar = attr_uring && count >= ATTR_URING_MIN
+    ? attr_ring_get () : NULL;
+  if (ar)
+    for (size_t n; i < count; i += n)
+      {
+	n = count - i < ATTR_URING_ENTRIES ? count - i : ATTR_URING_ENTRIES;
+	if (ring (ar, dirfd, attrs + i, n))
+	  {
+	    attr_ring_drop (ar);
+	    break;
+	  }
+      }
+  for (; i < count; i++)
+    attrs[i].error = one (dirfd, &attrs[i]);
+}
+
+void
+_dosix__attr_getv
+(int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count)
+{
+  attr_batch (dirfd, attrs, count, attr_get_one, attr_getv_ring);
+}
+
+void
+_dosix__attr_setv
+(int dirfd,
+ struct _dosattr_t *attrs,
+ size_t count)
+{
+  attr_batch (dirfd, attrs, count, attr_set_one, attr_setv_ring);
+}
@@ -0,0 +1,380 @@
+/*
+  dostime.c -- Local time conversion for DOS dates and times
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "_dos.h"
+
+
+/* constants */
+
+/* Intervals of constant offset kept by each thread */
+#define ZONE_CACHE 64
+
+/* An offset is taken not to change and change back within a step */
+#define ZONE_STEP (7 * 86400)
+
+/* Intervals are not searched further than this from a lookup */
+#define ZONE_SPAN (366 * 86400)
+
+#define DAY 86400
+
+
+/* type definitions */
+
+/* Span of time over which the zone keeps one offset from UTC */
+struct zone_interval
+{
+  time_t start, end;		/* [start, end) */
+  long gmtoff;
+  int isdst;
+  const char *zone;		/* abbreviation, from the zone itself */
+};
+
+struct zone_cache
+{
+  bool tz_set;			/* TZ is in the environment */
+  bool tz_long;			/* too long to be remembered */
+  char tz[128];			/* TZ the intervals are for */
+  struct zone_interval iv[ZONE_CACHE]; /* sorted, disjoint */
+  size_t count;
+  size_t last;			/* interval of the last lookup */
+};
+
+
+/* global variables */
+
+/* Every thread keeps its own cache, so that lookups take no lock */
+static __thread struct zone_cache cache;
+
+/* Microseconds the DOS clock is ahead of the host clock */
+static int64_t clock_offset;
+static unsigned clock_changes;	/* times it was set */
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+
+
+/* calendar arithmetic */
+
+/* Floored division, for times before the epoch */
+static
+int64_t
+floordiv
+(int64_t a,
+ int64_t b)
+{
+  return a / b - (a % b < 0);
+}
+
+/* Days from 1970-01-01 to a date of the proleptic Gregorian
+   calendar; month is 1 to 12 */
+static
+int64_t
+days_from_civil
+(int64_t year,
+ unsigned month,
+ unsigned day)
+{
+  year -= month <= 2;
+  int64_t era = floordiv (year, 400);
+  unsigned yoe = year - era * 400;
+  unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5
+    + day - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static
+void
+civil_from_days
+(int64_t days,
+ int64_t *year,
+ unsigned *month,
+ unsigned *day)
+{
+  days += 719468;
+  int64_t era = floordiv (days, 146097);
+  unsigned doe = days - era * 146097;
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  *day = doy - (153 * mp + 2) / 5 + 1;
+  *month = mp < 10 ? mp + 3 : mp - 9;
+  *year = era * 400 + yoe + (*month <= 2);
+}
+
+
+/* zone intervals */
+
+/* Forget the intervals whenever TZ changes, as localtime would */
+static
+void
+zone_check
+(void)
+{
+  const char *tz = getenv ("TZ");
+  if (tz && strlen (tz) >= sizeof (cache.tz))
+    {
+      if (! cache.tz_long) tzset ();
+      cache.tz_set = cache.tz_long = true;
+      cache.count = 0;
+      return;
+    }
+  if (! cache.tz_long && (tz != NULL) == cache.tz_set
+      && (! tz || ! strcmp (tz, cache.tz)))
+    return;
+  tzset ();
+  cache.tz_set = tz != NULL;
+  cache.tz_long = false;
+  strcpy (cache.tz, tz ? tz : "");
+  cache.count = cache.last = 0;
+}
+
+static
+bool
+zone_same
+(time_t t,
+ const struct zone_interval *iv)
+{
+  struct tm tm;
+  return localtime_r (&t, &tm)
+    && tm.tm_gmtoff == iv->gmtoff
+    && tm.tm_isdst == iv->isdst;
+}
+
+/* Farthest time from t towards limit with the offset of iv, a week at
+   a time and then second by second */
+static
+time_t
+zone_edge
+(time_t t,
+ time_t limit,
+ const struct zone_interval *iv)
+{
+  time_t same = t;
+  while (same != limit)
+    {
+      time_t probe = limit > same
+	? (limit - same > ZONE_STEP ? same + ZONE_STEP : limit)
+	: (same - limit > ZONE_STEP ? same - ZONE_STEP : limit);
+      if (zone_same (probe, iv))
+	{
+	  same = probe;
+	  continue;
+	}
+      while (probe - same > 1 || same - probe > 1)
+	{
+	  time_t mid = same + (probe - same) / 2;
+	  if (zone_same (mid, iv)) same = mid;
+	  else probe = mid;
+	}
+      break;
+    }
+  return same;
+}
+
+/* The interval holding t, found anew if it is not cached */
+static
+const struct zone_interval *
+zone_find
+(time_t t)
+{
+  if (cache.last < cache.count
+      && cache.iv[cache.last].start <= t && t < cache.iv[cache.last].end)
+    return &cache.iv[cache.last];
+  size_t lo = 0, hi = cache.count;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (cache.iv[mid].start <= t) lo = mid + 1;
+      else hi = mid;
+    }
+  if (lo && t < cache.iv[lo - 1].end)
+    return &cache.iv[cache.last = lo - 1];
+
+  struct tm tm;
+  if (! localtime_r (&t, &tm)) return NULL;
+  struct zone_interval iv =
+    {
+     .gmtoff = tm.tm_gmtoff,
+     .isdst = tm.tm_isdst,
+     .zone = tm.tm_zone
+    };
+  /* up to the neighbours, which keep the cache disjoint */
+  time_t low = t < INT64_MIN + ZONE_SPAN ? INT64_MIN : t - ZONE_SPAN;
+  time_t high = t > INT64_MAX - ZONE_SPAN ? INT64_MAX - 1 : t + ZONE_SPAN;
+  if (lo && cache.iv[lo - 1].end > low) low = cache.iv[lo - 1].end;
+  if (lo < cache.count && cache.iv[lo].start - 1 < high)
+    high = cache.iv[lo].start - 1;
+  iv.start = zone_edge (t, low, &iv);
+  iv.end = zone_edge (t, high, &iv) + 1;
+
+  /* a full cache loses the interval farthest from t */
+  if (cache.count == ZONE_CACHE)
+    {
+      if (lo > ZONE_CACHE / 2)
+	{
+	  memmove (&cache.iv[0], &cache.iv[1],
+		   (ZONE_CACHE - 1) * sizeof (*cache.iv));
+	  lo--;
+	}
+      cache.count--;
+    }
+  memmove (&cache.iv[lo + 1], &cache.iv[lo],
+	   (cache.count - lo) * sizeof (*cache.iv));
+  cache.iv[lo] = iv;
+  cache.count++;
+  return &cache.iv[cache.last = lo];
+}
+
+
+/* conversions */
+
+int
+_dosix__time_local
+(time_t t,
+ struct tm *tm)
+{
+  zone_check ();
+  const struct zone_interval *iv = zone_find (t);
+  if (! iv) return -1;
+  int64_t local = (int64_t) t + iv->gmtoff;
+  int64_t days = floordiv (local, DAY);
+  unsigned secs = local - days * DAY;
+  int64_t year;
+  unsigned month, day;
+  civil_from_days (days, &year, &month, &day);
+  if (year - 1900 > INT_MAX || year - 1900 < INT_MIN)
+    {
+      errno = EOVERFLOW;
+      return -1;
+    }
+  *tm = (struct tm)
+    {
+     .tm_sec = secs % 60,
+     .tm_min = secs / 60 % 60,
+     .tm_hour = secs / 3600,
+     .tm_mday = day,
+     .tm_mon = month - 1,
+     .tm_year = year - 1900,
+     .tm_wday = (days % 7 + 11) % 7,	/* 1970-01-01 was a Thursday */
+     .tm_yday = days - days_from_civil (year, 1, 1),
+     .tm_isdst = iv->isdst,
+     .tm_gmtoff = iv->gmtoff,
+     .tm_zone = iv->zone
+    };
+  return 0;
+}
+
+int
+_dosix__time_unix
+(const struct tm *tm,
+ time_t *t)
+{
+  zone_check ();
+  int64_t year = tm->tm_year + INT64_C (1900) + floordiv (tm->tm_mon, 12);
+  unsigned month = tm->tm_mon - floordiv (tm->tm_mon, 12) * 12 + 1;
+  int64_t local = (days_from_civil (year, month, 1) + tm->tm_mday - 1) * DAY
+    + tm->tm_hour * INT64_C (3600) + tm->tm_min * 60 + tm->tm_sec;
+  /* the offset of the last lookup is usually the right one */
+  long gmtoff = cache.last < cache.count ? cache.iv[cache.last].gmtoff : 0;
+  for (int i = 0; i < 3; i++)
+    {
+      const struct zone_interval *iv = zone_find (local - gmtoff);
+      if (! iv) return -1;
+      if (iv->gmtoff == gmtoff)
+	{
+	  *t = local - gmtoff;
+	  return 0;
+	}
+      gmtoff = iv->gmtoff;
+    }
+  /* a time skipped by the zone is left to mktime to place */
+  struct tm copy = *tm;
+  copy.tm_isdst = -1;
+  time_t utime = mktime (&copy);
+  if (utime == (time_t) -1) return -1;
+  *t = utime;
+  return 0;
+}
+
+
+/* DOS clock */
+
+/* The DOS clock runs apart from the host one, which only privileged
+   processes may set.  It may start off from the environment:
+   DOSIX_CLOCKOFS=seconds, ahead of the host clock.  Setting it leaves
+   the environment alone, as other threads may be reading it */
+static
+void
+clock_init
+(void)
+{
+  const char *env = getenv ("DOSIX_CLOCKOFS");
+  if (! env) return;
+  char *end;
+  double seconds = strtod (env, &end);
+  if (end != env && ! *end && seconds > -1e12 && seconds < 1e12)
+    clock_offset = seconds * 1e6 + (seconds < 0 ? -0.5 : 0.5);
+}
+
+void
+_dosix__clock_get
+(struct timeval *tv)
+{
+  pthread_once (&clock_once, clock_init);
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  int64_t usec = ts.tv_sec * INT64_C (1000000) + ts.tv_nsec / 1000
+    + __atomic_load_n (&clock_offset, __ATOMIC_RELAXED);
+  tv->tv_sec = floordiv (usec, 1000000);
+  tv->tv_usec = usec - tv->tv_sec * INT64_C (1000000);
+}
+
+void
+_dosix__clock_set
+(const struct timeval *tv)
+{
+  pthread_once (&clock_once, clock_init);
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  int64_t offset = (tv->tv_sec - ts.tv_sec) * INT64_C (1000000)
+    + tv->tv_usec - ts.tv_nsec / 1000;
+  __atomic_store_n (&clock_offset, offset, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&clock_changes, 1, __ATOMIC_RELEASE);
+}
+
+unsigned
+_dosix__clock_changes
+(void)
+{
+  return __atomic_load_n (&clock_changes, __ATOMIC_ACQUIRE);
+}
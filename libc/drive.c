@@ -0,0 +1,713 @@
+/*
+  drive.c -- Drive mount table and DOS path translation
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include "_dos.h"
+
+
+/* constants */
+
+#define DRIVE_COUNT 26
+#define DRIVE_DEFAULT 2		/* C: */
+#define PATH_CACHE_SIZE 64	/* directories kept open */
+#define SPACE_TTL 500000000	/* free space cache lifetime, in ns */
+
+
+/* type definitions */
+
+struct drive
+{
+  char *root;			/* host directory, NULL if unmapped */
+  int rootfd;			/* O_PATH descriptor of root */
+  char cwd[PATH_MAX];		/* current directory, relative to root */
+  struct path_entry *cwdent;	/* pinned entry of cwd, NULL at root */
+  struct fatvol *fat;		/* image volume, rootfd unused if set */
+  char dcwd[PATH_MAX + 3];	/* cwd as _getcwd reports it */
+  struct statvfs space;		/* cached free space ... */
+  uint64_t space_time;		/* ... when it was read ... */
+  unsigned space_gen;		/* ... and of which generation */
+  bool space_valid;
+};
+
+/* A resolved directory prefix.  Entries are keyed by the DOS path,
+   so a directory renamed behind our back is only noticed once its
+   entry is evicted. */
+struct path_entry
+{
+  int drive;
+  char *dir;			/* relative to root, NULL if free */
+  size_t hash;
+  int fd;			/* O_PATH descriptor of dir */
+  unsigned refs;		/* resolutions still using fd */
+  unsigned long used;		/* LRU clock */
+};
+
+
+/* global private variables */
+
+static pthread_once_t drive_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct drive drives[DRIVE_COUNT];
+static int current_drive = DRIVE_DEFAULT; /* only accessed atomically */
+static struct path_entry path_cache[PATH_CACHE_SIZE];
+static unsigned long path_clock;
+static unsigned space_gen;	/* bumped by every write */
+
+
+/* forward declarations */
+
+static
+struct path_entry *
+path_open
+(int drive,
+ const char *dir,
+ int *fd);
+
+static
+void
+drive_setcwd
+(int drive,
+ const char *cwd,
+ struct path_entry *cwdent);
+
+
+/* drive mount table */
+
+static
+bool
+drive_mount
+(int drive,
+ const char *root)
+{
+  assert (drive >= 0 && drive < DRIVE_COUNT);
+  /* a regular file is a disk image */
+  struct stat st;
+  struct fatvol *fat = NULL;
+  int fd = -1;
+  if (! stat (root, &st) && S_ISREG (st.st_mode))
+    {
+      fat = _dosix__fat_mount (root);
+      if (! fat) return false;
+    }
+  else
+    {
+      fd = open (root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0) return false;
+    }
+  char *_root = strdup (root);
+  if (! _root)
+    {
+      if (fd >= 0) close (fd);
+      return false;
+    }
+  /* no trailing slash, except for the host root itself */
+  size_t len = strlen (_root);
+  while (len > 1 && _root[len - 1] == '/')
+    _root[--len] = '\0';
+  drives[drive].root = _root;
+  drives[drive].rootfd = fd;
+  drives[drive].fat = fat;
+  drive_setcwd (drive, "", NULL);
+  return true;
+}
+
+/* The table is read from the environment:
+   DOSIX_DRIVES=C=/home/user;D=/mnt/cdrom
+   Without it C: maps the host root.  The current drive and directory
+   start at the host working directory when a drive contains it. */
+static
+void
+drive_init
+(void)
+{
+  const char *env = getenv ("DOSIX_DRIVES");
+  if (env)
+    {
+      char *spec = strdup (env), *save;
+      if (spec)
+	for (char *tok = strtok_r (spec, ";", &save); tok;
+	     tok = strtok_r (NULL, ";", &save))
+	  if (isalpha ((unsigned char) tok[0]) && tok[1] == '=' && tok[2])
+	    drive_mount (toupper ((unsigned char) tok[0]) - 'A', tok + 2);
+      free (spec);
+    }
+  else drive_mount (DRIVE_DEFAULT, "/");
+
+  char cwd[PATH_MAX];
+  if (! getcwd (cwd, sizeof (cwd)))
+    cwd[0] = '\0';
+  int current = DRIVE_DEFAULT;
+  size_t best = 0;
+  const char *rest = NULL;
+  for (int d = 0; d < DRIVE_COUNT; d++)
+    {
+      const char *root = drives[d].root;
+      if (! root || drives[d].fat) continue;
+      size_t len = strcmp (root, "/") ? strlen (root) : 0;
+      if (strncmp (cwd, root, len) || (cwd[len] != '/' && cwd[len])
+	  || len < best)
+	continue;
+      best = len;
+      current = d;
+      rest = cwd + len;
+      while (*rest == '/') rest++;
+    }
+  if (rest && *rest)
+    {
+      int fd;
+      struct path_entry *e = path_open (current, rest, &fd);
+      if (e) drive_setcwd (current, rest, e);
+      else if (fd >= 0) close (fd);
+    }
+  if (! drives[current].root)
+    for (int d = 0; d < DRIVE_COUNT; d++)
+      if (drives[d].root)
+	{
+	  current = d;
+	  break;
+	}
+  __atomic_store_n (&current_drive, current, __ATOMIC_RELAXED);
+}
+
+/* Replace the current directory of drive by cwd, whose pinned entry
+   is cwdent; caller holds path_lock */
+static
+void
+drive_setcwd
+(int drive,
+ const char *cwd,
+ struct path_entry *cwdent)
+{
+  struct drive *d = &drives[drive];
+  if (d->cwdent) d->cwdent->refs--;
+  d->cwdent = cwdent;
+  if (d->cwd != cwd) strcpy (d->cwd, cwd);
+  /* kept formatted, so that _getcwd is a copy */
+  char *p = d->dcwd;
+  *p++ = 'A' + drive, *p++ = ':', *p++ = '\\';
+  for (; *cwd; cwd++)
+    *p++ = *cwd == '/' ? '\\' : *cwd;
+  *p = '\0';
+}
+
+/* Split a drive specification off path; -1 if it names no mounted
+   drive */
+static
+int
+drive_parse
+(const char **path)
+{
+  int drive = __atomic_load_n (&current_drive, __ATOMIC_RELAXED);
+  if (isalpha ((unsigned char) (*path)[0]) && (*path)[1] == ':')
+    {
+      drive = toupper ((unsigned char) (*path)[0]) - 'A';
+      *path += 2;
+    }
+  if (! drives[drive].root)
+    {
+      errno = ENOTBLK;		/* reported as invalid drive */
+      return -1;
+    }
+  return drive;
+}
+
+
+/* path translation */
+
+static
+size_t
+path_hash
+(int drive,
+ const char *dir)
+{
+  size_t h = 2166136261u ^ drive;
+  for (; *dir; dir++)
+    h = (h ^ (unsigned char) *dir) * 16777619u;
+  return h;
+}
+
+/* Fold a DOS path on drive into a host path relative to the drive
+   root: both separators are accepted, ‘.’ and ‘..’ are resolved
+   lexically and ‘..’ never climbs above the root. */
+static
+bool
+path_normalize
+(int drive,
+ const char *path,
+ char *out)
+{
+  size_t len = 0;
+  if (*path != '\\' && *path != '/')
+    {
+      len = strlen (drives[drive].cwd);
+      memcpy (out, drives[drive].cwd, len);
+    }
+  out[len] = '\0';
+  while (*path)
+    {
+      while (*path == '\\' || *path == '/') path++;
+      size_t n = strcspn (path, "\\/");
+      if (! n) break;
+      if (n == 1 && path[0] == '.');
+      else if (n == 2 && path[0] == '.' && path[1] == '.')
+	{
+	  char *slash = strrchr (out, '/');
+	  len = slash ? slash - out : 0;
+	  out[len] = '\0';
+	}
+      else
+	{
+	  if (len + (len > 0) + n >= PATH_MAX)
+	    {
+	      errno = ENAMETOOLONG;
+	      return false;
+	    }
+	  if (len) out[len++] = '/';
+	  memcpy (out + len, path, n);
+	  len += n;
+	  out[len] = '\0';
+	}
+      path += n;
+    }
+  return true;
+}
+
+static
+struct path_entry *
+path_lookup
+(int drive,
+ const char *dir,
+ size_t hash)
+{
+  for (size_t i = 0; i < PATH_CACHE_SIZE; i++)
+    {
+      struct path_entry *e = &path_cache[i];
+      if (e->dir && e->hash == hash && e->drive == drive
+	  && ! strcmp (e->dir, dir))
+	return e;
+    }
+  return NULL;
+}
+
+static
+struct path_entry *
+path_insert
+(int drive,
+ const char *dir,
+ size_t hash,
+ int fd)
+{
+  struct path_entry *victim = NULL;
+  for (size_t i = 0; i < PATH_CACHE_SIZE; i++)
+    {
+      struct path_entry *e = &path_cache[i];
+      if (! e->dir)
+	{
+	  victim = e;
+	  break;
+	}
+      if (! e->refs && (! victim || e->used < victim->used))
+	victim = e;
+    }
+  if (! victim) return NULL;	/* every entry is in use */
+  char *_dir = strdup (dir);
+  if (! _dir) return NULL;
+  if (victim->dir)
+    {
+      free (victim->dir);
+      close (victim->fd);
+    }
+  victim->drive = drive;
+  victim->dir = _dir;
+  victim->hash = hash;
+  victim->fd = fd;
+  victim->refs = 0;
+  return victim;
+}
+
+/* Open dir relative to base one component at a time, taking those
+   not found for short names */
+static
+int
+path_walk
+(int base,
+ const char *dir)
+{
+  int fd = base;
+  while (*dir)
+    {
+      size_t n = strcspn (dir, "/");
+      char name[NAME_MAX + 1];
+      int next = -1;
+      if (n > NAME_MAX)
+	errno = ENAMETOOLONG;
+      else
+	{
+	  memcpy (name, dir, n);
+	  name[n] = '\0';
+	  next = openat (fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	  if (next < 0 && errno == ENOENT
+	      && ! _dosix__alias_resolve (fd, name, name, sizeof (name)))
+	    next = openat (fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	}
+      if (fd != base) close (fd);
+      if (next < 0) return -1;
+      fd = next;
+      dir += n;
+      if (*dir) dir++;
+    }
+  return fd;
+}
+
+/* Open dir, relative to the root of drive, through the cache.
+   Returns the entry pinned, or NULL with *fd either an uncached
+   descriptor the caller owns or -1 on error; caller holds
+   path_lock */
+static
+struct path_entry *
+path_open
+(int drive,
+ const char *dir,
+ int *fd)
+{
+  *fd = -1;
+  size_t hash = path_hash (drive, dir);
+  struct path_entry *e = path_lookup (drive, dir, hash);
+  if (! e)
+    {
+      /* walk only what is below the nearest cached ancestor; current
+	 directories are always cached */
+      char prefix[PATH_MAX];
+      strcpy (prefix, dir);
+      int base = drives[drive].rootfd;
+      const char *rest = dir;
+      for (char *s; (s = strrchr (prefix, '/'));)
+	{
+	  *s = '\0';
+	  struct path_entry *a =
+	    path_lookup (drive, prefix, path_hash (drive, prefix));
+	  if (a)
+	    {
+	      a->used = ++path_clock;
+	      base = a->fd;
+	      rest = dir + (s - prefix) + 1;
+	      break;
+	    }
+	}
+      int _fd = openat (base, rest, O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (_fd < 0 && errno == ENOENT)
+	_fd = path_walk (base, rest);
+      if (_fd < 0)
+	{
+	  /* a missing directory is reported as path not found */
+	  if (errno == ENOENT) errno = ENOTDIR;
+	  return NULL;
+	}
+      e = path_insert (drive, dir, hash, _fd);
+      if (! e)
+	{
+	  /* cache full of pinned entries: this one is private */
+	  *fd = _fd;
+	  return NULL;
+	}
+    }
+  e->used = ++path_clock;
+  e->refs++;
+  return e;
+}
+
+/* A short name that names nothing may be the alias of a long one, or
+   a real one in another case */
+static
+void
+path_alias
+(struct dospath *dp)
+{
+  char basis[11];
+  struct stat st;
+  int err = errno;
+  if (strcmp (dp->name, ".") && ! _dosix__alias_basis (dp->name, basis)
+      && fstatat (dp->dirfd, dp->name, &st, AT_SYMLINK_NOFOLLOW)
+      && errno == ENOENT
+      && ! _dosix__alias_resolve (dp->dirfd, dp->name, dp->_name,
+				  sizeof (dp->_name)))
+    dp->name = dp->_name;
+  errno = err;
+}
+
+int
+_dosix__path_resolve
+(const char *path,
+ struct dospath *dp)
+{
+  assert (path), assert (dp);
+  pthread_once (&drive_once, drive_init);
+  pthread_mutex_lock (&path_lock);
+  int drive = drive_parse (&path);
+  char *buf = dp->_buf;
+  if (drive < 0 || ! path_normalize (drive, path, buf))
+    {
+      pthread_mutex_unlock (&path_lock);
+      return -1;
+    }
+  dp->drive = drive;
+  dp->fat = drives[drive].fat;
+  dp->_entry = NULL;
+  dp->_fd = -1;
+
+  /* split into directory and final component */
+  char *slash = strrchr (buf, '/');
+  const char *dir;
+  if (slash)
+    {
+      *slash = '\0';
+      dir = buf;
+      dp->name = slash + 1;
+    }
+  else
+    {
+      dir = "";
+      dp->name = *buf ? buf : ".";
+    }
+  dp->dir = dir;
+  if (dp->fat)
+    {
+      /* images keep their own directory index */
+      pthread_mutex_unlock (&path_lock);
+      dp->dirfd = -1;
+      return 0;
+    }
+  if (! *dir)
+    {
+      pthread_mutex_unlock (&path_lock);
+      dp->dirfd = drives[drive].rootfd;
+      path_alias (dp);
+      return 0;
+    }
+
+  dp->_entry = path_open (drive, dir, &dp->_fd);
+  pthread_mutex_unlock (&path_lock);
+  if (dp->_entry)
+    dp->dirfd = dp->_entry->fd;
+  else if (dp->_fd >= 0)
+    dp->dirfd = dp->_fd;
+  else return -1;
+  path_alias (dp);
+  return 0;
+}
+
+void
+_dosix__path_release
+(struct dospath *dp)
+{
+  assert (dp);
+  if (dp->_entry)
+    {
+      pthread_mutex_lock (&path_lock);
+      dp->_entry->refs--;
+      pthread_mutex_unlock (&path_lock);
+      dp->_entry = NULL;
+    }
+  if (dp->_fd >= 0)
+    {
+      close (dp->_fd);
+      dp->_fd = -1;
+    }
+}
+
+
+/* current drive and directories */
+
+int
+_dosix__drive_get
+(void)
+{
+  pthread_once (&drive_once, drive_init);
+  return __atomic_load_n (&current_drive, __ATOMIC_RELAXED);
+}
+
+int
+_dosix__drive_set
+(int drive)
+{
+  pthread_once (&drive_once, drive_init);
+  if (drive < 0 || drive >= DRIVE_COUNT || ! drives[drive].root)
+    {
+      errno = ENOTBLK;
+      return -1;
+    }
+  __atomic_store_n (&current_drive, drive, __ATOMIC_RELAXED);
+  return 0;
+}
+
+int
+_dosix__drive_count
+(void)
+{
+  return DRIVE_COUNT;
+}
+
+int
+_dosix__drive_chdir
+(const char *path)
+{
+  assert (path);
+  pthread_once (&drive_once, drive_init);
+  pthread_mutex_lock (&path_lock);
+  char cwd[PATH_MAX];
+  int drive = drive_parse (&path);
+  if (drive < 0 || ! path_normalize (drive, path, cwd))
+    {
+      pthread_mutex_unlock (&path_lock);
+      return -1;
+    }
+  struct path_entry *e = NULL;
+  if (drives[drive].fat)
+    {
+      void *ds = _dosix__fat_opendir (drives[drive].fat, cwd);
+      if (! ds)
+	{
+	  pthread_mutex_unlock (&path_lock);
+	  return -1;
+	}
+      _dosix__fat_closedir (ds);
+    }
+  else if (*cwd)
+    {
+      /* the new directory stays open as long as it is current */
+      int fd;
+      e = path_open (drive, cwd, &fd);
+      if (! e)
+	{
+	  if (fd >= 0)
+	    {
+	      close (fd);
+	      errno = EMFILE;
+	    }
+	  pthread_mutex_unlock (&path_lock);
+	  return -1;
+	}
+    }
+  drive_setcwd (drive, cwd, e);
+  pthread_mutex_unlock (&path_lock);
+  return 0;
+}
+
+int
+_dosix__drive_getcwd
+(int drive,
+ char *buffer,
+ size_t size)
+{
+  assert (buffer);
+  pthread_once (&drive_once, drive_init);
+  if (drive < 0) drive = __atomic_load_n (&current_drive, __ATOMIC_RELAXED);
+  if (drive >= DRIVE_COUNT || ! drives[drive].root)
+    {
+      errno = ENOTBLK;
+      return -1;
+    }
+  pthread_mutex_lock (&path_lock);
+  size_t len = strlen (drives[drive].dcwd);
+  if (len >= size)
+    {
+      pthread_mutex_unlock (&path_lock);
+      errno = ERANGE;
+      return -1;
+    }
+  memcpy (buffer, drives[drive].dcwd, len + 1);
+  pthread_mutex_unlock (&path_lock);
+  return 0;
+}
+
+
+/* free space */
+
+void
+_dosix__drive_space_invalidate
+(void)
+{
+  __atomic_add_fetch (&space_gen, 1, __ATOMIC_RELAXED);
+}
+
+int
+_dosix__drive_space
+(int drive,
+ struct drive_space *space)
+{
+  assert (space);
+  pthread_once (&drive_once, drive_init);
+  if (drive == -1)
+    drive = __atomic_load_n (&current_drive, __ATOMIC_RELAXED);
+  if (drive < 0 || drive >= DRIVE_COUNT || ! drives[drive].root)
+    {
+      errno = ENOTBLK;
+      return -1;
+    }
+  struct drive *d = &drives[drive];
+  if (d->fat)
+    {
+      /* an image cannot change under us */
+      _dosix__fat_space (d->fat, space);
+      return 0;
+    }
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  uint64_t now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  unsigned gen = __atomic_load_n (&space_gen, __ATOMIC_RELAXED);
+  pthread_mutex_lock (&path_lock);
+  if (! d->space_valid || d->space_gen != gen
+      || now - d->space_time > SPACE_TTL)
+    {
+      if (fstatvfs (d->rootfd, &d->space))
+	{
+	  pthread_mutex_unlock (&path_lock);
+	  return -1;
+	}
+      d->space_time = now;
+      d->space_gen = gen;
+      d->space_valid = true;
+    }
+  unsigned long frsize = d->space.f_frsize ? d->space.f_frsize
+    : d->space.f_bsize;
+  space->bytes_per_sector = frsize % 512 ? frsize : 512;
+  space->sectors_per_cluster = frsize / space->bytes_per_sector;
+  space->total_clusters = d->space.f_blocks;
+  space->avail_clusters = d->space.f_bavail;
+  pthread_mutex_unlock (&path_lock);
+  return 0;
+}
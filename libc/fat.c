@@ -0,0 +1,1010 @@
+/*
+  fat.c -- FAT12/16/32 disk-image drives (read-only)
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <search.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dos.h>
+#include "_dos.h"
+
+
+/* constants */
+
+#define FAT_CACHE_BUDGET (1024 * 1024) /* bytes of cached clusters */
+#define FAT_CACHE_MIN 16	       /* clusters, whatever their size */
+#define FAT_DIR_CACHE 64	       /* directory indexes kept */
+#define FAT_ATTR_LFN 0x0f
+#define FAT_DIRENT_SIZE 32
+#define FAT_BAD UINT32_MAX	/* link out of the data area */
+
+
+/* type definitions */
+
+struct fatbuf
+{
+  uint32_t cluster;		/* 0 if free */
+  int next;			/* hash chain, -1 terminated */
+  unsigned long used;		/* LRU clock */
+  char *data;
+};
+
+/* All entries of a directory, parsed once */
+struct fatdir
+{
+  uint32_t cluster;		/* first cluster, 0 for a fixed root */
+  struct fatent *ents;		/* NULL if free */
+  size_t count;
+  unsigned refs;		/* open streams */
+  unsigned long used;		/* LRU clock */
+};
+
+struct fatvol
+{
+  int fd;			/* image file */
+  unsigned type;		/* 12, 16 or 32 */
+  uint32_t bytes_per_sector;
+  uint32_t cluster_size;
+  uint32_t clusters;		/* data clusters, numbered from 2 */
+  uint32_t free_clusters;	/* UINT32_MAX until counted */
+  off_t data_offset;		/* image offset of cluster 2 */
+  off_t root_offset;		/* FAT12/16 fixed root directory */
+  uint32_t root_entries;
+  uint32_t root_cluster;	/* FAT32 root directory */
+  const unsigned char *fat;	/* first FAT, mapped */
+  size_t fat_length;
+  void *map;			/* page-aligned mapping holding fat */
+  size_t maplen;
+  pthread_mutex_t lock;
+  struct fatbuf *bufs;		/* cluster cache */
+  int *buckets;
+  size_t nbufs;
+  unsigned long clock;
+  struct fatdir dirs[FAT_DIR_CACHE];
+};
+
+struct fatdirstream
+{
+  struct fatvol *vol;
+  struct fatdir *dir;
+  size_t pos;
+};
+
+struct fathandle
+{
+  int handle;			/* reserved host descriptor */
+  struct fatvol *vol;
+  struct fatent ent;
+  off_t pos;
+  uint32_t cur_cluster;		/* cluster holding ... */
+  uint32_t cur_index;		/* ... this cluster of the file */
+};
+
+
+/* global private variables */
+
+/* fat_lock guards the tree of handles; their count is also read
+   without it, so that host handles are told apart without locking */
+static pthread_mutex_t fat_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *fat_handles;
+static unsigned fat_nhandles;
+
+
+/* volume */
+
+static
+uint32_t
+le16
+(const unsigned char *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static
+uint32_t
+le32
+(const unsigned char *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/* Parse the boot sector at base; false if it holds no usable BPB */
+static
+bool
+fat_bpb
+(struct fatvol *vol,
+ const unsigned char *bs,
+ off_t base,
+ off_t size,
+ off_t *fat_offset)
+{
+  uint32_t bps = le16 (bs + 11);
+  uint32_t spc = bs[13];
+  uint32_t reserved = le16 (bs + 14);
+  uint32_t nfats = bs[16];
+  uint32_t root_entries = le16 (bs + 17);
+  uint32_t sectors = le16 (bs + 19) ? le16 (bs + 19) : le32 (bs + 32);
+  uint32_t fatsz = le16 (bs + 22) ? le16 (bs + 22) : le32 (bs + 36);
+  if ((bps != 512 && bps != 1024 && bps != 2048 && bps != 4096)
+      || ! spc || (spc & (spc - 1)) || ! reserved || ! nfats || ! fatsz)
+    return false;
+  uint32_t root_sectors = (root_entries * FAT_DIRENT_SIZE + bps - 1) / bps;
+  uint64_t meta = reserved + (uint64_t) nfats * fatsz + root_sectors;
+  if (sectors <= meta) return false;
+  vol->clusters = (sectors - meta) / spc;
+  vol->type = vol->clusters < 4085 ? 12 : vol->clusters < 65525 ? 16 : 32;
+  vol->bytes_per_sector = bps;
+  vol->cluster_size = bps * spc;
+  *fat_offset = base + (off_t) reserved * bps;
+  vol->fat_length = (size_t) fatsz * bps;
+  vol->root_offset = *fat_offset + (off_t) nfats * fatsz * bps;
+  vol->root_entries = root_entries;
+  vol->data_offset = vol->root_offset + (off_t) root_sectors * bps;
+  vol->root_cluster = vol->type == 32 ? le32 (bs + 44) : 0;
+  if (vol->type == 32
+      && (vol->root_cluster < 2 || vol->root_cluster >= vol->clusters + 2))
+    return false;
+  /* the FAT must describe every cluster and lie within the image */
+  uint64_t need = (uint64_t) (vol->clusters + 2) * vol->type / 8;
+  return need <= vol->fat_length
+    && *fat_offset + (off_t) vol->fat_length <= size;
+}
+
+/* Raw FAT entry of cluster */
+static
+uint32_t
+fat_entry
+(struct fatvol *vol,
+ uint32_t cluster)
+{
+  uint32_t next;
+  switch (vol->type)
+    {
+    case 12:
+      next = le16 (vol->fat + cluster + cluster / 2);
+      next = cluster & 1 ? next >> 4 : next & 0xfff;
+      break;
+    case 16:
+      next = le16 (vol->fat + 2 * cluster);
+      break;
+    default:
+      next = le32 (vol->fat + 4 * cluster) & 0x0fffffff;
+      break;
+    }
+  return next;
+}
+
+/* Whether cluster is in the data area, and so in the FAT; anything
+   else an image holds is refused with EUCLEAN */
+static
+bool
+fat_valid
+(struct fatvol *vol,
+ uint32_t cluster)
+{
+  if (cluster >= 2 && cluster < vol->clusters + 2) return true;
+  errno = EUCLEAN;
+  return false;
+}
+
+/* Next cluster in a chain, 0 at its end, FAT_BAD on a bad link */
+static
+uint32_t
+fat_next
+(struct fatvol *vol,
+ uint32_t cluster)
+{
+  uint32_t next = fat_entry (vol, cluster);
+  uint32_t end = vol->type == 12 ? 0xff8 : vol->type == 16 ? 0xfff8
+    : 0x0ffffff8;
+  if (next >= end) return 0;
+  return fat_valid (vol, next) ? next : FAT_BAD;
+}
+
+static
+off_t
+fat_cluster_offset
+(struct fatvol *vol,
+ uint32_t cluster)
+{
+  return vol->data_offset + (off_t) (cluster - 2) * vol->cluster_size;
+}
+
+static
+bool
+fat_pread
+(int fd,
+ void *buffer,
+ size_t count,
+ off_t offset)
+{
+  char *p = buffer;
+  while (count)
+    {
+      ssize_t ret = pread (fd, p, count, offset);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0)
+	{
+	  if (! ret) errno = EIO;	/* truncated image */
+	  return false;
+	}
+      p += ret, count -= ret, offset += ret;
+    }
+  return true;
+}
+
+/* A cluster through the LRU cache; caller holds vol->lock */
+static
+const char *
+fat_cluster
+(struct fatvol *vol,
+ uint32_t cluster)
+{
+  if (! fat_valid (vol, cluster)) return NULL;
+  int *bucket = &vol->buckets[cluster % vol->nbufs];
+  for (int i = *bucket; i >= 0; i = vol->bufs[i].next)
+    if (vol->bufs[i].cluster == cluster)
+      {
+	vol->bufs[i].used = ++vol->clock;
+	return vol->bufs[i].data;
+      }
+  size_t victim = 0;
+  for (size_t i = 1; i < vol->nbufs; i++)
+    if (vol->bufs[i].used < vol->bufs[victim].used)
+      victim = i;
+  struct fatbuf *b = &vol->bufs[victim];
+  if (b->cluster)
+    {
+      /* unlink from its old chain */
+      int *p = &vol->buckets[b->cluster % vol->nbufs];
+      while (*p != (int) victim) p = &vol->bufs[*p].next;
+      *p = b->next;
+      b->cluster = 0;
+    }
+  if (! fat_pread (vol->fd, b->data, vol->cluster_size,
+		   fat_cluster_offset (vol, cluster)))
+    return NULL;
+  b->cluster = cluster;
+  b->used = ++vol->clock;
+  b->next = *bucket;
+  *bucket = victim;
+  return b->data;
+}
+
+struct fatvol *
+_dosix__fat_mount
+(const char *image)
+{
+  assert (image);
+  int fd = open (image, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  struct stat st;
+  unsigned char bs[512];
+  struct fatvol *vol = calloc (1, sizeof (*vol));
+  if (! vol || fstat (fd, &st) || ! fat_pread (fd, bs, sizeof (bs), 0))
+    goto fail;
+  off_t fat_offset;
+  if (! fat_bpb (vol, bs, 0, st.st_size, &fat_offset))
+    {
+      /* a hard-disk image: use the first FAT partition */
+      if (bs[510] != 0x55 || bs[511] != 0xaa) goto fail;
+      bool found = false;
+      unsigned char mbr[64];
+      memcpy (mbr, bs + 446, sizeof (mbr));
+      for (int i = 0; i < 4 && ! found; i++)
+	{
+	  const unsigned char *pe = mbr + 16 * i;
+	  switch (pe[4])
+	    {
+	    case 0x01: case 0x04: case 0x06:
+	    case 0x0b: case 0x0c: case 0x0e:
+	      break;
+	    default:
+	      continue;
+	    }
+	  off_t base = (off_t) le32 (pe + 8) * 512;
+	  found = fat_pread (fd, bs, sizeof (bs), base)
+	    && fat_bpb (vol, bs, base, st.st_size, &fat_offset);
+	}
+      if (! found) goto fail;
+    }
+
+  /* map the first FAT: chains are then followed without a system
+     call */
+  long page = sysconf (_SC_PAGESIZE);
+  off_t start = fat_offset & ~(off_t) (page - 1);
+  vol->maplen = vol->fat_length + (fat_offset - start);
+  vol->map = mmap (NULL, vol->maplen, PROT_READ, MAP_SHARED, fd, start);
+  if (vol->map == MAP_FAILED) goto fail;
+  vol->fat = (const unsigned char *) vol->map + (fat_offset - start);
+
+  vol->nbufs = FAT_CACHE_BUDGET / vol->cluster_size;
+  if (vol->nbufs < FAT_CACHE_MIN) vol->nbufs = FAT_CACHE_MIN;
+  vol->bufs = calloc (vol->nbufs, sizeof (*vol->bufs));
+  vol->buckets = malloc (vol->nbufs * sizeof (*vol->buckets));
+  if (! vol->bufs || ! vol->buckets) goto fail_unmap;
+  for (size_t i = 0; i < vol->nbufs; i++)
+    {
+      vol->buckets[i] = -1;
+      vol->bufs[i].data = malloc (vol->cluster_size);
+      if (! vol->bufs[i].data) goto fail_unmap;
+    }
+  pthread_mutex_init (&vol->lock, NULL);
+  vol->free_clusters = UINT32_MAX;
+  vol->fd = fd;
+  return vol;
+
+ fail_unmap:
+  if (vol->bufs)
+    for (size_t i = 0; i < vol->nbufs; i++)
+      free (vol->bufs[i].data);
+  free (vol->bufs);
+  free (vol->buckets);
+  munmap (vol->map, vol->maplen);
+ fail:
+  free (vol);
+  close (fd);
+  errno = EINVAL;
+  return NULL;
+}
+
+
+/* directory index */
+
+static
+void
+fat_utf8
+(char *out,
+ size_t size,
+ const uint16_t *in)
+{
+  size_t n = 0;
+  for (; *in && n + 4 < size; in++)
+    if (*in < 0x80)
+      out[n++] = *in;
+    else if (*in < 0x800)
+      {
+	out[n++] = 0xc0 | *in >> 6;
+	out[n++] = 0x80 | (*in & 0x3f);
+      }
+    else
+      {
+	out[n++] = 0xe0 | *in >> 12;
+	out[n++] = 0x80 | (*in >> 6 & 0x3f);
+	out[n++] = 0x80 | (*in & 0x3f);
+      }
+  out[n] = '\0';
+}
+
+static
+void
+fat_shortname
+(char *out,
+ const unsigned char *e)
+{
+  /* NT keeps the case of all-lowercase base and extension here */
+  bool lbase = e[12] & 0x08, lext = e[12] & 0x10;
+  size_t n = 0;
+  for (int i = 0; i < 8 && e[i] != ' '; i++)
+    {
+      unsigned char c = i == 0 && e[i] == 0x05 ? 0xe5 : e[i];
+      out[n++] = lbase && c >= 'A' && c <= 'Z' ? c + 32 : c;
+    }
+  if (e[8] != ' ')
+    {
+      out[n++] = '.';
+      for (int i = 8; i < 11 && e[i] != ' '; i++)
+	out[n++] = lext && e[i] >= 'A' && e[i] <= 'Z' ? e[i] + 32 : e[i];
+    }
+  out[n] = '\0';
+}
+
+static
+unsigned char
+fat_checksum
+(const unsigned char *e)
+{
+  unsigned char sum = 0;
+  for (int i = 0; i < 11; i++)
+    sum = ((sum & 1) << 7) + (sum >> 1) + e[i];
+  return sum;
+}
+
+/* Parse raw directory entries, long names included */
+static
+bool
+fat_parse
+(struct fatvol *vol,
+ struct fatdir *dir,
+ const unsigned char *raw,
+ size_t count)
+{
+  static const int lfn_off[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24,
+				   28, 30 };
+  uint16_t lfn[20 * 13 + 1];
+  int lfn_next = 0;		/* ordinal expected next, 0 if none */
+  unsigned char lfn_sum = 0;
+  size_t cap = 16;
+  dir->ents = malloc (cap * sizeof (*dir->ents));
+  dir->count = 0;
+  if (! dir->ents) return false;
+  for (size_t i = 0; i < count; i++)
+    {
+      const unsigned char *e = raw + i * FAT_DIRENT_SIZE;
+      if (! e[0]) break;
+      if (e[0] == 0xe5)
+	{
+	  lfn_next = 0;
+	  continue;
+	}
+      if ((e[11] & 0x3f) == FAT_ATTR_LFN)
+	{
+	  int ord = e[0] & 0x1f;
+	  if (e[0] & 0x40)
+	    {
+	      if (! ord || ord > 20)
+		{
+		  lfn_next = 0;
+		  continue;
+		}
+	      memset (lfn, 0, sizeof (lfn));
+	      lfn_sum = e[13];
+	    }
+	  else if (ord != lfn_next - 1 || e[13] != lfn_sum)
+	    {
+	      lfn_next = 0;
+	      continue;
+	    }
+	  for (int k = 0; k < 13; k++)
+	    {
+	      uint16_t c = le16 (e + lfn_off[k]);
+	      lfn[(ord - 1) * 13 + k] = c == 0xffff ? 0 : c;
+	    }
+	  lfn_next = ord;
+	  continue;
+	}
+      if (e[11] & _A_VOLID)
+	{
+	  lfn_next = 0;
+	  continue;
+	}
+      if (dir->count == cap)
+	{
+	  struct fatent *ents = realloc (dir->ents, 2 * cap * sizeof (*ents));
+	  if (! ents) return false;
+	  dir->ents = ents, cap *= 2;
+	}
+      struct fatent *ent = &dir->ents[dir->count++];
+      fat_shortname (ent->alias, e);
+      if (lfn_next == 1 && lfn_sum == fat_checksum (e))
+	fat_utf8 (ent->name, sizeof (ent->name), lfn);
+      else strcpy (ent->name, ent->alias);
+      lfn_next = 0;
+      ent->attrib = e[11];
+      ent->wr_time = le16 (e + 22);
+      ent->wr_date = le16 (e + 24);
+      ent->cluster = le16 (e + 26) | (vol->type == 32 ? le16 (e + 20) << 16 : 0);
+      ent->size = le32 (e + 28);
+    }
+  return true;
+}
+
+/* The index of the directory starting at cluster, pinned; caller
+   holds vol->lock */
+static
+struct fatdir *
+fat_dir
+(struct fatvol *vol,
+ uint32_t cluster)
+{
+  struct fatdir *victim = NULL;
+  for (size_t i = 0; i < FAT_DIR_CACHE; i++)
+    {
+      struct fatdir *d = &vol->dirs[i];
+      if (d->ents && d->cluster == cluster)
+	{
+	  d->used = ++vol->clock;
+	  d->refs++;
+	  return d;
+	}
+      if (! d->refs && (! victim || ! d->ents
+			|| (victim->ents && d->used < victim->used)))
+	victim = d;
+    }
+  if (! victim)
+    {
+      errno = EMFILE;
+      return NULL;
+    }
+  free (victim->ents);
+  victim->ents = NULL;
+
+  unsigned char *raw = NULL;
+  size_t count = 0;
+  if (! cluster)
+    {
+      count = vol->root_entries;
+      raw = malloc (count * FAT_DIRENT_SIZE);
+      if (! raw || ! fat_pread (vol->fd, raw, count * FAT_DIRENT_SIZE,
+				vol->root_offset))
+	goto fail;
+    }
+  else
+    {
+      size_t per = vol->cluster_size / FAT_DIRENT_SIZE;
+      /* a chain longer than the volume is a loop */
+      for (uint32_t c = cluster, n = 0; c && n <= vol->clusters;
+	   c = fat_next (vol, c), n++)
+	{
+	  if (c == FAT_BAD) goto fail;
+	  unsigned char *_raw = realloc (raw, (count + per) * FAT_DIRENT_SIZE);
+	  if (! _raw) goto fail;
+	  raw = _raw;
+	  const char *data = fat_cluster (vol, c);
+	  if (! data) goto fail;
+	  memcpy (raw + count * FAT_DIRENT_SIZE, data, vol->cluster_size);
+	  count += per;
+	}
+    }
+  if (! fat_parse (vol, victim, raw, count))
+    {
+      free (victim->ents);
+      victim->ents = NULL;
+      goto fail;
+    }
+  free (raw);
+  victim->cluster = cluster;
+  victim->used = ++vol->clock;
+  victim->refs = 1;
+  return victim;
+
+ fail:
+  free (raw);
+  return NULL;
+}
+
+static
+struct fatent *
+fat_find
+(struct fatdir *dir,
+ const char *name)
+{
+  for (size_t i = 0; i < dir->count; i++)
+    if (! strcasecmp (dir->ents[i].name, name)
+	|| ! strcasecmp (dir->ents[i].alias, name))
+      return &dir->ents[i];
+  return NULL;
+}
+
+/* Walk path, relative to the root and ‘/’ separated, to the index of
+   the directory it names; caller holds vol->lock */
+static
+struct fatdir *
+fat_walk
+(struct fatvol *vol,
+ const char *path)
+{
+  struct fatdir *dir = fat_dir (vol, vol->root_cluster);
+  while (dir && *path)
+    {
+      size_t n = strcspn (path, "/");
+      char name[NAME_MAX + 1];
+      if (n > NAME_MAX) n = NAME_MAX;
+      memcpy (name, path, n);
+      name[n] = '\0';
+      path += n + (path[n] == '/');
+      struct fatent *ent = fat_find (dir, name);
+      uint32_t cluster = ent ? ent->cluster : 0;
+      bool isdir = ent && ent->attrib & _A_SUBDIR;
+      dir->refs--;
+      if (! isdir)
+	{
+	  errno = ENOTDIR;	/* reported as path not found */
+	  return NULL;
+	}
+      /* ‘..’ to the root is stored as cluster 0 */
+      dir = fat_dir (vol, cluster ? cluster : vol->root_cluster);
+    }
+  return dir;
+}
+
+int
+_dosix__fat_stat
+(struct fatvol *vol,
+ const char *dir,
+ const char *name,
+ struct fatent *ent)
+{
+  assert (vol), assert (dir), assert (name), assert (ent);
+  pthread_mutex_lock (&vol->lock);
+  struct fatdir *d = fat_walk (vol, dir);
+  if (! d)
+    {
+      pthread_mutex_unlock (&vol->lock);
+      return -1;
+    }
+  struct fatent *e = strcmp (name, ".") ? fat_find (d, name) : NULL;
+  if (e) *ent = *e;
+  else if (! strcmp (name, ".") && ! *dir)
+    {
+      /* the root has no entry of its own */
+      memset (ent, 0, sizeof (*ent));
+      ent->attrib = _A_SUBDIR;
+      ent->cluster = vol->root_cluster;
+    }
+  d->refs--;
+  pthread_mutex_unlock (&vol->lock);
+  if (! e && strcmp (name, "."))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  return 0;
+}
+
+void *
+_dosix__fat_opendir
+(struct fatvol *vol,
+ const char *dir)
+{
+  assert (vol), assert (dir);
+  struct fatdirstream *ds = malloc (sizeof (*ds));
+  if (! ds) return NULL;
+  pthread_mutex_lock (&vol->lock);
+  ds->dir = fat_walk (vol, dir);
+  pthread_mutex_unlock (&vol->lock);
+  if (! ds->dir)
+    {
+      free (ds);
+      return NULL;
+    }
+  ds->vol = vol;
+  ds->pos = 0;
+  return ds;
+}
+
+bool
+_dosix__fat_readdir
+(void *stream,
+ struct fatent *ent)
+{
+  assert (stream), assert (ent);
+  struct fatdirstream *ds = stream;
+  /* the index is pinned: no lock needed to read it */
+  if (ds->pos >= ds->dir->count) return false;
+  *ent = ds->dir->ents[ds->pos++];
+  return true;
+}
+
+void
+_dosix__fat_closedir
+(void *stream)
+{
+  struct fatdirstream *ds = stream;
+  if (! ds) return;
+  pthread_mutex_lock (&ds->vol->lock);
+  ds->dir->refs--;
+  pthread_mutex_unlock (&ds->vol->lock);
+  free (ds);
+}
+
+
+/* file handles */
+
+static
+int
+fat_handle_cmp
+(const void *_a,
+ const void *_b)
+{
+  const struct fathandle *a = (const struct fathandle *) _a;
+  const struct fathandle *b = (const struct fathandle *) _b;
+  return a->handle - b->handle;
+}
+
+static
+struct fathandle *
+fat_handle
+(int handle)
+{
+  if (! __atomic_load_n (&fat_nhandles, __ATOMIC_RELAXED)) return NULL;
+  struct fathandle key = { .handle = handle };
+  pthread_mutex_lock (&fat_lock);
+  struct fathandle **fh = tfind (&key, &fat_handles, fat_handle_cmp);
+  pthread_mutex_unlock (&fat_lock);
+  return fh ? *fh : NULL;
+}
+
+bool
+_dosix__fat_handle
+(int handle)
+{
+  return fat_handle (handle) != NULL;
+}
+
+int
+_dosix__fat_open
+(struct fatvol *vol,
+ const char *dir,
+ const char *name,
+ int *handle)
+{
+  assert (handle);
+  struct fathandle *fh = malloc (sizeof (*fh));
+  if (! fh) return -1;
+  if (_dosix__fat_stat (vol, dir, name, &fh->ent))
+    {
+      free (fh);
+      return -1;
+    }
+  if (fh->ent.attrib & _A_SUBDIR)
+    {
+      free (fh);
+      errno = EACCES;
+      return -1;
+    }
+  /* only empty files may have no cluster */
+  if (fh->ent.size && ! fat_valid (vol, fh->ent.cluster))
+    {
+      free (fh);
+      return -1;
+    }
+  /* the handle number is a host descriptor kept reserved, so it can
+     never collide with a host file */
+  fh->handle = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fh->handle < 0)
+    {
+      free (fh);
+      return -1;
+    }
+  fh->vol = vol;
+  fh->pos = 0;
+  fh->cur_cluster = fh->ent.cluster;
+  fh->cur_index = 0;
+  pthread_mutex_lock (&fat_lock);
+  bool ok = tsearch (fh, &fat_handles, fat_handle_cmp) != NULL;
+  if (ok) __atomic_add_fetch (&fat_nhandles, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&fat_lock);
+  if (! ok)
+    {
+      close (fh->handle);
+      free (fh);
+      errno = ENOMEM;
+      return -1;
+    }
+  *handle = fh->handle;
+  return 0;
+}
+
+/* Read from *pos, which is moved past what is read.  The volume lock
+   guards the position of the handle as well */
+static
+ssize_t
+fat_read
+(struct fathandle *fh,
+ void *buffer,
+ size_t count,
+ off_t *pos)
+{
+  struct fatvol *vol = fh->vol;
+  char *out = buffer;
+  size_t done = 0;
+  pthread_mutex_lock (&vol->lock);
+  if (*pos >= fh->ent.size) count = 0;
+  else if ((off_t) count > fh->ent.size - *pos)
+    count = fh->ent.size - *pos;
+  while (done < count)
+    {
+      uint32_t index = *pos / vol->cluster_size;
+      size_t offset = *pos % vol->cluster_size;
+      /* follow the chain from the last cluster visited if possible */
+      if (index < fh->cur_index)
+	fh->cur_cluster = fh->ent.cluster, fh->cur_index = 0;
+      while (fh->cur_cluster && fh->cur_cluster != FAT_BAD
+	     && fh->cur_index < index)
+	fh->cur_cluster = fat_next (vol, fh->cur_cluster), fh->cur_index++;
+      if (fh->cur_cluster == FAT_BAD)
+	{
+	  /* left for the read to start over, errno set */
+	  fh->cur_cluster = fh->ent.cluster, fh->cur_index = 0;
+	  break;
+	}
+      if (! fh->cur_cluster)
+	{
+	  errno = EIO;		/* chain shorter than the file */
+	  break;
+	}
+      size_t left = count - done;
+      if (! offset && left >= vol->cluster_size)
+	{
+	  /* whole clusters bypass the cache, one read per contiguous
+	     run */
+	  uint32_t last = fh->cur_cluster, n = 1;
+	  while ((size_t) (n + 1) * vol->cluster_size <= left)
+	    {
+	      uint32_t next = fat_next (vol, last);
+	      if (next != last + 1) break;
+	      last = next, n++;
+	    }
+	  size_t bytes = (size_t) n * vol->cluster_size;
+	  if (! fat_pread (vol->fd, out + done, bytes,
+			   fat_cluster_offset (vol, fh->cur_cluster)))
+	    break;
+	  fh->cur_cluster = last;
+	  fh->cur_index += n - 1;
+	  done += bytes, *pos += bytes;
+	  continue;
+	}
+      const char *data = fat_cluster (vol, fh->cur_cluster);
+      if (! data) break;
+      size_t n = vol->cluster_size - offset;
+      if (n > left) n = left;
+      memcpy (out + done, data + offset, n);
+      done += n, *pos += n;
+    }
+  pthread_mutex_unlock (&vol->lock);
+  return done || count == 0 ? (ssize_t) done : -1;
+}
+
+ssize_t
+_dosix__fat_read
+(int handle,
+ void *buffer,
+ size_t count)
+{
+  struct fathandle *fh = fat_handle (handle);
+  if (! fh)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  return fat_read (fh, buffer, count, &fh->pos);
+}
+
+ssize_t
+_dosix__fat_pread
+(int handle,
+ void *buffer,
+ size_t count,
+ off_t offset)
+{
+  struct fathandle *fh = fat_handle (handle);
+  if (! fh)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  return fat_read (fh, buffer, count, &offset);
+}
+
+off_t
+_dosix__fat_seek
+(int handle,
+ off_t offset,
+ int origin)
+{
+  struct fathandle *fh = fat_handle (handle);
+  if (! fh)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  pthread_mutex_lock (&fh->vol->lock);
+  switch (origin)
+    {
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += fh->pos; break;
+    case SEEK_END: offset += fh->ent.size; break;
+    default: offset = -1;
+    }
+  if (offset >= 0) fh->pos = offset;
+  pthread_mutex_unlock (&fh->vol->lock);
+  if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  return offset;
+}
+
+int
+_dosix__fat_fstat
+(int handle,
+ struct fatent *ent)
+{
+  struct fathandle *fh = fat_handle (handle);
+  if (! fh)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  *ent = fh->ent;
+  return 0;
+}
+
+int
+_dosix__fat_close
+(int handle)
+{
+  struct fathandle *fh = fat_handle (handle);
+  if (! fh)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  pthread_mutex_lock (&fat_lock);
+  tdelete (fh, &fat_handles, fat_handle_cmp);
+  __atomic_sub_fetch (&fat_nhandles, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&fat_lock);
+  free (fh);
+  return close (handle);
+}
+
+
+/* volume information */
+
+int
+_dosix__fat_type
+(struct fatvol *vol)
+{
+  assert (vol);
+  return vol->type;
+}
+
+void
+_dosix__fat_space
+(struct fatvol *vol,
+ struct drive_space *space)
+{
+  assert (vol), assert (space);
+  pthread_mutex_lock (&vol->lock);
+  if (vol->free_clusters == UINT32_MAX)
+    {
+      /* counted once: the volume is read-only */
+      uint32_t n = 0;
+      for (uint32_t c = 2; c < vol->clusters + 2; c++)
+	if (! fat_entry (vol, c)) n++;
+      vol->free_clusters = n;
+    }
+  space->bytes_per_sector = vol->bytes_per_sector;
+  space->sectors_per_cluster = vol->cluster_size / vol->bytes_per_sector;
+  space->total_clusters = vol->clusters;
+  space->avail_clusters = vol->free_clusters;
+  pthread_mutex_unlock (&vol->lock);
+}
@@ -22,9 +22,31 @@
 
 #include <dosix/compiler.h>
 
+#ifndef _DOSIX_LIBC_SRC
+#  define _bios_timeofday _dosix__bios_timeofday
+#  define _bios_tickcount _dosix__bios_tickcount
+
+#  ifndef __STRICT_ANSI__
+#    define bios_timeofday _bios_timeofday
+#    define bios_tickcount _bios_tickcount
+#  endif  /* ! __STRICT_ANSI__ */
+
+#endif	/* ! _DOSIX_LIBC_SRC */
+
+/* _bios_timeofday services */
+#define _TIME_GETCLOCK 0
+#define _TIME_SETCLOCK 1
+
+/* Timer ticks in a day, at about 18.2 ticks a second */
+#define _TICKS_PER_DAY 0x1800B0L
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+  unsigned __cdecl _dosix__bios_timeofday (unsigned, long *);
+
+  /* tick count (DOSix extension) */
+  unsigned long __cdecl _dosix__bios_tickcount (void);
 
 #ifdef __cplusplus
 }
@@ -29,6 +29,10 @@
 #  define _putch _dosix__putch
 #  define _cprintf _dosix__cprintf
 #  define _cscanf _dosix__cscanf
+#  define _inp _dosix__inp
+#  define _inpw _dosix__inpw
+#  define _outp _dosix__outp
+#  define _outpw _dosix__outpw
 
 #  ifndef __STRICT_ANSI__
 #    define cputs _cputs
@@ -37,6 +41,10 @@
 #    define putch _putch
 #    define cprintf _cprintf
 #    define cscanf _cscanf
+#    define inp _inp
+#    define inpw _inpw
+#    define outp _outp
+#    define outpw _outpw
 #  endif  /* ! __STRICT_ANSI__ */
 
 #endif	/* ! _DOSIX_LIBC_SRC */
@@ -50,6 +58,10 @@ extern "C" {
   int __cdecl _dosix__putch (int);
   int __cdecl _dosix__cprintf (const char *, ...);
   int __cdecl _dosix_cscanf (const char *, ...);
+  int __cdecl _dosix__inp (unsigned short);
+  unsigned short __cdecl _dosix__inpw (unsigned short);
+  int __cdecl _dosix__outp (unsigned short, int);
+  unsigned short __cdecl _dosix__outpw (unsigned short, unsigned short);
 #ifdef __cplusplus
 }
 #endif
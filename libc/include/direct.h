@@ -22,10 +22,31 @@
 
 #include <dosix/compiler.h>
 
+#ifndef _DOSIX_LIBC_SRC
+#define _chdir _dosix__chdir
+#define _getcwd _dosix__getcwd
+#define _getdcwd _dosix__getdcwd
+#define _getdrive _dosix__getdrive
+#define _chdrive _dosix__chdrive
+
+#ifndef __STRICT_ANSI__
+#define chdir _chdir
+#define getcwd _getcwd
+#define getdcwd _getdcwd
+#define getdrive _getdrive
+#define chdrive _chdrive
+#endif	/* ! __STRICT_ANSI__ */
+
+#endif	/* ! _DOSIX_LIBC_SRC */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
-
+  int __cdecl _dosix__chdir (const char *);
+  char * __cdecl _dosix__getcwd (char *, int);
+  char * __cdecl _dosix__getdcwd (int, char *, int);
+  int __cdecl _dosix__getdrive (void);
+  int __cdecl _dosix__chdrive (int);
 #ifdef __cplusplus
 }
 #endif
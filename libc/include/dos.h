@@ -23,7 +23,6 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <limits.h>
-#include <glob.h>
 #include <dosix/compiler.h>
 
 #ifndef _DOSIX_LIBC_SRC
@@ -32,10 +31,16 @@
 #define _dos_findclose _dosix__dos_findclose
 #define _dos_getfileattr _dosix__dos_getfileattr
 #define _dos_setfileattr _dosix__dos_setfileattr
+#define _dos_getfileattrs _dosix__dos_getfileattrs
+#define _dos_setfileattrs _dosix__dos_setfileattrs
 #define _dos_open _dosix__dos_open
 #define _dos_creat _dosix__dos_creat
 #define _dos_creatnew _dosix__dos_creatnew
 #define _dos_close _dosix__dos_close
+#define _dos_read _dosix__dos_read
+#define _dos_write _dosix__dos_write
+#define _dos_seek _dosix__dos_seek
+#define _dos_commit _dosix__dos_commit
 #define _dos_getftime _dosix__dos_getftime
 #define _dos_setftime _dosix__dos_setftime
 #define _dos_allocmem _dosix__dos_allocmem
@@ -45,11 +50,35 @@
 #define _dos_gettime _dosix__dos_gettime
 #define _dos_settime _dosix__dos_settime
 #define _dos_setdate _dosix__dos_setdate
+#define _dos_getdrive _dosix__dos_getdrive
+#define _dos_setdrive _dosix__dos_setdrive
+#define _dos_getdiskfree _dosix__dos_getdiskfree
+#define _dos_getvect _dosix__dos_getvect
+#define _dos_setvect _dosix__dos_setvect
+#define _dos_hookvect _dosix__dos_hookvect
+#define _dos_unhookvect _dosix__dos_unhookvect
 #define _intdosx _dosix__intdosx
 #define _intdos _dosix__intdos
 #define _int86x _dosix__int86x
 #define _int86 _dosix__int86
+#define _int86n _dosix__int86n
 #define _bdos _dosix__bdos
+#define _dosexterr _dosix__dosexterr
+#define _dos_mapfile _dosix__dos_mapfile
+#define _dos_mapseek _dosix__dos_mapseek
+#define _dos_unmapfile _dosix__dos_unmapfile
+#define _dos_aioread _dosix__dos_aioread
+#define _dos_aiowrite _dosix__dos_aiowrite
+#define _dos_aiopoll _dosix__dos_aiopoll
+#define _dos_aiowait _dosix__dos_aiowait
+#define _dos_wbcache _dosix__dos_wbcache
+#define _dos_wbstat _dosix__dos_wbstat
+#define _dos_walktree _dosix__dos_walktree
+#define _dos_findtree _dosix__dos_findtree
+#define _dos_findtreenext _dosix__dos_findtreenext
+#define _dos_findtreeclose _dosix__dos_findtreeclose
+#define _dos_timerstat _dosix__dos_timerstat
+#define _dos_replay _dosix__dos_replay
 
 #ifndef __STRICT_ANSI__
 #define dos_findfirst _dos_findfirst
@@ -57,10 +86,16 @@
 #define dos_findclose _dos_findclose
 #define dos_getfileattr _dos_getfileattr
 #define dos_setfileattr _dos_setfileattr
+#define dos_getfileattrs _dos_getfileattrs
+#define dos_setfileattrs _dos_setfileattrs
 #define dos_open _dos_open
 #define dos_creat _dos_creat
 #define dos_creatnew _dos_creatnew
 #define dos_close _dos_close
+#define dos_read _dos_read
+#define dos_write _dos_write
+#define dos_seek _dos_seek
+#define dos_commit _dos_commit
 #define dos_getftime _dos_getftime
 #define dos_setftime _dos_setftime
 #define dos_allocmem _dos_allocmem
@@ -70,11 +105,34 @@
 #define dos_gettime _dos_gettime
 #define dos_settime _dos_settime
 #define dos_setdate _dos_setdate
+#define dos_getdrive _dos_getdrive
+#define dos_setdrive _dos_setdrive
+#define dos_getdiskfree _dos_getdiskfree
+#define dos_getvect _dos_getvect
+#define dos_setvect _dos_setvect
+#define dos_hookvect _dos_hookvect
+#define dos_unhookvect _dos_unhookvect
 #define intdosx _intdosx
 #define intdos _intdos
 #define int86x _int86x
 #define int86 _int86
+#define int86n _int86n
 #define bdos _bdos
+#define dos_mapfile _dos_mapfile
+#define dos_mapseek _dos_mapseek
+#define dos_unmapfile _dos_unmapfile
+#define dos_aioread _dos_aioread
+#define dos_aiowrite _dos_aiowrite
+#define dos_aiopoll _dos_aiopoll
+#define dos_aiowait _dos_aiowait
+#define dos_wbcache _dos_wbcache
+#define dos_wbstat _dos_wbstat
+#define dos_walktree _dos_walktree
+#define dos_findtree _dos_findtree
+#define dos_findtreenext _dos_findtreenext
+#define dos_findtreeclose _dos_findtreeclose
+#define dos_timerstat _dos_timerstat
+#define dos_replay _dos_replay
 
 #define WORDREGS _WORDREGS
 #define BYTEREGS _BYTEREGS
@@ -89,6 +147,14 @@
 #define dosdate_t _dosdate_t
 #define dostime_t _dostime_t
 #define diskfree_t _diskfree_t
+#define mapwin_t _mapwin_t
+#define dosaio_t _dosaio_t
+#define wbstat_t _wbstat_t
+#define dosattr_t _dosattr_t
+#define doswalk_t _doswalk_t
+#define findtree_t _findtree_t
+#define timerstat_t _timerstat_t
+#define replaystat_t _replaystat_t
 #endif	/* ! __STRICT_ANSI__ */
 
 #endif	/* ! _DOS_LIBC_SRC */
@@ -110,6 +176,26 @@
 #define _A_DELETED 0x80 /* Novell DOS / OpenDOS */
 #define _A_SHAREABLE 0x80 /* Novell NetWare */
 
+/* Memory-mapped window access hints (DOSix extension) */
+#define _MAP_NORMAL 0x00
+#define _MAP_SEQUENTIAL 0x01
+#define _MAP_RANDOM 0x02
+#define _MAP_WILLNEED 0x04
+
+/* Default window length when none is given: the whole file is mapped
+   only if it fits in this address budget */
+#define _MAP_BUDGET ((size_t) 1 << (sizeof (void *) > 4 ? 30 : 24))
+
+/* Recursive search options (DOSix extension) */
+#define _FIND_PREORDER 0x00 /* directories before their contents */
+#define _FIND_POSTORDER 0x01 /* directories after their contents */
+#define _FIND_ANYDEPTH (~0u) /* no limit on the levels entered */
+
+/* Write-behind cache policies (DOSix extension) */
+#define _WB_WRITETHROUGH 0x00 /* every write reaches the file at once */
+#define _WB_ONCLOSE 0x01 /* write back on close, commit or when full */
+#define _WB_PERIODIC 0x02 /* also write back every interval ms */
+
 /* REMOVE-ME? */
 #define intrpt(intnum,regs)			\
   intr (intnum, (union REGPACK *) regs)
@@ -128,59 +214,40 @@
 /* #define DIRECTORY 0x08 */
 /* #define DRIVE     0x10 */
 
-/*** CPU ***/
-typedef struct cpu_word
-{
-  uintmax_t ax, bx, cx, dx;
-  uintmax_t si, di, bp, sp;
-  uintmax_t ip;
-  uintmax_t cs, ds, es, ss;
-  uintmax_t flags;
-} cpu_word_t;
-
-typedef struct cpu_byte
-{
-  uintmax_t al : 1 * 8;
-  uintmax_t ah : (sizeof (uintmax_t) - 1) * 8;
-  uintmax_t bl : 1 * 8;
-  uintmax_t bh : (sizeof (uintmax_t) - 1) * 8;
-  uintmax_t cl : 1 * 8;
-  uintmax_t ch : (sizeof (uintmax_t) - 1) * 8;
-  uintmax_t dl : 1 * 8;
-  uintmax_t dh : (sizeof (uintmax_t) - 1) * 8;
-} cpu_byte_t;
-
-typedef union cpu
-{
-  cpu_word_t r;
-  cpu_byte_t l;
-  cpu_byte_t h;
-} cpu_t;
+/*** 8086 CPU registers ***/
 
-/*** syscall_t ***/
-typedef
-void
-(*syscall_t)
-(cpu_t *);
+/* One register file serves every entry point, the services included,
+   so that registers are handed over by pointer.  Word registers that
+   may hold a flat address (segments being always zero here) are as
+   wide as a pointer, with their low bytes aliased as on the 8086; the
+   others are 16-bit.  It takes up 64 bytes on LP64 hosts. */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define _DOSIX_BYTEREG(l,h) \
+  uint8_t _##l##_pad[sizeof (uintptr_t) - 2]; uint8_t h, l
+#else
+#  define _DOSIX_BYTEREG(l,h) \
+  uint8_t l, h; uint8_t _##l##_pad[sizeof (uintptr_t) - 2]
+#endif
 
-/*** 8086 CPU registers ***/
 typedef struct _WORDREGS
 {
-  uintmax_t ax, bx, cx, dx;
-  uintmax_t si, di;
-  uintmax_t cflag;
+  uintptr_t ax, bx, cx, dx;
+  uintptr_t si, di;
+  uintptr_t es;			/* memory blocks are addresses */
+  uint16_t bp, ds, ss;
+  union
+  {
+    uint16_t cflag;
+    uint16_t flags;
+  };
 } _WORDREGS;
 
 typedef struct _BYTEREGS
 {
-  uintmax_t al : 1 * 8;
-  uintmax_t ah : (sizeof (uintmax_t) - 1) * 8;
-  uintmax_t bl : 1 * 8;
-  uintmax_t bh : (sizeof (uintmax_t) - 1) * 8;
-  uintmax_t cl : 1 * 8;
-  uintmax_t ch : (sizeof (uintmax_t) - 1) * 8;
-  uintmax_t dl : 1 * 8;
-  uintmax_t dh : (sizeof (uintmax_t) - 1) * 8;
+  _DOSIX_BYTEREG (al, ah);
+  _DOSIX_BYTEREG (bl, bh);
+  _DOSIX_BYTEREG (cl, ch);
+  _DOSIX_BYTEREG (dl, dh);
 } _BYTEREGS;
 
 typedef union _REGS
@@ -191,12 +258,13 @@ typedef union _REGS
   struct _BYTEREGS l;
 } _REGS;
 
+/* As wide as the registers of _WORDREGS they load */
 typedef struct _SREGS
 {
-  uintmax_t es;
-  uintmax_t cs;
-  uintmax_t ss;
-  uintmax_t ds;
+  uintptr_t es;
+  uint16_t cs;
+  uint16_t ss;
+  uint16_t ds;
 } _SREGS;
 
 typedef struct
@@ -207,35 +275,31 @@ typedef struct
   uintmax_t r_flags;
 } IREGS;
 
+/* Same layout as union _REGS */
 union REGPACK
 {
-  struct
-  {
-    uintmax_t al : 1 * 8;
-    uintmax_t ah : (sizeof (uintmax_t) - 1) * 8;
-    uintmax_t bl : 1 * 8;
-    uintmax_t bh : (sizeof (uintmax_t) - 1) * 8;
-    uintmax_t cl : 1 * 8;
-    uintmax_t ch : (sizeof (uintmax_t) - 1) * 8;
-    uintmax_t dl : 1 * 8;
-    uintmax_t dh : (sizeof (uintmax_t) - 1) * 8;
-  } h;
-  struct
-  {
-    uintmax_t ax, bx, cx, dx;
-    uintmax_t bp, si, di;
-    uintmax_t ds, es;
-    uintmax_t flags;
-  } x;
+  struct _WORDREGS x;
+  struct _BYTEREGS h;
 };
 
+/*** CPU ***/
+typedef union _REGS cpu_t;
+typedef struct _WORDREGS cpu_word_t;
+typedef struct _BYTEREGS cpu_byte_t;
+
+/*** syscall_t ***/
+typedef
+void
+(*syscall_t)
+(cpu_t *);
+
 struct _find_t
 {
   /* Private */
-  char *_filename;		/* Search template */
+  void *_dir;			/* Directory stream */
+  void *_fatdir;		/* Disk-image directory stream */
   unsigned _attrib;		/* Search attribute */
-  glob_t _glob; 		/* Directory stream */
-  size_t _gl_pathi;		/* Current index in _glob.gl_path */
+  char _pattern[NAME_MAX + 1];	/* Search template, without the path */
 
   /* Public */
   unsigned attrib;		/* Attribute set for matched path */
@@ -309,6 +373,114 @@ struct _dostime_t
   unsigned char hsecond; /* 0--99 */
 };
 
+struct _diskfree_t
+{
+  unsigned total_clusters;
+  unsigned avail_clusters;
+  unsigned sectors_per_cluster;
+  unsigned bytes_per_sector;
+};
+
+/* Sliding window over a file mapped through a DOS handle */
+struct _mapwin_t
+{
+  /* Private */
+  int _handle;			/* DOS handle the window maps */
+  unsigned _advice;		/* Access hints (_MAP_*) */
+  int _prot;			/* Mapping protection */
+  void *_base;			/* Page-aligned start of mapping */
+  size_t _maplen;		/* Length of mapping */
+  off_t _mapoff;		/* Page-aligned file offset of mapping */
+  size_t _winlen;		/* Requested window length */
+  off_t _filesize;		/* File length at map time */
+
+  /* Public */
+  off_t offset;			/* File offset of first byte in window */
+  size_t length;		/* Number of bytes available at address */
+  void *address;		/* Window contents */
+};
+
+/* Asynchronous transfer on a DOS handle (DOSix extension) */
+struct _dosaio_t
+{
+  /* Private */
+  struct _dosaio_t *_next;	/* Thread pool queue link */
+  int _opcode;			/* Read or write */
+  int _done;			/* Set once the transfer completed */
+
+  /* Public */
+  int handle;			/* DOS handle to transfer from/to */
+  off_t offset;			/* File offset of the transfer */
+  void *buffer;			/* Data buffer */
+  unsigned count;		/* Number of bytes requested */
+  unsigned result;		/* Number of bytes transferred */
+  unsigned error;		/* DOS extended error, zero on success */
+};
+
+/* Write-behind cache statistics (DOSix extension) */
+struct _wbstat_t
+{
+  uint64_t writes;		/* Writes absorbed by the cache */
+  uint64_t bytes_cached;	/* Bytes absorbed by the cache */
+  uint64_t bytes_coalesced;	/* Bytes merged into earlier writes */
+  uint64_t flushes;		/* Write-backs of a handle */
+  uint64_t flush_calls;		/* System calls issued by write-backs */
+  uint64_t flush_ns_total;	/* Time spent writing back */
+  uint64_t flush_ns_max;	/* Longest single write-back */
+};
+
+/* One file of a batched attribute query or change (DOSix extension) */
+struct _dosattr_t
+{
+  const char *name;		/* File name within the directory */
+  unsigned attrib;		/* Attributes got, or to set */
+  unsigned error;		/* DOS extended error, zero on success */
+};
+
+/* Entries of one directory reached by a tree walk (DOSix extension) */
+struct _doswalk_t
+{
+  const char *path;		/* Directory, as a prefix of entry names */
+  unsigned depth;		/* Levels below the starting directory */
+  struct _find_t *entries;	/* Entries matching the search */
+  size_t count;			/* Number of entries */
+};
+
+/* State of a recursive search (DOSix extension) */
+struct _findtree_t
+{
+  /* Private */
+  void *_state;			/* Open directories */
+
+  /* Public */
+  struct _find_t entry;		/* Entry found */
+  const char *parent;		/* Its directory, as a prefix of its name */
+  unsigned depth;		/* Levels below the starting directory */
+};
+
+/* Timer interrupt statistics (DOSix extension) */
+struct _timerstat_t
+{
+  uint64_t ticks;		/* Timer periods gone by since hooked */
+  uint64_t delivered;		/* INT 08h raised, missed ticks coalesced */
+  uint32_t reload;		/* Channel 0 count, 65536 for 18.2 Hz */
+};
+
+/* Replayed calls of one service (DOSix extension) */
+struct _replaystat_t
+{
+  unsigned char intnum, ah;	/* Vector and function */
+  char subreg;			/* 'A' or 'B' for a sub-function in AL or BL */
+  unsigned char sub;		/* Sub-function */
+  unsigned long calls;		/* Calls replayed */
+  unsigned long skipped;	/* Calls that cannot be replayed, or
+				   name a handle the replay lacks */
+  unsigned long failed;		/* Calls that set an error */
+  unsigned long mismatched;	/* Calls whose carry differs from recorded */
+  uint64_t ns, max_ns;		/* Total and longest time replaying */
+  uint64_t recorded_ns;		/* Total time when recorded */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -330,6 +502,10 @@ extern "C" {
   unsigned __cdecl _dosix__dos_creat (const char *, unsigned, int *);
   unsigned __cdecl _dosix__dos_creatnew (const char *, unsigned, int *);
   unsigned __cdecl _dosix__dos_close (int);
+  unsigned __cdecl _dosix__dos_read (int, void *, unsigned, unsigned *);
+  unsigned __cdecl _dosix__dos_write (int, const void *, unsigned, unsigned *);
+  unsigned __cdecl _dosix__dos_seek (int, off_t, int, off_t *);
+  unsigned __cdecl _dosix__dos_commit (int);
   unsigned __cdecl _dosix__dos_getftime (int, unsigned *, unsigned *);
   unsigned __cdecl _dosix__dos_setftime (int, unsigned, unsigned);
   unsigned __cdecl _dosix__dos_allocmem (size_t, uintptr_t *);
@@ -339,8 +515,41 @@ extern "C" {
   void __cdecl _dosix__dos_gettime (struct _dostime_t *);
   unsigned __cdecl _dosix__dos_settime (struct _dostime_t *);
   unsigned __cdecl _dosix__dos_setdate (struct _dosdate_t *);
+  void __cdecl _dosix__dos_getdrive (unsigned *);
+  void __cdecl _dosix__dos_setdrive (unsigned, unsigned *);
+  unsigned __cdecl _dosix__dos_getdiskfree (unsigned, struct _diskfree_t *);
   void __cdecl _dosix__dos_setvect (unsigned, syscall_t);
   syscall_t __cdecl _dosix__dos_getvect (unsigned);
+  /* memory-mapped windows (DOSix extension) */
+  unsigned __cdecl _dosix__dos_mapfile (int, off_t, size_t, unsigned, struct _mapwin_t *);
+  unsigned __cdecl _dosix__dos_mapseek (struct _mapwin_t *, off_t);
+  unsigned __cdecl _dosix__dos_unmapfile (struct _mapwin_t *);
+  /* asynchronous I/O (DOSix extension) */
+  unsigned __cdecl _dosix__dos_aioread (struct _dosaio_t *);
+  unsigned __cdecl _dosix__dos_aiowrite (struct _dosaio_t *);
+  int __cdecl _dosix__dos_aiopoll (struct _dosaio_t *);
+  unsigned __cdecl _dosix__dos_aiowait (struct _dosaio_t *);
+  /* write-behind cache (DOSix extension) */
+  unsigned __cdecl _dosix__dos_wbcache (unsigned, unsigned);
+  void __cdecl _dosix__dos_wbstat (struct _wbstat_t *);
+  /* batched attributes (DOSix extension) */
+  unsigned __cdecl _dosix__dos_getfileattrs (const char *, struct _dosattr_t *, size_t);
+  unsigned __cdecl _dosix__dos_setfileattrs (const char *, struct _dosattr_t *, size_t);
+  /* parallel tree walks (DOSix extension) */
+  unsigned __cdecl _dosix__dos_walktree (const char *, unsigned, unsigned, int (*) (const struct _doswalk_t *, void *), void *);
+  /* recursive find functions (DOSix extension) */
+  unsigned __cdecl _dosix__dos_findtree (const char *, unsigned, unsigned, unsigned, int (*) (const struct _findtree_t *, void *), void *, struct _findtree_t *);
+  unsigned __cdecl _dosix__dos_findtreenext (struct _findtree_t *);
+  void __cdecl _dosix__dos_findtreeclose (struct _findtree_t *);
+  /* timer interrupts (DOSix extension) */
+  void __cdecl _dosix__dos_timerstat (struct _timerstat_t *);
+  /* interrupt chaining (DOSix extension) */
+  unsigned __cdecl _dosix__dos_hookvect (unsigned, int (*) (cpu_t *, void *), void *);
+  unsigned __cdecl _dosix__dos_unhookvect (unsigned, int (*) (cpu_t *, void *), void *);
+  /* batched interrupts (DOSix extension) */
+  size_t __cdecl _dosix__int86n (int, union _REGS *, size_t);
+  /* call recording (DOSix extension) */
+  unsigned __cdecl _dosix__dos_replay (const char *, int (*) (const struct _replaystat_t *, void *), void *);
 #ifdef __cplusplus
 }
 #endif
@@ -90,7 +90,7 @@ typedef int (__far __cdecl *_fonexit_t) ();
 #ifdef __cplusplus
 extern "C" {
 #endif
-  extern int __near __cdecl _dosix__doserrno;
+  extern __thread int __near __cdecl _dosix__doserrno;
   void __cdecl _dosix_exit (int);
   void __cdecl _dosix__exit (int);
   int __cdecl _dosix_atexit (void (__cdecl *) (void));
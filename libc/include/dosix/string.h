@@ -37,6 +37,9 @@
 #define _fstrlwr _dosix__fstrlwr
 #define _strupr _dosix__strupr
 #define _fstrupr _dosix__fstrupr
+#define _stricmp _dosix__stricmp
+#define _strcmpi _dosix__stricmp
+#define _fstricmp _dosix__fstricmp
 
 #ifndef __STRICT_ANSI__
 #define memccpy _memccpy
@@ -73,6 +76,9 @@ extern "C" {
   /* strcat */
   char * __cdecl _dosix_strcat (char *, const char *);
   char __far * __far __cdecl _dosix__fstrcat (char __far *, const char __far *);
+  /* stricmp */
+  int __cdecl _dosix__stricmp (const char *, const char *);
+  int __far __cdecl _dosix__fstricmp (const char __far *, const char __far *);
   /* strdup */
   char * __cdecl _dosix__strdup (const char *);
   char __far * __far __cdecl _dosix__fstrdup (const char __far *);
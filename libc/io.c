@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <io.h>
+#include "_dos.h"
 
 
 /* _filelength */
@@ -34,8 +35,14 @@ off_t
 _dosix__filelength
 (int handle)
 {
+  if (_dosix__fat_handle (handle))
+    {
+      struct fatent ent;
+      if (_dosix__fat_fstat (handle, &ent)) return -1L;
+      return ent.size;
+    }
   struct stat fs;
-  if (fstat (handle, &fs))
+  if (_dosix__wbcache_flush (handle) || fstat (handle, &fs))
       return -1L;
   return fs.st_size;
 }
@@ -144,6 +144,39 @@ _dosix__fstrcat
 			(const char *) string2);
 }
 
+
+/* _stricmp functions */
+
+/* Compare as if both were lowercase; _strcmpi is the same function */
+int
+_dosix__stricmp
+(const char *string1,
+ const char *string2)
+{
+  assert (string1), assert (string2);
+  const unsigned char *s1 = (const unsigned char *) string1;
+  const unsigned char *s2 = (const unsigned char *) string2;
+  int c1, c2;
+  do
+    {
+      c1 = _dosix_tolower (*s1++);
+      c2 = _dosix_tolower (*s2++);
+    }
+  while (c1 == c2 && c1);
+  return c1 - c2;
+}
+
+int
+__far
+_dosix__fstricmp
+(const char __far *string1,
+ const char __far *string2)
+{
+  assert (string1), assert (string2);
+  return _dosix__stricmp ((const char *) string1,
+			  (const char *) string2);
+}
+
 
 /* _strdup functions */
 char *
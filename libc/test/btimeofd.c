@@ -0,0 +1,25 @@
+/* BTIMEOFD.C: This program uses _bios_timeofday to time a delay loop
+ * by the BIOS tick count, reporting whether midnight went by.
+ */
+
+#include <dosix/stdio.h>
+#include <bios.h>
+
+void main( void )
+{
+   long start, now;
+   unsigned midnight;
+
+   /* Wait two seconds, which is about 36 ticks */
+
+   _bios_timeofday( _TIME_GETCLOCK, &start );
+   do
+   {
+      midnight = _bios_timeofday( _TIME_GETCLOCK, &now );
+      if( midnight )
+         start -= _TICKS_PER_DAY;
+   } while( now - start < 36 );
+
+   printf( "Ticks since midnight: %ld\n", now );
+   printf( "Seconds since midnight: %ld\n", now * 10 / 182 );
+}
@@ -0,0 +1,37 @@
+/* CHGDIR.C: This program moves to the directory given on the
+ * command line on another drive, shows the current directory of
+ * both drives, and then makes that drive current.
+ */
+
+#include <dosix/stdlib.h>
+#include <dosix/stdio.h>
+#include <direct.h>
+
+void main( int argc, char *argv[] )
+{
+   char buffer[_MAX_PATH];
+   int drive, curdrive;
+
+   if( argc != 2 )
+   {
+      printf( "Usage: chgdir D:\\DIR\n" );
+      return;
+   }
+   drive = ( argv[1][0] & ~0x20 ) - 'A' + 1;
+   curdrive = _getdrive();
+
+   if( _chdir( argv[1] ) )
+   {
+      printf( "Unable to locate the directory: %s\n", argv[1] );
+      return;
+   }
+   if( _getdcwd( curdrive, buffer, _MAX_PATH ) != NULL )
+      printf( "Current directory of drive %c: %s\n",
+              curdrive + 'A' - 1, buffer );
+   if( _getdcwd( drive, buffer, _MAX_PATH ) != NULL )
+      printf( "Current directory of drive %c: %s\n",
+              drive + 'A' - 1, buffer );
+
+   if( _chdrive( drive ) == 0 && _getcwd( buffer, _MAX_PATH ) != NULL )
+      printf( "Drive %c: is now current: %s\n", _getdrive() + 'A' - 1, buffer );
+}
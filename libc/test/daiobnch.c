@@ -0,0 +1,99 @@
+/* DAIOBNCH.C: This program measures how random 4K reads issued with
+ * _dos_aioread scale with the number of requests kept in flight.
+ * Run it on the drive to be measured; the page cache is dropped for
+ * the data file before each pass.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <dosix/stdio.h>
+#include <dos.h>
+
+#define FILE_SIZE ( 256L * 1024 * 1024 )
+#define FILL_SIZE ( 1024 * 1024 )
+#define BLOCK_SIZE 4096
+#define READS 8192
+#define MAX_DEPTH 64
+
+static char fill[FILL_SIZE];
+static char blocks[MAX_DEPTH][BLOCK_SIZE];
+
+static double now( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void main( void )
+{
+   struct _dosaio_t aio[MAX_DEPTH];
+   int busy[MAX_DEPTH];
+   int fh, depth, i;
+   long off;
+
+   if( _dos_creat( "daiobnch.dat", _A_NORMAL, &fh ) != 0 )
+   {
+      printf( "Couldn't create data file\n" );
+      return;
+   }
+
+   /* Fill the data file, one write in flight per megabyte */
+   for( off = 0; off < FILE_SIZE; off += FILL_SIZE )
+   {
+      aio[0].handle = fh;
+      aio[0].offset = off;
+      aio[0].buffer = fill;
+      aio[0].count = FILL_SIZE;
+      if( _dos_aiowrite( &aio[0] ) || _dos_aiowait( &aio[0] ) )
+      {
+         printf( "Couldn't fill data file\n" );
+         return;
+      }
+   }
+   fdatasync( fh );
+
+   printf( "depth      IOPS      MB/s\n" );
+   for( depth = 1; depth <= MAX_DEPTH; depth *= 2 )
+   {
+      int issued = 0, completed = 0;
+      double start, elapsed;
+
+      posix_fadvise( fh, 0, FILE_SIZE, POSIX_FADV_DONTNEED );
+      start = now();
+      for( i = 0; i < depth; i++ )
+      {
+         aio[i].handle = fh;
+         aio[i].offset = ( random() % ( FILE_SIZE / BLOCK_SIZE ) ) * BLOCK_SIZE;
+         aio[i].buffer = blocks[i];
+         aio[i].count = BLOCK_SIZE;
+         busy[i] = _dos_aioread( &aio[i] ) == 0;
+         completed += !busy[i];
+         issued++;
+      }
+      while( completed < READS )
+         for( i = 0; i < depth; i++ )
+         {
+            if( !busy[i] || !_dos_aiopoll( &aio[i] ) )
+               continue;
+            completed++;
+            busy[i] = 0;
+            if( issued < READS )
+            {
+               aio[i].offset = ( random() % ( FILE_SIZE / BLOCK_SIZE ) ) * BLOCK_SIZE;
+               busy[i] = _dos_aioread( &aio[i] ) == 0;
+               completed += !busy[i];
+               issued++;
+            }
+         }
+      elapsed = now() - start;
+      printf( "%5d %9.0f %9.1f\n", depth, READS / elapsed,
+              READS * (double) BLOCK_SIZE / elapsed / ( 1024 * 1024 ) );
+   }
+
+   _dos_close( fh );
+   remove( "daiobnch.dat" );
+}
@@ -0,0 +1,34 @@
+/* DALIAS.C: This program creates files whose long names share their
+ * first letters, then lists the 8.3 aliases they are given.  Names
+ * that would collide tell themselves apart by the number after the
+ * tilde, which takes more room as it grows.
+ */
+
+#include <dosix/stdio.h>
+#include <dos.h>
+
+void main( void )
+{
+   struct _find_t find;
+   char name[64];
+   int fh, i;
+
+   for( i = 1; i <= 12; i++ )
+   {
+      sprintf( name, "Quarterly report %d.txt", i );
+      if( _dos_creat( name, _A_NORMAL, &fh ) != 0 )
+      {
+         printf( "Couldn't create %s\n", name );
+         return;
+      }
+      _dos_close( fh );
+   }
+
+   /* Aliases match patterns as the names themselves would */
+   if( !_dos_findfirst( "QUART*.TXT", _A_NORMAL, &find ) )
+   {
+      printf( "%s\n", find.name );
+      while( !_dos_findnext( &find ) )
+         printf( "%s\n", find.name );
+   }
+}
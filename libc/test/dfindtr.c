@@ -0,0 +1,28 @@
+/* DFINDTR.C: This program uses _dos_findtree to list the current
+ * directory and its subdirectories two levels down, each directory
+ * after its contents, without looking into directories named OBJ.
+ */
+
+#include <dosix/stdio.h>
+#include <dosix/string.h>
+#include <dos.h>
+
+static int skip( const struct _findtree_t *ft, void *arg )
+{
+   return stricmp( ft->entry.name, "OBJ" ) == 0;   /* Nonzero skips its contents */
+}
+
+void main( void )
+{
+   struct _findtree_t ft;
+   unsigned ret;
+
+   ret = _dos_findtree( "*.*", _A_SUBDIR, _FIND_POSTORDER, 2, skip, NULL,
+                        &ft );
+   while( ret == 0 )
+   {
+      printf( "%*s%s%s\n", 2 * ft.depth, "", ft.parent, ft.entry.name );
+      ret = _dos_findtreenext( &ft );
+   }
+   _dos_findtreeclose( &ft );
+}
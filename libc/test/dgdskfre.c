@@ -0,0 +1,22 @@
+/* DGDSKFRE.C: This program uses _dos_getdiskfree to report the size
+ * and the free space of the current drive.
+ */
+
+#include <dosix/stdio.h>
+#include <dos.h>
+
+void main( void )
+{
+   struct _diskfree_t drive;
+   unsigned long long cluster;
+
+   if( _dos_getdiskfree( 0, &drive ) != 0 )
+   {
+      printf( "Couldn't get disk information\n" );
+      return;
+   }
+   cluster = (unsigned long long) drive.sectors_per_cluster *
+             drive.bytes_per_sector;
+   printf( "Total space: %llu bytes\n", drive.total_clusters * cluster );
+   printf( "Free space:  %llu bytes\n", drive.avail_clusters * cluster );
+}
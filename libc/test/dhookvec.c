@@ -0,0 +1,40 @@
+/* DHOOKVEC.C: This program hooks INT 21H so that function 0x2A (get
+ * date) reports a fixed date, passing every other function on to DOS,
+ * and then unhooks it again.
+ */
+
+#include <dosix/stdio.h>
+#include <dos.h>
+
+static int fixeddate( cpu_t *cpu, void *arg )
+{
+   if( cpu->h.ah != 0x2a )
+      return 0;                    /* Not ours: pass it on */
+   cpu->x.cx = 1999;
+   cpu->h.dh = 12;
+   cpu->h.dl = 31;
+   return 1;                       /* Handled */
+}
+
+static void showdate( void )
+{
+   union _REGS regs;
+
+   regs.h.ah = 0x2a;
+   _intdos( &regs, &regs );
+   printf( "Today's date is %d-%d-%d\n", regs.h.dh, regs.h.dl,
+           regs.x.cx );
+}
+
+void main( void )
+{
+   showdate();
+   if( _dos_hookvect( 0x21, fixeddate, NULL ) != 0 )
+   {
+      printf( "Couldn't hook INT 21H\n" );
+      return;
+   }
+   showdate();
+   _dos_unhookvect( 0x21, fixeddate, NULL );
+   showdate();
+}
@@ -0,0 +1,37 @@
+/* DMAPFILE.C: This program maps its own source through a DOS handle
+ * in small windows and counts its lines without calling read.
+ */
+
+#include <dosix/fcntl.h>
+#include <dosix/stdio.h>
+#include <dos.h>
+
+void main( void )
+{
+   struct _mapwin_t win;
+   long lines = 0;
+   off_t offset = 0;
+   size_t i;
+   int fh;
+
+   if( _dos_open( "dmapfile.c", _O_RDONLY, &fh ) != 0 )
+   {
+      perror( "Open failed on input file\n" );
+      return;
+   }
+
+   /* Map 4K windows and slide them forward through the file */
+   if( _dos_mapfile( fh, 0, 4096, _MAP_SEQUENTIAL, &win ) == 0 )
+   {
+      do
+      {
+         for( i = 0; i < win.length; i++ )
+            if( ((char *) win.address)[i] == '\n' )
+               lines++;
+         offset += win.length;
+      } while( _dos_mapseek( &win, offset ) == 0 );
+      _dos_unmapfile( &win );
+   }
+   printf( "dmapfile.c has %ld lines\n", lines );
+   _dos_close( fh );
+}
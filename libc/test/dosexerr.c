@@ -0,0 +1,28 @@
+/* DOSEXERR.C: This program tries to open the file test.dat. If the
+ * attempted open operation fails, the program uses _dosexterr to
+ * display extended error information.
+ */
+
+#include <dosix/fcntl.h>
+#include <dosix/stdio.h>
+#include <dos.h>
+
+void main( void )
+{
+   struct _DOSERROR doserror;
+   int fh;
+
+   /* Attempt to open a non-existent file */
+   if( _dos_open( "NOSUCHF.ILE", _O_RDONLY, &fh ) != 0 )
+   {
+      _dosexterr( &doserror );
+      printf( "Error: %d  Class: %d  Action: %d  Locus: %d\n",
+              doserror.exterror, doserror.errclass,
+              doserror.action,   doserror.locus );
+   }
+   else
+   {
+      printf( "Open succeeded so no extended information printed\n" );
+      _dos_close( fh );
+   }
+}
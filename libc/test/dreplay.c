@@ -0,0 +1,57 @@
+/* DREPLAY.C: This program replays the DOS calls a program made while
+ * DOSIX_RECORD named the file to record them to, and reports the
+ * throughput and latency of each service, busiest first.
+ */
+
+#include <stdlib.h>
+#include <dosix/stdio.h>
+#include <dos.h>
+
+struct totals
+{
+   unsigned long calls, skipped;
+   double ns;
+};
+
+static int report( const struct _replaystat_t *stat, void *arg )
+{
+   struct totals *totals = arg;
+   char service[16];
+
+   if( stat->subreg )
+      sprintf( service, "%02Xh %02Xh %cL=%02Xh", stat->intnum, stat->ah,
+               stat->subreg, stat->sub );
+   else
+      sprintf( service, "%02Xh %02Xh", stat->intnum, stat->ah );
+   printf( "%-16s %9lu %7lu %6lu %6lu %9.0f %9.0f %9.0f\n", service,
+           stat->calls, stat->skipped, stat->failed, stat->mismatched,
+           stat->calls ? (double)stat->ns / stat->calls : 0.0,
+           (double)stat->max_ns,
+           stat->calls ? (double)stat->recorded_ns / stat->calls : 0.0 );
+   totals->calls += stat->calls;
+   totals->skipped += stat->skipped;
+   totals->ns += stat->ns;
+   return 0;
+}
+
+void main( int argc, char *argv[] )
+{
+   struct totals totals = { 0 };
+
+   if( argc != 2 )
+   {
+      printf( "Usage: dreplay file\n" );
+      exit( 1 );
+   }
+   printf( "%-16s %9s %7s %6s %6s %9s %9s %9s\n", "service", "calls",
+           "skipped", "failed", "differ", "ns/call", "max ns", "recorded" );
+   if( _dos_replay( argv[1], report, &totals ) != 0 )
+   {
+      printf( "Cannot replay %s\n", argv[1] );
+      exit( 1 );
+   }
+   printf( "%lu calls replayed, %lu skipped", totals.calls, totals.skipped );
+   if( totals.ns > 0 )
+      printf( ", %.0f calls/s", totals.calls / ( totals.ns / 1e9 ) );
+   printf( "\n" );
+}
@@ -0,0 +1,42 @@
+/* DSATTRS.C: This program reads the attributes of a few files of the
+ * current directory in one batch, makes them read-only in another and
+ * then restores them, reporting any file that could not be changed.
+ */
+
+#include <dosix/stdio.h>
+#include <dos.h>
+
+#define COUNT 3
+
+void main( void )
+{
+   struct _dosattr_t files[COUNT] =
+      { { "dsattrs.c" }, { "dgfileat.c" }, { "nosuch.c" } };
+   unsigned oldattrib[COUNT];
+   int i;
+
+   /* Get and display the attributes of every file */
+   _dos_getfileattrs( ".", files, COUNT );
+   for( i = 0; i < COUNT; i++ )
+   {
+      if( files[i].error != 0 )
+         printf( "%-12s error %u\n", files[i].name, files[i].error );
+      else
+         printf( "%-12s attribute: 0x%.4x\n", files[i].name,
+                 files[i].attrib );
+      oldattrib[i] = files[i].attrib;
+   }
+
+   /* Make every file read-only */
+   for( i = 0; i < COUNT; i++ )
+      files[i].attrib |= _A_RDONLY;
+   if( _dos_setfileattrs( ".", files, COUNT ) != 0 )
+      for( i = 0; i < COUNT; i++ )
+         if( files[i].error != 0 )
+            printf( "Couldn't change %s\n", files[i].name );
+
+   /* Restore file attributes */
+   for( i = 0; i < COUNT; i++ )
+      files[i].attrib = oldattrib[i];
+   _dos_setfileattrs( ".", files, COUNT );
+}
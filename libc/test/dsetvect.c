@@ -0,0 +1,39 @@
+/* DSETVECT.C: This program hooks the timer tick interrupt (1Ch),
+ * speeds the timer up to 100 ticks a second through the timer's
+ * ports and counts ticks for about a second.
+ */
+
+#include <dosix/stdio.h>
+#include <dos.h>
+#include <conio.h>
+
+static volatile unsigned long ticks = 0;
+static syscall_t oldvect;
+
+static void timertick( cpu_t *cpu )
+{
+   ++ticks;
+   oldvect( cpu );                  /* Chain to the previous handler */
+}
+
+void main( void )
+{
+   unsigned divisor = 11932;        /* 1193182 Hz / 100 */
+
+   oldvect = _dos_getvect( 0x1c );
+   _dos_setvect( 0x1c, timertick );
+
+   outp( 0x43, 0x36 );              /* Channel 0, low then high byte */
+   outp( 0x40, divisor & 0xff );
+   outp( 0x40, divisor >> 8 );
+
+   while( ticks < 100 )
+      ;
+
+   outp( 0x43, 0x36 );              /* Back to 18.2 ticks a second */
+   outp( 0x40, 0 );
+   outp( 0x40, 0 );
+   _dos_setvect( 0x1c, oldvect );
+
+   printf( "Counted %lu timer ticks\n", ticks );
+}
@@ -0,0 +1,31 @@
+/* DWALKTR.C: This program uses _dos_walktree to list every C source
+ * file in the current directory and all of its subdirectories, and
+ * counts the bytes they take.
+ */
+
+#include <dosix/stdio.h>
+#include <dos.h>
+
+static long long total;
+
+static int count( const struct _doswalk_t *dir, void *arg )
+{
+   size_t i;
+
+   for( i = 0; i < dir->count; i++ )
+   {
+      printf( "%s%-12s %10lld\n", dir->path, dir->entries[i].name,
+              (long long) dir->entries[i].size );
+      total += dir->entries[i].size;
+   }
+   return 0;   /* Nonzero stops the walk */
+}
+
+void main( void )
+{
+   /* Let the library pick the number of threads */
+   if( _dos_walktree( "*.c", _A_NORMAL, 0, count, NULL ) != 0 )
+      printf( "Couldn't walk the directory tree\n" );
+   else
+      printf( "Total: %lld bytes\n", total );
+}
@@ -0,0 +1,92 @@
+/* DWBCACHE.C: This program writes a log file one short line at a
+ * time, first straight through and then with the write-behind cache
+ * enabled, and reports how many system calls the cache saved.  It
+ * then checks that a write too large for the cache lands after the
+ * short ones it holds.
+ */
+
+#include <dosix/stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dos.h>
+
+#define LINES 100000
+#define BLOCK 614400U
+
+static char block[BLOCK];
+
+static double now( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double writelog( void )
+{
+   char line[32];
+   unsigned written;
+   double start;
+   int fh, i;
+
+   if( _dos_creat( "dwbcache.log", _A_NORMAL, &fh ) != 0 )
+   {
+      printf( "Couldn't create log file\n" );
+      return 0;
+   }
+   start = now();
+   for( i = 0; i < LINES; i++ )
+   {
+      sprintf( line, "record %06d\r\n", i );
+      _dos_write( fh, line, strlen( line ), &written );
+   }
+   _dos_close( fh );
+   return now() - start;
+}
+
+static void writemixed( void )
+{
+   unsigned written;
+   off_t length;
+   int fh;
+
+   if( _dos_creat( "dwbcache.dat", _A_NORMAL, &fh ) != 0 )
+   {
+      printf( "Couldn't create data file\n" );
+      return;
+   }
+   memset( block, 'x', BLOCK );
+   _dos_write( fh, "0123456789", 10, &written );  /* cached */
+   _dos_write( fh, block, BLOCK, &written );      /* written through */
+   _dos_seek( fh, 0, SEEK_END, &length );
+   _dos_close( fh );
+   printf( "mixed writes:  %ld bytes, %u expected\n",
+           (long)length, BLOCK + 10 );
+   remove( "dwbcache.dat" );
+}
+
+void main( void )
+{
+   struct _wbstat_t stat;
+   double elapsed;
+
+   _dos_wbcache( _WB_WRITETHROUGH, 0 );
+   elapsed = writelog();
+   printf( "write-through: %d writes in %.3f s\n", LINES, elapsed );
+
+   _dos_wbcache( _WB_ONCLOSE, 0 );
+   elapsed = writelog();
+   _dos_wbstat( &stat );
+   printf( "write-behind:  %d writes in %.3f s\n", LINES, elapsed );
+   printf( "  %llu bytes cached, %llu coalesced\n",
+           (unsigned long long) stat.bytes_cached,
+           (unsigned long long) stat.bytes_coalesced );
+   printf( "  %llu write-backs, %llu system calls, %.3f ms writing back\n",
+           (unsigned long long) stat.flushes,
+           (unsigned long long) stat.flush_calls,
+           stat.flush_ns_total / 1e6 );
+
+   remove( "dwbcache.log" );
+
+   writemixed();
+}
@@ -0,0 +1,69 @@
+/* INT86N.C: This program gets the attributes of the files named on
+ * the command line with a single _int86n call, then times a batch of
+ * get current drive calls against as many _intdos calls.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <dosix/stdio.h>
+#include <dos.h>
+
+#define CALLS 2000000L
+
+static double now( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void main( int argc, char *argv[] )
+{
+   union _REGS *regs;
+   double start, elapsed;
+   size_t failed;
+   long n;
+   int i;
+
+   if( argc < 2 )
+   {
+      printf( "Usage: int86n file...\n" );
+      exit( 1 );
+   }
+   regs = malloc( CALLS * sizeof( union _REGS ) );
+   if( regs == NULL )
+      exit( 1 );
+
+   /* One batch: get file attributes (43h, AL=00h) for each name */
+   for( i = 1; i < argc; i++ )
+   {
+      regs[i - 1].x.ax = 0x4300;
+      regs[i - 1].x.dx = (uintptr_t)argv[i];
+   }
+   failed = _int86n( 0x21, regs, argc - 1 );
+   for( i = 1; i < argc; i++ )
+      if( regs[i - 1].x.cflag )
+         printf( "%-20s error %u\n", argv[i], (unsigned)regs[i - 1].x.ax );
+      else
+         printf( "%-20s attributes %02Xh\n", argv[i],
+                 (unsigned)regs[i - 1].x.cx );
+   printf( "%u of %d calls failed\n\n", (unsigned)failed, argc - 1 );
+
+   /* Get current drive (19h), one at a time and then all at once */
+   start = now();
+   for( n = 0; n < CALLS; n++ )
+   {
+      regs[0].x.ax = 0x1900;
+      _intdos( &regs[0], &regs[0] );
+   }
+   elapsed = now() - start;
+   printf( "_intdos  %9.1f ns/call\n", elapsed / CALLS * 1e9 );
+
+   for( n = 0; n < CALLS; n++ )
+      regs[n].x.ax = 0x1900;
+   start = now();
+   _int86n( 0x21, regs, CALLS );
+   elapsed = now() - start;
+   printf( "_int86n  %9.1f ns/call\n", elapsed / CALLS * 1e9 );
+   free( regs );
+}
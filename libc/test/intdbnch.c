@@ -0,0 +1,55 @@
+/* INTDBNCH.C: This program measures the cost of intdos round-trips
+ * for services that do next to no work, so that the time is mostly
+ * spent reaching them.
+ */
+
+#include <time.h>
+#include <dosix/stdio.h>
+#include <dos.h>
+
+#define CALLS 2000000L
+
+static double now( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct
+{
+   const char *name;
+   unsigned ax, bx;
+} services[] =
+{
+   { "get current drive    (19h)",   0x1900, 0 },
+   { "get DTA address      (2Fh)",   0x2f00, 0 },
+   { "get interrupt vector (35h)",   0x3521, 0 },
+   { "get extended error   (59h)",   0x5900, 0 },
+   { "DOSix installed      (2F/D5h)", 0xd500, 0 }
+};
+
+void main( void )
+{
+   union _REGS inregs, outregs;
+   double start, elapsed;
+   unsigned i;
+   long n;
+
+   printf( "service                          ns/call\n" );
+   for( i = 0; i < sizeof( services ) / sizeof( services[0] ); i++ )
+   {
+      start = now();
+      for( n = 0; n < CALLS; n++ )
+      {
+         inregs.x.ax = services[i].ax;
+         inregs.x.bx = services[i].bx;
+         if( services[i].ax >> 8 == 0xd5 )
+            _int86( 0x2f, &inregs, &outregs );
+         else
+            _intdos( &inregs, &outregs );
+      }
+      elapsed = now() - start;
+      printf( "%-30s %9.1f\n", services[i].name, elapsed / CALLS * 1e9 );
+   }
+}
@@ -0,0 +1,68 @@
+/* LFNFIND.C: This program checks that the long file name services
+ * are present and then lists the current directory with them, showing
+ * the short name of each entry next to its long name.
+ */
+
+#include <dos.h>
+#include <dosix/stdio.h>
+
+struct finddata
+{
+   unsigned attrib;
+   unsigned long long cr_time, ac_time, wr_time;
+   unsigned size_high, size_low;
+   char reserved[8];
+   char name[260];
+   char alias[14];
+} __attribute__ (( packed ));
+
+void main( void )
+{
+   union  _REGS inregs, outregs;
+   struct _SREGS segregs;
+   struct finddata found;
+   char fsname[32], path[261];
+   unsigned handle;
+
+   /* Get volume information: bit 14 of BX tells long names work */
+   inregs.x.ax = 0x71a0;
+   inregs.x.dx = _FP_OFF( "\\" );
+   inregs.x.di = _FP_OFF( fsname );
+   inregs.x.cx = sizeof( fsname );
+   _intdosx( &inregs, &outregs, &segregs );
+   if( outregs.x.cflag || !( outregs.x.bx & 0x4000 ) )
+   {
+      printf( "Long file names are not supported\n" );
+      return;
+   }
+   printf( "File system: %s\n", fsname );
+
+   /* Find first, any attribute allowed, times in DOS format */
+   inregs.x.ax = 0x714e;
+   inregs.x.cx = _A_HIDDEN | _A_SYSTEM | _A_SUBDIR | _A_RDONLY | _A_ARCH;
+   inregs.x.si = 1;
+   inregs.x.dx = _FP_OFF( "*" );
+   inregs.x.di = _FP_OFF( &found );
+   _intdosx( &inregs, &outregs, &segregs );
+   handle = outregs.x.ax;
+   while( !outregs.x.cflag )
+   {
+      /* The short name is only asked for on demand */
+      inregs.x.ax = 0x7160;
+      inregs.x.cx = 1;
+      inregs.x.si = _FP_OFF( found.name );
+      inregs.x.di = _FP_OFF( path );
+      _intdosx( &inregs, &outregs, &segregs );
+      printf( "%-40s %s\n", found.name, outregs.x.cflag ? "" : path );
+
+      inregs.x.ax = 0x714f;
+      inregs.x.bx = handle;
+      inregs.x.si = 1;
+      inregs.x.di = _FP_OFF( &found );
+      _intdosx( &inregs, &outregs, &segregs );
+   }
+
+   inregs.x.ax = 0x71a1;
+   inregs.x.bx = handle;
+   _intdosx( &inregs, &outregs, &segregs );
+}
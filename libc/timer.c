@@ -0,0 +1,348 @@
+/*
+  timer.c -- Programmable interval timer and timer interrupts
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <conio.h>
+#include <dos.h>
+#include "_dos.h"
+
+
+/* constants */
+
+/* Input clock of the 8253/8254 */
+#define PIT_HZ 1193182
+
+/* I/O ports */
+#define PORT_PIT_COUNTER0 0x40
+#define PORT_PIT_COUNTER2 0x42
+#define PORT_PIT_CONTROL 0x43
+
+/* Control word fields */
+#define PIT_CHANNEL(cw) ((cw) >> 6)
+#define PIT_ACCESS(cw) (((cw) >> 4) & 3)
+#define PIT_READBACK 3
+#define PIT_LATCH 0
+#define PIT_LOBYTE 1
+#define PIT_HIBYTE 2
+#define PIT_LOHIBYTE 3
+
+#define INT08_TIMER 0x08
+
+
+/* type definitions */
+
+struct pit_channel
+{
+  unsigned access;		/* PIT_LOBYTE, PIT_HIBYTE or PIT_LOHIBYTE */
+  bool write_hi;		/* next byte written is the high one */
+  bool read_hi;			/* next byte read is the high one */
+  uint8_t reload_lo;		/* low byte written so far */
+  uint32_t reload;		/* 1 to 65536 */
+  struct timespec start;	/* when counting started from reload */
+  bool latched;
+  uint16_t latch;
+};
+
+
+/* global variables */
+
+/* Timer interrupts come from a thread of their own, which sleeps on a
+   timerfd between ticks.  It only exists once a program hooks INT 08h
+   or 1Ch, and the timerfd is disarmed while neither is hooked.  Ticks
+   the thread is too late for are delivered as one.  DOSIX_TIMER=0 in
+   the environment keeps timer interrupts from ever being raised. */
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static bool timer_disabled;
+static bool timer_hooked;
+static int timer_fd = -1;
+static struct _timerstat_t timer_stat;
+
+/* Channel 0 drives the timer interrupt; channel 2 is the speaker’s,
+   and only counts */
+static struct pit_channel pit[3] =
+  {
+   [0 ... 2] = {.access = PIT_LOHIBYTE, .reload = 0x10000}
+  };
+
+
+/* timer engine */
+
+static
+void
+timer_init
+(void)
+{
+  const char *env = getenv ("DOSIX_TIMER");
+  timer_disabled = env && ! strcmp (env, "0");
+}
+
+/* Arm the timerfd for the rate of channel 0, or disarm it; caller
+   holds timer_lock */
+static
+void
+timer_arm
+(void)
+{
+  uint64_t ns = timer_hooked
+    ? (uint64_t) pit[0].reload * 1000000000 / PIT_HZ
+    : 0;
+  struct itimerspec its =
+    {
+     .it_interval = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000},
+     .it_value = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000}
+    };
+  timerfd_settime (timer_fd, 0, &its, NULL);
+}
+
+/* Deliver the ticks of the timerfd arg.  Should it fail, it is
+   dropped for the next hook or reprogramming of channel 0 to start
+   the thread over */
+static
+void *
+timer_thread
+(void *arg)
+{
+  int fd = (intptr_t) arg;
+  /* signals are for the program’s own threads */
+  sigset_t all;
+  sigfillset (&all);
+  pthread_sigmask (SIG_BLOCK, &all, NULL);
+  for (;;)
+    {
+      uint64_t expirations;
+      ssize_t n = read (fd, &expirations, sizeof (expirations));
+      if (n < 0 && errno == EINTR) continue;
+      if (n != sizeof (expirations)) break;
+      __atomic_add_fetch (&timer_stat.ticks, expirations, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&timer_stat.delivered, 1, __ATOMIC_RELAXED);
+      _dosix__int86 (INT08_TIMER, NULL, NULL);
+    }
+  pthread_mutex_lock (&timer_lock);
+  if (timer_fd == fd) timer_fd = -1;
+  pthread_mutex_unlock (&timer_lock);
+  close (fd);
+  return NULL;
+}
+
+/* Start the thread if timer interrupts are hooked and it is not
+   running, then arm its timerfd; caller holds timer_lock */
+static
+void
+timer_start
+(void)
+{
+  if (timer_fd < 0 && timer_hooked)
+    {
+      timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+      pthread_t thread;
+      pthread_attr_t attr;
+      pthread_attr_init (&attr);
+      pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+      if (timer_fd >= 0
+	  && pthread_create (&thread, &attr, timer_thread,
+			     (void *) (intptr_t) timer_fd))
+	{
+	  close (timer_fd);
+	  timer_fd = -1;
+	}
+      pthread_attr_destroy (&attr);
+    }
+  if (timer_fd >= 0) timer_arm ();
+}
+
+void
+_dosix__timer_hook
+(bool hooked)
+{
+  pthread_once (&timer_once, timer_init);
+  if (timer_disabled) return;
+  pthread_mutex_lock (&timer_lock);
+  timer_hooked = hooked;
+  timer_start ();
+  pthread_mutex_unlock (&timer_lock);
+}
+
+
+/* _dos_timerstat */
+
+void
+_dosix__dos_timerstat
+(struct _timerstat_t *stat)
+{
+  stat->ticks = __atomic_load_n (&timer_stat.ticks, __ATOMIC_RELAXED);
+  stat->delivered = __atomic_load_n (&timer_stat.delivered,
+				     __ATOMIC_RELAXED);
+  pthread_mutex_lock (&timer_lock);
+  stat->reload = pit[0].reload;
+  pthread_mutex_unlock (&timer_lock);
+}
+
+
+/* programmable interval timer */
+
+/* Current count of channel c, which runs down from the reload value
+   as long as the program runs; caller holds timer_lock */
+static
+uint16_t
+pit_count
+(struct pit_channel *c)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  uint64_t ns = (now.tv_sec - c->start.tv_sec) * UINT64_C (1000000000)
+    + now.tv_nsec - c->start.tv_nsec;
+  uint64_t pulses = ns / 1000000000 * PIT_HZ
+    + ns % 1000000000 * PIT_HZ / 1000000000;
+  return c->reload - pulses % c->reload;
+}
+
+static
+void
+pit_control
+(uint8_t cw)
+{
+  unsigned channel = PIT_CHANNEL (cw);
+  if (channel == PIT_READBACK) return;
+  struct pit_channel *c = &pit[channel];
+  if (PIT_ACCESS (cw) == PIT_LATCH)
+    {
+      if (! c->latched) c->latch = pit_count (c);
+      c->latched = true;
+      return;
+    }
+  c->access = PIT_ACCESS (cw);
+  c->write_hi = c->read_hi = c->access == PIT_HIBYTE;
+  c->latched = false;
+  /* a thread that failed comes back with channel 0 reprogrammed */
+  if (channel == 0 && timer_fd < 0) timer_start ();
+}
+
+static
+void
+pit_write
+(unsigned channel,
+ uint8_t byte)
+{
+  struct pit_channel *c = &pit[channel];
+  uint32_t reload;
+  switch (c->access)
+    {
+    case PIT_LOBYTE:
+      reload = byte;
+      break;
+    case PIT_HIBYTE:
+      reload = byte << 8;
+      break;
+    default:
+      c->write_hi = ! c->write_hi;
+      if (c->write_hi)
+	{
+	  c->reload_lo = byte;
+	  return;
+	}
+      reload = byte << 8 | c->reload_lo;
+      break;
+    }
+  /* a count of 0 stands for 65536 */
+  c->reload = reload ? reload : 0x10000;
+  clock_gettime (CLOCK_MONOTONIC, &c->start);
+  if (channel == 0) timer_start ();
+}
+
+static
+uint8_t
+pit_read
+(unsigned channel)
+{
+  struct pit_channel *c = &pit[channel];
+  uint16_t count = c->latched ? c->latch : pit_count (c);
+  bool hi = c->access == PIT_HIBYTE
+    || (c->access == PIT_LOHIBYTE && c->read_hi);
+  if (c->access == PIT_LOHIBYTE) c->read_hi = ! c->read_hi;
+  if (c->access != PIT_LOHIBYTE || ! c->read_hi) c->latched = false;
+  return hi ? count >> 8 : count & 0xff;
+}
+
+
+/* _inp, _inpw, _outp, _outpw */
+
+/* Only the timer is there: other ports read as floating and take
+   writes, such as an end of interrupt to the PIC, without effect */
+
+int
+_dosix__inp
+(unsigned short port)
+{
+  pthread_once (&timer_once, timer_init);
+  if (port < PORT_PIT_COUNTER0 || port > PORT_PIT_COUNTER2)
+    return 0xff;
+  pthread_mutex_lock (&timer_lock);
+  uint8_t byte = pit_read (port - PORT_PIT_COUNTER0);
+  pthread_mutex_unlock (&timer_lock);
+  return byte;
+}
+
+unsigned short
+_dosix__inpw
+(unsigned short port)
+{
+  return _dosix__inp (port) | _dosix__inp (port + 1) << 8;
+}
+
+int
+_dosix__outp
+(unsigned short port,
+ int databyte)
+{
+  pthread_once (&timer_once, timer_init);
+  if (port >= PORT_PIT_COUNTER0 && port <= PORT_PIT_CONTROL)
+    {
+      pthread_mutex_lock (&timer_lock);
+      if (port == PORT_PIT_CONTROL) pit_control (databyte);
+      else pit_write (port - PORT_PIT_COUNTER0, databyte);
+      pthread_mutex_unlock (&timer_lock);
+    }
+  return databyte;
+}
+
+unsigned short
+_dosix__outpw
+(unsigned short port,
+ unsigned short dataword)
+{
+  _dosix__outp (port, dataword & 0xff);
+  _dosix__outp (port + 1, dataword >> 8);
+  return dataword;
+}
@@ -0,0 +1,470 @@
+/*
+  trace.c -- Interrupt call statistics, tracing and recording
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dos.h>
+#include "_dos.h"
+
+
+/* constants */
+
+/* Services kept apart; any more are only counted as a whole */
+#define TRACE_SLOTS 1024
+
+/* Latency buckets: bucket i holds calls of less than 2^i ns */
+#define TRACE_BUCKETS 40
+
+/* Longest ring of register snapshots */
+#define TRACE_RING_MAX (1 << 20)
+
+enum trace_format
+  {
+   TRACE_TEXT,
+   TRACE_JSON
+  };
+
+
+/* type definitions */
+
+struct trace_service
+{
+  uint32_t key;			/* 0 while the slot is free */
+  uint64_t calls;
+  uint64_t errors;		/* calls that failed */
+  uint16_t exterror;		/* extended error of the last of them */
+  uint64_t ns;			/* total time */
+  uint64_t max_ns;
+  uint64_t hist[TRACE_BUCKETS];
+};
+
+struct trace_snapshot
+{
+  uint64_t seq;			/* 0 while the entry was never filled */
+  uint64_t ns;
+  uint32_t key;
+  cpu_t in, out;
+};
+
+
+/* global variables */
+
+/* Tracing is asked for from the environment:
+   DOSIX_TRACE=text|json[,ring=entries][,file=path] for statistics,
+   and DOSIX_RECORD=path for a recording of the calls.  It is looked
+   up on the first interrupt, and costs no more than a test of
+   _dosix__trace_enabled while off.  Statistics are written at exit, to
+   standard error unless a file is named. */
+int _dosix__trace_enabled = -1;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static enum trace_format trace_format;
+static char *trace_file;
+static struct trace_service *trace_services;
+static uint64_t trace_overflow;	/* calls of services left out */
+static pthread_mutex_t trace_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_snapshot *trace_ring;
+static size_t trace_ring_size;
+static uint64_t trace_seq;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *record_file;
+
+
+/* setup */
+
+static void trace_dump (void);
+static void record_close (void);
+
+static
+bool
+trace_stats_init
+(const char *env)
+{
+  char *opts = strdup (env);
+  if (! opts) return false;
+  char *save;
+  for (char *opt = strtok_r (opts, ",", &save); opt;
+       opt = strtok_r (NULL, ",", &save))
+    if (! strcmp (opt, "json")) trace_format = TRACE_JSON;
+    else if (! strcmp (opt, "text")) trace_format = TRACE_TEXT;
+    else if (! strncmp (opt, "ring=", strlen ("ring=")))
+      {
+	trace_ring_size = strtoul (opt + strlen ("ring="), NULL, 10);
+	if (trace_ring_size > TRACE_RING_MAX)
+	  trace_ring_size = TRACE_RING_MAX;
+      }
+    else if (! strncmp (opt, "file=", strlen ("file=")))
+      {
+	free (trace_file);
+	trace_file = strdup (opt + strlen ("file="));
+      }
+  free (opts);
+  trace_services = calloc (TRACE_SLOTS, sizeof (*trace_services));
+  if (! trace_services) return false;
+  if (trace_ring_size)
+    {
+      trace_ring = calloc (trace_ring_size, sizeof (*trace_ring));
+      if (! trace_ring) trace_ring_size = 0;
+    }
+  atexit (trace_dump);
+  return true;
+}
+
+static
+bool
+record_init
+(const char *path)
+{
+  record_file = fopen (path, "we");
+  if (! record_file) return false;
+  fwrite (RECORD_MAGIC, 1, strlen (RECORD_MAGIC), record_file);
+  fputc (RECORD_VERSION, record_file);
+  atexit (record_close);
+  return true;
+}
+
+static
+void
+trace_init
+(void)
+{
+  const char *stats = getenv ("DOSIX_TRACE");
+  const char *record = getenv ("DOSIX_RECORD");
+  int enabled = 0;
+  if (stats && *stats && strcmp (stats, "0") && trace_stats_init (stats))
+    enabled |= TRACE_STATS;
+  if (record && *record && record_init (record))
+    enabled |= TRACE_RECORD;
+  __atomic_store_n (&_dosix__trace_enabled, enabled, __ATOMIC_RELEASE);
+}
+
+int
+_dosix__trace_start
+(void)
+{
+  pthread_once (&trace_once, trace_init);
+  return __atomic_load_n (&_dosix__trace_enabled, __ATOMIC_ACQUIRE);
+}
+
+uint64_t
+_dosix__trace_clock
+(void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * UINT64_C (1000000000) + ts.tv_nsec;
+}
+
+
+/* statistics */
+
+/* Slot of the service key, claimed if it has none yet */
+static
+struct trace_service *
+trace_slot
+(uint32_t key)
+{
+  size_t i = (key * UINT32_C (2654435761)) % TRACE_SLOTS;
+  for (size_t n = 0; n < TRACE_SLOTS; n++, i = (i + 1) % TRACE_SLOTS)
+    {
+      struct trace_service *s = &trace_services[i];
+      uint32_t k = __atomic_load_n (&s->key, __ATOMIC_ACQUIRE);
+      if (k == key) return s;
+      if (! k && __atomic_compare_exchange_n (&s->key, &k, key, false,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_ACQUIRE))
+	return s;
+      if (k == key) return s;
+    }
+  return NULL;
+}
+
+void
+_dosix__trace_end
+(uint32_t key,
+ uint64_t ns,
+ const cpu_t *in,
+ const cpu_t *out,
+ unsigned exterror)
+{
+  struct trace_service *s = trace_slot (key);
+  if (! s)
+    __atomic_add_fetch (&trace_overflow, 1, __ATOMIC_RELAXED);
+  else
+    {
+      unsigned bucket = ns ? 64 - __builtin_clzll (ns) : 0;
+      if (bucket >= TRACE_BUCKETS) bucket = TRACE_BUCKETS - 1;
+      __atomic_add_fetch (&s->calls, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&s->ns, ns, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&s->hist[bucket], 1, __ATOMIC_RELAXED);
+      uint64_t max = __atomic_load_n (&s->max_ns, __ATOMIC_RELAXED);
+      while (ns > max
+	     && ! __atomic_compare_exchange_n (&s->max_ns, &max, ns, true,
+					       __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED));
+      if (exterror)
+	{
+	  __atomic_add_fetch (&s->errors, 1, __ATOMIC_RELAXED);
+	  __atomic_store_n (&s->exterror, exterror, __ATOMIC_RELAXED);
+	}
+    }
+  if (trace_ring_size)
+    {
+      pthread_mutex_lock (&trace_ring_lock);
+      uint64_t seq = ++trace_seq;
+      trace_ring[(seq - 1) % trace_ring_size] = (struct trace_snapshot)
+	{
+	 .seq = seq,
+	 .ns = ns,
+	 .key = key,
+	 .in = *in,
+	 .out = *out
+	};
+      pthread_mutex_unlock (&trace_ring_lock);
+    }
+}
+
+
+/* report */
+
+/* Name of the service a key stands for, as in INT 21h AH=43h AL=00h */
+static
+void
+trace_name
+(uint32_t key,
+ char *name,
+ size_t size)
+{
+  int n = snprintf (name, size, "INT %02Xh AH=%02Xh",
+		    TRACE_KEY_INTNUM (key), TRACE_KEY_AH (key));
+  if (TRACE_KEY_REG (key) != TRACE_REG_NONE)
+    snprintf (name + n, size - n, " %s=%02Xh",
+	      TRACE_KEY_REG (key) == TRACE_REG_AL ? "AL" : "BL",
+	      TRACE_KEY_SUB (key));
+}
+
+/* Upper bound of the bucket holding the quantile q of s, never past
+   the slowest call seen */
+static
+uint64_t
+trace_quantile
+(const struct trace_service *s,
+ double q)
+{
+  uint64_t want = s->calls * q, seen = 0;
+  for (unsigned i = 0; i < TRACE_BUCKETS; i++)
+    if ((seen += s->hist[i]) > want)
+      {
+	uint64_t bound = UINT64_C (1) << i;
+	return bound < s->max_ns ? bound : s->max_ns;
+      }
+  return s->max_ns;
+}
+
+/* Busiest services first */
+static
+int
+trace_cmp
+(const void *a,
+ const void *b)
+{
+  const struct trace_service *sa = a, *sb = b;
+  return sa->ns < sb->ns ? 1 : sa->ns > sb->ns ? -1 : 0;
+}
+
+static
+void
+trace_dump_text
+(FILE *f,
+ const struct trace_service *services,
+ size_t count)
+{
+  uint64_t calls = 0, errors = 0;
+  for (size_t i = 0; i < count; i++)
+    {
+      calls += services[i].calls;
+      errors += services[i].errors;
+    }
+  fprintf (f, "DOSix trace: %ju calls, %ju failed, %ju untracked\n",
+	   (uintmax_t) calls, (uintmax_t) errors,
+	   (uintmax_t) trace_overflow);
+  fprintf (f, "%-24s %10s %8s %6s %12s %9s %9s %9s %10s\n",
+	   "service", "calls", "errors", "exterr", "total us",
+	   "mean ns", "p50 ns", "p99 ns", "max ns");
+  for (size_t i = 0; i < count; i++)
+    {
+      const struct trace_service *s = &services[i];
+      char name[32];
+      trace_name (s->key, name, sizeof (name));
+      fprintf (f, "%-24s %10ju %8ju %6u %12.1f %9ju %9ju %9ju %10ju\n",
+	       name, (uintmax_t) s->calls, (uintmax_t) s->errors,
+	       s->errors ? s->exterror : 0, s->ns / 1e3,
+	       (uintmax_t) (s->ns / s->calls),
+	       (uintmax_t) trace_quantile (s, 0.5),
+	       (uintmax_t) trace_quantile (s, 0.99),
+	       (uintmax_t) s->max_ns);
+    }
+  if (! trace_ring_size) return;
+  uint64_t last = trace_seq;
+  uint64_t first = last > trace_ring_size ? last - trace_ring_size + 1 : 1;
+  fprintf (f, "\nLast %ju calls:\n", (uintmax_t) (last - first + 1));
+  for (uint64_t seq = first; seq <= last; seq++)
+    {
+      const struct trace_snapshot *e =
+	&trace_ring[(seq - 1) % trace_ring_size];
+      if (e->seq != seq) continue;	/* overwritten while dumping */
+      char name[32];
+      trace_name (e->key, name, sizeof (name));
+      fprintf (f, "%8ju %-24s AX=%04jX BX=%04jX CX=%04jX DX=%04jX"
+	       " -> AX=%04jX CF=%u %ju ns\n",
+	       (uintmax_t) seq, name,
+	       (uintmax_t) e->in.x.ax & 0xffff, (uintmax_t) e->in.x.bx & 0xffff,
+	       (uintmax_t) e->in.x.cx & 0xffff, (uintmax_t) e->in.x.dx & 0xffff,
+	       (uintmax_t) e->out.x.ax & 0xffff, e->out.x.cflag ? 1 : 0,
+	       (uintmax_t) e->ns);
+    }
+}
+
+static
+void
+trace_dump_json
+(FILE *f,
+ const struct trace_service *services,
+ size_t count)
+{
+  fprintf (f, "{\"untracked\":%ju,\"services\":[", (uintmax_t) trace_overflow);
+  for (size_t i = 0; i < count; i++)
+    {
+      const struct trace_service *s = &services[i];
+      fprintf (f, "%s\n{\"int\":%u,\"ah\":%u,", i ? "," : "",
+	       TRACE_KEY_INTNUM (s->key), TRACE_KEY_AH (s->key));
+      if (TRACE_KEY_REG (s->key) != TRACE_REG_NONE)
+	fprintf (f, "\"%s\":%u,",
+		 TRACE_KEY_REG (s->key) == TRACE_REG_AL ? "al" : "bl",
+		 TRACE_KEY_SUB (s->key));
+      fprintf (f, "\"calls\":%ju,\"errors\":%ju,\"exterror\":%u,"
+	       "\"ns\":%ju,\"max_ns\":%ju,\"hist\":[",
+	       (uintmax_t) s->calls, (uintmax_t) s->errors,
+	       s->errors ? s->exterror : 0,
+	       (uintmax_t) s->ns, (uintmax_t) s->max_ns);
+      /* trailing empty buckets are left out */
+      unsigned n = TRACE_BUCKETS;
+      while (n && ! s->hist[n - 1]) n--;
+      for (unsigned b = 0; b < n; b++)
+	fprintf (f, "%s%ju", b ? "," : "", (uintmax_t) s->hist[b]);
+      fprintf (f, "]}");
+    }
+  fprintf (f, "],\n\"ring\":[");
+  uint64_t last = trace_seq;
+  uint64_t first = last > trace_ring_size ? last - trace_ring_size + 1 : 1;
+  bool comma = false;
+  for (uint64_t seq = first; trace_ring_size && seq <= last; seq++)
+    {
+      const struct trace_snapshot *e =
+	&trace_ring[(seq - 1) % trace_ring_size];
+      if (e->seq != seq) continue;
+      fprintf (f, "%s\n{\"seq\":%ju,\"int\":%u,"
+	       "\"in\":[%ju,%ju,%ju,%ju,%ju,%ju],"
+	       "\"out\":[%ju,%ju,%ju,%ju,%ju,%ju],\"cf\":%u,\"ns\":%ju}",
+	       comma ? "," : "", (uintmax_t) seq, TRACE_KEY_INTNUM (e->key),
+	       (uintmax_t) e->in.x.ax, (uintmax_t) e->in.x.bx,
+	       (uintmax_t) e->in.x.cx, (uintmax_t) e->in.x.dx,
+	       (uintmax_t) e->in.x.si, (uintmax_t) e->in.x.di,
+	       (uintmax_t) e->out.x.ax, (uintmax_t) e->out.x.bx,
+	       (uintmax_t) e->out.x.cx, (uintmax_t) e->out.x.dx,
+	       (uintmax_t) e->out.x.si, (uintmax_t) e->out.x.di,
+	       e->out.x.cflag ? 1 : 0, (uintmax_t) e->ns);
+      comma = true;
+    }
+  fprintf (f, "]}\n");
+}
+
+/* Runs at exit; calls still going on in other threads may be missed */
+static
+void
+trace_dump
+(void)
+{
+  struct trace_service *services =
+    malloc (TRACE_SLOTS * sizeof (*services));
+  if (! services) return;
+  pthread_mutex_lock (&trace_ring_lock);
+  size_t count = 0;
+  for (size_t i = 0; i < TRACE_SLOTS; i++)
+    if (trace_services[i].key && trace_services[i].calls)
+      services[count++] = trace_services[i];
+  qsort (services, count, sizeof (*services), trace_cmp);
+  FILE *f = trace_file ? fopen (trace_file, "w") : stderr;
+  if (f)
+    {
+      if (trace_format == TRACE_JSON)
+	trace_dump_json (f, services, count);
+      else trace_dump_text (f, services, count);
+      if (f != stderr) fclose (f);
+      else fflush (f);
+    }
+  pthread_mutex_unlock (&trace_ring_lock);
+  free (services);
+}
+
+
+/* call recording */
+
+void
+_dosix__trace_record
+(const void *record,
+ size_t size)
+{
+  pthread_mutex_lock (&record_lock);
+  if (record_file) fwrite (record, 1, size, record_file);
+  pthread_mutex_unlock (&record_lock);
+}
+
+bool
+_dosix__trace_records_to
+(int fd)
+{
+  const char *record = getenv ("DOSIX_RECORD");
+  struct stat a, b;
+  return record && *record && ! stat (record, &a) && ! fstat (fd, &b)
+    && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+static
+void
+record_close
+(void)
+{
+  pthread_mutex_lock (&record_lock);
+  fclose (record_file);
+  record_file = NULL;
+  pthread_mutex_unlock (&record_lock);
+}
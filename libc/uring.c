@@ -0,0 +1,145 @@
+/*
+  uring.c -- Minimal io_uring plumbing
+
+  Copyright (C) 2020 Bruno Félix Rezende Ribeiro <oitofelix@gnu.org>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _DOSIX_LIBC_SRC
+#define _GNU_SOURCE
+
+
+/* headers */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "_dos.h"
+
+
+/* rings */
+
+int
+_dosix__uring_setup
+(struct uring *ring,
+ unsigned entries)
+{
+  struct io_uring_params p = {0};
+  int fd = syscall (__NR_io_uring_setup, entries, &p);
+  if (fd < 0) return -1;
+  ring->fd = fd;
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  ring->cq_ring_size = p.cq_off.cqes
+    + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if (ring->cq_ring_size > ring->sq_ring_size)
+	ring->sq_ring_size = ring->cq_ring_size;
+      ring->cq_ring_size = ring->sq_ring_size;
+    }
+  ring->sq_ring = mmap (NULL, ring->sq_ring_size,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,
+			fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto close_fd;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ring = ring->sq_ring;
+  else
+    {
+      ring->cq_ring = mmap (NULL, ring->cq_ring_size,
+			    PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE,
+			    fd, IORING_OFF_CQ_RING);
+      if (ring->cq_ring == MAP_FAILED)
+	goto unmap_sq;
+    }
+  ring->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_size,
+		     PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE,
+		     fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto unmap_cq;
+  char *sq = ring->sq_ring, *cq = ring->cq_ring;
+  ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+  ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  ring->in_flight = 0;
+  return 0;
+
+ unmap_cq:
+  if (ring->cq_ring != ring->sq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+ unmap_sq:
+  munmap (ring->sq_ring, ring->sq_ring_size);
+ close_fd:
+  close (fd);
+  return -1;
+}
+
+int
+_dosix__uring_enter
+(struct uring *ring,
+ unsigned to_submit,
+ unsigned min_complete)
+{
+  int ret;
+  do
+    ret = syscall (__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+		   min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+bool
+_dosix__uring_probe
+(struct uring *ring,
+ const uint8_t *ops,
+ size_t count)
+{
+  /* as many ops as an opcode can name */
+  struct io_uring_probe *probe
+    = calloc (1, sizeof (*probe) + 256 * sizeof (probe->ops[0]));
+  if (! probe) return false;
+  /* kernels before the probe (5.6) lack the ops asked about anyway */
+  bool ok = syscall (__NR_io_uring_register, ring->fd,
+		     IORING_REGISTER_PROBE, probe, 256) >= 0;
+  for (size_t i = 0; ok && i < count; i++)
+    ok = ops[i] <= probe->last_op
+      && probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED;
+  free (probe);
+  return ok;
+}
+
+void
+_dosix__uring_close
+(struct uring *ring)
+{
+  munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  munmap (ring->sq_ring, ring->sq_ring_size);
+  close (ring->fd);
+}